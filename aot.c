@@ -0,0 +1,771 @@
+#define _GNU_SOURCE // dladdr
+#include "aot.h"
+#include "parse_elf.h"
+#include "hart.h"
+#include <stddef.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+
+// where the generated code finds x[], pc, memory and mem_size, checked when loading
+#define AOT_LAYOUT ((reg64)offsetof(Riscv64_register, x) | (reg64)offsetof(Riscv64_register, pc) << 16 \
+                   | (reg64)offsetof(Riscv64_memory, memory) << 32 | (reg64)offsetof(Riscv64_memory, mem_size) << 48)
+
+#define AOT_PATH_SIZE 4096
+
+// FNV-1a hash of the loaded text, ties a .so to the program it was made for
+static reg64 text_hash(Riscv64_memory* riscv_memory)
+{
+	reg64 hash = 0xcbf29ce484222325UL;
+	for(reg64 addr = riscv_memory->text_start; addr < riscv_memory->text_end; addr++)
+	{
+		hash ^= *get_actual_addr(riscv_memory, (byte*)addr);
+		hash *= 0x100000001b3UL;
+	}
+	return hash;
+}
+
+
+/*********************************************/
+/*                                           */
+/* control flow recovery                     */
+/*                                           */
+/*********************************************/
+
+typedef struct aot_program{
+	reg64 start;              // text
+	reg64 end;
+	long int inst_num;
+	Riscv64_decoded* ops;     // one record per instruction of the text
+	byte* leader;             // 1 if a block starts at the instruction
+	byte* entry;              // 1 if the function may be entered there from outside
+	reg64* function;          // start pcs of the guest functions, sorted
+	const char** name;        // their symbol names, NULL if none
+	long int function_num;
+} Aot_program;
+
+#define INDEX(p, pc) (((pc) - (p)->start) / sizeof(instruction))
+#define PC_OF(p, i)  ((p)->start + (i) * sizeof(instruction))
+#define IN_TEXT(p, pc) ((pc) >= (p)->start && (pc) < (p)->end && ((pc) & 3) == 0)
+
+static bool ends_block(Riscv64_decoded* op)
+{
+	return (op->id >= INST_BEQ && op->id <= INST_SCALL) || op->id == INST_FALLBACK;
+}
+
+static int compare_pc(const void* a, const void* b)
+{
+	reg64 x = *(const reg64*)a, y = *(const reg64*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void add_function(Aot_program* program, reg64 pc, long int* capacity)
+{
+	if(!IN_TEXT(program, pc))
+		return;
+	if(program->function_num == *capacity)
+	{
+		*capacity = *capacity * 2 + 16;
+		program->function = (reg64*) realloc (program->function, *capacity * sizeof(reg64));
+	}
+	program->function[program->function_num++] = pc;
+}
+
+// decode the whole text, find the functions from the symbol table and the blocks from the branches
+static void recover_program(Aot_program* program, Elf64_Ehdr* elf_header, Riscv64_memory* riscv_memory, reg64 entry)
+{
+	memset(program, 0, sizeof(Aot_program));
+	program->start = riscv_memory->text_start;
+	program->end = riscv_memory->text_end;
+	program->inst_num = (program->end - program->start) / sizeof(instruction);
+	program->ops = (Riscv64_decoded*) calloc (program->inst_num + 1, sizeof(Riscv64_decoded));
+	program->leader = (byte*) calloc (program->inst_num + 1, 1);
+	program->entry = (byte*) calloc (program->inst_num + 1, 1);
+	if(program->ops == NULL || program->leader == NULL || program->entry == NULL)
+	{
+		printf("Memory error.\n");
+		exit(1);
+	}
+
+	for(long int i = 0; i < program->inst_num; i++)
+		decode_to_record(&program->ops[i], (instruction) get_memory_reg32(riscv_memory, (byte*)PC_OF(program, i)));
+
+	// functions: the entry, the start of the text and every function symbol
+	long int capacity = 0;
+	add_function(program, program->start, &capacity);
+	add_function(program, entry, &capacity);
+
+	Elf64_Shdr* section_header_1 = (Elf64_Shdr*)((byte*)elf_header + elf_header->e_shoff);
+	Elf64_Sym* symbols = NULL;
+	long int symbol_num = 0;
+	const char* strings = NULL;
+	for(int i = 0; i < elf_header->e_shnum; i++)
+	{
+		Elf64_Shdr* section_header = (Elf64_Shdr*)((byte*)section_header_1 + elf_header->e_shentsize * i);
+		if(section_header->sh_type == SHT_SYMTAB)
+		{
+			Elf64_Shdr* string_header = (Elf64_Shdr*)((byte*)section_header_1 + elf_header->e_shentsize * section_header->sh_link);
+			symbols = (Elf64_Sym*)((byte*)elf_header + section_header->sh_offset);
+			symbol_num = section_header->sh_size / sizeof(Elf64_Sym);
+			strings = (const char*)elf_header + string_header->sh_offset;
+		}
+	}
+	for(long int i = 0; i < symbol_num; i++)
+		if((symbols[i].st_info & 0xf) == STT_FUNC)
+			add_function(program, symbols[i].st_value, &capacity);
+
+	// sort and drop duplicates
+	qsort(program->function, program->function_num, sizeof(reg64), compare_pc);
+	long int unique = 0;
+	for(long int i = 0; i < program->function_num; i++)
+		if(unique == 0 || program->function[i] != program->function[unique - 1])
+			program->function[unique++] = program->function[i];
+	program->function_num = unique;
+
+	program->name = (const char**) calloc (unique + 1, sizeof(char*));
+	for(long int i = 0; i < symbol_num; i++)
+	{
+		if((symbols[i].st_info & 0xf) != STT_FUNC)
+			continue;
+		reg64* found = (reg64*) bsearch(&symbols[i].st_value, program->function, unique, sizeof(reg64), compare_pc);
+		if(found != NULL)
+			program->name[found - program->function] = strings + symbols[i].st_name;
+	}
+
+	// blocks: functions, branch and jump targets, and whatever follows a block end;
+	// entries: functions, targets in other functions, and where calls and ecalls return to
+	for(long int i = 0; i < unique; i++)
+	{
+		program->leader[INDEX(program, program->function[i])] = 1;
+		program->entry[INDEX(program, program->function[i])] = 1;
+	}
+	long int f = 0;
+	for(long int i = 0; i < program->inst_num; i++)
+	{
+		Riscv64_decoded* op = &program->ops[i];
+		reg64 pc = PC_OF(program, i);
+		reg64 target = pc + (long int)op->imm;
+		while(f + 1 < unique && pc >= program->function[f + 1])
+			f++;
+
+		if((op->id >= INST_BEQ && op->id <= INST_JAL) && IN_TEXT(program, target))
+		{
+			program->leader[INDEX(program, target)] = 1;
+			if(target < program->function[f] || (f + 1 < unique && target >= program->function[f + 1]))
+				program->entry[INDEX(program, target)] = 1;
+		}
+		if(ends_block(op))
+			program->leader[i + 1] = 1;
+		if(((op->id == INST_JAL || op->id == INST_JALR) && op->rd != 0) || op->id == INST_SCALL || op->id == INST_FALLBACK)
+			program->entry[i + 1] = 1;
+	}
+}
+
+static void delete_program(Aot_program* program)
+{
+	free(program->ops);
+	free(program->leader);
+	free(program->entry);
+	free(program->function);
+	free(program->name);
+}
+
+
+/*********************************************/
+/*                                           */
+/* C generation                              */
+/*                                           */
+/*********************************************/
+
+typedef struct aot_writer{
+	FILE* out;
+	Aot_program* program;
+	long int first;          // instructions of the function being written
+	long int last;
+	unsigned int read;       // x[] read and written natively in the function
+	unsigned int write;
+	reg64* site;             // pcs of the instructions calling their handler
+	long int site_num;
+	long int site_capacity;
+	long int native;
+	long int block_num;
+	long int block_left;     // instructions of the block after the one being written
+} Aot_writer;
+
+// guest registers an op reads and writes in C, FALSE if it calls its handler
+static bool native_regs(Riscv64_decoded* op, unsigned int* read, unsigned int* write)
+{
+	unsigned int rd = 1u << op->rd, rs1 = 1u << op->rs1, rs2 = 1u << op->rs2;
+	switch(op->id)
+	{
+		case INST_ADD: case INST_SUB: case INST_SLL: case INST_SLT: case INST_SLTU: case INST_XOR:
+		case INST_SRL: case INST_SRA: case INST_OR: case INST_AND:
+		case INST_ADDW: case INST_SUBW: case INST_SLLW: case INST_SRLW: case INST_SRAW:
+			*read |= rs1 | rs2;
+			*write |= rd;
+			return TRUE;
+		case INST_ADDI: case INST_SLTI: case INST_SLTIU: case INST_XORI: case INST_ORI: case INST_ANDI:
+		case INST_SLLI: case INST_SRLI: case INST_SRAI:
+		case INST_ADDIW: case INST_SLLIW: case INST_SRLIW: case INST_SRAIW:
+		case INST_LB: case INST_LH: case INST_LW: case INST_LD: case INST_LBU: case INST_LHU: case INST_LWU:
+			*read |= rs1;
+			*write |= rd;
+			return TRUE;
+		case INST_SB: case INST_SH: case INST_SW: case INST_SD:
+		case INST_BEQ: case INST_BNE: case INST_BLT: case INST_BGE: case INST_BLTU: case INST_BGEU:
+			*read |= rs1 | rs2;
+			return TRUE;
+		case INST_LUI: case INST_AUIPC:
+			*write |= rd;
+			return TRUE;
+		case INST_JAL:
+			if(op->rd != 0)
+				*write |= rd;
+			return TRUE;
+		case INST_JALR:
+			*read |= rs1;
+			if(op->rd != 0)
+				*write |= rd;
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+static void write_flush(Aot_writer* w)
+{
+	for(int i = 0; i < 32; i++)
+		if(w->write & (1u << i))
+			fprintf(w->out, " X(%d) = x%d;", i, i);
+}
+
+static void write_reload(Aot_writer* w)
+{
+	for(int i = 0; i < 32; i++)
+		if((w->read | w->write) & (1u << i))
+			fprintf(w->out, " x%d = X(%d);", i, i);
+}
+
+// continue at target: a goto inside the function, otherwise leave it
+static void write_jump(Aot_writer* w, reg64 target)
+{
+	Aot_program* p = w->program;
+	if(IN_TEXT(p, target) && INDEX(p, target) >= w->first && INDEX(p, target) < w->last)
+		fprintf(w->out, "goto L_%lx;", target);
+	else
+		fprintf(w->out, "{ PC = 0x%lxUL; goto out; }", target);
+}
+
+// call the handler of op, as the block engine does
+static void write_site(Aot_writer* w, Riscv64_decoded* op, reg64 pc)
+{
+	if(w->site_num == w->site_capacity)
+	{
+		w->site_capacity = w->site_capacity * 2 + 64;
+		w->site = (reg64*) realloc (w->site, w->site_capacity * sizeof(reg64));
+	}
+	w->site[w->site_num] = pc;
+
+	fprintf(w->out, "\tPC = 0x%lxUL;", pc + sizeof(instruction));
+	write_flush(w);
+	fprintf(w->out, " SITE(%ld);", w->site_num);
+	if(ends_block(op))
+		fprintf(w->out, " return n;"); // ecall may exit, let run_aot look
+	else
+		write_reload(w);
+	fprintf(w->out, "\n");
+	w->site_num++;
+}
+
+// one instruction in C, with the same results as its function in "riscv_instruction.c"
+static void write_op(Aot_writer* w, Riscv64_decoded* op, reg64 pc)
+{
+	FILE* out = w->out;
+	int rd = op->rd, rs1 = op->rs1, rs2 = op->rs2, imm = op->imm;
+	const char* cond = NULL;
+	const char* load = NULL;
+	const char* store = NULL;
+
+	switch(op->id)
+	{
+		case INST_ADD:   fprintf(out, "\tx%d = x%d + x%d;\n", rd, rs1, rs2); break;
+		case INST_SUB:   fprintf(out, "\tx%d = x%d - x%d;\n", rd, rs1, rs2); break;
+		case INST_AND:   fprintf(out, "\tx%d = x%d & x%d;\n", rd, rs1, rs2); break;
+		case INST_OR:    fprintf(out, "\tx%d = x%d | x%d;\n", rd, rs1, rs2); break;
+		case INST_XOR:   fprintf(out, "\tx%d = x%d ^ x%d;\n", rd, rs1, rs2); break;
+		case INST_SLL:   fprintf(out, "\tx%d = x%d << (x%d & 63);\n", rd, rs1, rs2); break;
+		case INST_SRL:   fprintf(out, "\tx%d = x%d >> (x%d & 63);\n", rd, rs1, rs2); break;
+		case INST_SRA:   fprintf(out, "\tx%d = (reg64)((long)x%d >> (x%d & 63));\n", rd, rs1, rs2); break;
+		case INST_SLT:   fprintf(out, "\tx%d = (x%d - x%d) >> 63;\n", rd, rs1, rs2); break; // sign of the difference, as slt()
+		case INST_SLTU:  fprintf(out, "\tx%d = x%d < x%d;\n", rd, rs1, rs2); break;
+		case INST_ADDW:  fprintf(out, "\tx%d = (reg64)(long)(int)(x%d + x%d);\n", rd, rs1, rs2); break;
+		case INST_SUBW:  fprintf(out, "\tx%d = (reg64)(long)(int)(x%d - x%d);\n", rd, rs1, rs2); break;
+		case INST_SLLW:  fprintf(out, "\tx%d = (reg64)(long)(int)((unsigned)x%d << (x%d & 31));\n", rd, rs1, rs2); break;
+		case INST_SRLW:  fprintf(out, "\tx%d = (unsigned)x%d >> (x%d & 31);\n", rd, rs1, rs2); break; // zero-extended, as srlw()
+		case INST_SRAW:  fprintf(out, "\tx%d = (reg64)(long)((int)x%d >> (x%d & 31));\n", rd, rs1, rs2); break;
+
+		case INST_ADDI:  fprintf(out, "\tx%d = x%d + (reg64)(%d);\n", rd, rs1, imm); break;
+		case INST_XORI:  fprintf(out, "\tx%d = x%d ^ (reg64)(%d);\n", rd, rs1, imm); break;
+		case INST_ORI:   fprintf(out, "\tx%d = x%d | (reg64)(%d);\n", rd, rs1, imm); break;
+		case INST_ANDI:  fprintf(out, "\tx%d = x%d & (reg64)(%d);\n", rd, rs1, imm); break;
+		case INST_SLTI:  fprintf(out, "\tx%d = (x%d - (reg64)(%d)) >> 63;\n", rd, rs1, imm); break;
+		case INST_SLTIU: fprintf(out, "\tx%d = x%d < (reg64)(%d);\n", rd, rs1, imm); break;
+		case INST_SLLI:  fprintf(out, "\tx%d = x%d << %d;\n", rd, rs1, imm & 63); break;
+		case INST_SRLI:  fprintf(out, "\tx%d = x%d >> %d;\n", rd, rs1, imm & 63); break;
+		case INST_SRAI:  fprintf(out, "\tx%d = (reg64)((long)x%d >> %d);\n", rd, rs1, imm & 63); break;
+		case INST_ADDIW: fprintf(out, "\tx%d = (reg64)(long)(int)(x%d + (reg64)(%d));\n", rd, rs1, imm); break;
+		case INST_SLLIW: fprintf(out, "\tx%d = (reg64)(long)(int)((unsigned)x%d << %d);\n", rd, rs1, imm & 31); break;
+		case INST_SRLIW: fprintf(out, "\tx%d = (unsigned)x%d >> %d;\n", rd, rs1, imm & 31); break; // zero-extended, as srliw()
+		case INST_SRAIW: fprintf(out, "\tx%d = (reg64)(long)((int)x%d >> %d);\n", rd, rs1, imm & 31); break;
+
+		case INST_LUI:   fprintf(out, "\tx%d = (reg64)(%d);\n", rd, imm); break;
+		case INST_AUIPC: fprintf(out, "\tx%d = 0x%lxUL;\n", rd, pc + (long int)imm); break;
+
+		// loads are all zero-extended, as the load functions
+		case INST_LB: case INST_LBU: load = "load8";  break;
+		case INST_LH: case INST_LHU: load = "load16"; break;
+		case INST_LW: case INST_LWU: load = "load32"; break;
+		case INST_LD:                load = "load64"; break;
+		case INST_SB: store = "store8";  break;
+		case INST_SH: store = "store16"; break;
+		case INST_SW: store = "store32"; break;
+		case INST_SD: store = "store64"; break;
+
+		// same comparisons as the branch functions
+		case INST_BEQ:  cond = "x%d == x%d"; break;
+		case INST_BNE:  cond = "x%d != x%d"; break;
+		case INST_BLT:  cond = "(long)(x%d - x%d) < 0"; break;
+		case INST_BGE:  cond = "(long)(x%d - x%d) >= 0"; break;
+		case INST_BLTU: cond = "x%d < x%d"; break;
+		case INST_BGEU: cond = "x%d > x%d"; break;
+
+		case INST_JAL:
+			fprintf(out, "\t");
+			if(rd != 0)
+				fprintf(out, "x%d = 0x%lxUL; ", rd, pc + sizeof(instruction));
+			write_jump(w, pc + (long int)imm);
+			fprintf(out, "\n");
+			return;
+		case INST_JALR:
+		{
+			// rd is written before rs1 is read, as jalr()
+			fprintf(out, "\t");
+			if(rd != 0)
+				fprintf(out, "x%d = 0x%lxUL; ", rd, pc + sizeof(instruction));
+			fprintf(out, "t = (x%d + (reg64)(%d)) & ~1UL;\n", rs1, imm);
+			// a jump that is not a call or return may go to a block of this function (switch tables)
+			if(rd == 0 && rs1 != 1)
+			{
+				fprintf(out, "\tswitch(t)\n\t{\n");
+				for(long int i = w->first; i < w->last; i++)
+					if(w->program->leader[i])
+						fprintf(out, "\t\tcase 0x%lxUL: goto L_%lx;\n", PC_OF(w->program, i), PC_OF(w->program, i));
+				fprintf(out, "\t}\n");
+			}
+			fprintf(out, "\tPC = t; goto out;\n");
+			return;
+		}
+
+		default:
+			write_site(w, op, pc);
+			return;
+	}
+	w->native++;
+
+	if(load != NULL || store != NULL)
+	{
+		// an address too far for the guard pages is reported before the access
+		fprintf(out, "\ta = x%d + (reg64)(%d); if(FAR(a)) { PC = 0x%lxUL;", rs1, imm, pc + sizeof(instruction));
+		write_flush(w);
+		fprintf(out, " aot_bad_access(m, a); }\n");
+	}
+	if(load != NULL)
+		fprintf(out, "\tx%d = %s(mem + a);\n", rd, load);
+	else if(store != NULL)
+	{
+		// a store into the text leaves the function, which may have changed, to run_aot()
+		fprintf(out, "\t%s(mem + a, x%d);", store, rs2);
+		fprintf(out, " if(STORE_TO_TEXT(a)) { PC = 0x%lxUL; n -= %ld; goto out; }\n", pc + sizeof(instruction), w->block_left);
+	}
+	else if(cond != NULL)
+	{
+		fprintf(out, "\tif(");
+		fprintf(out, cond, rs1, rs2);
+		fprintf(out, ") ");
+		write_jump(w, pc + (long int)imm);
+		fprintf(out, "\n");
+	}
+}
+
+// one guest function [first, last) as a C function that can be entered at any of its blocks
+static void write_function(Aot_writer* w, long int f)
+{
+	Aot_program* p = w->program;
+	FILE* out = w->out;
+	reg64 start = p->function[f];
+	w->first = INDEX(p, start);
+	w->last = f + 1 < p->function_num ? INDEX(p, p->function[f + 1]) : p->inst_num;
+
+	w->read = 0;
+	w->write = 0;
+	for(long int i = w->first; i < w->last; i++)
+		native_regs(&p->ops[i], &w->read, &w->write);
+
+	fprintf(out, "\n// %s\n", p->name[f] != NULL ? p->name[f] : "(no symbol)");
+	fprintf(out, "static long f_%lx(byte* r, byte* m)\n{\n", start);
+	fprintf(out, "\tbyte* mem = MEMORY; reg64 a, t; long n = 0;\n");
+	for(int i = 0; i < 32; i++)
+		if((w->read | w->write) & (1u << i))
+			fprintf(out, "\treg64 x%d = X(%d);\n", i, i);
+
+	fprintf(out, "\tswitch(PC)\n\t{\n");
+	for(long int i = w->first; i < w->last; i++)
+		if(p->entry[i])
+			fprintf(out, "\t\tcase 0x%lxUL: goto L_%lx;\n", PC_OF(p, i), PC_OF(p, i));
+	fprintf(out, "\t\tdefault: return 0;\n\t}\n");
+
+	for(long int i = w->first; i < w->last; i++)
+	{
+		reg64 pc = PC_OF(p, i);
+		if(p->leader[i])
+		{
+			long int length = 1;
+			while(i + length < w->last && !p->leader[i + length])
+				length++;
+			fprintf(out, "L_%lx:\n\tn += %ld;\n", pc, length);
+			w->block_num++;
+		}
+		w->block_left = 0;
+		while(i + w->block_left + 1 < w->last && !p->leader[i + w->block_left + 1])
+			w->block_left++;
+		write_op(w, &p->ops[i], pc);
+
+		// the function ends without a jump, go on in the next one
+		if(i == w->last - 1 && !(p->ops[i].id == INST_JAL || p->ops[i].id == INST_JALR || p->ops[i].id == INST_SCALL || p->ops[i].id == INST_FALLBACK))
+			fprintf(out, "\tPC = 0x%lxUL; goto out;\n", pc + sizeof(instruction));
+	}
+
+	fprintf(out, "out:\n\t");
+	write_flush(w);
+	fprintf(out, "\n\treturn n;\n}\n");
+}
+
+static void write_prologue(FILE* out, const char* file_name, Riscv64_memory* riscv_memory)
+{
+	fprintf(out, "/* generated by \"simulator -aot %s\", do not edit */\n", file_name);
+	fprintf(out, "#include <string.h>\n\n");
+	fprintf(out, "#define STORE_TO_TEXT(a) ((a) - 0x%lxUL < 0x%lxUL)\n",
+	        riscv_memory->text_start, riscv_memory->text_end - riscv_memory->text_start);
+	fprintf(out, "typedef unsigned long reg64;\ntypedef unsigned char byte;\n\n");
+	fprintf(out, "#define X(i)     (*(reg64*)(r + %d + 8 * (i)))\n", (int)offsetof(Riscv64_register, x));
+	fprintf(out, "#define PC       (*(reg64*)(r + %d))\n", (int)offsetof(Riscv64_register, pc));
+	fprintf(out, "#define MEMORY   (*(byte**)(m + %d))\n", (int)offsetof(Riscv64_memory, memory));
+	fprintf(out, "#define FAR(a)   __builtin_expect((a) + 0x%lxUL >= *(reg64*)(m + %d) + 0x%lxUL, 0)\n",
+	        GUARD_SIZE, (int)offsetof(Riscv64_memory, mem_size), 2 * GUARD_SIZE);
+	fprintf(out, "#define SITE(k)  aot_site_fn[k](aot_site_rec[k], r, m)\n\n");
+	// volatile: a load out of the memory must fault on the guard pages even if its value is never used
+	fprintf(out, "typedef unsigned short __attribute__((aligned(1), may_alias)) u16;\n");
+	fprintf(out, "typedef unsigned int __attribute__((aligned(1), may_alias)) u32;\n");
+	fprintf(out, "typedef reg64 __attribute__((aligned(1), may_alias)) u64;\n");
+	fprintf(out, "static inline reg64 load8(byte* p)  { return *(volatile byte*)p; }\n");
+	fprintf(out, "static inline reg64 load16(byte* p) { return *(volatile u16*)p; }\n");
+	fprintf(out, "static inline reg64 load32(byte* p) { return *(volatile u32*)p; }\n");
+	fprintf(out, "static inline reg64 load64(byte* p) { return *(volatile u64*)p; }\n");
+	fprintf(out, "static inline void store8(byte* p, reg64 v)  { *p = (byte)v; }\n");
+	fprintf(out, "static inline void store16(byte* p, reg64 v) { unsigned short u = v; memcpy(p, &u, 2); }\n");
+	fprintf(out, "static inline void store32(byte* p, reg64 v) { unsigned int u = v; memcpy(p, &u, 4); }\n");
+	fprintf(out, "static inline void store64(byte* p, reg64 v) { memcpy(p, &v, 8); }\n\n");
+	fprintf(out, "// set by the simulator when loading\n");
+	fprintf(out, "extern void* aot_site_rec[];\n");
+	fprintf(out, "extern void (*aot_site_fn[])(void*, byte*, byte*);\n");
+	fprintf(out, "extern void (*aot_bad_access)(byte*, reg64);\n");
+}
+
+static void write_tables(Aot_writer* w, Riscv64_memory* riscv_memory)
+{
+	Aot_program* p = w->program;
+	FILE* out = w->out;
+	long int site_size = w->site_num > 0 ? w->site_num : 1;
+
+	fprintf(out, "\nconst int aot_abi = %d;\n", AOT_ABI);
+	fprintf(out, "const reg64 aot_layout = 0x%lxUL;\n", AOT_LAYOUT);
+	fprintf(out, "const reg64 aot_text_hash = 0x%lxUL;\n", text_hash(riscv_memory));
+	fprintf(out, "const long aot_function_num = %ld;\n", p->function_num);
+
+	long int entry_num = 0;
+	fprintf(out, "\nconst reg64 aot_entry_pc[] = {\n");
+	for(long int i = 0; i < p->inst_num; i++)
+		if(p->entry[i])
+		{
+			fprintf(out, "\t0x%lxUL,\n", PC_OF(p, i));
+			entry_num++;
+		}
+	fprintf(out, "};\n");
+	fprintf(out, "long (*const aot_entry_fn[])(byte*, byte*) = {\n");
+	long int f = 0;
+	for(long int i = 0; i < p->inst_num; i++)
+	{
+		while(f + 1 < p->function_num && PC_OF(p, i) >= p->function[f + 1])
+			f++;
+		if(p->entry[i])
+			fprintf(out, "\tf_%lx,\n", p->function[f]);
+	}
+	fprintf(out, "};\n");
+	fprintf(out, "const long aot_entry_num = %ld;\n", entry_num);
+
+	fprintf(out, "\nconst long aot_site_num = %ld;\n", w->site_num);
+	fprintf(out, "const reg64 aot_site_pc[%ld] = {\n", site_size);
+	for(long int k = 0; k < w->site_num; k++)
+		fprintf(out, "\t0x%lxUL,\n", w->site[k]);
+	fprintf(out, "};\n");
+	fprintf(out, "void* aot_site_rec[%ld];\n", site_size);
+	fprintf(out, "void (*aot_site_fn[%ld])(void*, byte*, byte*);\n", site_size);
+	fprintf(out, "void (*aot_bad_access)(byte*, reg64);\n");
+}
+
+void translate_aot(const char* file_name, Elf64_Ehdr* elf_header, Riscv64_memory* riscv_memory, reg64 entry)
+{
+	char c_path[AOT_PATH_SIZE], so_path[AOT_PATH_SIZE], command[3 * AOT_PATH_SIZE];
+	snprintf(c_path, AOT_PATH_SIZE, "%s.aot.c", file_name);
+	snprintf(so_path, AOT_PATH_SIZE, "%s.aot.so", file_name);
+
+	#ifdef SOFT_MMU
+	// the generated code addresses the flat memory
+	printf("aot: not available with the software mmu.\n");
+	return;
+	#endif
+	if(riscv_memory->text_end <= riscv_memory->text_start)
+	{
+		printf("aot: no executable section in %s.\n", file_name);
+		return;
+	}
+
+	FILE* out = fopen(c_path, "w");
+	if(out == NULL)
+	{
+		printf("Can not open file : %s successfully.\n", c_path);
+		exit(1);
+	}
+
+	struct timeval start_time, end_time;
+	gettimeofday(&start_time, NULL);
+
+	Aot_program program;
+	recover_program(&program, elf_header, riscv_memory, entry);
+
+	Aot_writer writer;
+	memset(&writer, 0, sizeof(Aot_writer));
+	writer.out = out;
+	writer.program = &program;
+
+	write_prologue(out, file_name, riscv_memory);
+	for(long int f = 0; f < program.function_num; f++)
+		write_function(&writer, f);
+	write_tables(&writer, riscv_memory);
+	fclose(out);
+
+	printf("aot: %ld functions, %ld blocks, %ld instructions (%ld in C, %ld handler calls) written to %s\n",
+	       program.function_num, writer.block_num, program.inst_num, writer.native, writer.site_num, c_path);
+
+	// compile it
+	const char* cc = getenv("CC") != NULL ? getenv("CC") : "gcc";
+	const char* cflags = getenv("AOT_CFLAGS") != NULL ? getenv("AOT_CFLAGS") : "-O1";
+	snprintf(command, sizeof(command), "%s %s -shared -fPIC -o '%s' '%s'", cc, cflags, so_path, c_path);
+	int status = system(command);
+
+	gettimeofday(&end_time, NULL);
+	double seconds = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1e6;
+	if(status != 0)
+		printf("aot: \"%s\" failed.\n", command);
+	else
+		printf("aot: %s compiled in %.3f seconds\n", so_path, seconds);
+
+	free(writer.site);
+	delete_program(&program);
+}
+
+
+/*********************************************/
+/*                                           */
+/* loading and running                       */
+/*                                           */
+/*********************************************/
+
+#define AOT_HASH(pc) ((pc) >> 2)
+
+// the aot whose code a fault on the guard pages is looked up in
+static Riscv64_aot* fault_aot = NULL;
+
+// the translated C code does not keep the pc of every access, report the
+// start of the guest function whose translation host_pc is in
+static bool aot_guest_pc(void* host_pc, reg64* guest_pc)
+{
+	Riscv64_aot* aot = fault_aot;
+	Dl_info in_code, in_aot;
+	if(aot == NULL || aot->entry_num == 0 || dladdr(host_pc, &in_code) == 0
+	   || dladdr((void*)aot->entry_fn[0], &in_aot) == 0 || in_code.dli_fbase != in_aot.dli_fbase)
+		return FALSE;
+	aot_function function = NULL;
+	for(long int i = 0; i < aot->entry_num; i++)
+		if((void*)aot->entry_fn[i] <= host_pc && (function == NULL || aot->entry_fn[i] > function))
+			function = aot->entry_fn[i];
+	if(function == NULL)
+		return FALSE;
+	*guest_pc = -1;
+	for(long int i = 0; i < aot->entry_num; i++)
+		if(aot->entry_fn[i] == function && aot->entry_pc[i] < *guest_pc)
+			*guest_pc = aot->entry_pc[i];
+	return TRUE;
+}
+
+Riscv64_aot* load_aot(const char* file_name, Riscv64_memory* riscv_memory)
+{
+	char so_path[AOT_PATH_SIZE];
+	snprintf(so_path, AOT_PATH_SIZE, "%s.aot.so", file_name);
+	// the generated code accesses the memory and branches directly, past the tlb and the models
+	#if defined(SOFT_MMU) || defined(CACHE_MODEL) || defined(BRANCH_MODEL) || defined(PIPELINE_MODEL)
+	return NULL;
+	#endif
+	if(access(so_path, R_OK) != 0)
+		return NULL;
+
+	void* handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+	if(handle == NULL)
+	{
+		printf("aot: can not open %s: %s\n", so_path, dlerror());
+		return NULL;
+	}
+
+	const int* abi           = (const int*) dlsym(handle, "aot_abi");
+	const reg64* layout      = (const reg64*) dlsym(handle, "aot_layout");
+	const reg64* hash        = (const reg64*) dlsym(handle, "aot_text_hash");
+	const long* function_num = (const long*) dlsym(handle, "aot_function_num");
+	const long* entry_num    = (const long*) dlsym(handle, "aot_entry_num");
+	const reg64* entry_pc    = (const reg64*) dlsym(handle, "aot_entry_pc");
+	aot_function const* entry_fn = (aot_function const*) dlsym(handle, "aot_entry_fn");
+	const long* site_num     = (const long*) dlsym(handle, "aot_site_num");
+	const reg64* site_pc     = (const reg64*) dlsym(handle, "aot_site_pc");
+	void** site_rec          = (void**) dlsym(handle, "aot_site_rec");
+	inst_handler* site_fn    = (inst_handler*) dlsym(handle, "aot_site_fn");
+	void (**bad_access)(Riscv64_memory*, reg64) = (void (**)(Riscv64_memory*, reg64)) dlsym(handle, "aot_bad_access");
+
+	if(abi == NULL || layout == NULL || hash == NULL || function_num == NULL || entry_num == NULL || entry_pc == NULL
+	   || entry_fn == NULL || site_num == NULL || site_pc == NULL || site_rec == NULL || site_fn == NULL || bad_access == NULL
+	   || *abi != AOT_ABI || *layout != AOT_LAYOUT || *hash != text_hash(riscv_memory))
+	{
+		printf("aot: %s does not match this program or simulator, run with -aot again.\n", so_path);
+		dlclose(handle);
+		return NULL;
+	}
+
+	Riscv64_aot* aot = (Riscv64_aot*) malloc (sizeof(Riscv64_aot));
+	memset(aot, 0, sizeof(Riscv64_aot));
+	aot->handle = handle;
+	aot->entry_num = *entry_num;
+	aot->entry_pc = entry_pc;
+	aot->entry_fn = entry_fn;
+	aot->function_num = *function_num;
+
+	// the handlers of this simulator for the instructions left to them
+	aot->site = (Riscv64_decoded*) calloc (*site_num + 1, sizeof(Riscv64_decoded));
+	for(long int k = 0; k < *site_num; k++)
+	{
+		decode_to_record(&aot->site[k], (instruction) get_memory_reg32(riscv_memory, (byte*)site_pc[k]));
+		site_rec[k] = &aot->site[k];
+		site_fn[k] = aot->site[k].handler;
+	}
+
+	*bad_access = bad_guest_access;
+
+	// entry pc -> index
+	long int hash_size = 1;
+	while(hash_size < 2 * aot->entry_num)
+		hash_size <<= 1;
+	aot->hash_mask = hash_size - 1;
+	aot->hash = (long int*) malloc (hash_size * sizeof(long int));
+	if(aot->site == NULL || aot->hash == NULL)
+	{
+		printf("Memory error.\n");
+		exit(1);
+	}
+	for(long int i = 0; i < hash_size; i++)
+		aot->hash[i] = -1;
+	for(long int i = 0; i < aot->entry_num; i++)
+	{
+		long int slot = AOT_HASH(entry_pc[i]) & aot->hash_mask;
+		while(aot->hash[slot] >= 0)
+			slot = (slot + 1) & aot->hash_mask;
+		aot->hash[slot] = i;
+	}
+
+	fault_aot = aot;
+	add_guest_pc_finder(aot_guest_pc);
+
+	printf("aot: running %s, %ld functions\n", so_path, aot->function_num);
+	return aot;
+}
+
+void delete_aot(Riscv64_aot* aot)
+{
+	if(fault_aot == aot)
+		fault_aot = NULL;
+	dlclose(aot->handle);
+	free(aot->site);
+	free(aot->hash);
+	free(aot);
+}
+
+void invalidate_aot(Riscv64_aot* aot, Riscv64_memory* riscv_memory, reg64 addr, reg64 length)
+{
+	if(addr < riscv_memory->text_end && riscv_memory->text_start < addr + length)
+		aot->stale = TRUE;
+}
+
+static inline aot_function lookup_aot(Riscv64_aot* aot, reg64 pc)
+{
+	if(aot->stale)
+		return NULL;
+	long int slot = AOT_HASH(pc) & aot->hash_mask;
+	for(long int i; (i = aot->hash[slot]) >= 0; slot = (slot + 1) & aot->hash_mask)
+		if(aot->entry_pc[i] == pc)
+			return aot->entry_fn[i];
+	return NULL;
+}
+
+long int run_aot(Riscv64_aot* aot, Riscv64_block_cache* cache, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	long int count = 0;
+	// a store into the text makes the functions stale
+	for(reg64 addr = riscv_memory->text_start; addr < riscv_memory->text_end; addr += 4096)
+		mark_code_page(riscv_memory, addr);
+
+	while(!riscv_memory->exit_happened)
+	{
+		// a function loops inside, past an exit_group or a store into code of another hart:
+		// once there are harts the blocks run, which come back here after every branch
+		if(riscv_memory->harts != NULL && poll_harts(riscv_memory))
+			break;
+		aot_function function = riscv_memory->harts == NULL ? lookup_aot(aot, get_register_pc(riscv_register)) : NULL;
+		long int executed = function != NULL ? function(riscv_register, riscv_memory) : 0;
+		if(executed > 0)
+		{
+			aot->call++;
+			aot->executed += executed;
+			count += executed;
+		}
+		else
+		{
+			// not translated, e.g. an indirect jump into the middle of a block
+			aot->interpreted++;
+			count += step_block(cache, riscv_register, riscv_memory);
+		}
+	}
+	return count;
+}
+
+void print_aot_stats(Riscv64_aot* aot, long int count)
+{
+	printf("aot: %ld instructions (%.2f%%) executed in translated code, %ld calls, %ld blocks run by the block engine\n",
+	       aot->executed, count ? 100.0 * aot->executed / count : 0.0, aot->call, aot->interpreted);
+}
@@ -0,0 +1,65 @@
+#ifndef __AOT_H__
+#define __AOT_H__
+#include "memory_system.h"
+#include "riscv_instruction.h"
+#include "decode_cache.h"
+#include "block_cache.h"
+
+/*********************************************/
+/*                                           */
+/* ahead-of-time translation                 */
+/*                                           */
+/*********************************************/
+/* "./simulator -aot prog" recovers the      */
+/* control flow of the text of prog, writes  */
+/* one C function per guest function to      */
+/* prog.aot.c and compiles it into           */
+/* prog.aot.so. A later run of prog with the */
+/* block or jit engine dlopens prog.aot.so   */
+/* and calls the translated functions. Any   */
+/* pc they do not know, e.g. the target of   */
+/* an indirect jump that could not be        */
+/* resolved, is run by the block engine.     */
+/* A store into the text returns to run_aot, */
+/* and from then on everything is left to    */
+/* the block engine, as the functions span   */
+/* many pages.                               */
+/*********************************************/
+
+#define AOT_ABI 4    // bump when the generated code changes incompatibly
+
+// a translated function: runs from the current pc until it leaves the function,
+// leaves the next guest pc in riscv_register->pc and returns the instructions executed
+typedef long int (*aot_function)(Riscv64_register*, Riscv64_memory*);
+
+typedef struct riscv64_aot{
+	void* handle;              // of dlopen
+	long int entry_num;        // pcs a translated function can be entered at
+	const reg64* entry_pc;
+	aot_function const* entry_fn;
+	long int* hash;            // open addressing, index into entry_pc or -1
+	long int hash_mask;
+	Riscv64_decoded* site;     // records of the instructions the translation calls handlers for
+	long int function_num;
+	bool stale;                // the text was written, do not call the functions any more
+	// statistics
+	long int executed;         // instructions executed in translated code
+	long int call;             // calls of translated functions
+	long int interpreted;      // blocks run by the block engine
+} Riscv64_aot;
+
+struct elf64_hdr; // "parse_elf.h" has no include guard
+
+// write file_name.aot.c for the loaded program and compile it into file_name.aot.so
+void translate_aot(const char* file_name, struct elf64_hdr*, Riscv64_memory*, reg64 entry);
+
+// open file_name.aot.so, NULL if there is none or it was made for another program
+Riscv64_aot* load_aot(const char* file_name, Riscv64_memory*);
+void delete_aot(Riscv64_aot*);
+void invalidate_aot(Riscv64_aot*, Riscv64_memory*, reg64 addr, reg64 length); // the code there was written
+void print_aot_stats(Riscv64_aot*, long int count);
+
+// run until the guest exits, return the number of instructions executed
+long int run_aot(Riscv64_aot*, Riscv64_block_cache*, Riscv64_register*, Riscv64_memory*);
+
+#endif
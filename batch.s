@@ -0,0 +1,30 @@
+# Run in batch mode after smc.elf and far_load.elf: the output of every job
+# comes under its name in the order of the files, the bad access of far_load
+# ends its job only, and a job reads an empty stdin.
+# args: -j 2 smc.elf far_load.elf
+# expect: ==== smc.elf ====
+# expect: ok
+# expect: ==== far_load.elf ====
+# expect: Out of memory!
+# expect: ==== batch.elf ====
+# expect: eof
+# expect: batch: 3 files on 2 workers
+# exit: 0
+  li a0, 0
+  li a1, 0x40000
+  li a2, 16
+  li a7, 63             # read
+  ecall
+  li t0, 0x0a666f65     # "eof\n"
+  beqz a0, print
+  li t0, 0x0a6f6e       # "no\n"
+print:
+  li a1, 0x40100
+  sw t0, 0(a1)
+  li a0, 1
+  li a2, 4
+  li a7, 64
+  ecall
+  li a0, 0
+  li a7, 93
+  ecall
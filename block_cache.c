@@ -0,0 +1,333 @@
+#include "block_cache.h"
+#include "breakpoint.h"
+#include "cache_model.h"
+#include "pipeline_model.h"
+#include "hart.h"
+
+
+#define BLOCK_HASH(pc) (((pc) >> 2) & (BLOCK_HASH_SIZE - 1))
+
+/*********************************************/
+/*                                           */
+/* initialization and gc                     */
+/*                                           */
+/*********************************************/
+
+void init_block_cache(Riscv64_block_cache** cache)
+{
+	*cache = (Riscv64_block_cache*) malloc (sizeof(Riscv64_block_cache));
+	memset(*cache, 0, sizeof(Riscv64_block_cache));
+}
+
+static void free_retired_blocks(Riscv64_block_cache* cache)
+{
+	while(cache->retired != NULL)
+	{
+		Riscv64_block* next = cache->retired->hash_next;
+		free(cache->retired);
+		cache->retired = next;
+	}
+}
+
+void delete_block_cache(Riscv64_block_cache* cache)
+{
+	free_retired_blocks(cache);
+	for(int i = 0; i < BLOCK_HASH_SIZE; i++)
+	{
+		Riscv64_block* block = cache->bucket[i];
+		while(block != NULL)
+		{
+			Riscv64_block* next = block->hash_next;
+			free(block);
+			block = next;
+		}
+	}
+	if(cache->jit != NULL)
+		delete_jit(cache->jit);
+	free(cache);
+}
+
+
+/*********************************************/
+/*                                           */
+/* translation                               */
+/*                                           */
+/*********************************************/
+
+// translate the straight-line run starting at pc
+static Riscv64_block* translate_block(Riscv64_block_cache* cache, Riscv64_memory* riscv_memory, reg64 start)
+{
+	Riscv64_decoded ops[BLOCK_MAX_LENGTH];
+	reg64 target[2] = {0, 0};
+	int length = 0;
+	reg64 pc = start;
+
+	while(length < BLOCK_MAX_LENGTH)
+	{
+		instruction inst = (instruction) get_memory_reg32(riscv_memory, (byte*)pc);
+		Riscv64_decoded* op = &ops[length++];
+		decode_to_record(op, inst);
+		INSTID id = op->id;
+		if(is_breakpoint(pc))
+			make_trap(op);
+
+		switch(id)
+		{
+			case INST_BEQ:
+			case INST_BNE:
+			case INST_BLT:
+			case INST_BGE:
+			case INST_BLTU:
+			case INST_BGEU:
+				target[0] = pc + (long int)op->imm;
+				target[1] = pc + sizeof(instruction);
+				goto done;
+			case INST_JAL:
+				target[0] = pc + (long int)op->imm;
+				goto done;
+			case INST_JALR:
+			case INST_SCALL:
+				goto done;
+			default:
+				break;
+		}
+		pc += sizeof(instruction);
+	}
+	// too long, continue in the next block
+	target[1] = pc;
+
+done:
+	// fuse adjacent pairs, the second record stays in place after the fused one
+	for(int i = 0; i + 1 < length; i++)
+		if(fuse_records(&ops[i], &ops[i+1]))
+		{
+			cache->fused++;
+			i++;
+		}
+
+	Riscv64_block* block = (Riscv64_block*) malloc (sizeof(Riscv64_block) + length * sizeof(Riscv64_decoded));
+	if(block == NULL)
+	{
+		printf("Memory error.\n");
+		exit(1);
+	}
+	memset(block, 0, sizeof(Riscv64_block));
+	block->start = start;
+	block->length = length;
+	block->target[0] = target[0];
+	block->target[1] = target[1];
+	memcpy(block->ops, ops, length * sizeof(Riscv64_decoded));
+	mark_code_page(riscv_memory, start);
+	mark_code_page(riscv_memory, start + (length - 1) * sizeof(instruction));
+	return block;
+}
+
+Riscv64_block* lookup_block(Riscv64_block_cache* cache, Riscv64_memory* riscv_memory, reg64 pc)
+{
+	Riscv64_block** head = &cache->bucket[BLOCK_HASH(pc)];
+	cache->lookup++;
+
+	for(Riscv64_block* block = *head; block != NULL; block = block->hash_next)
+	{
+		if(block->start == pc)
+			return block;
+	}
+
+	Riscv64_block* block = translate_block(cache, riscv_memory, pc);
+	block->hash_next = *head;
+	*head = block;
+	cache->block_num++;
+	return block;
+}
+
+
+static bool overlaps(Riscv64_block* block, reg64 addr, reg64 length)
+{
+	return block->start < addr + length && addr < block->start + block->length * sizeof(instruction);
+}
+
+void invalidate_blocks(Riscv64_block_cache* cache, reg64 addr, reg64 length)
+{
+	for(int i = 0; i < BLOCK_HASH_SIZE; i++)
+	{
+		Riscv64_block** prev = &cache->bucket[i];
+		while(*prev != NULL)
+		{
+			Riscv64_block* block = *prev;
+			if(!overlaps(block, addr, length))
+			{
+				// do not chain into a retired block
+				for(int k = 0; k < 2; k++)
+					if(block->link[k] != NULL && overlaps(block->link[k], addr, length))
+						block->link[k] = NULL;
+				prev = &block->hash_next;
+				continue;
+			}
+			// the block may be the one running, it is freed by run_blocks() or step_block()
+			*prev = block->hash_next;
+			block->link[0] = block->link[1] = NULL;
+			block->hash_next = cache->retired;
+			cache->retired = block;
+			cache->invalidated++;
+		}
+	}
+}
+
+
+/*********************************************/
+/*                                           */
+/* execution                                 */
+/*                                           */
+/*********************************************/
+
+// run one block, the pc must be at its start; return the number of instructions executed, fewer
+// than its length if a store into translated code left it: the rest of the ops may be stale
+static inline long int execute_block(Riscv64_block_cache* cache, Riscv64_block* block, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	long int executed = block->length;
+	if(block->jit != NULL)
+	{
+		block->jit(riscv_register, riscv_memory);
+		if(riscv_memory->code_invalidated)
+		{
+			// the compiled code returned right after the store, with the pc of the next instruction
+			riscv_memory->code_invalidated = FALSE;
+			executed = (riscv_register->pc - block->start) / sizeof(instruction);
+		}
+		cache->jit_executed += executed;
+	}
+	else
+	{
+		reg64 pc = block->start;
+		Riscv64_decoded* op = block->ops;
+		Riscv64_decoded* end = block->ops + block->length;
+
+		for(; op < end; op++)
+		{
+			CACHE_FETCH(riscv_memory, pc, sizeof(instruction));
+			pc += sizeof(instruction); // the handlers expect pc to point to the next instruction, as after fetch()
+			riscv_register->pc = pc;
+			op->handler(op, riscv_register, riscv_memory);
+			PIPELINE_RETIRE(riscv_memory, op, pc - sizeof(instruction), riscv_register->pc);
+			if(op->id >= INST_FUSED_FIRST) // the handler ran the next record too
+			{
+				op++;
+				pc += sizeof(instruction);
+			}
+			if(riscv_memory->code_invalidated)
+			{
+				// go on at the next pc, riscv_register->pc, in a block translated again
+				riscv_memory->code_invalidated = FALSE;
+				block->exec_count++;
+				return (pc - block->start) / sizeof(instruction);
+			}
+		}
+
+		// promote a hot block to host code
+		if(cache->jit != NULL && block->exec_count + 1 == JIT_THRESHOLD)
+			block->jit = jit_compile(cache->jit, riscv_memory, block->start, block->ops, block->length);
+	}
+	block->exec_count++;
+	return executed;
+}
+
+long int step_block(Riscv64_block_cache* cache, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	free_retired_blocks(cache);
+	riscv_memory->code_invalidated = FALSE;
+	Riscv64_block* block = lookup_block(cache, riscv_memory, get_register_pc(riscv_register));
+	return execute_block(cache, block, riscv_register, riscv_memory);
+}
+
+long int run_blocks(Riscv64_block_cache* cache, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	long int count = 0;
+	// a restored snapshot may have dropped translations before the run
+	riscv_memory->code_invalidated = FALSE;
+	Riscv64_block* block = lookup_block(cache, riscv_memory, get_register_pc(riscv_register));
+
+	while(1)
+	{
+		if(cache->retired != NULL) // block is never one of them here
+			free_retired_blocks(cache);
+		count += execute_block(cache, block, riscv_register, riscv_memory);
+
+		if(riscv_memory->exit_happened)
+			return count;
+		// another hart may have ended the program, or stored into code
+		if(riscv_memory->harts != NULL && poll_harts(riscv_memory))
+			return count;
+
+		// follow the chain if the block went where it went before
+		reg64 next = riscv_register->pc;
+		if(block->link[0] != NULL && next == block->target[0])
+		{
+			cache->chained++;
+			block = block->link[0];
+			continue;
+		}
+		if(block->link[1] != NULL && next == block->target[1])
+		{
+			cache->chained++;
+			block = block->link[1];
+			continue;
+		}
+
+		Riscv64_block* successor = lookup_block(cache, riscv_memory, next);
+		if(block->target[0] != 0 && next == block->target[0])
+			block->link[0] = successor;
+		else if(block->target[1] != 0 && next == block->target[1])
+			block->link[1] = successor;
+		block = successor;
+	}
+}
+
+
+/*********************************************/
+/*                                           */
+/* statistics                                */
+/*                                           */
+/*********************************************/
+
+#define HOT_BLOCK_NUM 10
+
+void print_block_cache_stats(Riscv64_block_cache* cache, long int count)
+{
+	Riscv64_block* hot[HOT_BLOCK_NUM] = {NULL};
+
+	// keep the blocks with the most instructions executed
+	for(int i = 0; i < BLOCK_HASH_SIZE; i++)
+	{
+		for(Riscv64_block* block = cache->bucket[i]; block != NULL; block = block->hash_next)
+		{
+			long int weight = block->exec_count * block->length;
+			for(int j = 0; j < HOT_BLOCK_NUM; j++)
+			{
+				if(hot[j] == NULL || weight > hot[j]->exec_count * hot[j]->length)
+				{
+					memmove(&hot[j+1], &hot[j], (HOT_BLOCK_NUM - j - 1) * sizeof(Riscv64_block*));
+					hot[j] = block;
+					break;
+				}
+			}
+		}
+	}
+
+	printf("block cache: %ld blocks translated, %ld lookups, %ld chained transitions\n",
+	       cache->block_num, cache->lookup, cache->chained);
+	if(cache->invalidated > 0)
+		printf("block cache: %ld blocks invalidated by stores into their code\n", cache->invalidated);
+	if(cache->jit != NULL)
+	{
+		print_jit_stats(cache->jit);
+		printf("jit: %ld instructions (%.2f%%) executed in compiled blocks\n",
+		       cache->jit_executed, count ? 100.0 * cache->jit_executed / count : 0.0);
+	}
+	printf("   start pc   length   executed   instructions\n");
+	for(int j = 0; j < HOT_BLOCK_NUM && hot[j] != NULL; j++)
+	{
+		long int weight = hot[j]->exec_count * hot[j]->length;
+		printf("   %8lx   %6d   %8ld   %12ld (%.2f%%)\n", hot[j]->start, hot[j]->length, hot[j]->exec_count,
+		       weight, count ? 100.0 * weight / count : 0.0);
+	}
+}
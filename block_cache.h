@@ -0,0 +1,65 @@
+#ifndef __BLOCK_CACHE_H__
+#define __BLOCK_CACHE_H__
+#include "memory_system.h"
+#include "riscv_instruction.h"
+#include "decode_cache.h"
+#include "jit.h"
+
+/*********************************************/
+/*                                           */
+/* basic-block translation cache             */
+/*                                           */
+/*********************************************/
+/* A block is a straight-line run of         */
+/* instructions ending at a branch, jal,     */
+/* jalr or ecall, translated once into an    */
+/* array of decoded records and found by its */
+/* start pc. A block ending in a direct      */
+/* branch or jal remembers the blocks it     */
+/* went to, so hot loops go from block to    */
+/* block without a lookup. The pages a block */
+/* is translated from are marked as code, a  */
+/* store into one retires the blocks on it.  */
+/*********************************************/
+
+#define BLOCK_MAX_LENGTH   64       // longest straight-line run in one block
+#define BLOCK_HASH_SIZE    (1<<12)  // buckets of the start pc hash table
+
+typedef struct riscv64_block Riscv64_block;
+struct riscv64_block{
+	reg64 start;              // guest pc of the first instruction
+	int length;               // number of instructions
+	reg64 target[2];          // static successors: [0] branch/jump target, [1] fall through, 0 if none
+	Riscv64_block* link[2];   // chained successor block of target[i], NULL until first used
+	long int exec_count;      // times the block was entered
+	jit_code jit;             // compiled host code, NULL while interpreted
+	Riscv64_block* hash_next; // next block in the same bucket
+	Riscv64_decoded ops[];    // the translated instructions
+};
+
+typedef struct riscv64_block_cache{
+	Riscv64_block* bucket[BLOCK_HASH_SIZE];
+	Riscv64_jit* jit;         // compiles hot blocks if not NULL
+	Riscv64_block* retired;   // invalidated blocks, freed when none of them can be running
+	// statistics
+	long int block_num;       // blocks translated
+	long int lookup;          // hash table lookups
+	long int chained;         // block transitions that followed a link
+	long int jit_executed;    // instructions executed in compiled blocks
+	long int invalidated;     // blocks retired by invalidate_blocks()
+	long int fused;           // pairs fused in the blocks
+} Riscv64_block_cache;
+
+void init_block_cache(Riscv64_block_cache**);
+void delete_block_cache(Riscv64_block_cache*);
+void print_block_cache_stats(Riscv64_block_cache*, long int count); // summary and the hottest blocks
+
+Riscv64_block* lookup_block(Riscv64_block_cache*, Riscv64_memory*, reg64 pc); // find or translate the block at pc
+void invalidate_blocks(Riscv64_block_cache*, reg64 addr, reg64 length); // the code there was written, translate it again
+
+// run until the guest exits, return the number of instructions executed
+long int run_blocks(Riscv64_block_cache*, Riscv64_register*, Riscv64_memory*);
+// run the block at the current pc once, return the number of instructions executed
+long int step_block(Riscv64_block_cache*, Riscv64_register*, Riscv64_memory*);
+
+#endif
@@ -0,0 +1,410 @@
+#include "branch_predictor.h"
+
+#define PREDICT_BIMODAL 0
+#define PREDICT_GSHARE  1
+#define PREDICT_TAGE    2
+
+static const char* kind_name[] = {"bimodal", "gshare", "tage"};
+
+typedef struct predictor_config{
+	int kind;
+	int bits;
+} Predictor_config;
+
+static Predictor_config predictor_config[PREDICTOR_MAX] = {
+	{PREDICT_BIMODAL, 12},
+	{PREDICT_GSHARE,  14},
+	{PREDICT_TAGE,    10},
+};
+static int predictor_config_num = 3;
+static bool predictor_config_given = FALSE; // the first -bpred predictor replaces the defaults
+static int btb_config_bits = 10;
+static int ras_config_size = 16;
+
+bool set_branch_config(const char* spec)
+{
+	char kind[16];
+	int value;
+	if(sscanf(spec, "%15[a-z]:%d", kind, &value) != 2)
+	{
+		printf("-bpred needs bimodal:bits, gshare:bits, tage:bits, btb:bits or ras:entries.\n");
+		return FALSE;
+	}
+
+	if(strcmp(kind, "btb") == 0)
+	{
+		if(value < 1 || value > 24)
+		{
+			printf("btb: the bits must be between 1 and 24.\n");
+			return FALSE;
+		}
+		btb_config_bits = value;
+		return TRUE;
+	}
+	if(strcmp(kind, "ras") == 0)
+	{
+		if(value < 1 || value > RAS_MAX)
+		{
+			printf("ras: the entries must be between 1 and %d.\n", RAS_MAX);
+			return FALSE;
+		}
+		ras_config_size = value;
+		return TRUE;
+	}
+
+	for(int i = 0; i < 3; i++)
+	{
+		if(strcmp(kind, kind_name[i]) != 0)
+			continue;
+		if(value < 1 || value > 24)
+		{
+			printf("%s: the bits must be between 1 and 24.\n", kind);
+			return FALSE;
+		}
+		if(!predictor_config_given)
+			predictor_config_num = 0;
+		predictor_config_given = TRUE;
+		if(predictor_config_num == PREDICTOR_MAX)
+		{
+			printf("-bpred: at most %d predictors.\n", PREDICTOR_MAX);
+			return FALSE;
+		}
+		predictor_config[predictor_config_num].kind = i;
+		predictor_config[predictor_config_num].bits = value;
+		predictor_config_num++;
+		return TRUE;
+	}
+	printf("-bpred: unknown predictor %s.\n", kind);
+	return FALSE;
+}
+
+
+/*********************************************/
+/*                                           */
+/* direction predictors                      */
+/*                                           */
+/*********************************************/
+
+// a 2-bit saturating counter, taken from 2 up
+static inline bool train_counter(byte* counter, bool taken)
+{
+	bool prediction = *counter >= 2;
+	if(taken && *counter < 3)
+		(*counter)++;
+	else if(!taken && *counter > 0)
+		(*counter)--;
+	return prediction;
+}
+
+static bool predict_bimodal(Riscv64_predictor* p, reg64 pc, bool taken)
+{
+	return train_counter(&p->counters[(pc >> 2) & ((1L << p->bits) - 1)], taken);
+}
+
+static bool predict_gshare(Riscv64_predictor* p, reg64 pc, bool taken)
+{
+	reg64 mask = (1L << p->bits) - 1;
+	bool prediction = train_counter(&p->counters[((pc >> 2) ^ p->history) & mask], taken);
+	p->history = ((p->history << 1) | taken) & mask;
+	return prediction;
+}
+
+/* TAGE: the longest history whose tagged table has the branch provides the prediction, */
+/* a misprediction allocates an entry in a table of longer history                     */
+typedef struct tage_entry{
+	reg16 tag;
+	signed char counter;      // -4 to 3, taken from 0 up
+	byte useful;              // 0 to 3, an entry is only replaced when it is 0
+} Tage_entry;
+
+// the last length bits of the history folded to bits bits, updated a bit at a time
+typedef struct folded_history{
+	reg32 value;
+	int length;
+	int bits;
+} Folded_history;
+
+typedef struct tage{
+	Tage_entry* table[TAGE_TABLES];
+	Folded_history index[TAGE_TABLES];
+	Folded_history tag[TAGE_TABLES][2];
+	byte history[TAGE_HISTORY]; // the outcome of the i-th last branch is history[(head + i) % TAGE_HISTORY]
+	int head;
+	long int branches;
+} Tage;
+
+static const int tage_length[TAGE_TABLES] = {5, 15, 44, 130};
+
+static void fold_history(Folded_history* f, byte* history, int head)
+{
+	f->value = (f->value << 1) | history[head];
+	f->value ^= (reg32)history[(head + f->length) % TAGE_HISTORY] << (f->length % f->bits);
+	f->value ^= f->value >> f->bits;
+	f->value &= (1U << f->bits) - 1;
+}
+
+static bool predict_tage(Riscv64_predictor* p, reg64 pc, bool taken)
+{
+	Tage* t = (Tage*)p->tage;
+	reg64 mask = (1L << p->bits) - 1;
+	Tage_entry* entry[TAGE_TABLES];
+	reg16 tag[TAGE_TABLES];
+	int provider = -1;
+	int alternate = -1;
+	for(int i = TAGE_TABLES - 1; i >= 0; i--)
+	{
+		entry[i] = &t->table[i][((pc >> 2) ^ (pc >> (2 + p->bits)) ^ t->index[i].value) & mask];
+		tag[i] = ((pc >> 2) ^ t->tag[i][0].value ^ (t->tag[i][1].value << 1)) & ((1 << TAGE_TAG_BITS) - 1);
+		if(entry[i]->tag != tag[i])
+			continue;
+		if(provider < 0)
+			provider = i;
+		else if(alternate < 0)
+			alternate = i;
+	}
+
+	byte* base = &p->counters[(pc >> 2) & ((1L << (p->bits + 2)) - 1)];
+	bool base_prediction = *base >= 2;
+	bool alternate_prediction = alternate >= 0 ? entry[alternate]->counter >= 0 : base_prediction;
+	bool prediction;
+	if(provider >= 0)
+	{
+		Tage_entry* e = entry[provider];
+		prediction = e->counter >= 0;
+		if(prediction != alternate_prediction)
+		{
+			if(prediction == taken && e->useful < 3)
+				e->useful++;
+			else if(prediction != taken && e->useful > 0)
+				e->useful--;
+		}
+		if(taken && e->counter < 3)
+			e->counter++;
+		else if(!taken && e->counter > -4)
+			e->counter--;
+	}
+	else
+		prediction = train_counter(base, taken);
+
+	// a longer history might have told this one apart
+	if(prediction != taken && provider < TAGE_TABLES - 1)
+	{
+		int i = provider + 1;
+		while(i < TAGE_TABLES && entry[i]->useful != 0)
+			i++;
+		if(i < TAGE_TABLES)
+		{
+			entry[i]->tag = tag[i];
+			entry[i]->counter = taken ? 0 : -1;
+		}
+		else
+			for(i = provider + 1; i < TAGE_TABLES; i++)
+				entry[i]->useful--;
+	}
+
+	// age the useful bits now and then, so that old entries can be replaced
+	if(++t->branches % TAGE_U_RESET == 0)
+		for(int i = 0; i < TAGE_TABLES; i++)
+			for(long int j = 0; j <= mask; j++)
+				t->table[i][j].useful >>= 1;
+
+	t->head = (t->head + TAGE_HISTORY - 1) % TAGE_HISTORY;
+	t->history[t->head] = taken;
+	for(int i = 0; i < TAGE_TABLES; i++)
+	{
+		fold_history(&t->index[i], t->history, t->head);
+		fold_history(&t->tag[i][0], t->history, t->head);
+		fold_history(&t->tag[i][1], t->history, t->head);
+	}
+	return prediction;
+}
+
+
+/*********************************************/
+/*                                           */
+/* initialization and gc                     */
+/*                                           */
+/*********************************************/
+
+static void clear_predictor(Riscv64_predictor* p)
+{
+	long int counters = p->tage != NULL ? 1L << (p->bits + 2) : 1L << p->bits;
+	memset(p->counters, 1, counters); // weakly not taken
+	p->history = 0;
+	p->mispredicted = 0;
+	if(p->tage != NULL)
+	{
+		Tage* t = (Tage*)p->tage;
+		for(int i = 0; i < TAGE_TABLES; i++)
+		{
+			memset(t->table[i], 0, (1L << p->bits) * sizeof(Tage_entry));
+			t->index[i].value = 0;
+			t->tag[i][0].value = 0;
+			t->tag[i][1].value = 0;
+		}
+		memset(t->history, 0, TAGE_HISTORY);
+		t->head = 0;
+		t->branches = 0;
+	}
+}
+
+void init_branch_model(Riscv64_branch_model** model)
+{
+	*model = (Riscv64_branch_model*) malloc (sizeof(Riscv64_branch_model));
+	memset(*model, 0, sizeof(Riscv64_branch_model));
+
+	for(int n = 0; n < predictor_config_num; n++)
+	{
+		Riscv64_predictor* p = &(*model)->predictor[n];
+		int kind = predictor_config[n].kind;
+		p->bits = predictor_config[n].bits;
+		snprintf(p->name, sizeof(p->name), "%s:%d", kind_name[kind], p->bits);
+		if(kind == PREDICT_TAGE)
+		{
+			Tage* t = (Tage*) malloc (sizeof(Tage));
+			for(int i = 0; i < TAGE_TABLES; i++)
+			{
+				t->table[i] = (Tage_entry*) malloc ((1L << p->bits) * sizeof(Tage_entry));
+				t->index[i].length = tage_length[i];
+				t->index[i].bits = p->bits;
+				t->tag[i][0].length = tage_length[i];
+				t->tag[i][0].bits = TAGE_TAG_BITS;
+				t->tag[i][1].length = tage_length[i];
+				t->tag[i][1].bits = TAGE_TAG_BITS - 1;
+			}
+			p->tage = t;
+			p->predict = predict_tage;
+			p->counters = (byte*) malloc (1L << (p->bits + 2));
+		}
+		else
+		{
+			p->predict = kind == PREDICT_GSHARE ? predict_gshare : predict_bimodal;
+			p->counters = (byte*) malloc (1L << p->bits);
+		}
+	}
+	(*model)->predictor_num = predictor_config_num;
+	(*model)->btb_bits = btb_config_bits;
+	(*model)->btb = (Riscv64_btb_entry*) malloc ((1L << btb_config_bits) * sizeof(Riscv64_btb_entry));
+	(*model)->ras_size = ras_config_size;
+	reset_branch_model(*model);
+}
+
+void reset_branch_model(Riscv64_branch_model* model)
+{
+	for(int n = 0; n < model->predictor_num; n++)
+		clear_predictor(&model->predictor[n]);
+	memset(model->btb, 0, (1L << model->btb_bits) * sizeof(Riscv64_btb_entry));
+	memset(model->ras, 0, sizeof(model->ras));
+	model->ras_top = 0;
+	model->conditional = 0;
+	model->taken = 0;
+	model->jumps = 0;
+	model->calls = 0;
+	model->returns = 0;
+	model->btb_lookups = 0;
+	model->btb_misses = 0;
+	model->ras_misses = 0;
+}
+
+void delete_branch_model(Riscv64_branch_model* model)
+{
+	for(int n = 0; n < model->predictor_num; n++)
+	{
+		Riscv64_predictor* p = &model->predictor[n];
+		if(p->tage != NULL)
+		{
+			Tage* t = (Tage*)p->tage;
+			for(int i = 0; i < TAGE_TABLES; i++)
+				free(t->table[i]);
+			free(t);
+		}
+		free(p->counters);
+	}
+	free(model->btb);
+	free(model);
+}
+
+
+/*********************************************/
+/*                                           */
+/* branches and jumps                        */
+/*                                           */
+/*********************************************/
+
+// a taken branch or jump is redirected at fetch if the btb has its target
+static void lookup_btb(Riscv64_branch_model* model, reg64 pc, reg64 target)
+{
+	Riscv64_btb_entry* entry = &model->btb[(pc >> 2) & ((1L << model->btb_bits) - 1)];
+	model->btb_lookups++;
+	if(entry->pc != pc || entry->target != target)
+	{
+		model->btb_misses++;
+		entry->pc = pc;
+		entry->target = target;
+	}
+}
+
+void branch_conditional(Riscv64_branch_model* model, reg64 pc, reg64 target, bool taken)
+{
+	model->conditional++;
+	for(int n = 0; n < model->predictor_num; n++)
+	{
+		Riscv64_predictor* p = &model->predictor[n];
+		if(p->predict(p, pc, taken) != taken)
+			p->mispredicted++;
+	}
+	if(taken)
+	{
+		model->taken++;
+		lookup_btb(model, pc, target);
+	}
+}
+
+#define IS_LINK(r) ((r) == 1 || (r) == 5)
+
+void branch_jump(Riscv64_branch_model* model, reg64 pc, reg64 target, int rd, int rs1)
+{
+	model->jumps++;
+	// a return reads a link register another than the one it writes
+	if(IS_LINK(rs1) && !(IS_LINK(rd) && rd == rs1))
+	{
+		model->returns++;
+		if(model->ras[model->ras_top] != target)
+			model->ras_misses++;
+		model->ras_top = (model->ras_top + model->ras_size - 1) % model->ras_size;
+	}
+	else
+		lookup_btb(model, pc, target);
+	// a call writes one
+	if(IS_LINK(rd))
+	{
+		model->calls++;
+		model->ras_top = (model->ras_top + 1) % model->ras_size;
+		model->ras[model->ras_top] = pc + sizeof(instruction);
+	}
+}
+
+
+/*********************************************/
+/*                                           */
+/* statistics                                */
+/*                                           */
+/*********************************************/
+
+void print_branch_stats(Riscv64_branch_model* model, long int count)
+{
+	double kilo = count ? count / 1000.0 : 1.0;
+	printf("branches: %ld conditional (%.2f%% taken), %ld jumps, %ld calls, %ld returns\n",
+	       model->conditional, model->conditional ? 100.0 * model->taken / model->conditional : 0.0,
+	       model->jumps, model->calls, model->returns);
+	for(int n = 0; n < model->predictor_num; n++)
+	{
+		Riscv64_predictor* p = &model->predictor[n];
+		printf("%s: %ld mispredicted (%.2f%%, %.2f MPKI)\n", p->name, p->mispredicted,
+		       model->conditional ? 100.0 * p->mispredicted / model->conditional : 0.0, p->mispredicted / kilo);
+	}
+	printf("btb: %ld entries, %ld lookups, %ld misses (%.2f MPKI)\n", 1L << model->btb_bits,
+	       model->btb_lookups, model->btb_misses, model->btb_misses / kilo);
+	printf("ras: %d entries, %ld returns mispredicted (%.2f MPKI)\n", model->ras_size,
+	       model->ras_misses, model->ras_misses / kilo);
+}
@@ -0,0 +1,99 @@
+#ifndef __BRANCH_PREDICTOR_H__
+#define __BRANCH_PREDICTOR_H__
+#include "memory_system.h"
+
+/*********************************************/
+/*                                           */
+/* branch prediction model                   */
+/*                                           */
+/*********************************************/
+/* Built with "make BPRED=model" every       */
+/* branch and jump also goes through a model */
+/* of the front end. Several direction       */
+/* predictors (bimodal, gshare, TAGE) see    */
+/* the same conditional branches in one run, */
+/* each one predicting and then training     */
+/* with the outcome, so their MPKI can be    */
+/* compared side by side. Taken branches,    */
+/* jal and indirect jalr look their target   */
+/* up in a BTB; calls and returns are told   */
+/* apart by their link registers (x1 or x5,  */
+/* as the RISC-V spec hints) and returns are */
+/* predicted by a return address stack. The  */
+/* model does not change what the program    */
+/* does.                                     */
+/*********************************************/
+
+#define PREDICTOR_MAX 8       // direction predictors in one run
+#define RAS_MAX       256
+
+// TAGE: a bimodal base and tagged tables of geometric history lengths
+#define TAGE_TABLES   4
+#define TAGE_TAG_BITS 9
+#define TAGE_HISTORY  256     // bits of global history kept, more than the longest length
+#define TAGE_U_RESET  (1L<<18) // branches between two agings of the useful bits
+
+typedef struct riscv64_predictor Riscv64_predictor;
+// return the prediction for the branch at pc, then train with taken
+typedef bool (*predict_function)(Riscv64_predictor*, reg64 pc, bool taken);
+
+struct riscv64_predictor{
+	char name[32];            // kind:bits, as given to -bpred
+	predict_function predict;
+	int bits;                 // log2 of the table size
+	byte* counters;           // bimodal and gshare: 2-bit counters, TAGE: its base
+	reg64 history;            // gshare: global history of the last bits branches
+	void* tage;               // TAGE: the tagged tables and folded histories
+	// statistics
+	long int mispredicted;
+};
+
+typedef struct riscv64_btb_entry{
+	reg64 pc;                 // of the branch, 0 if empty
+	reg64 target;
+} Riscv64_btb_entry;
+
+typedef struct riscv64_branch_model{
+	Riscv64_predictor predictor[PREDICTOR_MAX];
+	int predictor_num;
+	Riscv64_btb_entry* btb;   // direct mapped
+	int btb_bits;
+	reg64 ras[RAS_MAX];       // circular, an overflow overwrites the oldest return
+	int ras_size;
+	int ras_top;
+	// statistics
+	long int conditional;     // conditional branches
+	long int taken;
+	long int jumps;           // jal and jalr
+	long int calls;
+	long int returns;
+	long int btb_lookups;     // taken branches and jumps but returns
+	long int btb_misses;      // no entry, or another target
+	long int ras_misses;      // returns to another address than the top of the stack
+} Riscv64_branch_model;
+
+// the model of the next init_branch_model(), bimodal:12, gshare:14 and tage:10 with a 10-bit
+// btb and 16 return addresses until set_branch_config() changes them
+// parse "bimodal:bits", "gshare:bits", "tage:bits", "btb:bits" or "ras:entries",
+// FALSE (with a message) if it is wrong
+bool set_branch_config(const char* spec);
+
+void init_branch_model(Riscv64_branch_model**); // all tables cleared
+void reset_branch_model(Riscv64_branch_model*); // cleared again with the statistics
+void delete_branch_model(Riscv64_branch_model*);
+void print_branch_stats(Riscv64_branch_model*, long int count);
+
+// pc is the address of the branch or jump
+void branch_conditional(Riscv64_branch_model*, reg64 pc, reg64 target, bool taken);
+void branch_jump(Riscv64_branch_model*, reg64 pc, reg64 target, int rd, int rs1); // rs1 -1 for jal
+
+// the hooks of the branch and jump functions, nothing without BRANCH_MODEL
+#ifdef BRANCH_MODEL
+#define BRANCH_CONDITIONAL(riscv_memory, pc, target, taken) branch_conditional((riscv_memory)->branch_model, pc, target, taken)
+#define BRANCH_JUMP(riscv_memory, pc, target, rd, rs1)      branch_jump((riscv_memory)->branch_model, pc, target, rd, rs1)
+#else
+#define BRANCH_CONDITIONAL(riscv_memory, pc, target, taken)
+#define BRANCH_JUMP(riscv_memory, pc, target, rd, rs1)
+#endif
+
+#endif
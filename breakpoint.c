@@ -0,0 +1,501 @@
+#define _GNU_SOURCE // REG_EFL
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "breakpoint.h"
+#include "debug.h"
+
+
+#define TRAP_FLAG 0x100 // of EFLAGS, single-steps the host
+
+Riscv64_breakpoints riscv_breakpoints = { .watch_hit = -1 };
+
+static long int page_size = 0;
+#define HOST_PAGE(p) ((byte*)((unsigned long int)(p) & ~(page_size - 1)))
+
+// host pages unprotected while the faulting store is single-stepped
+static byte* open_page[2];
+static int open_page_num = 0;
+
+static struct sigaction old_segv;
+static struct sigaction old_trap;
+static bool handlers_installed = FALSE;
+
+
+/*********************************************/
+/*                                           */
+/* traps in the caches                       */
+/*                                           */
+/*********************************************/
+
+bool is_breakpoint(reg64 pc)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	if(pc == b->step_pc && pc != 0)
+		return TRUE;
+	for(int i = 0; i < b->pc_num; i++)
+		if(b->pc[i] == pc)
+			return TRUE;
+	return FALSE;
+}
+
+static bool is_user_breakpoint(reg64 pc)
+{
+	for(int i = 0; i < riscv_breakpoints.pc_num; i++)
+		if(riscv_breakpoints.pc[i] == pc)
+			return TRUE;
+	return FALSE;
+}
+
+void make_trap(Riscv64_decoded* record)
+{
+	record->id = INST_TRAP;
+	record->handler = exec_trap;
+}
+
+// a trap, or the instruction decoded again, in the record of pc
+static void set_record(Riscv64_decoded* record, reg64 pc, bool trap)
+{
+	if(trap)
+		make_trap(record);
+	else
+		decode_to_record(record, (instruction) get_memory_reg32(riscv_breakpoints.riscv_memory, (byte*)pc));
+}
+
+// put or remove the trap of pc in every record of it the attached caches hold
+static void place_trap(reg64 pc, bool trap)
+{
+	Riscv64_decode_cache* decode_cache = riscv_breakpoints.decode_cache;
+	Riscv64_block_cache* block_cache = riscv_breakpoints.block_cache;
+
+	if(decode_cache != NULL && pc - decode_cache->base < decode_cache->limit - decode_cache->base)
+	{
+		Riscv64_decoded* entry = &decode_cache->entries[(pc - decode_cache->base) >> 2];
+		set_record(entry, pc, trap);
+		// a pair fused into the previous record would skip it
+		if(entry > decode_cache->entries && entry[-1].id >= INST_FUSED_FIRST)
+			unfuse_record(&entry[-1]);
+	}
+
+	if(block_cache != NULL)
+	{
+		for(int i = 0; i < BLOCK_HASH_SIZE; i++)
+		{
+			for(Riscv64_block* block = block_cache->bucket[i]; block != NULL; block = block->hash_next)
+			{
+				if(pc - block->start >= block->length * sizeof(instruction))
+					continue;
+				int k = (pc - block->start) >> 2;
+				set_record(&block->ops[k], pc, trap);
+				if(k > 0 && block->ops[k-1].id >= INST_FUSED_FIRST)
+					unfuse_record(&block->ops[k-1]);
+				block->jit = NULL; // its host code does not know the trap, interpret it from now on
+			}
+		}
+	}
+}
+
+// one-shot trap at the next instruction to run
+static void place_step(reg64 pc)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	reg64 old = b->step_pc;
+	b->step_pc = pc;
+	if(old != 0 && old != pc && !is_user_breakpoint(old))
+		place_trap(old, FALSE);
+	place_trap(pc, TRUE);
+}
+
+static bool in_text(reg64 pc)
+{
+	Riscv64_memory* riscv_memory = riscv_breakpoints.riscv_memory;
+	return riscv_memory == NULL || (pc >= riscv_memory->text_start && pc < riscv_memory->text_end);
+}
+
+void exec_trap(Riscv64_decoded* d, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	reg64 pc = riscv_register->pc - sizeof(instruction);
+
+	if(pc == b->step_pc)
+	{
+		b->step_pc = 0;
+		if(!is_user_breakpoint(pc))
+			place_trap(pc, FALSE); // d is the instruction again
+	}
+	if(b->watch_hit >= 0)
+	{
+		printf("watchpoint 0x%lx (%ld bytes): 0x%lx written by the instruction at 0x%lx\n",
+		       b->watch[b->watch_hit].addr, b->watch[b->watch_hit].length, b->watch_addr, b->watch_pc);
+		b->watch_hit = -1;
+	}
+	else if(is_user_breakpoint(pc))
+		printf("breakpoint at 0x%lx\n", pc);
+	printf("pc = 0x%lx, instruction = 0x%x\n", pc, get_memory_reg32(riscv_memory, (byte*)pc));
+
+	DEBUG_MODE(riscv_register, riscv_memory);
+	if(riscv_memory->exit_happened)
+		return; // "exit"
+
+	// run the instruction from a record of its own, the trap may be gone by now
+	Riscv64_decoded record;
+	decode_to_record(&record, (instruction) get_memory_reg32(riscv_memory, (byte*)pc));
+	record.handler(&record, riscv_register, riscv_memory);
+
+	if(b->stepping)
+	{
+		b->stepping = FALSE;
+		if(!riscv_memory->exit_happened)
+			place_step(get_register_pc(riscv_register));
+	}
+}
+
+
+/*********************************************/
+/*                                           */
+/* watchpoints                               */
+/*                                           */
+/*********************************************/
+
+// host page of the guest address, NULL if it is not mapped
+static byte* watched_host_page(reg64 addr)
+{
+	Riscv64_memory* riscv_memory = riscv_breakpoints.riscv_memory;
+	if(out_of_memory_virtual(riscv_memory, (byte*)addr))
+		return NULL;
+	return HOST_PAGE(get_actual_addr(riscv_memory, (byte*)addr));
+}
+
+// write-protect the host pages under every watchpoint or give them back the protection the
+// memory system wants, page by page as the guest pages need not be contiguous on the host
+static void protect_watched(bool watch)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	if(b->riscv_memory == NULL)
+		return;
+	for(int i = 0; i < b->watch_num; i++)
+		for(reg64 addr = b->watch[i].addr & ~(page_size - 1); addr < b->watch[i].addr + b->watch[i].length; addr += page_size)
+		{
+			byte* page = watched_host_page(addr);
+			int protection = watch ? PROT_READ : guest_page_protection(b->riscv_memory, addr);
+			if(page != NULL && mprotect(page, page_size, protection) != 0)
+				perror("watchpoint: mprotect");
+		}
+}
+
+static bool is_watched_page(byte* host)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	if(b->riscv_memory == NULL)
+		return FALSE;
+	for(int i = 0; i < b->watch_num; i++)
+		for(reg64 addr = b->watch[i].addr & ~(page_size - 1); addr < b->watch[i].addr + b->watch[i].length; addr += page_size)
+			if(watched_host_page(addr) == HOST_PAGE(host))
+				return TRUE;
+	return FALSE;
+}
+
+// the watchpoint [addr, addr + length) overlaps, or -1
+static int watched(reg64 addr, reg64 length)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	for(int i = 0; i < b->watch_num; i++)
+		if(addr < b->watch[i].addr + b->watch[i].length && b->watch[i].addr < addr + length)
+			return i;
+	return -1;
+}
+
+// remember a write to a watchpoint, it is reported when the next instruction traps
+static void watch_written(reg64 addr, reg64 length)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	int hit = watched(addr, length);
+	if(hit < 0)
+		return;
+	b->watch_hit = hit;
+	b->watch_addr = MAX(addr, b->watch[hit].addr);
+	b->watch_pc = get_register_pc(b->riscv_register) - sizeof(instruction);
+	place_step(get_register_pc(b->riscv_register));
+}
+
+// a signal that is not ours goes to the handler from before, which stays in place for the next
+// one; SIG_DFL is put back so that the fault repeats and ends the process as it would have
+static void forward_signal(struct sigaction* old, int sig, siginfo_t* info, void* context)
+{
+	if(old->sa_flags & SA_SIGINFO)
+		old->sa_sigaction(sig, info, context);
+	else if(old->sa_handler == SIG_DFL)
+		signal(sig, SIG_DFL);
+	else if(old->sa_handler != SIG_IGN)
+		old->sa_handler(sig);
+}
+
+// a store to a watched page: let it through once and stop right after it
+static void on_segv(int sig, siginfo_t* info, void* context)
+{
+	ucontext_t* uc = (ucontext_t*)context;
+	byte* host = (byte*)info->si_addr;
+
+	if(!is_watched_page(host) || open_page_num == 2)
+	{
+		// not ours, e.g. a store to a code page the memory system tracks
+		forward_signal(&old_segv, sig, info, context);
+		return;
+	}
+	// a code page or a page of a snapshot sees the store as well
+	track_host_write(riscv_breakpoints.riscv_memory, host);
+	open_page[open_page_num++] = HOST_PAGE(host);
+	mprotect(HOST_PAGE(host), page_size, PROT_READ | PROT_WRITE);
+	uc->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+}
+
+// the store is done: protect the pages again and see what it wrote
+static void on_trap(int sig, siginfo_t* info, void* context)
+{
+	ucontext_t* uc = (ucontext_t*)context;
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+
+	if(open_page_num == 0)
+	{
+		forward_signal(&old_trap, sig, info, context);
+		return;
+	}
+	uc->uc_mcontext.gregs[REG_EFL] &= ~TRAP_FLAG;
+	for(int i = 0; i < open_page_num; i++)
+		mprotect(open_page[i], page_size, PROT_READ);
+	open_page_num = 0;
+
+	// the guest store that was running, pc already points past it
+	reg64 pc = get_register_pc(b->riscv_register) - sizeof(instruction);
+	instruction inst = (instruction) get_memory_reg32(b->riscv_memory, (byte*)pc);
+	int imm;
+	reg64 length;
+	switch(GetINSTID(inst, &imm))
+	{
+		case INST_SB:  length = 1; break;
+		case INST_SH:  length = 2; break;
+		case INST_SW:
+		case INST_FSW: length = 4; break;
+		case INST_SD:
+		case INST_FSD: length = 8; break;
+		default:       return;
+	}
+	watch_written(b->riscv_register->x[RS1(inst)] + imm, length);
+}
+
+static void install_handlers()
+{
+	if(handlers_installed)
+		return;
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	action.sa_sigaction = on_segv;
+	sigaction(SIGSEGV, &action, &old_segv);
+	action.sa_sigaction = on_trap;
+	sigaction(SIGTRAP, &action, &old_trap);
+	handlers_installed = TRUE;
+}
+
+static void remove_handlers()
+{
+	if(!handlers_installed)
+		return;
+	sigaction(SIGSEGV, &old_segv, NULL);
+	sigaction(SIGTRAP, &old_trap, NULL);
+	handlers_installed = FALSE;
+}
+
+// compiled blocks do not keep the guest pc a watchpoint hit needs
+static void drop_compiled_blocks()
+{
+	Riscv64_block_cache* block_cache = riscv_breakpoints.block_cache;
+	if(block_cache == NULL)
+		return;
+	for(int i = 0; i < BLOCK_HASH_SIZE; i++)
+		for(Riscv64_block* block = block_cache->bucket[i]; block != NULL; block = block->hash_next)
+			block->jit = NULL;
+}
+
+void begin_host_write()
+{
+	if(riscv_breakpoints.watch_num > 0)
+		protect_watched(FALSE);
+}
+
+void end_host_write(reg64 addr, reg64 length)
+{
+	if(riscv_breakpoints.watch_num == 0 || riscv_breakpoints.riscv_memory == NULL)
+		return;
+	protect_watched(TRUE);
+	if(length > 0)
+		watch_written(addr, length);
+}
+
+
+/*********************************************/
+/*                                           */
+/* setting and listing                       */
+/*                                           */
+/*********************************************/
+
+bool add_breakpoint(reg64 pc)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	if((pc & 3) != 0 || !in_text(pc))
+	{
+		printf("breakpoint: 0x%lx is not an instruction of the text\n", pc);
+		return FALSE;
+	}
+	if(is_user_breakpoint(pc))
+		return TRUE;
+	if(b->pc_num == BREAKPOINT_MAX)
+	{
+		printf("breakpoint: at most %d breakpoints\n", BREAKPOINT_MAX);
+		return FALSE;
+	}
+	b->pc[b->pc_num++] = pc;
+	place_trap(pc, TRUE);
+	return TRUE;
+}
+
+bool delete_breakpoint(reg64 pc)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	for(int i = 0; i < b->pc_num; i++)
+	{
+		if(b->pc[i] != pc)
+			continue;
+		b->pc[i] = b->pc[--b->pc_num];
+		if(pc != b->step_pc)
+			place_trap(pc, FALSE);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+bool add_watchpoint(reg64 addr, reg64 length)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	if(length == 0 || addr + length > guest_mem_size || addr + length < addr)
+	{
+		printf("watchpoint: 0x%lx (%ld bytes) is not in the memory\n", addr, length);
+		return FALSE;
+	}
+	if(b->watch_num == WATCHPOINT_MAX)
+	{
+		printf("watchpoint: at most %d watchpoints\n", WATCHPOINT_MAX);
+		return FALSE;
+	}
+	b->watch[b->watch_num].addr = addr;
+	b->watch[b->watch_num].length = length;
+	b->watch_num++;
+	if(b->riscv_memory != NULL)
+	{
+		install_handlers();
+		drop_compiled_blocks();
+		protect_watched(TRUE);
+	}
+	return TRUE;
+}
+
+bool delete_watchpoint(reg64 addr)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	for(int i = 0; i < b->watch_num; i++)
+	{
+		if(b->watch[i].addr != addr)
+			continue;
+		protect_watched(FALSE);
+		b->watch[i] = b->watch[--b->watch_num];
+		protect_watched(TRUE);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+void delete_all_breakpoints()
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	while(b->pc_num > 0)
+		delete_breakpoint(b->pc[0]);
+	while(b->watch_num > 0)
+		delete_watchpoint(b->watch[0].addr);
+	if(b->step_pc != 0)
+		place_trap(b->step_pc, FALSE);
+	b->step_pc = 0;
+	b->stepping = FALSE;
+}
+
+void step_breakpoint()
+{
+	riscv_breakpoints.stepping = TRUE;
+}
+
+bool breakpoints_set()
+{
+	return riscv_breakpoints.pc_num > 0 || riscv_breakpoints.watch_num > 0;
+}
+
+bool watchpoints_set()
+{
+	return riscv_breakpoints.watch_num > 0;
+}
+
+void print_breakpoints()
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	for(int i = 0; i < b->pc_num; i++)
+		printf("breakpoint 0x%lx\n", b->pc[i]);
+	for(int i = 0; i < b->watch_num; i++)
+		printf("watchpoint 0x%lx, %ld bytes\n", b->watch[i].addr, b->watch[i].length);
+}
+
+
+/*********************************************/
+/*                                           */
+/* attaching to a run                        */
+/*                                           */
+/*********************************************/
+
+void attach_breakpoints(Riscv64_decode_cache* decode_cache, Riscv64_block_cache* block_cache,
+	Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	if(page_size == 0)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	b->decode_cache = decode_cache;
+	b->block_cache = block_cache;
+	b->riscv_register = riscv_register;
+	b->riscv_memory = riscv_memory;
+	b->step_pc = 0;
+	b->stepping = FALSE;
+	b->watch_hit = -1;
+
+	for(int i = 0; i < b->pc_num; i++)
+	{
+		if(in_text(b->pc[i]))
+			place_trap(b->pc[i], TRUE);
+		else
+			printf("breakpoint: 0x%lx is not an instruction of the text\n", b->pc[i]);
+	}
+	if(b->watch_num > 0)
+	{
+		install_handlers();
+		protect_watched(TRUE);
+	}
+}
+
+void detach_breakpoints()
+{
+	Riscv64_breakpoints* b = &riscv_breakpoints;
+	protect_watched(FALSE);
+	remove_handlers();
+	b->decode_cache = NULL;
+	b->block_cache = NULL;
+	b->riscv_register = NULL;
+	b->riscv_memory = NULL;
+	b->step_pc = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef __BREAKPOINT_H__
+#define __BREAKPOINT_H__
+#include "memory_system.h"
+#include "riscv_instruction.h"
+#include "decode_cache.h"
+#include "block_cache.h"
+
+/*********************************************/
+/*                                           */
+/* breakpoints and watchpoints               */
+/*                                           */
+/*********************************************/
+/* Nothing is checked per instruction. A     */
+/* breakpoint replaces the record of its pc  */
+/* in the decode cache, or in every cached   */
+/* block that covers it, by an INST_TRAP     */
+/* record, whose handler enters DEBUG_MODE   */
+/* and then runs the instruction. A          */
+/* watchpoint write-protects the host pages  */
+/* of its guest range; a store to them       */
+/* faults, is single-stepped on the host and */
+/* stops at the next guest instruction.      */
+/* Blocks with traps and, while watchpoints  */
+/* are set, all blocks stay interpreted, and */
+/* the aot code is not used.                 */
+/*********************************************/
+
+#define BREAKPOINT_MAX 64
+#define WATCHPOINT_MAX 16
+
+typedef struct riscv64_watchpoint{
+	reg64 addr;   // guest address
+	reg64 length; // bytes
+} Riscv64_watchpoint;
+
+typedef struct riscv64_breakpoints{
+	reg64 pc[BREAKPOINT_MAX];
+	int pc_num;
+	Riscv64_watchpoint watch[WATCHPOINT_MAX];
+	int watch_num;
+	reg64 step_pc;         // one-shot trap of "n" or of a watchpoint hit, 0 if none
+	bool stepping;         // "n" was entered, stop after the trapped instruction
+	// the watchpoint that was written, reported at the next stop
+	int watch_hit;         // index into watch or -1
+	reg64 watch_addr;      // written guest address
+	reg64 watch_pc;        // pc of the store
+	// the run the traps are placed in, see attach_breakpoints()
+	Riscv64_decode_cache* decode_cache;
+	Riscv64_block_cache* block_cache;
+	Riscv64_register* riscv_register;
+	Riscv64_memory* riscv_memory;
+} Riscv64_breakpoints;
+
+extern Riscv64_breakpoints riscv_breakpoints;
+
+// set before a run or from DEBUG_MODE, return FALSE if the address can not take one
+bool add_breakpoint(reg64 pc);
+bool delete_breakpoint(reg64 pc);
+bool add_watchpoint(reg64 addr, reg64 length);
+bool delete_watchpoint(reg64 addr);
+void delete_all_breakpoints();
+void step_breakpoint();            // stop again after the next instruction
+void print_breakpoints();
+bool breakpoints_set();            // any breakpoint or watchpoint
+bool watchpoints_set();
+
+// place the traps into the caches of a run and protect the watched pages, either cache may be NULL
+void attach_breakpoints(Riscv64_decode_cache*, Riscv64_block_cache*, Riscv64_register*, Riscv64_memory*);
+void detach_breakpoints();
+
+// for the caches: whether pc has a trap, and turning a record into one
+bool is_breakpoint(reg64 pc);
+void make_trap(Riscv64_decoded*);
+void exec_trap(Riscv64_decoded*, Riscv64_register*, Riscv64_memory*); // handler of INST_TRAP
+
+// syscalls that let the host write guest memory, around the host call
+void begin_host_write();
+void end_host_write(reg64 addr, reg64 length);
+
+#endif
@@ -0,0 +1,521 @@
+#include "cache_model.h"
+#include "coherence.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char* level_name[CACHE_LEVELS] = {"L1I", "L1D", "L2", "LLC"};
+static const char* policy_name[] = {"lru", "plru", "rrip"};
+
+Riscv64_cache_config cache_config[CACHE_LEVELS] = {
+	{32L << 10,  8,  64, CACHE_LRU,  FALSE},  // L1I
+	{32L << 10,  8,  64, CACHE_LRU,  FALSE},  // L1D
+	{256L << 10, 8,  64, CACHE_PLRU, FALSE},  // L2
+	{2L << 20,   16, 64, CACHE_RRIP, FALSE},  // LLC
+};
+
+static bool is_power_of_2(long int n)
+{
+	return n > 0 && (n & (n - 1)) == 0;
+}
+
+static int log2_of(long int n)
+{
+	int shift = 0;
+	while((1L << shift) < n)
+		shift++;
+	return shift;
+}
+
+// "32k", "2m" or bytes
+static long int parse_size(const char* text)
+{
+	char* end;
+	long int size = strtol(text, &end, 0);
+	if(*end == 'k' || *end == 'K')
+		size <<= 10;
+	else if(*end == 'm' || *end == 'M')
+		size <<= 20;
+	return size;
+}
+
+bool set_cache_config(const char* spec)
+{
+	char text[128];
+	char* field[6] = {NULL};
+	int field_num = 0;
+	strncpy(text, spec, sizeof(text) - 1);
+	text[sizeof(text) - 1] = '\0';
+	for(char* p = strtok(text, ":"); p != NULL && field_num < 6; p = strtok(NULL, ":"))
+		field[field_num++] = p;
+
+	int level = -1;
+	for(int i = 0; field_num > 0 && i < CACHE_LEVELS; i++)
+		if(strcasecmp(field[0], level_name[i]) == 0)
+			level = i;
+	if(level < 0 || field_num < 2)
+	{
+		printf("-cache needs level:size:ways:line[:lru|plru|rrip[:wb|wt]], the level one of l1i, l1d, l2, llc.\n");
+		return FALSE;
+	}
+
+	Riscv64_cache_config config = cache_config[level];
+	config.size = parse_size(field[1]);
+	if(field_num > 2)
+		config.ways = atoi(field[2]);
+	if(field_num > 3)
+		config.line = atoi(field[3]);
+	if(field_num > 4)
+	{
+		config.policy = -1;
+		for(int i = 0; i < 3; i++)
+			if(strcmp(field[4], policy_name[i]) == 0)
+				config.policy = i;
+	}
+	if(field_num > 5)
+		config.write_through = strcmp(field[5], "wt") == 0;
+
+	if(config.size == 0 && (level == CACHE_L2 || level == CACHE_LLC))
+	{
+		cache_config[level] = config;
+		return TRUE;
+	}
+	long int sets = config.ways > 0 && config.line > 0 ? config.size / config.ways / config.line : 0;
+	if(config.policy < 0 || (field_num > 5 && strcmp(field[5], "wt") != 0 && strcmp(field[5], "wb") != 0))
+		printf("%s: unknown replacement or write policy.\n", level_name[level]);
+	else if(config.ways < 1 || config.ways > CACHE_WAY_MAX)
+		printf("%s: the ways must be between 1 and %d.\n", level_name[level], CACHE_WAY_MAX);
+	else if(!is_power_of_2(config.line) || config.line < 8)
+		printf("%s: the line must be a power of 2 of at least 8 bytes.\n", level_name[level]);
+	else if(!is_power_of_2(sets) || sets * config.ways * config.line != config.size)
+		printf("%s: size / (ways * line) must be a power of 2.\n", level_name[level]);
+	else if(config.policy == CACHE_PLRU && !is_power_of_2(config.ways))
+		printf("%s: plru needs a power of 2 ways.\n", level_name[level]);
+	else
+	{
+		cache_config[level] = config;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+
+/*********************************************/
+/*                                           */
+/* initialization and gc                     */
+/*                                           */
+/*********************************************/
+
+static void empty_cache(Riscv64_cache* cache)
+{
+	long int lines = (cache->set_mask + 1) * cache->stride;
+	memset(cache->tags, 0xff, lines * sizeof(reg64));
+	memset(cache->dirty, 0, lines * sizeof(bool));
+	memset(cache->lru, 0, lines * sizeof(reg64));
+	memset(cache->plru, 0, (cache->set_mask + 1) * sizeof(reg64));
+	memset(cache->rrpv, RRIP_MAX, lines);
+	cache->clock = 0;
+	cache->last_line = -1;
+	cache->last_dirty = FALSE;
+	cache->accesses = 0;
+	cache->misses = 0;
+	cache->writebacks = 0;
+}
+
+void init_cache_model(Riscv64_cache_model** model)
+{
+	*model = (Riscv64_cache_model*) malloc (sizeof(Riscv64_cache_model));
+	memset(*model, 0, sizeof(Riscv64_cache_model));
+
+	Riscv64_cache* below = NULL; // the levels are linked from the bottom up
+	for(int i = CACHE_LEVELS - 1; i >= 0; i--)
+	{
+		Riscv64_cache* cache = &(*model)->level[i];
+		cache->config = cache_config[i];
+		cache->name = level_name[i];
+		cache->next = below;
+		if(cache->config.size == 0)
+			continue;
+		if(i >= CACHE_L2)
+			below = cache;
+
+		long int sets = cache->config.size / cache->config.ways / cache->config.line;
+		cache->line_shift = log2_of(cache->config.line);
+		cache->set_mask = sets - 1;
+		cache->stride = (cache->config.ways + 1) & ~1;
+		long int lines = sets * cache->stride;
+		cache->tags = (reg64*) aligned_alloc (16, lines * sizeof(reg64));
+		cache->dirty = (bool*) malloc (lines * sizeof(bool));
+		cache->lru = (reg64*) malloc (lines * sizeof(reg64));
+		cache->plru = (reg64*) malloc (sets * sizeof(reg64));
+		cache->rrpv = (byte*) malloc (lines);
+		empty_cache(cache);
+	}
+	// L1I and L1D share what is below them
+	(*model)->level[CACHE_L1I].next = below;
+	(*model)->level[CACHE_L1D].next = below;
+}
+
+void reset_cache_model(Riscv64_cache_model* model)
+{
+	for(int i = 0; i < CACHE_LEVELS; i++)
+		if(model->level[i].config.size != 0)
+			empty_cache(&model->level[i]);
+	model->memory_reads = 0;
+	model->memory_writes = 0;
+}
+
+void delete_cache_model(Riscv64_cache_model* model)
+{
+	for(int i = 0; i < CACHE_LEVELS; i++)
+	{
+		Riscv64_cache* cache = &model->level[i];
+		if(cache->config.size == 0)
+			continue;
+		free(cache->tags);
+		free(cache->dirty);
+		free(cache->lru);
+		free(cache->plru);
+		free(cache->rrpv);
+		free(cache->state);
+	}
+	free(model);
+}
+
+void share_cache_levels(Riscv64_cache_model* model, Riscv64_cache_model* from)
+{
+	for(int i = CACHE_L2; i < CACHE_LEVELS; i++)
+	{
+		Riscv64_cache* cache = &model->level[i];
+		if(cache->config.size == 0)
+			continue;
+		free(cache->tags);
+		free(cache->dirty);
+		free(cache->lru);
+		free(cache->plru);
+		free(cache->rrpv);
+		cache->config.size = 0;
+	}
+	model->level[CACHE_L1I].next = from->level[CACHE_L1I].next;
+	model->level[CACHE_L1D].next = from->level[CACHE_L1D].next;
+}
+
+
+/*********************************************/
+/*                                           */
+/* replacement                               */
+/*                                           */
+/*********************************************/
+
+// way of line in the set, -1 if it is not there
+static inline int find_way(Riscv64_cache* cache, reg64* tags, reg64 line)
+{
+	#ifdef __SSE2__
+	// SSE2 has no 64-bit compare: both 32-bit halves must be equal
+	__m128i key = _mm_set1_epi64x((long int)line);
+	for(int way = 0; way < cache->stride; way += 2)
+	{
+		__m128i equal = _mm_cmpeq_epi32(_mm_load_si128((__m128i*)&tags[way]), key);
+		equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+		int mask = _mm_movemask_pd(_mm_castsi128_pd(equal));
+		if(mask != 0)
+			return way + (mask & 1 ? 0 : 1);
+	}
+	#else
+	for(int way = 0; way < cache->config.ways; way++)
+		if(tags[way] == line)
+			return way;
+	#endif
+	return -1;
+}
+
+static void touch_way(Riscv64_cache* cache, long int set, int way, bool fill)
+{
+	long int index = set * cache->stride + way;
+	switch(cache->config.policy)
+	{
+		case CACHE_LRU:
+			cache->lru[index] = ++cache->clock;
+			break;
+		case CACHE_PLRU:
+		{
+			// every node on the path points to the half the way is in
+			reg64 bits = cache->plru[set];
+			int node = 1;
+			for(int level = log2_of(cache->config.ways) - 1; level >= 0; level--)
+			{
+				int half = (way >> level) & 1;
+				bits = half ? bits | (1UL << node) : bits & ~(1UL << node);
+				node = node * 2 + half;
+			}
+			cache->plru[set] = bits;
+			break;
+		}
+		case CACHE_RRIP:
+			cache->rrpv[index] = fill ? RRIP_INSERT : 0;
+			break;
+	}
+}
+
+static int victim_way(Riscv64_cache* cache, long int set)
+{
+	reg64* tags = &cache->tags[set * cache->stride];
+	int ways = cache->config.ways;
+	for(int way = 0; way < ways; way++)
+		if(tags[way] == (reg64)-1)
+			return way;
+
+	switch(cache->config.policy)
+	{
+		case CACHE_LRU:
+		{
+			reg64* lru = &cache->lru[set * cache->stride];
+			int oldest = 0;
+			for(int way = 1; way < ways; way++)
+				if(lru[way] < lru[oldest])
+					oldest = way;
+			return oldest;
+		}
+		case CACHE_PLRU:
+		{
+			// follow the nodes to the other half
+			reg64 bits = cache->plru[set];
+			int node = 1;
+			int way = 0;
+			for(int level = log2_of(ways) - 1; level >= 0; level--)
+			{
+				int half = !((bits >> node) & 1);
+				way = way * 2 + half;
+				node = node * 2 + half;
+			}
+			return way;
+		}
+		default:
+		{
+			// the first distant line, ageing the set until there is one
+			byte* rrpv = &cache->rrpv[set * cache->stride];
+			while(1)
+			{
+				for(int way = 0; way < ways; way++)
+					if(rrpv[way] >= RRIP_MAX)
+						return way;
+				for(int way = 0; way < ways; way++)
+					rrpv[way]++;
+			}
+		}
+	}
+}
+
+
+/*********************************************/
+/*                                           */
+/* lookup                                    */
+/*                                           */
+/*********************************************/
+
+// an access of the level above to the line at addr
+static void cache_reference(Riscv64_cache_model* model, Riscv64_cache* cache, reg64 addr, bool write)
+{
+	if(cache == NULL)
+	{
+		if(write)
+			model->memory_writes++;
+		else
+			model->memory_reads++;
+		return;
+	}
+	if(cache->lock != NULL)
+	{
+		pthread_mutex_lock(cache->lock);
+		cache->accesses++;
+		cache_lookup(cache->owner, cache, addr >> cache->line_shift, write);
+		pthread_mutex_unlock(cache->lock);
+		return;
+	}
+	cache->accesses++;
+	cache_lookup(model, cache, addr >> cache->line_shift, write);
+}
+
+static void coherent_lookup(Riscv64_cache_model*, Riscv64_cache*, reg64 line, bool write);
+
+void cache_lookup(Riscv64_cache_model* model, Riscv64_cache* cache, reg64 line, bool write)
+{
+	if(cache->state != NULL)
+	{
+		coherent_lookup(model, cache, line, write);
+		return;
+	}
+	long int set = line & cache->set_mask;
+	reg64* tags = &cache->tags[set * cache->stride];
+	reg64 addr = line << cache->line_shift;
+	int way = find_way(cache, tags, line);
+
+	if(way >= 0)
+	{
+		touch_way(cache, set, way, FALSE);
+		if(write && cache->config.write_through)
+			cache_reference(model, cache->next, addr, TRUE);
+		else if(write)
+			cache->dirty[set * cache->stride + way] = TRUE;
+		cache->last_line = line;
+		cache->last_dirty = cache->dirty[set * cache->stride + way];
+		return;
+	}
+
+	cache->misses++;
+	if(write && cache->config.write_through)
+	{
+		// no write allocate, the last line stays where it was
+		cache_reference(model, cache->next, addr, TRUE);
+		return;
+	}
+
+	way = victim_way(cache, set);
+	long int index = set * cache->stride + way;
+	if(tags[way] != (reg64)-1 && cache->dirty[index])
+	{
+		cache->writebacks++;
+		cache_reference(model, cache->next, tags[way] << cache->line_shift, TRUE);
+	}
+	cache_reference(model, cache->next, addr, FALSE);
+	tags[way] = line;
+	cache->dirty[index] = write;
+	touch_way(cache, set, way, TRUE);
+	// the first hit after a fill changes the prediction of rrip
+	cache->last_line = cache->config.policy == CACHE_RRIP ? (reg64)-1 : line;
+	cache->last_dirty = write;
+}
+
+void cache_fetch_block(Riscv64_cache_model* model, reg64 pc, int size)
+{
+	Riscv64_cache* cache = &model->level[CACHE_L1I];
+	cache->accesses += size / sizeof(instruction);
+	// one touch in every line
+	for(reg64 addr = pc; addr < pc + size; addr = ((addr >> cache->line_shift) + 1) << cache->line_shift)
+		cache_touch(model, cache, addr, sizeof(instruction), FALSE);
+}
+
+
+/*********************************************/
+/*                                           */
+/* coherence                                 */
+/*                                           */
+/*********************************************/
+
+// the L1D of a hart with harts, write-back whatever it is configured: a store needs the copy in M
+static void coherent_lookup(Riscv64_cache_model* model, Riscv64_cache* cache, reg64 line, bool write)
+{
+	long int set = line & cache->set_mask;
+	reg64* tags = &cache->tags[set * cache->stride];
+	int way = find_way(cache, tags, line);
+
+	if(way >= 0)
+	{
+		long int index = set * cache->stride + way;
+		touch_way(cache, set, way, FALSE);
+		if(write && cache->state[index] != COHERENCE_M)
+			cache->state[index] = coherence_upgrade(model, line, model->access_addr, model->access_size, cache->state[index]);
+		if(write)
+			cache->dirty[index] = TRUE;
+		cache->last_line = line;
+		cache->last_dirty = cache->state[index] == COHERENCE_M;
+		return;
+	}
+
+	cache->misses++;
+	way = victim_way(cache, set);
+	long int index = set * cache->stride + way;
+	if(tags[way] != (reg64)-1)
+	{
+		if(cache->dirty[index])
+		{
+			cache->writebacks++;
+			cache_reference(model, cache->next, tags[way] << cache->line_shift, TRUE);
+		}
+		coherence_evict(model, tags[way]);
+	}
+	byte state = coherence_fill(model, line, model->access_addr, model->access_size, write);
+	cache_reference(model, cache->next, line << cache->line_shift, FALSE);
+	tags[way] = line;
+	cache->dirty[index] = write;
+	cache->state[index] = state;
+	touch_way(cache, set, way, TRUE);
+	cache->last_line = cache->config.policy == CACHE_RRIP ? (reg64)-1 : line;
+	cache->last_dirty = state == COHERENCE_M;
+}
+
+void coherent_data(Riscv64_cache_model* model, reg64 addr, int size, bool write)
+{
+	take_hart_events(model->memory);
+	Riscv64_cache* cache = &model->level[CACHE_L1D];
+	cache->accesses++;
+	model->access_addr = addr;
+	model->access_size = size;
+	cache_touch(model, cache, addr, size, write);
+}
+
+void apply_coherence_event(Riscv64_memory* riscv_memory, Riscv64_hart_event* event)
+{
+	Riscv64_cache_model* model = riscv_memory->cache_model;
+	Riscv64_cache* cache = &model->level[CACHE_L1D];
+	reg64 line = event->addr >> cache->line_shift;
+	long int set = line & cache->set_mask;
+	int way = find_way(cache, &cache->tags[set * cache->stride], line);
+	if(way < 0)
+		return; // evicted since
+	long int index = set * cache->stride + way;
+	if(event->type == COHERENCE_INVALIDATE)
+	{
+		// a dirty copy goes to the hart that stores, not to the level below
+		cache->tags[index] = -1;
+		cache->dirty[index] = FALSE;
+		cache->state[index] = COHERENCE_I;
+		coherence_lost(model, line, event->addr, event->size);
+	}
+	else
+	{
+		model->coherence->hart[model->hart].downgraded++;
+		if(cache->state[index] == COHERENCE_M && model->coherence->protocol == COHERENCE_MOESI)
+			cache->state[index] = COHERENCE_O;
+		else if(cache->state[index] != COHERENCE_O)
+		{
+			if(cache->dirty[index])
+			{
+				cache->writebacks++;
+				cache_reference(model, cache->next, line << cache->line_shift, TRUE);
+				cache->dirty[index] = FALSE;
+			}
+			cache->state[index] = COHERENCE_S;
+		}
+	}
+	if(cache->last_line == line)
+		cache->last_line = -1;
+}
+
+
+/*********************************************/
+/*                                           */
+/* statistics                                */
+/*                                           */
+/*********************************************/
+
+void print_cache_stats(Riscv64_cache_model* model, long int count)
+{
+	for(int i = 0; i < CACHE_LEVELS; i++)
+	{
+		Riscv64_cache* cache = &model->level[i];
+		if(cache->config.size == 0)
+			continue;
+		char size[32];
+		if(cache->config.size % 1024 == 0)
+			snprintf(size, sizeof(size), "%ldKb", cache->config.size >> 10);
+		else
+			snprintf(size, sizeof(size), "%ldb", cache->config.size);
+		printf("%s: %s %d-way %db %s %s, %ld accesses, %ld misses (%.2f%%, %.2f MPKI), %ld writebacks\n",
+		       cache->name, size, cache->config.ways, cache->config.line,
+		       policy_name[cache->config.policy], cache->config.write_through ? "wt" : "wb",
+		       cache->accesses, cache->misses, cache->accesses ? 100.0 * cache->misses / cache->accesses : 0.0,
+		       count ? 1000.0 * cache->misses / count : 0.0, cache->writebacks);
+	}
+	printf("memory: %ld line reads, %ld writes\n", model->memory_reads, model->memory_writes);
+}
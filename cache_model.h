@@ -0,0 +1,153 @@
+#ifndef __CACHE_MODEL_H__
+#define __CACHE_MODEL_H__
+#include <pthread.h>
+#include "memory_system.h"
+
+/*********************************************/
+/*                                           */
+/* cache hierarchy model                     */
+/*                                           */
+/*********************************************/
+/* Built with "make CACHE=model" every       */
+/* fetch, load and store of the guest also   */
+/* goes through a model of set-associative   */
+/* caches: L1I and L1D in front of a unified */
+/* L2 and LLC, then the memory. Only tags    */
+/* are kept, the data stays in the guest     */
+/* memory, so the model counts hits, misses  */
+/* and writebacks but does not change what   */
+/* the program does. The levels are not      */
+/* inclusive: a line is filled into every    */
+/* level on its way up, and an eviction only */
+/* writes a dirty line one level down.       */
+/* The tags of a set are compared two at a   */
+/* time with SSE2, and an access to the line */
+/* the level hit last is counted without a   */
+/* lookup, as it can not change the state.   */
+/* Once there are harts the L1Ds are kept    */
+/* coherent, see "coherence.h".              */
+/*********************************************/
+
+#define CACHE_L1I    0
+#define CACHE_L1D    1
+#define CACHE_L2     2
+#define CACHE_LLC    3
+#define CACHE_LEVELS 4
+#define CACHE_WAY_MAX 64      // a PLRU tree of a set fits in 64 bits
+
+// replacement policies
+#define CACHE_LRU  0
+#define CACHE_PLRU 1          // tree pseudo-LRU, needs a power of 2 ways
+#define CACHE_RRIP 2          // static RRIP with 2-bit re-reference predictions
+
+#define RRIP_MAX    3         // predicted re-reference in the distant future, the victim
+#define RRIP_INSERT 2         // a new line is not expected to be reused soon
+
+typedef struct riscv64_cache_config{
+	long int size;            // bytes, 0 for no such level (L2 and LLC only)
+	int ways;
+	int line;                 // bytes, a power of 2
+	int policy;               // CACHE_LRU etc.
+	bool write_through;       // and no write allocate, write back and write allocate if not
+} Riscv64_cache_config;
+
+typedef struct riscv64_cache Riscv64_cache;
+struct riscv64_cache{
+	Riscv64_cache_config config;
+	const char* name;
+	int line_shift;
+	long int set_mask;
+	int stride;               // tags of a set, ways rounded up to a multiple of 2
+	reg64* tags;              // line address (guest address >> line_shift) of every way, -1 if invalid
+	bool* dirty;
+	reg64* lru;               // CACHE_LRU: clock of the last access of every way
+	reg64* plru;              // CACHE_PLRU: tree bits of every set
+	byte* rrpv;               // CACHE_RRIP: re-reference prediction of every way
+	reg64 clock;
+	reg64 last_line;          // line of the last access, it is in the cache
+	bool last_dirty;          // and dirty, so a store to it changes nothing
+	Riscv64_cache* next;      // the level below, NULL for the memory
+	// with harts, see "coherence.h"
+	byte* state;              // the L1D of a hart: the coherence state of every way, NULL without harts
+	pthread_mutex_t* lock;    // the first level below L1: the lock the harts share it with
+	struct riscv64_cache_model* owner;    // and the model it is counted in
+	// statistics
+	long int accesses;
+	long int misses;
+	long int writebacks;      // dirty lines written to the level below
+};
+
+typedef struct riscv64_cache_model{
+	Riscv64_cache level[CACHE_LEVELS];
+	long int memory_reads;    // lines read from the memory
+	long int memory_writes;   // lines or write-through stores sent to the memory
+	// with harts, see "coherence.h"
+	struct riscv64_coherence* coherence;  // NULL while the program runs on one hart
+	int hart;
+	struct riscv64_memory* memory;        // of the hart, its events are applied before a data access
+	reg64 access_addr;                    // and the data access that goes on
+	int access_size;
+} Riscv64_cache_model;
+
+// the hierarchy of the next init_cache_model(), the defaults until set_cache_config() changes them
+extern Riscv64_cache_config cache_config[CACHE_LEVELS];
+// parse "level:size:ways:line[:policy[:wb|wt]]", e.g. "l2:512k:8:64:rrip", FALSE (with a message) if it is wrong
+bool set_cache_config(const char* spec);
+
+void init_cache_model(Riscv64_cache_model**); // all levels empty
+void reset_cache_model(Riscv64_cache_model*); // empty again and clear the statistics
+void delete_cache_model(Riscv64_cache_model*);
+void print_cache_stats(Riscv64_cache_model*, long int count);
+
+void cache_lookup(Riscv64_cache_model*, Riscv64_cache*, reg64 line, bool write); // slow path: search the set of line and fill it on a miss
+// a cloned hart uses the levels below L1 of the model from, its own are freed
+void share_cache_levels(Riscv64_cache_model*, Riscv64_cache_model* from);
+// a data access of a hart with harts
+void coherent_data(Riscv64_cache_model*, reg64 addr, int size, bool write);
+
+// an access to the same line as the last one is a hit that changes nothing, except a store to a clean line
+static inline void cache_touch(Riscv64_cache_model* model, Riscv64_cache* cache, reg64 addr, int size, bool write)
+{
+	reg64 line = addr >> cache->line_shift;
+	reg64 last = (addr + size - 1) >> cache->line_shift;
+	if(line != cache->last_line || (write && !cache->last_dirty))
+		cache_lookup(model, cache, line, write);
+	if(last != line) // misaligned over two lines
+		cache_lookup(model, cache, last, write);
+}
+
+// size bytes of instructions at pc, one access for each instruction
+static inline void cache_fetch(Riscv64_cache_model* model, reg64 pc, int size)
+{
+	Riscv64_cache* cache = &model->level[CACHE_L1I];
+	cache->accesses += size / sizeof(instruction);
+	cache_touch(model, cache, pc, size, FALSE);
+}
+
+// the same for a block of any length, for host code
+void cache_fetch_block(Riscv64_cache_model*, reg64 pc, int size);
+
+static inline void cache_data(Riscv64_cache_model* model, reg64 addr, int size, bool write)
+{
+	if(model->coherence != NULL)
+	{
+		coherent_data(model, addr, size, write);
+		return;
+	}
+	Riscv64_cache* cache = &model->level[CACHE_L1D];
+	cache->accesses++;
+	cache_touch(model, cache, addr, size, write);
+}
+
+// the hooks of the instruction functions and the engines, nothing without CACHE_MODEL
+#ifdef CACHE_MODEL
+#define CACHE_FETCH(riscv_memory, pc, size)  cache_fetch((riscv_memory)->cache_model, (reg64)(pc), size)
+#define CACHE_LOAD(riscv_memory, addr, size)  cache_data((riscv_memory)->cache_model, (reg64)(addr), size, FALSE)
+#define CACHE_STORE(riscv_memory, addr, size) cache_data((riscv_memory)->cache_model, (reg64)(addr), size, TRUE)
+#else
+#define CACHE_FETCH(riscv_memory, pc, size)
+#define CACHE_LOAD(riscv_memory, addr, size)
+#define CACHE_STORE(riscv_memory, addr, size)
+#endif
+
+#endif
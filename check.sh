@@ -0,0 +1,35 @@
+#!/bin/sh
+# Run the regression programs of "make check" and compare what they print with
+# the "# expect:" lines of their sources, each of which must be a line of the
+# output, and the "# absent:" lines, none of which may be one, and the status
+# with "# exit:". "# args:" are simulator options.
+#
+#   sh check.sh program.s ...
+#
+# The program is program.elf, assembled by the Makefile with rvasm, its output
+# is left in program.log.
+simulator=${SIMULATOR:-./simulator}
+failed=0
+for source in "$@"; do
+	program=${source%.s}
+	args=$(sed -n 's/^# args: //p' "$source")
+	$simulator $args "$program.elf" < /dev/null > "$program.log" 2>&1
+	status=$?
+	result=ok
+	expected=$(sed -n 's/^# exit: //p' "$source")
+	if [ -n "$expected" ] && [ "$status" != "$expected" ]; then
+		result="exit status $status, not $expected"
+	fi
+	sed -n 's/^# expect: //p' "$source" > "$program.expect"
+	while IFS= read -r line; do
+		grep -qxF -- "$line" "$program.log" || result="no \"$line\""
+	done < "$program.expect"
+	sed -n 's/^# absent: //p' "$source" > "$program.expect"
+	while IFS= read -r line; do
+		grep -qxF -- "$line" "$program.log" && result="\"$line\" printed"
+	done < "$program.expect"
+	rm -f "$program.expect"
+	echo "$program: $result"
+	[ "$result" = ok ] || failed=1
+done
+exit $failed
@@ -0,0 +1,308 @@
+#include <unistd.h>
+#include <sys/time.h>
+#include "checkpoint.h"
+
+Riscv64_checkpoint_trigger checkpoint_trigger[CHECKPOINT_MAX];
+int checkpoint_trigger_num = 0;
+
+bool add_checkpoint_trigger(const char* spec)
+{
+	Riscv64_checkpoint_trigger trigger = {0, 0};
+	char* end;
+	if(spec[0] == '@')
+		trigger.pc = strtoul(spec + 1, &end, 16);
+	else
+		trigger.count = strtol(spec, &end, 0);
+	if(*end != '\0' || (trigger.pc == 0 && trigger.count <= 0))
+	{
+		printf("-checkpoint needs a number of instructions or @pc (hexadecimal).\n");
+		return FALSE;
+	}
+	if(checkpoint_trigger_num == CHECKPOINT_MAX)
+	{
+		printf("-checkpoint: at most %d checkpoints.\n", CHECKPOINT_MAX);
+		return FALSE;
+	}
+	checkpoint_trigger[checkpoint_trigger_num++] = trigger;
+	return TRUE;
+}
+
+
+/*********************************************/
+/*                                           */
+/* page compression                          */
+/*                                           */
+/*********************************************/
+/* A page is a list of runs, each two 16-bit */
+/* numbers of zero words and of the words    */
+/* that follow them, and those words.        */
+/*********************************************/
+
+#define PAGE_WORDS (CHECKPOINT_PAGE / sizeof(reg64))
+
+// return the length, CHECKPOINT_PAGE if it would not be shorter than limit
+static long int compress_page(const reg64* page, byte* out, long int limit)
+{
+	long int length = 0;
+	int i = 0;
+	while(i < PAGE_WORDS)
+	{
+		int zeros = 0, words = 0;
+		while(i + zeros < PAGE_WORDS && page[i + zeros] == 0)
+			zeros++;
+		while(i + zeros + words < PAGE_WORDS && page[i + zeros + words] != 0)
+			words++;
+		if(length + 4 + words * sizeof(reg64) >= limit)
+			return CHECKPOINT_PAGE;
+		unsigned short run[2] = {zeros, words};
+		memcpy(out + length, run, sizeof(run));
+		memcpy(out + length + sizeof(run), page + i + zeros, words * sizeof(reg64));
+		length += sizeof(run) + words * sizeof(reg64);
+		i += zeros + words;
+	}
+	return length;
+}
+
+static void decompress_page(const byte* in, long int length, reg64* page)
+{
+	memset(page, 0, CHECKPOINT_PAGE);
+	int i = 0;
+	for(long int read = 0; read < length; )
+	{
+		unsigned short run[2];
+		memcpy(run, in + read, sizeof(run));
+		read += sizeof(run);
+		i += run[0];
+		if(i + run[1] > PAGE_WORDS)
+			break; // corrupted
+		memcpy(page + i, in + read, run[1] * sizeof(reg64));
+		read += run[1] * sizeof(reg64);
+		i += run[1];
+	}
+}
+
+
+/*********************************************/
+/*                                           */
+/* writing                                   */
+/*                                           */
+/*********************************************/
+
+typedef struct page_list{
+	Riscv64_checkpoint_page* pages;
+	byte** host;                    // of the pages stored as they are, NULL for the others
+	long int num;
+	long int size;
+	byte* data;                     // the compressed pages
+	long int data_length;
+	long int data_size;
+	long int raw_num;
+} Page_list;
+
+static bool zero_page(const reg64* page)
+{
+	for(int i = 0; i < PAGE_WORDS; i++)
+		if(page[i] != 0)
+			return FALSE;
+	return TRUE;
+}
+
+static void add_pages(void* arg, reg64 addr, byte* host, long int length)
+{
+	Page_list* list = (Page_list*)arg;
+	for(long int offset = 0; offset < length; offset += CHECKPOINT_PAGE)
+	{
+		const reg64* page = (const reg64*)(host + offset);
+		if(zero_page(page))
+			continue;
+		if(list->num == list->size)
+		{
+			list->size = list->size ? 2 * list->size : 256;
+			list->pages = (Riscv64_checkpoint_page*) realloc (list->pages, list->size * sizeof(Riscv64_checkpoint_page));
+			list->host = (byte**) realloc (list->host, list->size * sizeof(byte*));
+		}
+		if(list->data_length + CHECKPOINT_PAGE > list->data_size)
+		{
+			list->data_size = list->data_size ? 2 * list->data_size : 64 * CHECKPOINT_PAGE;
+			list->data = (byte*) realloc (list->data, list->data_size);
+		}
+		if(list->pages == NULL || list->host == NULL || list->data == NULL)
+		{
+			printf("Memory error.\n");
+			exit(1);
+		}
+		// kept as it is unless it gets down to three quarters
+		Riscv64_checkpoint_page* entry = &list->pages[list->num];
+		entry->addr = addr + offset;
+		entry->length = compress_page(page, list->data + list->data_length, CHECKPOINT_PAGE * 3 / 4);
+		if(entry->length < CHECKPOINT_PAGE)
+		{
+			entry->offset = list->data_length;
+			list->data_length += entry->length;
+			list->host[list->num] = NULL;
+		}
+		else
+		{
+			list->host[list->num] = (byte*)page;
+			list->raw_num++;
+		}
+		list->num++;
+	}
+}
+
+static void write_all(FILE* file, const void* data, long int length, const char* name)
+{
+	if(length > 0 && fwrite(data, 1, length, file) != length)
+	{
+		printf("can not write %s.\n", name);
+		exit(1);
+	}
+}
+
+void write_checkpoint(const char* file_name, long int count, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	Riscv64_checkpoint_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.page_size = CHECKPOINT_PAGE;
+	header.mem_size = riscv_memory->mem_size;
+	header.count = count;
+	header.registers = *riscv_register;
+	header.edata = (reg64)riscv_memory->edata;
+	header.text_start = riscv_memory->text_start;
+	header.text_end = riscv_memory->text_end;
+	#ifdef SOFT_MMU
+	header.region_num = riscv_memory->region_num;
+	for(int i = 0; i < riscv_memory->region_num; i++)
+	{
+		header.region[i].start = riscv_memory->region[i].start;
+		header.region[i].end = riscv_memory->region[i].end;
+		header.region[i].prot = riscv_memory->region[i].prot;
+	}
+	#endif
+
+	Page_list list;
+	memset(&list, 0, sizeof(list));
+	visit_pages(riscv_memory, add_pages, &list);
+	header.page_num = list.num;
+	header.raw_num = list.raw_num;
+
+	// header, index, compressed pages, then the others from a page boundary
+	long int align = sysconf(_SC_PAGESIZE) > CHECKPOINT_PAGE ? sysconf(_SC_PAGESIZE) : CHECKPOINT_PAGE;
+	long int data_start = sizeof(header) + list.num * sizeof(Riscv64_checkpoint_page);
+	long int raw_start = (data_start + list.data_length + align - 1) / align * align;
+	long int raw = raw_start;
+	for(long int i = 0; i < list.num; i++)
+	{
+		if(list.host[i] == NULL)
+			list.pages[i].offset += data_start;
+		else
+		{
+			list.pages[i].offset = raw;
+			raw += CHECKPOINT_PAGE;
+		}
+	}
+
+	char name[4096];
+	snprintf(name, sizeof(name), "%s.%ld.ckpt", file_name, count);
+	FILE* file = fopen(name, "wb");
+	if(file == NULL)
+	{
+		printf("can not write %s.\n", name);
+		exit(1);
+	}
+	write_all(file, &header, sizeof(header), name);
+	write_all(file, list.pages, list.num * sizeof(Riscv64_checkpoint_page), name);
+	write_all(file, list.data, list.data_length, name);
+	static const byte padding[CHECKPOINT_PAGE * 16];
+	write_all(file, padding, raw_start - data_start - list.data_length, name);
+	for(long int i = 0; i < list.num; i++)
+		if(list.host[i] != NULL)
+			write_all(file, list.host[i], CHECKPOINT_PAGE, name);
+	fclose(file);
+
+	gettimeofday(&end, NULL);
+	printf("checkpoint: %ld instructions, %ld pages (%ld compressed to %ld Kb), %ld Kb written to %s in %.3f ms\n",
+	       count, list.num, list.num - list.raw_num, list.data_length >> 10, raw >> 10, name,
+	       (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_usec - start.tv_usec) / 1e3);
+	free(list.pages);
+	free(list.host);
+	free(list.data);
+}
+
+
+/*********************************************/
+/*                                           */
+/* restoring                                 */
+/*                                           */
+/*********************************************/
+
+bool is_checkpoint(byte* buffer, long int size)
+{
+	Riscv64_checkpoint_header* header = (Riscv64_checkpoint_header*)buffer;
+	if(size < sizeof(Riscv64_checkpoint_header) || memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0)
+		return FALSE;
+	if(header->version != CHECKPOINT_VERSION || header->page_size != CHECKPOINT_PAGE
+	   || size < sizeof(Riscv64_checkpoint_header) + header->page_num * sizeof(Riscv64_checkpoint_page))
+	{
+		printf("The checkpoint was written by another version of the simulator.\n");
+		exit(1);
+	}
+	if(header->mem_size != guest_mem_size)
+	{
+		printf("The checkpoint was taken with -m %ld.\n", header->mem_size >> 20);
+		exit(1);
+	}
+	return TRUE;
+}
+
+long int load_checkpoint(byte* buffer, int fd, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	Riscv64_checkpoint_header* header = (Riscv64_checkpoint_header*)buffer;
+	Riscv64_checkpoint_page* pages = (Riscv64_checkpoint_page*)(header + 1);
+	#ifdef SOFT_MMU
+	// the stack region of the fresh memory is among them
+	for(int i = 0; i < header->region_num; i++)
+	{
+		Riscv64_checkpoint_region* region = &header->region[i];
+		bool mapped = FALSE;
+		for(int j = 0; j < riscv_memory->region_num; j++)
+			mapped |= riscv_memory->region[j].start == region->start && riscv_memory->region[j].end == region->end;
+		if(!mapped)
+			map_region(riscv_memory, region->start, region->end - region->start, region->prot);
+	}
+	if(header->region_num == 0) // taken with a flat memory
+		map_region(riscv_memory, 0, riscv_memory->mem_size, PAGE_READ | PAGE_WRITE | PAGE_EXEC);
+	#endif
+
+	reg64 page[PAGE_WORDS];
+	for(long int i = 0; i < header->page_num; )
+	{
+		if(pages[i].length < CHECKPOINT_PAGE)
+		{
+			decompress_page(buffer + pages[i].offset, pages[i].length, page);
+			copy_to_guest(riscv_memory, pages[i].addr, page, CHECKPOINT_PAGE);
+			i++;
+			continue;
+		}
+		// the pages stored as they are at following addresses are mapped at once
+		long int run = 1;
+		while(i + run < header->page_num && pages[i + run].length == CHECKPOINT_PAGE
+		      && pages[i + run].addr == pages[i].addr + run * CHECKPOINT_PAGE)
+			run++;
+		if(!map_file_to_guest(riscv_memory, pages[i].addr, run * CHECKPOINT_PAGE, fd, pages[i].offset))
+			copy_to_guest(riscv_memory, pages[i].addr, buffer + pages[i].offset, run * CHECKPOINT_PAGE);
+		i += run;
+	}
+
+	*riscv_register = header->registers;
+	riscv_memory->edata = (byte*)header->edata;
+	riscv_memory->text_start = header->text_start;
+	riscv_memory->text_end = header->text_end;
+	printf("checkpoint: %ld pages restored, %ld mapped from the file, going on after %ld instructions\n",
+	       header->page_num, header->raw_num, header->count);
+	return header->count;
+}
@@ -0,0 +1,81 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+#include "memory_system.h"
+
+/*********************************************/
+/*                                           */
+/* checkpoint files                          */
+/*                                           */
+/*********************************************/
+/* "-checkpoint count" or "-checkpoint @pc"  */
+/* writes the architectural state when that  */
+/* many instructions have executed, or when  */
+/* the program first gets to pc, into        */
+/* filename.count.ckpt: the registers, fcsr, */
+/* the heap top, the text range, the regions */
+/* with MMU=soft and the guest pages that    */
+/* are not all zero. A page that compresses  */
+/* (runs of zero words) is stored            */
+/* compressed, the others as they are, page  */
+/* aligned after them, so that restoring     */
+/* maps them copy-on-write from the file     */
+/* like the segments of an ELF and only      */
+/* decompresses the rest. A checkpoint is    */
+/* given to the simulator instead of an ELF  */
+/* and goes on from where it was taken. The  */
+/* host files the program has open are not   */
+/* part of it.                               */
+/*********************************************/
+
+#define CHECKPOINT_MAGIC   "RV64CKPT"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_PAGE    4096
+#define CHECKPOINT_MAX     64       // -checkpoint options
+#define CHECKPOINT_REGIONS 16       // REGION_MAX of MMU=soft
+
+typedef struct riscv64_checkpoint_region{
+	reg64 start;
+	reg64 end;
+	long int prot;
+} Riscv64_checkpoint_region;
+
+typedef struct riscv64_checkpoint_header{
+	char magic[8];
+	int version;
+	int page_size;                  // CHECKPOINT_PAGE
+	long int mem_size;              // -m of the run it was taken in
+	long int count;                 // instructions executed then
+	Riscv64_register registers;
+	reg64 edata;
+	reg64 text_start;
+	reg64 text_end;
+	long int region_num;            // 0 without MMU=soft
+	Riscv64_checkpoint_region region[CHECKPOINT_REGIONS];
+	long int page_num;
+	long int raw_num;               // pages stored as they are
+} Riscv64_checkpoint_header;
+
+// after the header, by address
+typedef struct riscv64_checkpoint_page{
+	reg64 addr;
+	long int offset;                // in the file, page aligned for a page stored as it is
+	long int length;                // CHECKPOINT_PAGE if stored as it is, less if compressed
+} Riscv64_checkpoint_page;
+
+// the -checkpoint options, by instruction count or pc (the other one 0)
+typedef struct riscv64_checkpoint_trigger{
+	long int count;
+	reg64 pc;
+} Riscv64_checkpoint_trigger;
+extern Riscv64_checkpoint_trigger checkpoint_trigger[CHECKPOINT_MAX];
+extern int checkpoint_trigger_num;
+bool add_checkpoint_trigger(const char* spec); // "count" or "@pc" (hexadecimal), FALSE (with a message) if wrong
+
+// write file_name.count.ckpt
+void write_checkpoint(const char* file_name, long int count, Riscv64_register*, Riscv64_memory*);
+// TRUE if the mapped file is a checkpoint, exits if it is one this run can not restore
+bool is_checkpoint(byte* buffer, long int size);
+// instead of load_program, into the fresh memory, fd the file of buffer; return the count it was taken at
+long int load_checkpoint(byte* buffer, int fd, Riscv64_register*, Riscv64_memory*);
+
+#endif
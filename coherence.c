@@ -0,0 +1,451 @@
+#include "coherence.h"
+#include "execute.h"
+
+static const char* protocol_name[] = {"mesi", "moesi"};
+
+int coherence_protocol = COHERENCE_MESI;
+
+bool set_coherence_config(const char* spec)
+{
+	for(int i = 0; i < 2; i++)
+		if(strcmp(spec, protocol_name[i]) == 0)
+		{
+			coherence_protocol = i;
+			return TRUE;
+		}
+	printf("-coherence needs mesi or moesi.\n");
+	return FALSE;
+}
+
+
+/*********************************************/
+/*                                           */
+/* directory                                 */
+/*                                           */
+/*********************************************/
+
+#define DIRECTORY_SIZE 4096   // entries at first, a power of 2
+
+static inline long int line_hash(Riscv64_coherence* coherence, reg64 line)
+{
+	return (line * 0x9e3779b97f4a7c15UL >> 20) & (coherence->capacity - 1);
+}
+
+static void insert_line(Riscv64_coherence* coherence, Riscv64_coherence_line* entry)
+{
+	long int i = line_hash(coherence, entry->line);
+	while(coherence->lines[i].line != (reg64)-1)
+		i = (i + 1) & (coherence->capacity - 1);
+	coherence->lines[i] = *entry;
+}
+
+static void alloc_lines(Riscv64_coherence* coherence, long int capacity)
+{
+	coherence->lines = (Riscv64_coherence_line*) malloc (capacity * sizeof(Riscv64_coherence_line));
+	if(coherence->lines == NULL)
+	{
+		printf("Memory error.\n");
+		exit(1);
+	}
+	memset(coherence->lines, 0xff, capacity * sizeof(Riscv64_coherence_line));
+	coherence->capacity = capacity;
+}
+
+// the entry of line, a new one if it has none; with the lock
+static Riscv64_coherence_line* find_line(Riscv64_coherence* coherence, reg64 line)
+{
+	long int i = line_hash(coherence, line);
+	while(coherence->lines[i].line != (reg64)-1)
+	{
+		if(coherence->lines[i].line == line)
+			return &coherence->lines[i];
+		i = (i + 1) & (coherence->capacity - 1);
+	}
+
+	// a line is never removed, it keeps its statistics
+	if(2 * (coherence->line_num + 1) > coherence->capacity)
+	{
+		Riscv64_coherence_line* old = coherence->lines;
+		long int capacity = coherence->capacity;
+		alloc_lines(coherence, capacity * 2);
+		for(long int j = 0; j < capacity; j++)
+			if(old[j].line != (reg64)-1)
+				insert_line(coherence, &old[j]);
+		free(old);
+		i = line_hash(coherence, line);
+		while(coherence->lines[i].line != (reg64)-1)
+			i = (i + 1) & (coherence->capacity - 1);
+	}
+	Riscv64_coherence_line* entry = &coherence->lines[i];
+	memset(entry, 0, sizeof(Riscv64_coherence_line));
+	entry->line = line;
+	entry->owner = -1;
+	coherence->line_num++;
+	return entry;
+}
+
+// a bit each 1/64 of the line for the bytes of [addr, addr + size) in it
+static reg64 line_bytes(Riscv64_coherence* coherence, reg64 line, reg64 addr, int size)
+{
+	reg64 start = line << coherence->line_shift;
+	reg64 end = start + (1UL << coherence->line_shift);
+	reg64 first = MAX(addr, start);
+	reg64 last = MIN(addr + size, end);
+	if(first >= last)
+		return 0;
+	int shift = coherence->line_shift > 6 ? coherence->line_shift - 6 : 0;
+	int low = (first - start) >> shift;
+	int high = (last - 1 - start) >> shift;
+	return (high == 63 ? ~0UL : (1UL << (high + 1)) - 1) & ~((1UL << low) - 1);
+}
+
+// the counters of the symbol of addr
+static Riscv64_coherence_count* symbol_count(Riscv64_coherence* coherence, reg64 addr)
+{
+	long int symbol = find_symbol(coherence->process, addr);
+	return &coherence->symbol_count[symbol >= 0 ? symbol : coherence->process->symbol_num];
+}
+
+// a store at addr takes the line from the other harts
+static void invalidate_others(Riscv64_cache_model* model, Riscv64_coherence_line* entry, reg64 addr, int size)
+{
+	reg64 others = entry->sharers & ~(1UL << model->hart);
+	for(int hart = 0; others != 0; hart++, others >>= 1)
+		if(others & 1)
+		{
+			post_hart_event(model->memory, hart, COHERENCE_INVALIDATE, addr, size);
+			entry->count.invalidations++;
+			symbol_count(model->coherence, addr)->invalidations++;
+		}
+	entry->sharers = 1UL << model->hart;
+	entry->owner = model->hart;
+	entry->state = COHERENCE_M;
+}
+
+byte coherence_fill(Riscv64_cache_model* model, reg64 line, reg64 addr, int size, bool write)
+{
+	Riscv64_coherence* coherence = model->coherence;
+	Riscv64_coherence_hart* hart = &coherence->hart[model->hart];
+	reg64 self = 1UL << model->hart;
+	byte state;
+	pthread_mutex_lock(&coherence->lock);
+	Riscv64_coherence_line* entry = find_line(coherence, line);
+	entry->sharers &= ~self;
+	if(entry->owner == model->hart)
+		entry->owner = -1;
+
+	// a miss on a line a store of another hart took
+	int slot = line & (COHERENCE_LOST - 1);
+	if(hart->lost_line[slot] == line)
+	{
+		Riscv64_coherence_count* count = symbol_count(coherence, addr);
+		if(hart->lost_bytes[slot] & line_bytes(coherence, line, addr, size))
+		{
+			entry->count.true_sharing++;
+			count->true_sharing++;
+		}
+		else
+		{
+			entry->count.false_sharing++;
+			count->false_sharing++;
+		}
+		hart->lost_line[slot] = -1;
+	}
+
+	if(entry->owner >= 0)
+		entry->transfers++;
+	if(write)
+	{
+		invalidate_others(model, entry, addr, size);
+		state = COHERENCE_M;
+	}
+	else
+	{
+		// the owner keeps a dirty copy with MOESI, and gives up E or M with MESI
+		if(entry->owner >= 0 && entry->state != COHERENCE_O)
+		{
+			post_hart_event(model->memory, entry->owner, COHERENCE_DOWNGRADE, addr, size);
+			if(entry->state == COHERENCE_M && coherence->protocol == COHERENCE_MOESI)
+				entry->state = COHERENCE_O;
+			else
+				entry->owner = -1;
+		}
+		entry->sharers |= self;
+		if(entry->sharers == self)
+		{
+			entry->owner = model->hart;
+			entry->state = COHERENCE_E;
+		}
+		state = entry->sharers == self ? COHERENCE_E : COHERENCE_S;
+	}
+	pthread_mutex_unlock(&coherence->lock);
+	return state;
+}
+
+byte coherence_upgrade(Riscv64_cache_model* model, reg64 line, reg64 addr, int size, byte state)
+{
+	Riscv64_coherence* coherence = model->coherence;
+	pthread_mutex_lock(&coherence->lock);
+	Riscv64_coherence_line* entry = find_line(coherence, line);
+	if(state == COHERENCE_S || state == COHERENCE_O)
+	{
+		entry->count.upgrades++;
+		symbol_count(coherence, addr)->upgrades++;
+	}
+	invalidate_others(model, entry, addr, size);
+	pthread_mutex_unlock(&coherence->lock);
+	return COHERENCE_M;
+}
+
+void coherence_evict(Riscv64_cache_model* model, reg64 line)
+{
+	Riscv64_coherence* coherence = model->coherence;
+	pthread_mutex_lock(&coherence->lock);
+	Riscv64_coherence_line* entry = find_line(coherence, line);
+	entry->sharers &= ~(1UL << model->hart);
+	if(entry->owner == model->hart)
+		entry->owner = -1;
+	pthread_mutex_unlock(&coherence->lock);
+}
+
+void coherence_lost(Riscv64_cache_model* model, reg64 line, reg64 addr, int size)
+{
+	Riscv64_coherence_hart* hart = &model->coherence->hart[model->hart];
+	int slot = line & (COHERENCE_LOST - 1);
+	hart->lost_line[slot] = line;
+	hart->lost_bytes[slot] = line_bytes(model->coherence, line, addr, size);
+	hart->invalidated++;
+}
+
+
+/*********************************************/
+/*                                           */
+/* harts                                     */
+/*                                           */
+/*********************************************/
+
+static void add_hart(Riscv64_coherence* coherence, Riscv64_memory* riscv_memory)
+{
+	Riscv64_cache_model* model = riscv_memory->cache_model;
+	Riscv64_cache* cache = &model->level[CACHE_L1D];
+	long int lines = (cache->set_mask + 1) * cache->stride;
+	cache->state = (byte*) calloc (lines, 1);
+	if(cache->state == NULL)
+	{
+		printf("Memory error.\n");
+		exit(1);
+	}
+	model->coherence = coherence;
+	model->hart = riscv_memory->hart_id;
+	model->memory = riscv_memory;
+	Riscv64_coherence_hart* hart = &coherence->hart[model->hart];
+	hart->model = model;
+	hart->memory = riscv_memory;
+	memset(hart->lost_line, 0xff, sizeof(hart->lost_line));
+}
+
+void init_coherence(Riscv64_memory* process)
+{
+	Riscv64_coherence* coherence = (Riscv64_coherence*) calloc (1, sizeof(Riscv64_coherence));
+	if(coherence == NULL)
+	{
+		printf("Memory error.\n");
+		exit(1);
+	}
+	Riscv64_cache_model* model = process->cache_model;
+	Riscv64_cache* cache = &model->level[CACHE_L1D];
+	pthread_mutex_init(&coherence->lock, NULL);
+	pthread_mutex_init(&coherence->shared_lock, NULL);
+	coherence->protocol = coherence_protocol;
+	coherence->line_shift = cache->line_shift;
+	coherence->process = process;
+	coherence->symbol_count = (Riscv64_coherence_count*) calloc (process->symbol_num + 1, sizeof(Riscv64_coherence_count));
+	alloc_lines(coherence, DIRECTORY_SIZE);
+	add_hart(coherence, process);
+
+	// the levels below L1 are shared from now on
+	if(cache->next != NULL)
+	{
+		cache->next->lock = &coherence->shared_lock;
+		cache->next->owner = model;
+	}
+	// the lines hart 0 has are its own
+	long int lines = (cache->set_mask + 1) * cache->stride;
+	for(long int i = 0; i < lines; i++)
+	{
+		if(cache->tags[i] == (reg64)-1 || i % cache->stride >= cache->config.ways)
+			continue;
+		Riscv64_coherence_line* entry = find_line(coherence, cache->tags[i]);
+		cache->state[i] = cache->dirty[i] ? COHERENCE_M : COHERENCE_E;
+		entry->sharers = 1;
+		entry->owner = 0;
+		entry->state = cache->state[i];
+	}
+	cache->last_line = -1;
+	hart_event_taker = apply_coherence_event;
+}
+
+void join_coherence(Riscv64_memory* riscv_memory)
+{
+	Riscv64_cache_model* shared = riscv_memory->process->cache_model;
+	share_cache_levels(riscv_memory->cache_model, shared);
+	add_hart(shared->coherence, riscv_memory);
+}
+
+void leave_coherence(Riscv64_memory* riscv_memory)
+{
+	Riscv64_cache_model* model = riscv_memory->cache_model;
+	Riscv64_coherence* coherence = model->coherence;
+	Riscv64_cache* cache = &model->level[CACHE_L1D];
+	long int lines = (cache->set_mask + 1) * cache->stride;
+	pthread_mutex_lock(&coherence->lock);
+	for(long int i = 0; i < lines; i++)
+		if(cache->state[i] != COHERENCE_I && cache->tags[i] != (reg64)-1)
+		{
+			Riscv64_coherence_line* entry = find_line(coherence, cache->tags[i]);
+			entry->sharers &= ~(1UL << model->hart);
+			if(entry->owner == model->hart)
+				entry->owner = -1;
+		}
+	pthread_mutex_unlock(&coherence->lock);
+	Riscv64_coherence_hart* hart = &coherence->hart[model->hart];
+	hart->l1d_accesses = cache->accesses;
+	hart->l1d_misses = cache->misses;
+	hart->model = NULL;
+}
+
+
+/*********************************************/
+/*                                           */
+/* statistics                                */
+/*                                           */
+/*********************************************/
+
+static long int count_weight(const Riscv64_coherence_count* count)
+{
+	return count->invalidations + count->upgrades + count->true_sharing + count->false_sharing;
+}
+
+static Riscv64_coherence_count* sort_counts;
+
+// indices of counts, most first
+static int compare_count(const void* a, const void* b)
+{
+	long int x = count_weight(&sort_counts[*(long int*)a]);
+	long int y = count_weight(&sort_counts[*(long int*)b]);
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static long int sort_top(Riscv64_coherence_count* counts, long int num, long int* top)
+{
+	long int n = 0;
+	for(long int i = 0; i < num; i++)
+		if(count_weight(&counts[i]) > 0)
+			top[n++] = i;
+	sort_counts = counts;
+	qsort(top, n, sizeof(long int), compare_count);
+	return MIN(n, COHERENCE_TOP);
+}
+
+static void print_count(const char* name, Riscv64_coherence_count* count)
+{
+	printf("%18s %13ld %9ld %8ld %8ld", name, count->invalidations, count->upgrades, count->true_sharing, count->false_sharing);
+}
+
+static void print_coherence_stats(Riscv64_coherence* coherence)
+{
+	Riscv64_memory* process = coherence->process;
+	Riscv64_coherence_count total = {0};
+	long int transfers = 0;
+	Riscv64_coherence_count* counts = (Riscv64_coherence_count*) malloc (coherence->capacity * sizeof(Riscv64_coherence_count));
+	long int* top = (long int*) malloc ((MAX(coherence->capacity, process->symbol_num) + 1) * sizeof(long int));
+	for(long int i = 0; i < coherence->capacity; i++)
+	{
+		Riscv64_coherence_line* entry = &coherence->lines[i];
+		memset(&counts[i], 0, sizeof(Riscv64_coherence_count));
+		if(entry->line == (reg64)-1)
+			continue;
+		counts[i] = entry->count;
+		transfers += entry->transfers;
+		total.invalidations += entry->count.invalidations;
+		total.upgrades += entry->count.upgrades;
+		total.true_sharing += entry->count.true_sharing;
+		total.false_sharing += entry->count.false_sharing;
+	}
+
+	printf("coherence: %s, %ld lines, %ld invalidations, %ld upgrades, %ld transfers, %ld true and %ld false sharing misses\n",
+	       protocol_name[coherence->protocol], coherence->line_num, total.invalidations, total.upgrades, transfers,
+	       total.true_sharing, total.false_sharing);
+	for(int id = 0; id < HART_MAX; id++)
+	{
+		Riscv64_coherence_hart* hart = &coherence->hart[id];
+		if(hart->memory == NULL)
+			continue;
+		printf("L1D of hart %d: %ld accesses, %ld misses (%.2f%%), %ld invalidated, %ld downgraded\n", id,
+		       hart->l1d_accesses, hart->l1d_misses, hart->l1d_accesses ? 100.0 * hart->l1d_misses / hart->l1d_accesses : 0.0,
+		       hart->invalidated, hart->downgraded);
+	}
+
+	long int num = sort_top(counts, coherence->capacity, top);
+	if(num > 0)
+		printf("%18s %13s %9s %8s %8s  %s\n", "line", "invalidations", "upgrades", "true", "false", "symbols in it");
+	for(long int i = 0; i < num; i++)
+	{
+		char name[32];
+		reg64 start = coherence->lines[top[i]].line << coherence->line_shift;
+		reg64 end = start + (1UL << coherence->line_shift);
+		snprintf(name, sizeof(name), "%lx", start);
+		print_count(name, &counts[top[i]]);
+		// the symbol the line starts in and the ones that start in it
+		long int symbol = find_symbol(process, start);
+		if(symbol < 0)
+		{
+			symbol = 0;
+			while(symbol < process->symbol_num && process->symbols[symbol].addr < start)
+				symbol++;
+		}
+		printf(" ");
+		for(int shown = 0; symbol < process->symbol_num && process->symbols[symbol].addr < end; symbol++, shown++)
+			printf(shown < 4 ? " %s" : shown == 4 ? " ..." : "", process->symbols[symbol].name);
+		printf("\n");
+	}
+
+	num = sort_top(coherence->symbol_count, process->symbol_num + 1, top);
+	if(num > 0)
+		printf("%18s %13s %9s %8s %8s\n", "symbol", "invalidations", "upgrades", "true", "false");
+	for(long int i = 0; i < num; i++)
+	{
+		print_count(top[i] < process->symbol_num ? process->symbols[top[i]].name : "(no symbol)", &coherence->symbol_count[top[i]]);
+		printf("\n");
+	}
+	free(counts);
+	free(top);
+}
+
+void delete_coherence(Riscv64_memory* process)
+{
+	Riscv64_cache_model* model = process->cache_model;
+	Riscv64_coherence* coherence = model->coherence;
+	if(coherence == NULL)
+		return;
+	Riscv64_cache* cache = &model->level[CACHE_L1D];
+	coherence->hart[0].l1d_accesses = cache->accesses;
+	coherence->hart[0].l1d_misses = cache->misses;
+	print_coherence_stats(coherence);
+
+	hart_event_taker = NULL;
+	model->coherence = NULL;
+	free(cache->state);
+	cache->state = NULL;
+	cache->last_line = -1;
+	if(cache->next != NULL)
+	{
+		cache->next->lock = NULL;
+		cache->next->owner = NULL;
+	}
+	pthread_mutex_destroy(&coherence->lock);
+	pthread_mutex_destroy(&coherence->shared_lock);
+	free(coherence->lines);
+	free(coherence->symbol_count);
+	free(coherence);
+}
@@ -0,0 +1,135 @@
+#ifndef __COHERENCE_H__
+#define __COHERENCE_H__
+#include <pthread.h>
+#include "memory_system.h"
+#include "cache_model.h"
+#include "hart.h"
+
+/*********************************************/
+/*                                           */
+/* coherence of the L1D caches of the harts  */
+/*                                           */
+/*********************************************/
+/* With "make CACHE=model", once the program */
+/* clones its first hart, every hart has an  */
+/* L1I and an L1D of its own in front of the */
+/* L2 and LLC of hart 0, which all of them   */
+/* share under a lock. The lines of the L1D  */
+/* are in the states of MESI, or of MOESI    */
+/* with "-coherence moesi", kept by a        */
+/* directory of the lines (the harts with a  */
+/* copy and the owner) under a lock of its   */
+/* own. A miss or a store to a copy that is  */
+/* not M asks the directory, which sends the */
+/* invalidations (a store) and downgrades (a */
+/* load of a line another hart owns) to the  */
+/* other copies as events of the harts (see  */
+/* "hart.h"); a hart applies them before its */
+/* next load or store. Stores to an E copy   */
+/* become M without an upgrade.              */
+/*                                           */
+/* For every line the directory counts the   */
+/* invalidations, the upgrades (stores to an */
+/* S or O copy), the misses served by the    */
+/* copy of another hart and the misses of a  */
+/* hart on a line a store of another had     */
+/* taken from it: true sharing if it reads   */
+/* or writes bytes that store wrote, false   */
+/* sharing if not. The same is counted for  */
+/* the symbol of the ELF the access is in.   */
+/* At the exit the lines with the most of    */
+/* them, with the symbols in them, and the   */
+/* symbols with the most are printed.        */
+/*                                           */
+/* The harts run on host threads that do not */
+/* wait for each other, so the order of the  */
+/* accesses of different harts, and with it  */
+/* the counts, change from run to run; a     */
+/* quantum (see "hart.h") keeps it close to  */
+/* the order of their cycles.                */
+/*********************************************/
+
+// states of a line in an L1D
+#define COHERENCE_I 0
+#define COHERENCE_S 1
+#define COHERENCE_E 2
+#define COHERENCE_O 3         // MOESI: dirty and shared, the owner writes it back
+#define COHERENCE_M 4
+
+// protocols
+#define COHERENCE_MESI  0
+#define COHERENCE_MOESI 1
+
+// events of the harts
+#define COHERENCE_INVALIDATE 1  // addr and size are the store
+#define COHERENCE_DOWNGRADE  2  // to S, or an M line to O with MOESI
+
+#define COHERENCE_LOST  256   // lines a hart remembers a store of another took from it, a power of 2
+#define COHERENCE_TOP   10    // lines and symbols printed
+
+typedef struct riscv64_coherence_count{
+	long int invalidations;   // copies invalidated by stores
+	long int upgrades;        // stores to a copy in S or O
+	long int true_sharing;    // misses on bytes a store of another hart wrote
+	long int false_sharing;   // misses on other bytes of a line a store of another hart took
+} Riscv64_coherence_count;
+
+typedef struct riscv64_coherence_line{
+	reg64 line;               // line address, -1 for a free entry
+	reg64 sharers;            // bit a hart with a copy
+	int owner;                // hart with the copy in E, O or M, -1 if none
+	byte state;               // of the copy of the owner
+	// statistics
+	Riscv64_coherence_count count;
+	long int transfers;       // misses served by the copy of another hart
+} Riscv64_coherence_line;
+
+typedef struct riscv64_coherence_hart{
+	Riscv64_cache_model* model;           // NULL if there is no such hart
+	Riscv64_memory* memory;               // the view of the hart
+	reg64 lost_line[COHERENCE_LOST];      // -1 if none
+	reg64 lost_bytes[COHERENCE_LOST];     // a bit each 1/64 of the line the store wrote
+	// statistics
+	long int invalidated;                 // invalidations applied to copies it had
+	long int downgraded;
+	long int l1d_accesses;                // of its L1D when it ended
+	long int l1d_misses;
+} Riscv64_coherence_hart;
+
+typedef struct riscv64_coherence{
+	pthread_mutex_t lock;                 // of the directory
+	pthread_mutex_t shared_lock;          // of the levels below L1
+	int protocol;
+	int line_shift;                       // of the L1D
+	Riscv64_coherence_line* lines;        // open addressing by line
+	long int capacity;                    // a power of 2
+	long int line_num;
+	Riscv64_coherence_hart hart[HART_MAX];
+	Riscv64_memory* process;              // for the symbols
+	Riscv64_coherence_count* symbol_count; // by the symbol of the access, the last for none
+} Riscv64_coherence;
+
+// the protocol of the next init_coherence(), MESI until set_coherence_config() changes it
+extern int coherence_protocol;
+// parse "mesi" or "moesi", FALSE (with a message) if it is neither
+bool set_coherence_config(const char* spec);
+
+// make the model of the process coherent with the harts to come, at the first clone
+void init_coherence(Riscv64_memory* process);
+// the model of a cloned hart, whose levels below L1 become the ones of the process
+void join_coherence(Riscv64_memory* hart);
+// a hart that ends: its copies leave the directory, the statistics of its L1D are kept
+void leave_coherence(Riscv64_memory* hart);
+// print the statistics and make the model of the process a model of one hart again
+void delete_coherence(Riscv64_memory* process);
+
+// the directory, for the L1D of the model; the state the copy gets
+byte coherence_fill(Riscv64_cache_model*, reg64 line, reg64 addr, int size, bool write);
+byte coherence_upgrade(Riscv64_cache_model*, reg64 line, reg64 addr, int size, byte state);
+void coherence_evict(Riscv64_cache_model*, reg64 line);
+// a store of another hart at addr invalidated the copy of line
+void coherence_lost(Riscv64_cache_model*, reg64 line, reg64 addr, int size);
+// an event another hart sent to the L1D of the hart, see "cache_model.c"
+void apply_coherence_event(Riscv64_memory*, Riscv64_hart_event*);
+
+#endif
@@ -0,0 +1,83 @@
+/*******************************************************************/
+/* Checks of the simulator context of "riscvsim.h" that need a     */
+/* host program around it, run by "make check" after check.sh:     */
+/*                                                                 */
+/*   - a guest fault ends the program, not this process            */
+/*   - "exit" in the debug mode does the same                      */
+/*   - a second context can not run while another thread runs one  */
+/*                                                                 */
+/* The guest programs are the .elf files "make check" assembles.   */
+/*******************************************************************/
+#include <pthread.h>
+#include <unistd.h>
+#include "riscvsim.h"
+#include "breakpoint.h"
+
+static int failed = 0;
+
+static void report(const char* check, bool ok)
+{
+	printf("context_check: %s: %s\n", check, ok ? "ok" : "FAILED");
+	if(!ok)
+		failed = 1;
+}
+
+static Riscv64_sim* load(const char* file_name)
+{
+	Riscv64_sim* sim;
+	init_sim(&sim);
+	if(!load_sim(sim, file_name))
+		exit(1);
+	return sim;
+}
+
+static void* run_spin(void* arg)
+{
+	run_sim((Riscv64_sim*)arg, 0);
+	return NULL;
+}
+
+int main()
+{
+	// far_store.elf stores to 1 << 40
+	Riscv64_sim* sim = load("far_store.elf");
+	long int count = run_sim(sim, 0);
+	report("fault", count == 0 && sim_exited(sim) && sim_fault(sim) == FAULT_ACCESS);
+	delete_sim(sim);
+
+	// stop at the load of far_load.elf and answer "exit"
+	int input[2];
+	if(pipe(input) != 0 || write(input[1], "exit\n", 5) != 5)
+		return 1;
+	close(input[1]);
+	dup2(input[0], 0);
+	sim = load("far_load.elf");
+	add_breakpoint(0x10024);
+	run_sim(sim, 0);
+	delete_all_breakpoints();
+	report("debug exit", sim_exited(sim) && sim_fault(sim) == FAULT_NONE && sim_exit_code(sim) == 0);
+	delete_sim(sim);
+
+	// context_spin.elf runs until it is let go
+	Riscv64_sim* spinning = load("context_spin.elf");
+	pthread_t thread;
+	pthread_create(&thread, NULL, run_spin, spinning);
+	reg32 flag = 0;
+	while(flag == 0)
+	{
+		usleep(1000);
+		copy_from_guest(spinning->riscv_memory, &flag, 0x40000, sizeof(flag));
+	}
+	sim = load("far_load.elf");
+	count = run_sim(sim, 0);
+	report("one context at a time", count == -1 && !sim_exited(sim));
+	flag = 1;
+	copy_to_guest(spinning->riscv_memory, 0x40004, &flag, sizeof(flag));
+	pthread_join(thread, NULL);
+	report("the running context", sim_exited(spinning) && sim_exit_code(spinning) == 0);
+	delete_sim(spinning);
+	count = run_sim(sim, 0);
+	report("the next context", count == 0 && sim_fault(sim) == FAULT_ACCESS);
+	delete_sim(sim);
+	return failed;
+}
@@ -0,0 +1,11 @@
+# Run by context_check.c in a thread of its own: says it started at 0x40000,
+# then spins until the host sets the word at 0x40004.
+  li s2, 0x40000
+  li t0, 1
+  sw t0, 0(s2)
+wait:
+  lw t1, 4(s2)
+  beqz t1, wait
+  li a0, 0
+  li a7, 93
+  ecall
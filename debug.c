@@ -1,8 +1,6 @@
 #include "debug.h"
-
-// somthing for debug
-bool debug_flag = FALSE;
-unsigned long int pause_addr = -1;
+#include "breakpoint.h"
+#include "hart.h"
 
 
 // void DEBUG(char* p1, ...)
@@ -57,49 +55,83 @@ void DEBUG_INST(char* inst_name, char* type, Riscv64_decoder* riscv_decoder, Ris
 	printf("\n");
 }
 
+// entered only from the trap of a breakpoint, a watchpoint or "n", see "breakpoint.h"
 void DEBUG_MODE(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
 {
 	char command[30];
+	reg64 addr, length;
 	
 	while(1)
 	{
 		printf("Please enter command (enter 'help' for help):\n");
-		scanf("%s", command);
+		if(scanf("%29s", command) != 1)
+		{
+			// no more input, run to the end
+			delete_all_breakpoints();
+			break;
+		}
 		if(strcmp(command, "help") == 0)
 		{
-			printf("exit:  exit the program immediately.\n");
-			printf("rtn:   continue to run the program till end.\n");
+			printf("exit:  end the program immediately, with exit code 0.\n");
+			printf("rtn:   delete all break points and run the program till end.\n");
 			printf("r:     run to the next break point\n");
 			printf("n:     run next instruction.\n");
 			printf("reg:   print out all general register.\n");
+			printf("b x:   set a break point at pc x (hex).\n");
+			printf("d x:   delete the break point at pc x (hex).\n");
+			printf("w x l: stop after writes to the l bytes at address x (hex).\n");
+			printf("dw x:  delete the watch point at address x (hex).\n");
+			printf("info:  list the break points and watch points.\n");
 		}
-		// exit program directly
+		// end the program, the engine stops at the trap
 		else if(strcmp(command, "exit") == 0)
 		{
-			exit(0);
+			exit_program(riscv_memory, 0);
+			break;
 		}
-		// run to next pause_addr
+		// run to next break point
 		else if(strcmp(command, "r") == 0)
 		{
-			debug_flag = FALSE;
 			break;
 		}
 		// run till end
 		else if(strcmp(command, "rtn") == 0)
 		{	
-			debug_flag = FALSE;
-			pause_addr = -1;
+			delete_all_breakpoints();
 			break;
 		}
 		// next instruction
 		else if(strcmp(command, "n") == 0)
 		{
+			step_breakpoint();
 			break;
 		}	
 		else if(strcmp(command, "reg") == 0)
 		{
 			DEBUG_SHOW_REG_GENERAL(riscv_register);
 		}
+		else if(strcmp(command, "b") == 0 && scanf("%lx", &addr) == 1)
+		{
+			add_breakpoint(addr);
+		}
+		else if(strcmp(command, "d") == 0 && scanf("%lx", &addr) == 1)
+		{
+			if(!delete_breakpoint(addr))
+				printf("no break point at 0x%lx\n", addr);
+		}
+		else if(strcmp(command, "w") == 0 && scanf("%lx %ld", &addr, &length) == 2)
+		{
+			add_watchpoint(addr, length);
+		}
+		else if(strcmp(command, "dw") == 0 && scanf("%lx", &addr) == 1)
+		{
+			if(!delete_watchpoint(addr))
+				printf("no watch point at 0x%lx\n", addr);
+		}
+		else if(strcmp(command, "info") == 0)
+		{
+			print_breakpoints();
+		}
 		else 
 		{
 			printf("invalid command!\n");
@@ -0,0 +1,282 @@
+#include "decode_cache.h"
+#include "execute.h"
+#include "breakpoint.h"
+#include "cache_model.h"
+#include "branch_predictor.h"
+
+/*********************************************/
+/*                                           */
+/* one handler per concrete instruction      */
+/*                                           */
+/*********************************************/
+
+#define INST(id, func, format) \
+static void exec_##func(Riscv64_decoded* d, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory) \
+{ \
+	FORMAT_##format(func); \
+}
+#include "instruction_list.h"
+#undef INST
+
+// anything not in the list goes through the old path, so it behaves exactly as before
+static void exec_fallback(Riscv64_decoded* d, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	Riscv64_decoder riscv_decoder;
+	memset(&riscv_decoder, 0, sizeof(Riscv64_decoder));
+	decode(&riscv_decoder, (instruction)d->imm);
+	execute(&riscv_decoder, riscv_register, riscv_memory);
+}
+
+// the instructions of "fusion_list.h" inline, each with the same result as its function in
+// "riscv_instruction.c" (pc points past the instruction, as after fetch())
+#define X(i) riscv_register->x[i]
+#define PC   riscv_register->pc
+#define FUSED_lui(r)   X(r->rd) = (long int)r->imm
+#define FUSED_auipc(r) X(r->rd) = (long int)(PC - sizeof(instruction) + r->imm)
+#define FUSED_addi(r)  X(r->rd) = X(r->rs1) + r->imm
+#define FUSED_addiw(r) X(r->rd) = (unsigned long int)((int)X(r->rs1) + (int)r->imm)
+#define FUSED_slli(r)  X(r->rd) = (long int)X(r->rs1) << r->imm
+#define FUSED_srli(r)  X(r->rd) = (unsigned long int)X(r->rs1) >> r->imm
+#define FUSED_slt(r)   X(r->rd) = (long int)(X(r->rs1) - X(r->rs2)) < 0
+#define FUSED_slti(r)  X(r->rd) = (long int)(X(r->rs1) - (long int)r->imm) < 0
+#define FUSED_sltu(r)  X(r->rd) = X(r->rs1) < X(r->rs2)
+#define FUSED_sltiu(r) X(r->rd) = X(r->rs1) < (unsigned long int)r->imm
+#define FUSED_ld(r) \
+	do { \
+		CACHE_LOAD(riscv_memory, X(r->rs1) + r->imm, sizeof(reg64)); \
+		X(r->rd) = get_memory_reg64(riscv_memory, (byte*)(X(r->rs1) + r->imm)); \
+	} while(0)
+#define FUSED_branch(r, taken) \
+	do { \
+		reg64 target = PC - sizeof(instruction) + (long int)r->imm; \
+		BRANCH_CONDITIONAL(riscv_memory, PC - sizeof(instruction), target, taken); \
+		if(taken) \
+			PC = target; \
+	} while(0)
+#define FUSED_beq(r)   FUSED_branch(r, X(r->rs1) - X(r->rs2) == 0)
+#define FUSED_bne(r)   FUSED_branch(r, X(r->rs1) - X(r->rs2) != 0)
+#define FUSED_jalr(r) \
+	do { \
+		reg64 link = PC; \
+		if(r->rd != 0) \
+			X(r->rd) = link; \
+		reg64 target = (X(r->rs1) + (long int)r->imm) & ~1UL; \
+		BRANCH_JUMP(riscv_memory, link - sizeof(instruction), target, r->rd, r->rs1); \
+		PC = target; \
+	} while(0)
+
+// a fused pair runs both instructions, the record of the second one is the next record
+// (the engines fetch the first one, the handler the second)
+#define FUSE(id, FIRST, first, SECOND, second) \
+static void exec_##id(Riscv64_decoded* d, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory) \
+{ \
+	Riscv64_decoded* d2 = d + 1; \
+	FUSED_##first(d); \
+	CACHE_FETCH(riscv_memory, PC, sizeof(instruction)); \
+	PC += sizeof(instruction); \
+	FUSED_##second(d2); \
+	riscv_memory->fused_executed++; \
+}
+#include "fusion_list.h"
+#undef FUSE
+#undef X
+#undef PC
+
+static inst_handler handler_table[INST_COUNT] = {
+	#define INST(id, func, format) exec_##func,
+	#include "instruction_list.h"
+	#undef INST
+	exec_trap,
+	exec_fallback,
+	#define FUSE(id, FIRST, first, SECOND, second) exec_##id,
+	#include "fusion_list.h"
+	#undef FUSE
+};
+
+// the two instructions of every fused id, indexed by id - INST_FUSED_FIRST
+static const unsigned char fused_pair[][2] = {
+	#define FUSE(id, FIRST, first, SECOND, second) {INST_##FIRST, INST_##SECOND},
+	#include "fusion_list.h"
+	#undef FUSE
+};
+
+
+/*********************************************/
+/*                                           */
+/* macro-op fusion                           */
+/*                                           */
+/*********************************************/
+
+INSTID unfused_id(INSTID id)
+{
+	return id >= INST_FUSED_FIRST ? (INSTID)fused_pair[id - INST_FUSED_FIRST][0] : id;
+}
+
+void unfuse_record(Riscv64_decoded* record)
+{
+	record->id = unfused_id(record->id);
+	record->handler = handler_table[record->id];
+}
+
+bool fuse_records(Riscv64_decoded* first, Riscv64_decoded* second)
+{
+	INSTID a = unfused_id(first->id);
+	INSTID b = unfused_id(second->id);
+
+	for(int i = 0; i < INST_COUNT - INST_FUSED_FIRST; i++)
+	{
+		if(fused_pair[i][0] != a || fused_pair[i][1] != b)
+			continue;
+
+		// only the idiom: the second instruction consumes what the first one wrote
+		bool idiom;
+		switch(b)
+		{
+			case INST_BEQ:
+			case INST_BNE:
+				if(a == INST_ADDI || a == INST_ADDIW) // counter against a bound
+					idiom = second->rs1 == first->rd || second->rs2 == first->rd;
+				else                                  // flag against zero
+					idiom = (second->rs1 == first->rd && second->rs2 == 0) || (second->rs1 == 0 && second->rs2 == first->rd);
+				break;
+			case INST_ADDI:
+			case INST_ADDIW:
+			case INST_SRLI:
+				idiom = second->rs1 == first->rd && second->rd == first->rd;
+				break;
+			default: // jalr, ld
+				idiom = second->rs1 == first->rd;
+		}
+		// x0 as a destination is left to the functions, set_register_general() complains about it
+		if(!idiom || first->rd == 0 || (b == INST_LD && second->rd == 0))
+			return FALSE;
+
+		first->id = INST_FUSED_FIRST + i;
+		first->handler = handler_table[first->id];
+		return TRUE;
+	}
+	return FALSE;
+}
+
+void print_fusion_stats(long int pairs, long int executed, long int count)
+{
+	printf("fusion: %ld pairs fused by the decoder, %ld dynamic instructions executed fused (%.2f%%)\n",
+	       pairs, 2 * executed, count ? 200.0 * executed / count : 0.0);
+}
+
+void decode_to_record(Riscv64_decoded* record, instruction inst)
+{
+	int imm;
+	INSTID id = GetINSTID(inst, &imm);
+
+	record->id      = id;
+	record->handler = handler_table[id];
+	record->rd      = RD(inst);
+	record->rs1     = RS1(inst);
+	record->rs2     = RS2(inst);
+	record->imm     = imm;
+}
+
+
+/*********************************************/
+/*                                           */
+/* the cache                                 */
+/*                                           */
+/*********************************************/
+
+void init_decode_cache(Riscv64_decode_cache** cache, Riscv64_memory* riscv_memory)
+{
+	*cache = (Riscv64_decode_cache*) malloc (sizeof(Riscv64_decode_cache));
+	memset(*cache, 0, sizeof(Riscv64_decode_cache));
+
+	(*cache)->base  = riscv_memory->text_start;
+	(*cache)->limit = riscv_memory->text_end;
+	if((*cache)->limit < (*cache)->base)
+		(*cache)->limit = (*cache)->base;
+
+	long int entry_num = ((*cache)->limit - (*cache)->base) / sizeof(instruction) + 1;
+	(*cache)->entries = (Riscv64_decoded*) calloc (entry_num, sizeof(Riscv64_decoded));
+	if((*cache)->entries == NULL)
+	{
+		printf("Memory error.\n");
+		exit(1);
+	}
+}
+
+void delete_decode_cache(Riscv64_decode_cache* cache)
+{
+	free(cache->entries);
+	free(cache);
+}
+
+Riscv64_decoded* fill_decode_cache(Riscv64_decode_cache* cache, Riscv64_memory* riscv_memory, reg64 pc)
+{
+	if(pc - cache->base >= cache->limit - cache->base || (pc & 3) != 0)
+	{
+		cache->uncached++;
+		decode_to_record(&cache->scratch, (instruction) get_memory_reg32(riscv_memory, (byte*)pc));
+		return &cache->scratch;
+	}
+
+	// decode ahead along the straight line, so every pair in it can be fused
+	Riscv64_decoded* entry = &cache->entries[(pc - cache->base) >> 2];
+	Riscv64_decoded* end = &cache->entries[(cache->limit - cache->base) >> 2];
+	Riscv64_decoded* record = entry;
+	reg64 addr = pc;
+
+	cache->miss++;
+	decode_to_record(record, (instruction) get_memory_reg32(riscv_memory, (byte*)addr));
+	mark_code_page(riscv_memory, addr);
+	cache->fill++;
+	while(record + 1 < end && !(record->id >= INST_BEQ && record->id <= INST_SCALL) && record->id != INST_FALLBACK)
+	{
+		Riscv64_decoded* next = record + 1;
+		addr += sizeof(instruction);
+		bool decoded = next->handler != NULL;
+		if(!decoded)
+		{
+			decode_to_record(next, (instruction) get_memory_reg32(riscv_memory, (byte*)addr));
+			mark_code_page(riscv_memory, addr);
+			cache->fill++;
+		}
+		if(fuse_records(record, next))
+			cache->fused++;
+		if(decoded)
+			break;
+		record = next;
+	}
+	return entry;
+}
+
+void invalidate_decode_cache(Riscv64_decode_cache* cache, reg64 addr, reg64 length)
+{
+	reg64 start = addr > cache->base ? addr : cache->base;
+	reg64 end = addr + length < cache->limit ? addr + length : cache->limit;
+	if(start >= end)
+		return;
+	// every record a byte of the range is in
+	Riscv64_decoded* first = &cache->entries[(start - cache->base) >> 2];
+	Riscv64_decoded* last = &cache->entries[(end - cache->base + sizeof(instruction) - 1) >> 2];
+	for(Riscv64_decoded* entry = first; entry < last; entry++)
+	{
+		// a trap decodes the instruction again when it runs
+		if(entry->handler != NULL && entry->id != INST_TRAP)
+		{
+			entry->handler = NULL;
+			cache->invalidated++;
+		}
+	}
+	// a pair fused into the record before would run the old second instruction
+	if(first > cache->entries && first[-1].id >= INST_FUSED_FIRST)
+		unfuse_record(&first[-1]);
+}
+
+void print_decode_cache_stats(Riscv64_decode_cache* cache)
+{
+	long int hit = cache->lookup - cache->miss - cache->uncached;
+	printf("decode cache: %ld lookups, %ld misses, %ld decoded, %ld uncached, hit rate %.4f%%\n",
+	       cache->lookup, cache->miss, cache->fill, cache->uncached,
+	       cache->lookup ? 100.0 * hit / cache->lookup : 0.0);
+	if(cache->invalidated > 0)
+		printf("decode cache: %ld records invalidated by stores into the text\n", cache->invalidated);
+}
@@ -0,0 +1,87 @@
+#ifndef __DECODE_CACHE_H__
+#define __DECODE_CACHE_H__
+#include "memory_system.h"
+#include "riscv_instruction.h"
+
+/*********************************************/
+/*                                           */
+/* pre-decoded instruction cache             */
+/*                                           */
+/*********************************************/
+/* Every static instruction in the text is   */
+/* decoded once into a compact record, and   */
+/* the main loop only looks the record up by */
+/* pc and calls its handler. The pages it    */
+/* decodes are marked as code, a store into  */
+/* one clears their records.                 */
+/*********************************************/
+
+typedef struct riscv64_decoded Riscv64_decoded;
+typedef void (*inst_handler)(Riscv64_decoded*, Riscv64_register*, Riscv64_memory*);
+
+// a decoded instruction, 16 bytes
+struct riscv64_decoded{
+	inst_handler handler; // NULL if the entry is not decoded yet
+	int imm;              // immediate, shamt for shifts, rs3 for R4, the raw instruction for INST_FALLBACK
+	unsigned char id;     // INSTID
+	unsigned char rd;
+	unsigned char rs1;
+	unsigned char rs2;
+};
+
+// how the operands of a record d are passed to the instruction function, see "instruction_list.h"
+// (expects riscv_register and riscv_memory in scope)
+#define FORMAT_RR(func)     func(riscv_register, d->rd, d->rs1, d->rs2)
+#define FORMAT_RI(func)     func(riscv_register, d->rd, d->rs1, d->imm)
+#define FORMAT_R1(func)     func(riscv_register, d->rd, d->rs1)
+#define FORMAT_R4(func)     func(riscv_register, d->rd, d->rs1, d->rs2, d->imm)
+#define FORMAT_MEM_RD(func) func(riscv_register, riscv_memory, d->rd, d->rs1, d->imm)
+#define FORMAT_MEM_RS(func) func(riscv_register, riscv_memory, d->rs1, d->rs2, d->imm)
+#define FORMAT_UPPER(func)  func(riscv_register, riscv_memory, d->rd, d->imm)
+#define FORMAT_SYS(func)    func(riscv_register, riscv_memory)
+#define FORMAT_AMO(func)    func(riscv_register, riscv_memory, d->rd, d->rs1, d->rs2)
+
+typedef struct riscv64_decode_cache{
+	reg64 base;                // guest pc of entries[0]
+	reg64 limit;               // first guest pc after the cached range
+	Riscv64_decoded* entries;  // one entry per 4 bytes of [base, limit)
+	Riscv64_decoded scratch;   // for pcs outside the cached range
+	// statistics
+	long int lookup;
+	long int miss;             // lookups in the cached range that had to decode
+	long int fill;             // entries decoded, the ones decoded ahead of a miss too
+	long int uncached;         // lookups outside the cached range
+	long int invalidated;      // records dropped by invalidate_decode_cache()
+	long int fused;            // pairs fused by the decoder
+} Riscv64_decode_cache;
+
+void init_decode_cache(Riscv64_decode_cache**, Riscv64_memory*); // cover the text recorded by load_program
+void delete_decode_cache(Riscv64_decode_cache*);
+void print_decode_cache_stats(Riscv64_decode_cache*);
+
+void decode_to_record(Riscv64_decoded*, instruction inst); // decode one instruction into a record
+// macro-op fusion, see "fusion_list.h": the records of a pair must be adjacent
+bool fuse_records(Riscv64_decoded* first, Riscv64_decoded* second); // fuse second into first if they are a known pair
+void unfuse_record(Riscv64_decoded*);  // back to the record of the first instruction alone
+INSTID unfused_id(INSTID id);          // id of the first instruction of a fused id, id itself otherwise
+// pairs fused by the decoders, and executed fused (fused_executed of the memory)
+void print_fusion_stats(long int pairs, long int executed, long int count);
+
+Riscv64_decoded* fill_decode_cache(Riscv64_decode_cache*, Riscv64_memory*, reg64 pc); // slow path of the lookup
+void invalidate_decode_cache(Riscv64_decode_cache*, reg64 addr, reg64 length); // the text there was written, decode it again
+
+// return the decoded record of the instruction at pc
+static inline Riscv64_decoded* lookup_decode_cache(Riscv64_decode_cache* cache, Riscv64_memory* riscv_memory, reg64 pc)
+{
+	reg64 offset = pc - cache->base;
+	cache->lookup++;
+	if(offset < cache->limit - cache->base)
+	{
+		Riscv64_decoded* entry = &cache->entries[offset >> 2];
+		if(entry->handler != NULL)
+			return entry;
+	}
+	return fill_decode_cache(cache, riscv_memory, pc);
+}
+
+#endif
@@ -5,11 +5,11 @@
 /* implementation. If you want to add a new instruction to our     */
 /* simulator, you could just simply follow the steps below:        */
 /*                                                                 */
-/*  1. Add the opcode of your new instruction(maybe your funct3    */
-/*     and funct7 as well, if there are any conflict with current  */
-/*     opcodes) to the appropriate place(according to your         */
-/*     instruction type) in the function GetINSTYPE in             */
-/*     "riscv_instruction.c";                                      */
+/*  1. Add the encoding of your new instruction(its opcode, and    */
+/*     maybe funct3 and funct7 as well) to the patterns in         */
+/*     "gen_decode_table.c", which generates the decode table      */
+/*     behind GetINSTYPE and GetINSTID, and an entry to            */
+/*     "instruction_list.h";                                       */
 /*  2. Add your instruction entrance to function XX_Execute        */
 /*     according to your instruction type. For example, if your    */
 /*     instruction is R_TYPE, then your are welcome to the         */
@@ -22,12 +22,8 @@
 /* will work!                                                      */
 /*******************************************************************/
 #include "execute.h"
-
-extern int EXIT_HAPPENED;
-
-// something for debug
-extern bool debug_flag;
-extern unsigned long int pause_addr;
+#include <sys/mman.h>
+#include <unistd.h>
 
 /*********************************************/
 /*                                           */
@@ -35,15 +31,6 @@ extern unsigned long int pause_addr;
 /*                                           */
 /*********************************************/
 
-// print the help information
-void help()
-{
-	printf("This is a simulator to execute riscv ELF!\n\n");
-	printf("     Usage: ./exeute filename\n\n");
-	printf("Multiple ELFs is supported, just separate the filename with space. The order of execution is the same as the input order.\n");
-
-}
-
 void print_mem(byte* start, int length)
 {
 	for(int i = 1; i <= length; i++)
@@ -56,31 +43,42 @@ void print_mem(byte* start, int length)
 	return;
 }
 
-// read the  whole file into the mem
-byte* read_file(FILE* file_p, int* p_size)
+// map the whole file read-only into the mem, its pages are read on demand
+// and shared with the page cache (and other runs of the same file)
+byte* map_file(FILE* file_p, int* p_size)
 {
 	// get size of the file
 	fseek(file_p, 0, SEEK_END);
 	*p_size = ftell(file_p);
 	rewind(file_p);
 
-	// malloc buffer
-	byte* buffer = (byte*) malloc (sizeof(byte) * *p_size);
-	if(buffer == NULL)
+	byte* buffer = (byte*) mmap (NULL, *p_size, PROT_READ, MAP_PRIVATE, fileno(file_p), 0);
+	if(buffer == MAP_FAILED)
 	{
-		printf("Memory error.\n");
+		printf("Can not map the file.\n");
 		exit(1);
 	}
 
-	// read
-	fread(buffer, 1, *p_size, file_p);
-
 	return buffer;
 }
 
+void unmap_file(byte* buffer, int size)
+{
+	munmap(buffer, size);
+}
+
+static int compare_symbol(const void* a, const void* b)
+{
+	reg64 x = ((Riscv64_symbol*)a)->addr;
+	reg64 y = ((Riscv64_symbol*)b)->addr;
+	return x < y ? -1 : x > y;
+}
+
 // load the program to the memory system
-void load_program(Elf64_Ehdr* elf_header, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+void load_program(Elf64_Ehdr* elf_header, int fd, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
 {
+	long int page_size = sysconf(_SC_PAGESIZE);
+
 	// set PC
 	riscv_register->pc = elf_header->e_entry;
 
@@ -90,23 +88,46 @@ void load_program(Elf64_Ehdr* elf_header, Riscv64_register* riscv_register, Risc
 	int ph_num = elf_header->e_phnum;
 
 	// load segment to virtual memory one by one
+	reg64 seg_end = 0;
 	for(int i = 0; i < ph_num; i++)
 	{
 		Elf64_Phdr* program_header = (Elf64_Phdr*)((byte*)program_header_1 + ph_size*i);
 
 		// pointer to segment in the file
 		byte* p_seg_in_file = (byte*)elf_header + program_header->p_offset;
-		// pointer to segment in the virtual memory
-		byte* p_seg_actual_addr = get_actual_addr(riscv_memory, (byte*)program_header->p_vaddr);
-		// copy the segment to virtual memory
-		memcpy(p_seg_actual_addr, p_seg_in_file, program_header->p_memsz);
+		if(program_header->p_type == PT_LOAD)
+		{
+			int prot = (program_header->p_flags & PF_R ? PAGE_READ : 0) | (program_header->p_flags & PF_W ? PAGE_WRITE : 0)
+			           | (program_header->p_flags & PF_X ? PAGE_EXEC : 0);
+			map_region(riscv_memory, program_header->p_vaddr, program_header->p_memsz, prot);
+			seg_end = MAX(seg_end, program_header->p_vaddr + program_header->p_memsz);
+			// the whole pages of the segment are mapped copy-on-write from the file, the
+			// partial ones at its ends are copied, as is a segment at an offset that is
+			// not congruent to its address; the rest up to p_memsz (bss) is still zero
+			// in the fresh memory and its pages stay untouched
+			reg64 start = program_header->p_vaddr;
+			reg64 end = start + program_header->p_filesz;
+			reg64 page_start = (start + page_size - 1) & ~(page_size - 1);
+			reg64 page_end = end & ~(page_size - 1);
+			if(fd >= 0 && (start - program_header->p_offset) % page_size == 0 && page_start < page_end
+			   && map_file_to_guest(riscv_memory, page_start, page_end - page_start, fd, program_header->p_offset + (page_start - start)))
+			{
+				copy_to_guest(riscv_memory, start, p_seg_in_file, page_start - start);
+				copy_to_guest(riscv_memory, page_end, p_seg_in_file + (page_end - start), end - page_end);
+			}
+			else
+				copy_to_guest(riscv_memory, start, p_seg_in_file, program_header->p_filesz);
+		}
 		// set pc to head of the 1st seg
 		if (i == 0)
 		{
 			set_register_pc(riscv_register, (reg64)program_header->p_vaddr);
 		}
-		EXIT_HAPPENED = FALSE;
+		riscv_memory->exit_happened = FALSE;
 	}
+	// the heap grows from the end of the segments towards the stack
+	if(seg_end < (reg64)STACK_ADDR - STACK_SIZE)
+		map_region(riscv_memory, seg_end, STACK_ADDR - STACK_SIZE - seg_end, PAGE_READ | PAGE_WRITE);
 
 	// section
 	Elf64_Shdr* section_header_1 = (Elf64_Shdr*)((byte*)elf_header + elf_header->e_shoff);
@@ -138,9 +159,22 @@ void load_program(Elf64_Ehdr* elf_header, Riscv64_register* riscv_register, Risc
 		{
 			string_table = (byte*)elf_header + section_header->sh_offset;
 		}
+
+		// executable section, widen the text range (for the decode cache)
+		if((section_header->sh_flags & SHF_EXECINSTR) && section_header->sh_size > 0)
+		{
+			reg64 start = section_header->sh_addr;
+			reg64 end = section_header->sh_addr + section_header->sh_size;
+			if(riscv_memory->text_end == 0 || start < riscv_memory->text_start)
+				riscv_memory->text_start = start;
+			if(end > riscv_memory->text_end)
+				riscv_memory->text_end = end;
+		}
 	}
 
 	// symbol table
+	riscv_memory->symbols = (Riscv64_symbol*) malloc (MAX(symtab_num, 1) * sizeof(Riscv64_symbol));
+	riscv_memory->symbol_num = 0;
 	for(int i = 0; i < symtab_num; i++)
 	{
 		Elf64_Sym* symbol_table = (Elf64_Sym*)((byte*)symbol_tabel_1 + symtab_size*i);
@@ -149,13 +183,41 @@ void load_program(Elf64_Ehdr* elf_header, Riscv64_register* riscv_register, Risc
 		// get edata (for heap)
 		if(strcmp(string_table+symbol_table->st_name, "_edata") == 0)
 		{
-			riscv_memory->edata = symbol_table->st_value;
+			riscv_memory->edata = (byte*)symbol_table->st_value;
+		}
+		// objects and functions, to name the addresses the models report
+		int type = symbol_table->st_info & 0xf;
+		if((type == STT_OBJECT || type == STT_FUNC) && symbol_table->st_size > 0)
+		{
+			Riscv64_symbol* symbol = &riscv_memory->symbols[riscv_memory->symbol_num++];
+			symbol->addr = symbol_table->st_value;
+			symbol->size = symbol_table->st_size;
+			symbol->name = (const char*)string_table + symbol_table->st_name;
 		}
 	}
+	qsort(riscv_memory->symbols, riscv_memory->symbol_num, sizeof(Riscv64_symbol), compare_symbol);
 
 	return;
 }
 
+long int find_symbol(Riscv64_memory* riscv_memory, reg64 addr)
+{
+	// the last symbol that starts at or before addr
+	long int low = 0;
+	long int high = riscv_memory->symbol_num;
+	while(low < high)
+	{
+		long int middle = (low + high) / 2;
+		if(riscv_memory->symbols[middle].addr <= addr)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if(low == 0 || addr - riscv_memory->symbols[low - 1].addr >= riscv_memory->symbols[low - 1].size)
+		return -1;
+	return low - 1;
+}
+
 
 /*********************************************/
 /*                                           */
@@ -167,22 +229,18 @@ instruction fetch(Riscv64_memory* riscv_memory, Riscv64_register* riscv_register
 {
 	byte* virtual_addr_pc = (byte*) get_register_pc(riscv_register);
 	instruction inst = (instruction) get_memory_reg64(riscv_memory, virtual_addr_pc);
+	CACHE_FETCH(riscv_memory, virtual_addr_pc, sizeof(instruction));
 	register_pc_self_increase(riscv_register);
 
 	#ifdef DEBUG
 	printf("pc=%x  instruction=%x \n", virtual_addr_pc, inst);
 	#endif
 
-	//check whether to debug
-	if((int)virtual_addr_pc == (int)pause_addr)
-	{
-		debug_flag = TRUE;
-	}
-
 	return inst;
 }
 
-void decode(Riscv64_decoder* riscv_decoder, instruction inst)
+// extract every field of the instruction, without classifying it
+void decode_fields(Riscv64_decoder* riscv_decoder, instruction inst)
 {
 	riscv_decoder->inst         = inst;    // save the complete instruction for debug
 	riscv_decoder->opcode       = OPCODE(inst);
@@ -206,6 +264,11 @@ void decode(Riscv64_decoder* riscv_decoder, instruction inst)
 	riscv_decoder->rm           = RM(inst);
 	riscv_decoder->rs3          = RS3(inst);
 	riscv_decoder->width        = WIDTH(inst);
+}
+
+void decode(Riscv64_decoder* riscv_decoder, instruction inst)
+{
+	decode_fields(riscv_decoder, inst);
 
 	// get an immediate regardless of INS_TYPE, for debug convenience
 	switch (GetINSTYPE(riscv_decoder))
@@ -248,7 +311,7 @@ void execute(Riscv64_decoder* riscv_decoder,
 			R_execute(riscv_decoder, riscv_register, riscv_memory);
 			break;
 		case R4_TYPE:
-//			R4_execute(riscv_decoder, riscv_register, riscv_memory);
+			R4_execute(riscv_decoder, riscv_register, riscv_memory);
 			break;
 		case I_TYPE:
 			I_execute(riscv_decoder, riscv_register, riscv_memory);
@@ -270,104 +333,3 @@ void execute(Riscv64_decoder* riscv_decoder,
 			Error_NoDef(riscv_decoder);
 	}
 }
-
-
-/*********************************************/
-/*                                           */
-/* main function                             */
-/*                                           */
-/*********************************************/
-
-int main(int argc, char const *argv[])
-{
-	// check
-	if(argc < 2 || strcmp(argv[1],"help") == 0)
-	{
-		help();
-		return 0;
-	}
-
-
-	#ifdef DEBUG
-	printf("Now in DEBUG mode.\n");
-	printf("Please type in the address(hexadecimal) where the program will be paused:\n");
-	scanf("%x", &pause_addr);
-	#endif
-
-	int file_num = argc - 1; // number of file
-	FILE *file_p;  // file pointer
-
-	// memory system
-	Riscv64_register *riscv_register;
-	Riscv64_memory *riscv_memory;
-	Riscv64_decoder *riscv_decoder;
-
-	// execute elf one by one
-	for (int i = 1; i <= file_num; i++ )
-	{
-		char *file_name = argv[i];
-
-		// not absolute addr, add "./" to the head of the str
-		char pre_addr[3] = "./";
-		if(file_name[0] != '/')
-		{
-			file_name = strcat(pre_addr, file_name);
-			printf("%s", file_name);
-		}
-
-		file_p = fopen(file_name, "rb");  // binary mode
-
-		if(file_p == NULL)
-		{
-			printf("Can not open file : %s successfully.\n", file_name);
-			exit(1);
-		}
-
-		printf("executing file : %s ...\n", file_name);
-
-		// read the whole elf
-		int size;
-		byte* buffer = read_file(file_p, &size);
-		printf("the size of the file is : %d bytes\n", size);
-
-		// get the elf header
-		Elf64_Ehdr* elf_header = (Elf64_Ehdr*) buffer;
-
-		// initialize memory system
-		/* XJM modified */
-		// riscv_decoder = init_decoder(riscv_decoder);
-		// riscv_register = init_register(riscv_register);
-		// riscv_memory = init_memory(riscv_memory);
-		init_decoder(&riscv_decoder);
-		init_memory(&riscv_memory);
-		init_register(&riscv_register, riscv_memory);
-
-
-		//load program
-		load_program(elf_header, riscv_register, riscv_memory);
-
-		long int count = 0;
-		while(!EXIT_HAPPENED)
-		{
-			instruction inst = fetch(riscv_memory, riscv_register);
-			decode(riscv_decoder, inst);
-			execute(riscv_decoder, riscv_register, riscv_memory);
-
-			// debug mode
-			if(debug_flag == TRUE)
-			{
-				DEBUG_MODE(riscv_register, riscv_memory);
-			}
-
-			count += 1;
-		}
-
-		printf("Program exits!\n");
-		printf("%ld instructions executed.\n", count);
-		// gc
-		delete_memory_system(riscv_decoder, riscv_register, riscv_memory);
-		free(buffer);
-	}
-
-	return 0;
-}
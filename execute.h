@@ -6,6 +6,20 @@
 #include "parse_elf.h"
 #include "riscv_instruction.h"
 #include "debug.h"
+#include "decode_cache.h"
+#include "threaded_engine.h"
+#include "block_cache.h"
+#include "aot.h"
+#include "breakpoint.h"
+#include "cache_model.h"
+#include "branch_predictor.h"
+#include "pipeline_model.h"
+#include "ooo_model.h"
+#include "simpoint.h"
+#include "checkpoint.h"
+#include "hart.h"
+#include "coherence.h"
+#include "riscvsim.h"
 
 /*********************************************/
 /*                                           */
@@ -20,9 +34,11 @@ void print_mem(byte* start, int length); // print out a block of mem, for debug
 /* functions for parsing elf and load program*/
 /*                                           */
 /*********************************************/
-void help(); // print the help information
-byte* read_file(FILE* file_p, int* size);  //read the  whole file into the mem
-void load_program(Elf64_Ehdr*, Riscv64_register*, Riscv64_memory*); // load program
+byte* map_file(FILE* file_p, int* size);  // map the whole file into the mem, read-only
+void unmap_file(byte* buffer, int size);
+void load_program(Elf64_Ehdr*, int fd, Riscv64_register*, Riscv64_memory*); // load program, mapping whole pages of the segments from fd if it is not -1
+// the index in riscv_memory->symbols of the symbol addr is in, -1 if there is none
+long int find_symbol(Riscv64_memory*, reg64 addr);
 
 /*********************************************/
 /*                                           */
@@ -30,7 +46,10 @@ void load_program(Elf64_Ehdr*, Riscv64_register*, Riscv64_memory*); // load prog
 /*                                           */
 /*********************************************/
 instruction fetch(Riscv64_memory*, Riscv64_register*); // fetch a instruction memory system
+void decode_fields(Riscv64_decoder*, instruction inst); // extract all fields of the instruction
 void decode(Riscv64_decoder*, instruction inst); // decode
 void execute(Riscv64_decoder*, Riscv64_register*, Riscv64_memory*); // merge the E & M & W in one step?
 
+// the engines and the context of a run, see "riscvsim.h"
+
 #endif
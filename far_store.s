@@ -0,0 +1,29 @@
+# A store far beyond the guard pages of the flat memory is reported as
+# a bad access, not a crash or a write to host memory. The loop makes the store
+# hot enough for the block and jit engines to compile it before the far round.
+# expect: Out of memory!
+# expect: address 0x10000000000 accessed by the instruction at pc 0x10024
+# exit: 0
+  li s1, 0
+  li s3, 100
+  li s2, 0x40000
+  li s5, 1
+  slli s5, s5, 40       # 1 << 40, far beyond the guard pages
+loop:
+  sd s1, 0(s2)
+  addi s1, s1, 1
+  blt s1, s3, loop
+  beq s2, s5, missed
+  mv s2, s5
+  j loop
+missed:
+  li t0, 0x0a6f6e       # "no\n", the far store was not reported
+  li a0, 1
+  li a1, 0x40100
+  sw t0, 0(a1)
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 1
+  li a7, 93
+  ecall
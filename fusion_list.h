@@ -0,0 +1,43 @@
+/*******************************************************************/
+/* The pairs of adjacent instructions the decoder fuses into one   */
+/* record. Each entry is FUSE(ID, FIRST, first, SECOND, second):   */
+/*                                                                 */
+/*   ID      - suffix of the enum value INST_<ID>                  */
+/*   FIRST   - INST_<FIRST> and function of the first instruction, */
+/*   first     its record becomes the fused one                    */
+/*   SECOND  - INST_<SECOND> and function of the second            */
+/*   second    instruction, its record follows unchanged           */
+/*                                                                 */
+/* When the pair is taken is decided by fuse_records() in          */
+/* "decode_cache.c". The fused handler runs both instructions with */
+/* the FUSED_<function> macros there, which give the same state as */
+/* running the functions one by one.                               */
+/*                                                                 */
+/* Include this file after defining FUSE, and #undef it after.     */
+/*******************************************************************/
+
+/* 32-bit constants */
+FUSE(LUI_ADDI,   LUI,   lui,   ADDI,  addi)
+FUSE(LUI_ADDIW,  LUI,   lui,   ADDIW, addiw)
+
+/* pc-relative far calls and loads, absolute loads */
+FUSE(AUIPC_JALR, AUIPC, auipc, JALR,  jalr)
+FUSE(AUIPC_LD,   AUIPC, auipc, LD,    ld)
+FUSE(LUI_LD,     LUI,   lui,   LD,    ld)
+
+/* zero-extension */
+FUSE(SLLI_SRLI,  SLLI,  slli,  SRLI,  srli)
+
+/* compare and branch on the result */
+FUSE(SLT_BEQ,    SLT,   slt,   BEQ,   beq)
+FUSE(SLT_BNE,    SLT,   slt,   BNE,   bne)
+FUSE(SLTU_BEQ,   SLTU,  sltu,  BEQ,   beq)
+FUSE(SLTU_BNE,   SLTU,  sltu,  BNE,   bne)
+FUSE(SLTI_BEQ,   SLTI,  slti,  BEQ,   beq)
+FUSE(SLTI_BNE,   SLTI,  slti,  BNE,   bne)
+FUSE(SLTIU_BEQ,  SLTIU, sltiu, BEQ,   beq)
+FUSE(SLTIU_BNE,  SLTIU, sltiu, BNE,   bne)
+
+/* loop counter update and the loop branch */
+FUSE(ADDI_BNE,   ADDI,  addi,  BNE,   bne)
+FUSE(ADDIW_BNE,  ADDIW, addiw, BNE,   bne)
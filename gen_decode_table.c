@@ -0,0 +1,369 @@
+/*******************************************************************/
+/* Generator of "decode_table.h", run by the Makefile before       */
+/* riscv_instruction.c is compiled.                                */
+/*                                                                 */
+/* Every concrete instruction of "instruction_list.h" is described */
+/* below by the bits that must match in its encoding. For each     */
+/* opcode and funct3 the generator finds which of the remaining    */
+/* bits 20-31 (funct7, rs2, fmt) decide the instruction, and lays  */
+/* out a row of ids indexed by just those bits. Decoding is then   */
+/*                                                                 */
+/*   entry = &decode_major[opcode][funct3];                        */
+/*   id    = decode_minor[entry->base + ((inst >> entry->shift)    */
+/*                                       & entry->mask)];          */
+/*   imm   = immediate[decode_immediate[id]];                      */
+/*                                                                 */
+/* without a single branch, see GetINSTID() in                     */
+/* "riscv_instruction.c". An encoding no pattern matches is        */
+/* INST_FALLBACK and runs through the old decode() & execute().    */
+/*******************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "riscv_instruction.h"
+
+typedef struct{
+	INSTID id;
+	instruction match;  // value of the bits under mask
+	instruction mask;
+	IMMTYPE imm;
+} pattern;
+
+/* masks of the fields that take part in a match */
+#define M_OP     0x0000007f  // opcode
+#define M_F3     0x0000707f  // opcode, funct3
+#define M_F7     0xfe00707f  // opcode, funct3, funct7
+#define M_F6     0xfc00707f  // opcode, funct3, funct6 (RV64 shifts)
+#define M_FP     0xfe00007f  // opcode, funct7 (fp, funct3 is the rounding mode)
+#define M_FP_RS2 0xfff0007f  // opcode, funct7, rs2 (fp conversions)
+#define M_R4     0x0600007f  // opcode, fmt
+#define M_AMO    0xf800707f  // opcode, funct3, funct5 (atomics)
+
+#define OP(op, f3, f7)  ((op) | ((f3) << 12) | ((instruction)(f7) << 25))
+#define FP(f7, rs2)     (0x53 | ((rs2) << 20) | ((instruction)(f7) << 25))
+#define AMO(f3, f5)     (0x2f | ((f3) << 12) | ((instruction)(f5) << 27))
+
+/* the decoding of the old GetINSTYPE() & XX_execute() trees, first match wins */
+static const pattern patterns[] = {
+	/* RV32I / RV64I */
+	{INST_LB,     OP(0x03, 0, 0),    M_F3, IMM_I},
+	{INST_LH,     OP(0x03, 1, 0),    M_F3, IMM_I},
+	{INST_LW,     OP(0x03, 2, 0),    M_F3, IMM_I},
+	{INST_LD,     OP(0x03, 3, 0),    M_F3, IMM_I},
+	{INST_LBU,    OP(0x03, 4, 0),    M_F3, IMM_I},
+	{INST_LHU,    OP(0x03, 5, 0),    M_F3, IMM_I},
+	{INST_LWU,    OP(0x03, 6, 0),    M_F3, IMM_I},
+	{INST_SB,     OP(0x23, 0, 0),    M_F3, IMM_S},
+	{INST_SH,     OP(0x23, 1, 0),    M_F3, IMM_S},
+	{INST_SW,     OP(0x23, 2, 0),    M_F3, IMM_S},
+	{INST_SD,     OP(0x23, 3, 0),    M_F3, IMM_S},
+	{INST_ADD,    OP(0x33, 0, 0x00), M_F7, IMM_I},
+	{INST_SUB,    OP(0x33, 0, 0x20), M_F7, IMM_I},
+	{INST_SLL,    OP(0x33, 1, 0x00), M_F7, IMM_I},
+	{INST_SLT,    OP(0x33, 2, 0x00), M_F7, IMM_I},
+	{INST_SLTU,   OP(0x33, 3, 0x00), M_F7, IMM_I},
+	{INST_XOR,    OP(0x33, 4, 0x00), M_F7, IMM_I},
+	{INST_SRL,    OP(0x33, 5, 0x00), M_F7, IMM_I},
+	{INST_SRA,    OP(0x33, 5, 0x20), M_F7, IMM_I},
+	{INST_OR,     OP(0x33, 6, 0x00), M_F7, IMM_I},
+	{INST_AND,    OP(0x33, 7, 0x00), M_F7, IMM_I},
+	{INST_ADDI,   OP(0x13, 0, 0),    M_F3, IMM_I},
+	{INST_SLTI,   OP(0x13, 2, 0),    M_F3, IMM_I},
+	{INST_SLTIU,  OP(0x13, 3, 0),    M_F3, IMM_I},
+	{INST_XORI,   OP(0x13, 4, 0),    M_F3, IMM_I},
+	{INST_ORI,    OP(0x13, 6, 0),    M_F3, IMM_I},
+	{INST_ANDI,   OP(0x13, 7, 0),    M_F3, IMM_I},
+	{INST_SLLI,   OP(0x13, 1, 0x00), M_F6, IMM_SHAMT64},
+	{INST_SRLI,   OP(0x13, 5, 0x00), M_F6, IMM_SHAMT64},
+	{INST_SRAI,   OP(0x13, 5, 0x20), M_F6, IMM_SHAMT64},
+	{INST_ADDW,   OP(0x3b, 0, 0x00), M_F7, IMM_I},
+	{INST_SUBW,   OP(0x3b, 0, 0x20), M_F7, IMM_I},
+	{INST_SLLW,   OP(0x3b, 1, 0),    M_F3, IMM_I},
+	{INST_SRLW,   OP(0x3b, 5, 0x00), M_F7, IMM_I},
+	{INST_SRAW,   OP(0x3b, 5, 0x20), M_F7, IMM_I},
+	{INST_ADDIW,  OP(0x1b, 0, 0),    M_F3, IMM_I},
+	{INST_SLLIW,  OP(0x1b, 1, 0),    M_F3, IMM_SHAMT32},
+	{INST_SRLIW,  OP(0x1b, 5, 0x00), M_F7, IMM_SHAMT32},
+	{INST_SRAIW,  OP(0x1b, 5, 0x20), M_F7, IMM_SHAMT32},
+	{INST_LUI,    OP(0x37, 0, 0),    M_OP, IMM_U},
+	{INST_AUIPC,  OP(0x17, 0, 0),    M_OP, IMM_U},
+	{INST_BEQ,    OP(0x63, 0, 0),    M_F3, IMM_SB},
+	{INST_BNE,    OP(0x63, 1, 0),    M_F3, IMM_SB},
+	{INST_BLT,    OP(0x63, 4, 0),    M_F3, IMM_SB},
+	{INST_BGE,    OP(0x63, 5, 0),    M_F3, IMM_SB},
+	{INST_BLTU,   OP(0x63, 6, 0),    M_F3, IMM_SB},
+	{INST_BGEU,   OP(0x63, 7, 0),    M_F3, IMM_SB},
+	{INST_JAL,    OP(0x6f, 0, 0),    M_OP, IMM_UJ},
+	{INST_JALR,   OP(0x67, 0, 0),    M_F3, IMM_I},
+	{INST_SCALL,  OP(0x73, 0, 0),    M_F3, IMM_I},
+
+	/* RV32M / RV64M, the word ops other than mulw only look at funct3 */
+	{INST_MUL,    OP(0x33, 0, 0x01), M_F7, IMM_I},
+	{INST_MULH,   OP(0x33, 1, 0x01), M_F7, IMM_I},
+	{INST_MULHSU, OP(0x33, 2, 0x01), M_F7, IMM_I},
+	{INST_MULHU,  OP(0x33, 3, 0x01), M_F7, IMM_I},
+	{INST_DIV,    OP(0x33, 4, 0x01), M_F7, IMM_I},
+	{INST_DIVU,   OP(0x33, 5, 0x01), M_F7, IMM_I},
+	{INST_REM,    OP(0x33, 6, 0x01), M_F7, IMM_I},
+	{INST_REMU,   OP(0x33, 7, 0x01), M_F7, IMM_I},
+	{INST_MULW,   OP(0x3b, 0, 0x01), M_F7, IMM_I},
+	{INST_DIVW,   OP(0x3b, 4, 0),    M_F3, IMM_I},
+	{INST_DIVUW,  OP(0x3b, 5, 0x01), M_F7, IMM_I},
+	{INST_REMW,   OP(0x3b, 6, 0),    M_F3, IMM_I},
+	{INST_REMUW,  OP(0x3b, 7, 0),    M_F3, IMM_I},
+
+	/* RV32F / RV64F */
+	{INST_FLW,       OP(0x07, 2, 0),    M_F3,     IMM_I},
+	{INST_FSW,       OP(0x27, 2, 0),    M_F3,     IMM_S},
+	{INST_FADD_S,    FP(0x00, 0),       M_FP,     IMM_I},
+	{INST_FSUB_S,    FP(0x04, 0),       M_FP,     IMM_I},
+	{INST_FMUL_S,    FP(0x08, 0),       M_FP,     IMM_I},
+	{INST_FDIV_S,    FP(0x0c, 0),       M_FP,     IMM_I},
+	{INST_FSQRT_S,   FP(0x2c, 0),       M_FP,     IMM_I},
+	{INST_FSGNJ_S,   OP(0x53, 0, 0x10), M_F7,     IMM_I},
+	{INST_FSGNJN_S,  OP(0x53, 1, 0x10), M_F7,     IMM_I},
+	{INST_FSGNJX_S,  OP(0x53, 2, 0x10), M_F7,     IMM_I},
+	{INST_FMIN_S,    OP(0x53, 0, 0x14), M_F7,     IMM_I},
+	{INST_FMAX_S,    OP(0x53, 1, 0x14), M_F7,     IMM_I},
+	{INST_FLE_S,     OP(0x53, 0, 0x50), M_F7,     IMM_I},
+	{INST_FLT_S,     OP(0x53, 1, 0x50), M_F7,     IMM_I},
+	{INST_FEQ_S,     OP(0x53, 2, 0x50), M_F7,     IMM_I},
+	{INST_FMV_X_S,   FP(0x70, 0),       M_FP,     IMM_I},
+	{INST_FMV_S_X,   FP(0x78, 0),       M_FP,     IMM_I},
+	{INST_FCVT_W_S,  FP(0x60, 0),       M_FP_RS2, IMM_I},
+	{INST_FCVT_WU_S, FP(0x60, 1),       M_FP_RS2, IMM_I},
+	{INST_FCVT_L_S,  FP(0x60, 2),       M_FP_RS2, IMM_I},
+	{INST_FCVT_LU_S, FP(0x60, 3),       M_FP_RS2, IMM_I},
+	{INST_FCVT_S_W,  FP(0x68, 0),       M_FP_RS2, IMM_I},
+	{INST_FCVT_S_WU, FP(0x68, 1),       M_FP_RS2, IMM_I},
+	{INST_FCVT_S_L,  FP(0x68, 2),       M_FP_RS2, IMM_I},
+	{INST_FCVT_S_LU, FP(0x68, 3),       M_FP_RS2, IMM_I},
+	{INST_FMADD_S,   OP(0x43, 0, 0),    M_R4,     IMM_RS3},
+	{INST_FMSUB_S,   OP(0x47, 0, 0),    M_R4,     IMM_RS3},
+	{INST_FNMSUB_S,  OP(0x4b, 0, 0),    M_R4,     IMM_RS3},
+	{INST_FNMADD_S,  OP(0x4f, 0, 0),    M_R4,     IMM_RS3},
+
+	/* RV32D */
+	{INST_FLD,       OP(0x07, 3, 0),    M_F3,     IMM_I},
+	{INST_FSD,       OP(0x27, 3, 0),    M_F3,     IMM_S},
+	{INST_FADD_D,    FP(0x01, 0),       M_FP,     IMM_I},
+	{INST_FSUB_D,    FP(0x05, 0),       M_FP,     IMM_I},
+	{INST_FMUL_D,    FP(0x09, 0),       M_FP,     IMM_I},
+	{INST_FDIV_D,    FP(0x0d, 0),       M_FP,     IMM_I},
+	{INST_FSQRT_D,   FP(0x2d, 0),       M_FP,     IMM_I},
+	{INST_FSGNJ_D,   OP(0x53, 0, 0x11), M_F7,     IMM_I},
+	{INST_FSGNJN_D,  OP(0x53, 1, 0x11), M_F7,     IMM_I},
+	{INST_FSGNJX_D,  OP(0x53, 2, 0x11), M_F7,     IMM_I},
+	{INST_FMIN_D,    OP(0x53, 0, 0x15), M_F7,     IMM_I},
+	{INST_FMAX_D,    OP(0x53, 1, 0x15), M_F7,     IMM_I},
+	{INST_FLE_D,     OP(0x53, 0, 0x51), M_F7,     IMM_I},
+	{INST_FLT_D,     OP(0x53, 1, 0x51), M_F7,     IMM_I},
+	{INST_FEQ_D,     OP(0x53, 2, 0x51), M_F7,     IMM_I},
+	{INST_FMV_X_D,   FP(0x71, 0),       M_FP,     IMM_I},
+	{INST_FMV_D_X,   FP(0x79, 0),       M_FP,     IMM_I},
+	{INST_FCVT_S_D,  FP(0x20, 0),       M_FP,     IMM_I},
+	{INST_FCVT_D_S,  FP(0x21, 0),       M_FP,     IMM_I},
+	{INST_FCVT_W_D,  FP(0x61, 0),       M_FP_RS2, IMM_I},
+	{INST_FCVT_WU_D, FP(0x61, 1),       M_FP_RS2, IMM_I},
+	{INST_FCVT_D_W,  FP(0x69, 0),       M_FP_RS2, IMM_I},
+	{INST_FCVT_D_WU, FP(0x69, 1),       M_FP_RS2, IMM_I},
+	{INST_FMADD_D,   OP(0x43, 0, 0x01), M_R4,     IMM_RS3},
+	{INST_FMSUB_D,   OP(0x47, 0, 0x01), M_R4,     IMM_RS3},
+	{INST_FNMSUB_D,  OP(0x4b, 0, 0x01), M_R4,     IMM_RS3},
+	{INST_FNMADD_D,  OP(0x4f, 0, 0x01), M_R4,     IMM_RS3},
+
+	/* RV32A / RV64A, aq and rl do not change the instruction */
+	{INST_LR_W,       AMO(2, 0x02),       M_AMO,    IMM_I},
+	{INST_SC_W,       AMO(2, 0x03),       M_AMO,    IMM_I},
+	{INST_AMOSWAP_W,  AMO(2, 0x01),       M_AMO,    IMM_I},
+	{INST_AMOADD_W,   AMO(2, 0x00),       M_AMO,    IMM_I},
+	{INST_AMOXOR_W,   AMO(2, 0x04),       M_AMO,    IMM_I},
+	{INST_AMOAND_W,   AMO(2, 0x0c),       M_AMO,    IMM_I},
+	{INST_AMOOR_W,    AMO(2, 0x08),       M_AMO,    IMM_I},
+	{INST_AMOMIN_W,   AMO(2, 0x10),       M_AMO,    IMM_I},
+	{INST_AMOMAX_W,   AMO(2, 0x14),       M_AMO,    IMM_I},
+	{INST_AMOMINU_W,  AMO(2, 0x18),       M_AMO,    IMM_I},
+	{INST_AMOMAXU_W,  AMO(2, 0x1c),       M_AMO,    IMM_I},
+	{INST_LR_D,       AMO(3, 0x02),       M_AMO,    IMM_I},
+	{INST_SC_D,       AMO(3, 0x03),       M_AMO,    IMM_I},
+	{INST_AMOSWAP_D,  AMO(3, 0x01),       M_AMO,    IMM_I},
+	{INST_AMOADD_D,   AMO(3, 0x00),       M_AMO,    IMM_I},
+	{INST_AMOXOR_D,   AMO(3, 0x04),       M_AMO,    IMM_I},
+	{INST_AMOAND_D,   AMO(3, 0x0c),       M_AMO,    IMM_I},
+	{INST_AMOOR_D,    AMO(3, 0x08),       M_AMO,    IMM_I},
+	{INST_AMOMIN_D,   AMO(3, 0x10),       M_AMO,    IMM_I},
+	{INST_AMOMAX_D,   AMO(3, 0x14),       M_AMO,    IMM_I},
+	{INST_AMOMINU_D,  AMO(3, 0x18),       M_AMO,    IMM_I},
+	{INST_AMOMAXU_D,  AMO(3, 0x1c),       M_AMO,    IMM_I},
+};
+#define PATTERN_NUM (sizeof(patterns) / sizeof(pattern))
+
+static const char* inst_name[INST_FALLBACK + 1] = {
+	#define INST(id, func, format) "INST_" #id,
+	#include "instruction_list.h"
+	#undef INST
+	"INST_TRAP",
+	"INST_FALLBACK",
+};
+
+static const char* imm_name[IMM_COUNT] = {
+	"IMM_I", "IMM_S", "IMM_SB", "IMM_U", "IMM_UJ", "IMM_SHAMT64", "IMM_SHAMT32", "IMM_RS3", "IMM_RAW"
+};
+
+static const char* type_name[NOT_DEFINED + 1] = {
+	"R_TYPE", "R4_TYPE", "I_TYPE", "S_TYPE", "SB_TYPE", "U_TYPE", "UJ_TYPE", "NOT_DEFINED"
+};
+
+// the type of the old GetINSTYPE()
+static INSTYPE instruction_type(int opcode, int funct3)
+{
+	switch(opcode)
+	{
+		case 0x33: case 0x53: case 0x3b: case 0x2f:
+			return R_TYPE;
+		case 0x43: case 0x47: case 0x4b: case 0x4f:
+			return R4_TYPE;
+		case 0x67: case 0x03: case 0x73: case 0x07:
+			return I_TYPE;
+		case 0x23: case 0x27:
+			return S_TYPE;
+		case 0x63:
+			return SB_TYPE;
+		case 0x37: case 0x17:
+			return U_TYPE;
+		case 0x6f:
+			return UJ_TYPE;
+		case 0x13: // shifts are R_TYPE
+			return funct3 == 1 || funct3 == 5 ? R_TYPE : I_TYPE;
+		case 0x1b:
+			if(funct3 == 1 || funct3 == 5)
+				return R_TYPE;
+			return funct3 == 0 ? I_TYPE : NOT_DEFINED;
+		default:
+			return NOT_DEFINED;
+	}
+}
+
+// the patterns that can match with the given opcode and funct3
+static const pattern* candidate[PATTERN_NUM];
+static int candidate_num;
+
+static INSTID match(instruction inst)
+{
+	for(int i = 0; i < candidate_num; i++)
+		if((inst & candidate[i]->mask) == candidate[i]->match)
+			return candidate[i]->id;
+	return INST_FALLBACK;
+}
+
+#define HIGH_BITS 12            // bits 20-31, the only ones besides opcode and funct3 a pattern may test
+#define MINOR_MAX (1 << 16)
+
+static unsigned char minor[MINOR_MAX];
+static int minor_num = 0;
+static Riscv64_decode_entry major[128][8];
+
+int main()
+{
+	IMMTYPE immediate[INST_FALLBACK + 1];
+	unsigned char all[1 << HIGH_BITS];  // id for every value of bits 20-31
+	unsigned char row[1 << HIGH_BITS];
+
+	for(int id = 0; id <= INST_FALLBACK; id++)
+		immediate[id] = id == INST_FALLBACK ? IMM_RAW : IMM_I;
+	for(int i = 0; i < PATTERN_NUM; i++)
+	{
+		if(patterns[i].mask & 0x000f8f80) // rd and rs1 never decide an instruction
+		{
+			fprintf(stderr, "gen_decode_table: pattern of %s tests rd or rs1\n", inst_name[patterns[i].id]);
+			exit(1);
+		}
+		immediate[patterns[i].id] = patterns[i].imm;
+	}
+
+	for(int opcode = 0; opcode < 128; opcode++)
+	{
+		for(int funct3 = 0; funct3 < 8; funct3++)
+		{
+			instruction low = opcode | (funct3 << 12);
+
+			candidate_num = 0;
+			for(int i = 0; i < PATTERN_NUM; i++)
+				if((low & patterns[i].mask & 0x000fffff) == (patterns[i].match & 0x000fffff))
+					candidate[candidate_num++] = &patterns[i];
+			for(int high = 0; high < (1 << HIGH_BITS); high++)
+				all[high] = match(low | (instruction)high << 20);
+
+			// the bits of 20-31 that change the instruction
+			int depend = 0;
+			for(int bit = 0; bit < HIGH_BITS; bit++)
+				for(int high = 0; high < (1 << HIGH_BITS); high++)
+					if(all[high] != all[high ^ (1 << bit)])
+					{
+						depend |= 1 << bit;
+						break;
+					}
+
+			int first = 0, last = -1;
+			if(depend)
+			{
+				first = __builtin_ctz(depend);
+				last  = 31 - __builtin_clz(depend);
+			}
+			int length = 1 << (last - first + 1);
+			for(int k = 0; k < length; k++)
+				row[k] = all[k << first];
+
+			// share identical rows
+			int base;
+			for(base = 0; base + length <= minor_num; base++)
+				if(memcmp(&minor[base], row, length) == 0)
+					break;
+			if(base + length > minor_num)
+			{
+				base = minor_num;
+				if(base + length > MINOR_MAX)
+				{
+					fprintf(stderr, "gen_decode_table: table too large\n");
+					exit(1);
+				}
+				memcpy(&minor[base], row, length);
+				minor_num += length;
+			}
+
+			major[opcode][funct3].base  = base;
+			major[opcode][funct3].mask  = length - 1;
+			major[opcode][funct3].shift = 20 + first;
+			major[opcode][funct3].type  = instruction_type(opcode, funct3);
+		}
+	}
+
+	printf("/* generated by gen_decode_table from \"gen_decode_table.c\", do not edit */\n\n");
+
+	printf("// indexed by opcode and funct3\n");
+	printf("static const Riscv64_decode_entry decode_major[128][8] = {\n");
+	for(int opcode = 0; opcode < 128; opcode++)
+	{
+		printf("\t{ // 0x%02x\n", opcode);
+		for(int funct3 = 0; funct3 < 8; funct3++)
+		{
+			Riscv64_decode_entry* e = &major[opcode][funct3];
+			printf("\t\t{%5d, 0x%03x, %2d, %s},\n", e->base, e->mask, e->shift, type_name[e->type]);
+		}
+		printf("\t},\n");
+	}
+	printf("};\n\n");
+
+	printf("// INSTID, rows of decode_major\n");
+	printf("static const unsigned char decode_minor[%d] = {", minor_num);
+	for(int i = 0; i < minor_num; i++)
+		printf("%s%3d,", i % 16 ? " " : "\n\t", minor[i]);
+	printf("\n};\n\n");
+
+	printf("// IMMTYPE of every INSTID\n");
+	printf("static const unsigned char decode_immediate[INST_FALLBACK + 1] = {\n");
+	for(int id = 0; id <= INST_FALLBACK; id++)
+		printf("\t%s, // %s\n", imm_name[immediate[id]], inst_name[id]);
+	printf("};\n");
+	return 0;
+}
@@ -0,0 +1,578 @@
+#include <limits.h>
+#include <stddef.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "hart.h"
+#include "cache_model.h"
+#include "branch_predictor.h"
+#include "pipeline_model.h"
+#include "ooo_model.h"
+#include "simpoint.h"
+#include "checkpoint.h"
+#include "coherence.h"
+
+#define ENOSYS_GUEST 38
+#define EAGAIN_GUEST 11
+#define FUTEX_SLICE  10000000  // ns a futex wait sleeps before the hart looks at the exit again
+
+long int quantum_length = 0;
+hart_event_handler hart_event_taker = NULL;
+
+static long int host_futex(int* word, int op, int value, const struct timespec* timeout)
+{
+	return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+static Riscv64_hart_sync* sync_of(Riscv64_memory* riscv_memory)
+{
+	return &riscv_memory->process->harts->sync[riscv_memory->hart_id];
+}
+
+long int hart_cycles(Riscv64_memory* riscv_memory)
+{
+	if(riscv_memory->process->harts == NULL)
+		return PIPELINE_CYCLES(riscv_memory);
+	return PIPELINE_CYCLES(riscv_memory) + sync_of(riscv_memory)->offset;
+}
+
+
+/*********************************************/
+/*                                           */
+/* quanta                                    */
+/*                                           */
+/*********************************************/
+
+#ifdef PIPELINE_MODEL
+static inline bool quanta(Riscv64_memory* riscv_memory)
+{
+	return quantum_length > 0 && riscv_memory->process->harts != NULL;
+}
+
+// all of the functions below with the lock of the barrier
+static void set_quantum_end(Riscv64_memory* riscv_memory)
+{
+	PIPELINE_QUANTUM(riscv_memory)->end = riscv_memory->process->harts->quantum_end - sync_of(riscv_memory)->offset;
+}
+
+// every member got to the end of the quantum
+static void end_quantum(Riscv64_harts* harts)
+{
+	harts->arrived = 0;
+	harts->quantum_end += quantum_length;
+	harts->generation++;
+	pthread_cond_broadcast(&harts->next);
+}
+
+static void quantum_barrier(void* arg)
+{
+	Riscv64_memory* riscv_memory = (Riscv64_memory*)arg;
+	Riscv64_memory* process = riscv_memory->process;
+	Riscv64_harts* harts = process->harts;
+	Riscv64_hart_sync* sync = sync_of(riscv_memory);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_mutex_lock(&harts->lock);
+	long int generation = harts->generation;
+	if(++harts->arrived == harts->members)
+		end_quantum(harts);
+	while(harts->generation == generation && !__atomic_load_n(&process->exit_happened, __ATOMIC_SEQ_CST))
+		pthread_cond_wait(&harts->next, &harts->lock);
+	if(harts->generation == generation)
+		PIPELINE_QUANTUM(riscv_memory)->end = LONG_MAX; // the program ends, nothing to wait for
+	else
+		set_quantum_end(riscv_memory);
+	pthread_mutex_unlock(&harts->lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sync->quanta++;
+	sync->waited += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+	take_hart_events(riscv_memory);
+}
+
+// the hart is at cycle on the clock of the harts, or at the start of the quantum if that is later
+static void join_quanta(Riscv64_memory* riscv_memory, long int cycle)
+{
+	Riscv64_harts* harts = riscv_memory->process->harts;
+	Riscv64_hart_sync* sync = sync_of(riscv_memory);
+	Riscv64_quantum* quantum = PIPELINE_QUANTUM(riscv_memory);
+	sync->offset = MAX(cycle, harts->quantum_end - quantum_length) - PIPELINE_CYCLES(riscv_memory);
+	sync->member = TRUE;
+	harts->members++;
+	quantum->handler = quantum_barrier;
+	quantum->arg = riscv_memory;
+	set_quantum_end(riscv_memory);
+}
+
+static void leave_quanta(Riscv64_memory* riscv_memory)
+{
+	Riscv64_harts* harts = riscv_memory->process->harts;
+	sync_of(riscv_memory)->member = FALSE;
+	harts->members--;
+	PIPELINE_QUANTUM(riscv_memory)->end = LONG_MAX;
+	if(harts->members > 0 && harts->arrived == harts->members)
+		end_quantum(harts);
+}
+#endif
+
+
+/*********************************************/
+/*                                           */
+/* events                                    */
+/*                                           */
+/*********************************************/
+
+// the hart the thread runs, NULL on hart 0
+static __thread Riscv64_hart* running_hart = NULL;
+
+static Riscv64_hart* hart_of(Riscv64_memory* riscv_memory)
+{
+	return (Riscv64_hart*)((byte*)riscv_memory - offsetof(Riscv64_hart, memory));
+}
+
+// drop the translations of [addr, addr + length) the hart of the memory has, TRUE if there were any
+static bool drop_code(Riscv64_memory* riscv_memory, reg64 addr, reg64 length)
+{
+	Riscv64_harts* harts = riscv_memory->process->harts;
+	if(riscv_memory->hart_id == 0)
+		return harts->code_written != NULL && harts->code_written(harts->code_write_arg, addr, length);
+	Riscv64_decode_cache* cache = hart_of(riscv_memory)->decode_cache;
+	long int before = cache->invalidated;
+	invalidate_decode_cache(cache, addr, length);
+	return cache->invalidated != before;
+}
+
+// the code write handler of the process once there are harts, on the thread of the hart that
+// stored: it drops its translations now, the others when they take the event
+static bool on_shared_code_write(void* arg, reg64 addr, reg64 length)
+{
+	Riscv64_memory* process = (Riscv64_memory*)arg;
+	Riscv64_memory* writer = running_hart != NULL ? &running_hart->memory : process;
+	Riscv64_harts* harts = process->harts;
+	for(int id = 0; id < MIN(__atomic_load_n(&harts->num, __ATOMIC_SEQ_CST), HART_MAX); id++)
+	{
+		Riscv64_hart_sync* sync = &harts->sync[id];
+		if(id == writer->hart_id || __atomic_load_n(&sync->ended, __ATOMIC_ACQUIRE))
+			continue;
+		if(!post_hart_event(writer, id, HART_EVENT_CODE, addr, length))
+			__atomic_store_n(&sync->code_lost, TRUE, __ATOMIC_RELEASE);
+	}
+	if(!drop_code(writer, addr, length))
+		return FALSE;
+	writer->code_invalidated = TRUE;
+	return TRUE;
+}
+
+bool post_hart_event(Riscv64_memory* riscv_memory, int to, int type, reg64 addr, int size)
+{
+	Riscv64_hart_sync* sync = &riscv_memory->process->harts->sync[to];
+	long int tail = __atomic_load_n(&sync->tail, __ATOMIC_RELAXED);
+	while(TRUE)
+	{
+		long int slot = tail & (HART_EVENTS - 1);
+		long int sequence = __atomic_load_n(&sync->sequence[slot], __ATOMIC_ACQUIRE);
+		if(sequence < tail)
+		{
+			__atomic_fetch_add(&sync->lost, 1, __ATOMIC_RELAXED);
+			return FALSE;
+		}
+		// the slot is free while its sequence is the tail, which the poster takes
+		if(sequence == tail && __atomic_compare_exchange_n(&sync->tail, &tail, tail + 1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+			Riscv64_hart_event* event = &sync->event[slot];
+			event->cycle = hart_cycles(riscv_memory);
+			event->addr = addr;
+			event->size = size;
+			event->type = type;
+			event->from = riscv_memory->hart_id;
+			__atomic_store_n(&sync->sequence[slot], tail + 1, __ATOMIC_RELEASE);
+			return TRUE;
+		}
+		if(sequence > tail)
+			tail = __atomic_load_n(&sync->tail, __ATOMIC_RELAXED);
+	}
+}
+
+int take_hart_events(Riscv64_memory* riscv_memory)
+{
+	if(riscv_memory->process->harts == NULL)
+		return 0;
+	Riscv64_hart_sync* sync = sync_of(riscv_memory);
+	if(__atomic_load_n(&sync->code_lost, __ATOMIC_RELAXED) && __atomic_exchange_n(&sync->code_lost, FALSE, __ATOMIC_ACQUIRE))
+		drop_code(riscv_memory, 0, riscv_memory->mem_size);
+	int taken = 0;
+	while(TRUE)
+	{
+		long int slot = sync->head & (HART_EVENTS - 1);
+		if(__atomic_load_n(&sync->sequence[slot], __ATOMIC_ACQUIRE) != sync->head + 1)
+			return taken;
+		Riscv64_hart_event event = sync->event[slot];
+		__atomic_store_n(&sync->sequence[slot], sync->head + HART_EVENTS, __ATOMIC_RELEASE);
+		sync->head++;
+		if(event.type == HART_EVENT_CODE)
+			drop_code(riscv_memory, event.addr, event.size);
+		else if(hart_event_taker != NULL)
+			hart_event_taker(riscv_memory, &event);
+		taken++;
+	}
+}
+
+bool poll_harts(Riscv64_memory* riscv_memory)
+{
+	take_hart_events(riscv_memory);
+	return __atomic_load_n(&riscv_memory->process->exit_happened, __ATOMIC_RELAXED);
+}
+
+
+/*********************************************/
+/*                                           */
+/* harts                                     */
+/*                                           */
+/*********************************************/
+
+// the loop of the call engine, till the hart or the program exits
+static long int run_hart_loop(Riscv64_hart* hart)
+{
+	Riscv64_register* riscv_register = &hart->registers;
+	Riscv64_memory* riscv_memory = &hart->memory;
+	Riscv64_memory* process = riscv_memory->process;
+	long int count = 0;
+	while(!riscv_memory->exit_happened && !__atomic_load_n(&process->exit_happened, __ATOMIC_RELAXED))
+	{
+		take_hart_events(riscv_memory);
+		reg64 pc = get_register_pc(riscv_register);
+		Riscv64_decoded* decoded = lookup_decode_cache(hart->decode_cache, riscv_memory, pc);
+		CACHE_FETCH(riscv_memory, pc, sizeof(instruction));
+		register_pc_self_increase(riscv_register);
+		decoded->handler(decoded, riscv_register, riscv_memory);
+		PIPELINE_RETIRE(riscv_memory, decoded, pc, riscv_register->pc);
+		count++;
+	}
+	return count;
+}
+
+static void* run_hart(void* arg)
+{
+	Riscv64_hart* hart = (Riscv64_hart*)arg;
+	Riscv64_memory* riscv_memory = &hart->memory;
+	Riscv64_memory* process = riscv_memory->process;
+	running_hart = hart;
+	// a fault of the hart ends the program as it does on hart 0, the hart is not counted
+	// unless its own instructions ran to the end
+	sigjmp_buf jump;
+	hart->count = 0;
+	if(sigsetjmp(jump, 1) == 0)
+	{
+		catch_faults(&jump);
+		hart->count = run_hart_loop(hart) + riscv_memory->fused_executed;
+		// a thread library joins the hart on this word, which may be a bad address too
+		if(hart->clear_tid != 0)
+		{
+			int* word = (int*)get_atomic_addr(riscv_memory, hart->clear_tid, sizeof(int), TRUE);
+			__atomic_store_n(word, 0, __ATOMIC_SEQ_CST);
+			host_futex(word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+		}
+	}
+	catch_faults(NULL);
+	#ifdef PIPELINE_MODEL
+	if(quanta(riscv_memory))
+	{
+		pthread_mutex_lock(&process->harts->lock);
+		leave_quanta(riscv_memory);
+		pthread_mutex_unlock(&process->harts->lock);
+	}
+	#endif
+	sync_of(riscv_memory)->cycles = hart_cycles(riscv_memory);
+	__atomic_store_n(&sync_of(riscv_memory)->ended, TRUE, __ATOMIC_RELEASE);
+	#ifdef CACHE_MODEL
+	leave_coherence(riscv_memory);
+	#endif
+	return NULL;
+}
+
+static void delete_hart(Riscv64_hart* hart)
+{
+	#ifdef CACHE_MODEL
+	delete_cache_model(hart->memory.cache_model);
+	#endif
+	#ifdef BRANCH_MODEL
+	delete_branch_model(hart->memory.branch_model);
+	#endif
+	#if defined(OOO_MODEL)
+	delete_ooo_model(hart->memory.ooo_model);
+	#elif defined(PIPELINE_MODEL)
+	delete_pipeline_model(hart->memory.pipeline_model);
+	#endif
+	delete_decode_cache(hart->decode_cache);
+	free(hart);
+}
+
+// the next id if there is one below HART_MAX, otherwise -1
+static int claim_hart_id(Riscv64_harts* harts)
+{
+	int id = __atomic_load_n(&harts->num, __ATOMIC_SEQ_CST);
+	do
+	{
+		if(id >= HART_MAX)
+			return -1;
+	}
+	while(!__atomic_compare_exchange_n(&harts->num, &id, id + 1, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+	return id;
+}
+
+// give back the id of a hart that did not start, unless a later clone took the next one
+// (then it stays a hole stop_harts() skips)
+static void release_hart_id(Riscv64_harts* harts, int id)
+{
+	int next = id + 1;
+	__atomic_compare_exchange_n(&harts->num, &next, id, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+void hart_clone(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	Riscv64_memory* process = riscv_memory->process;
+	reg64 flags = riscv_register->x[10];
+	if(!(flags & CLONE_VM))
+	{
+		printf("clone: only threads (CLONE_VM) are simulated.\n");
+		riscv_register->x[10] = -ENOSYS_GUEST;
+		return;
+	}
+	#ifdef SOFT_MMU
+	printf("clone: not with MMU=soft.\n");
+	riscv_register->x[10] = -ENOSYS_GUEST;
+	return;
+	#endif
+	if(process->snapshot != NULL || checkpoint_trigger_num > 0 || bbv_interval > 0 || simpoint_file != NULL)
+	{
+		printf("clone: not with -repeat, -checkpoint, -bbv or -simpoint.\n");
+		riscv_register->x[10] = -ENOSYS_GUEST;
+		return;
+	}
+
+	// only hart 0 runs before the first clone
+	if(process->harts == NULL)
+	{
+		process->harts = (Riscv64_harts*) calloc (1, sizeof(Riscv64_harts));
+		if(process->harts == NULL)
+		{
+			printf("Memory error.\n");
+			raise_fault(riscv_memory, FAULT_HOST);
+		}
+		process->harts->num = 1;
+		for(int i = 0; i < HART_MAX; i++)
+			for(int slot = 0; slot < HART_EVENTS; slot++)
+				process->harts->sync[i].sequence[slot] = slot;
+		#ifdef CACHE_MODEL
+		init_coherence(process);
+		#endif
+		#ifdef PIPELINE_MODEL
+		if(quantum_length > 0)
+		{
+			pthread_mutex_init(&process->harts->lock, NULL);
+			pthread_cond_init(&process->harts->next, NULL);
+			process->harts->quantum_end = PIPELINE_CYCLES(process) + quantum_length;
+			join_quanta(process, PIPELINE_CYCLES(process));
+		}
+		#endif
+		// a store into code drops the translations of every hart
+		process->harts->code_written = process->code_written;
+		process->harts->code_write_arg = process->code_write_arg;
+		set_code_write_handler(process, on_shared_code_write, process);
+	}
+	Riscv64_harts* harts = process->harts;
+	Riscv64_hart* hart = (Riscv64_hart*) calloc (1, sizeof(Riscv64_hart));
+	int id = hart != NULL ? claim_hart_id(harts) : -1;
+	if(id < 0)
+	{
+		free(hart);
+		riscv_register->x[10] = -EAGAIN_GUEST;
+		return;
+	}
+
+	hart->id = id;
+	hart->registers = *riscv_register;
+	hart->registers.a0 = 0;
+	if(riscv_register->x[11] != 0)
+		hart->registers.sp = riscv_register->x[11];
+	if(flags & CLONE_SETTLS)
+		hart->registers.tp = riscv_register->x[13];
+	if(flags & CLONE_CHILD_CLEARTID)
+		hart->clear_tid = riscv_register->x[14];
+
+	hart->memory = *process;
+	Riscv64_memory* memory = &hart->memory;
+	memory->harts = NULL;
+	memory->hart_id = id;
+	memory->snapshot = NULL;
+	memory->code_written = NULL;
+	memory->code_write_arg = NULL;
+	memory->fault_register = &hart->registers;
+	memory->exit_happened = FALSE;
+	memory->exit_code = 0;
+	memory->fused_executed = 0;
+	memory->reserved = FALSE;
+	#ifdef CACHE_MODEL
+	init_cache_model(&memory->cache_model);
+	join_coherence(memory);
+	#endif
+	#ifdef BRANCH_MODEL
+	init_branch_model(&memory->branch_model);
+	#endif
+	#if defined(OOO_MODEL)
+	init_ooo_model(&memory->ooo_model);
+	#elif defined(PIPELINE_MODEL)
+	init_pipeline_model(&memory->pipeline_model);
+	#endif
+	init_decode_cache(&hart->decode_cache, memory);
+
+	if(flags & CLONE_PARENT_SETTID)
+		__atomic_store_n((int*)get_atomic_addr(riscv_memory, riscv_register->x[12], sizeof(int), TRUE), id, __ATOMIC_SEQ_CST);
+	if(flags & CLONE_CHILD_SETTID)
+		__atomic_store_n((int*)get_atomic_addr(riscv_memory, riscv_register->x[14], sizeof(int), TRUE), id, __ATOMIC_SEQ_CST);
+
+	#ifdef PIPELINE_MODEL
+	if(quanta(memory))
+	{
+		pthread_mutex_lock(&harts->lock);
+		join_quanta(memory, hart_cycles(riscv_memory));
+		pthread_mutex_unlock(&harts->lock);
+	}
+	#endif
+
+	if(pthread_create(&hart->thread, NULL, run_hart, hart) != 0)
+	{
+		#ifdef PIPELINE_MODEL
+		if(quanta(memory))
+		{
+			pthread_mutex_lock(&harts->lock);
+			leave_quanta(memory);
+			pthread_mutex_unlock(&harts->lock);
+		}
+		#endif
+		#ifdef CACHE_MODEL
+		leave_coherence(memory);
+		#endif
+		delete_hart(hart);
+		release_hart_id(harts, id);
+		riscv_register->x[10] = -EAGAIN_GUEST;
+		return;
+	}
+	// stop_harts() gets to it after the hart that cloned it, which had set it
+	__atomic_store_n(&harts->hart[id], hart, __ATOMIC_RELEASE);
+	riscv_register->x[10] = id;
+}
+
+void hart_exit_group(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	exit_program(riscv_memory, (int)riscv_register->x[10]);
+}
+
+void exit_program(Riscv64_memory* riscv_memory, int exit_code)
+{
+	Riscv64_memory* process = riscv_memory->process;
+	__atomic_store_n(&process->exit_code, exit_code, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&process->exit_happened, TRUE, __ATOMIC_SEQ_CST);
+	riscv_memory->exit_happened = TRUE;
+	riscv_memory->exit_code = exit_code;
+}
+
+void hart_futex(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	int* word = (int*)get_atomic_addr(riscv_memory, riscv_register->x[10], sizeof(int), FALSE);
+	int value = (int)riscv_register->x[12];
+	switch(riscv_register->x[11] & FUTEX_CMD_MASK)
+	{
+		case FUTEX_WAIT:
+		{
+			// the guest timeout is not kept, a wake up that comes early is allowed
+			struct timespec slice = {0, FUTEX_SLICE};
+			#ifdef PIPELINE_MODEL
+			// the others do not wait for a sleeping hart
+			bool member = quanta(riscv_memory) && sync_of(riscv_memory)->member;
+			if(member)
+			{
+				pthread_mutex_lock(&riscv_memory->process->harts->lock);
+				leave_quanta(riscv_memory);
+				pthread_mutex_unlock(&riscv_memory->process->harts->lock);
+			}
+			#endif
+			if(host_futex(word, FUTEX_WAIT_PRIVATE, value, &slice) != 0 && errno == EAGAIN)
+				riscv_register->x[10] = -EAGAIN_GUEST;
+			else
+				riscv_register->x[10] = 0;
+			#ifdef PIPELINE_MODEL
+			if(member)
+			{
+				pthread_mutex_lock(&riscv_memory->process->harts->lock);
+				join_quanta(riscv_memory, hart_cycles(riscv_memory));
+				pthread_mutex_unlock(&riscv_memory->process->harts->lock);
+			}
+			#endif
+			break;
+		}
+		case FUTEX_WAKE:
+			riscv_register->x[10] = host_futex(word, FUTEX_WAKE_PRIVATE, value, NULL);
+			break;
+		default:
+			riscv_register->x[10] = -ENOSYS_GUEST;
+	}
+}
+
+long int stop_harts(Riscv64_memory* riscv_memory)
+{
+	Riscv64_harts* harts = riscv_memory->harts;
+	if(harts == NULL)
+		return 0;
+	__atomic_store_n(&riscv_memory->exit_happened, TRUE, __ATOMIC_SEQ_CST);
+	#ifdef PIPELINE_MODEL
+	if(quantum_length > 0)
+	{
+		// wake the harts at the barrier
+		pthread_mutex_lock(&harts->lock);
+		pthread_cond_broadcast(&harts->next);
+		pthread_mutex_unlock(&harts->lock);
+	}
+	#endif
+
+	// a hart clones only harts with greater ids, joined after it
+	long int count = 0;
+	int started = 0;
+	for(int id = 1; id < MIN(__atomic_load_n(&harts->num, __ATOMIC_SEQ_CST), HART_MAX); id++)
+	{
+		Riscv64_hart* hart = __atomic_load_n(&harts->hart[id], __ATOMIC_ACQUIRE);
+		if(hart == NULL)
+			continue;
+		pthread_join(hart->thread, NULL);
+		count += hart->count;
+		started++;
+		delete_hart(hart);
+	}
+	printf("harts: %d started, %ld instructions executed by them\n", started, count);
+	for(int id = 0; id < MIN(harts->num, HART_MAX); id++)
+		if(harts->sync[id].lost > 0)
+			printf("hart %d: %ld events lost on a full ring\n", id, harts->sync[id].lost);
+	#ifdef CACHE_MODEL
+	delete_coherence(riscv_memory);
+	#endif
+	#ifdef PIPELINE_MODEL
+	if(quantum_length > 0)
+	{
+		harts->sync[0].cycles = hart_cycles(riscv_memory);
+		printf("quanta: %ld cycles each, %ld ended\n", quantum_length, harts->generation);
+		for(int id = 0; id < MIN(harts->num, HART_MAX); id++)
+			if(id == 0 || harts->hart[id] != NULL)
+				printf("hart %d: %ld cycles, %ld quanta, %.3f ms at the barrier\n", id, harts->sync[id].cycles,
+				       harts->sync[id].quanta, harts->sync[id].waited / 1e6);
+		pthread_cond_destroy(&harts->next);
+		pthread_mutex_destroy(&harts->lock);
+	}
+	#endif
+	free(harts);
+	riscv_memory->harts = NULL;
+	return count;
+}
@@ -0,0 +1,161 @@
+#ifndef __HART_H__
+#define __HART_H__
+#include <pthread.h>
+#include "memory_system.h"
+#include "decode_cache.h"
+
+/*********************************************/
+/*                                           */
+/* harts                                     */
+/*                                           */
+/*********************************************/
+/* The clone system call starts a hart: a    */
+/* host thread with registers of its own, a  */
+/* copy of the registers of its parent, on a */
+/* copy of the Riscv64_memory of the program */
+/* that shares the guest memory but has the  */
+/* exit status, the lr reservation, a decode */
+/* cache and the models of its own. There is */
+/* no lock between harts: lr, sc and amo are */
+/* host atomics on the guest memory, futex   */
+/* is the host futex on the guest word.      */
+/*                                           */
+/* Hart 0 is the program itself and runs on  */
+/* the engine of the build; the others step  */
+/* through their decode cache as the call    */
+/* engine does. exit ends the hart that      */
+/* calls it, the program with hart 0,        */
+/* exit_group ends the program. Only the     */
+/* flat memory, no snapshot (-repeat),       */
+/* checkpoints or profiling: clone fails     */
+/* there. The models print the statistics of */
+/* hart 0, but for the caches (see           */
+/* "coherence.h").                           */
+/*                                           */
+/* A store into code the caches translated   */
+/* faults on the page kept read-only for it  */
+/* (see mark_code_page()): the hart that     */
+/* stores drops its translations at once,    */
+/* the others get an event (below) they take */
+/* before their next instruction, hart 0 at  */
+/* its next branch or block.                 */
+/*********************************************/
+
+#define HART_MAX 64
+
+// flags of clone, the others are ignored
+#define CLONE_VM             0x00000100  // required
+#define CLONE_SETTLS         0x00080000
+#define CLONE_PARENT_SETTID  0x00100000
+#define CLONE_CHILD_CLEARTID 0x00200000
+#define CLONE_CHILD_SETTID   0x01000000
+
+typedef struct riscv64_hart{
+	int id;                          // the tid clone returned
+	pthread_t thread;
+	Riscv64_register registers;
+	Riscv64_memory memory;           // the view of the hart, see above
+	Riscv64_decode_cache* decode_cache;
+	reg64 clear_tid;                 // CLONE_CHILD_CLEARTID, zeroed and woken at its exit
+	long int count;                  // instructions executed, when it has ended
+} Riscv64_hart;
+
+/*********************************************/
+/*                                           */
+/* quanta and events                         */
+/*                                           */
+/*********************************************/
+/* With a timing model (TIMING=inorder or    */
+/* ooo) and "-quantum cycles" the harts run  */
+/* in step: each one runs its model to the   */
+/* end of the quantum and waits there for    */
+/* the others, then all of them start the    */
+/* next one. Their clocks are never more     */
+/* than a quantum apart, so the quantum      */
+/* trades the accuracy for the speed: a      */
+/* short one comes close to a lock-step      */
+/* machine, a long one waits less often. A   */
+/* hart leaves the barrier while it sleeps   */
+/* in futex and when it exits, and joins it  */
+/* at the start of the quantum that runs. A  */
+/* clone starts at the cycle of its parent.  */
+/*                                           */
+/* A hart posts events (of the caches, see   */
+/* the models, and of stores into code) to   */
+/* another without a lock: a bounded ring a  */
+/* hart, a sequence number a slot, which the */
+/* owner takes at each barrier and where the */
+/* poster asks for.                          */
+/*********************************************/
+
+#define HART_EVENTS 1024                 // a power of 2
+
+// a store into code: drop the translations of [addr, addr + size); the models number theirs from 1
+#define HART_EVENT_CODE 0
+
+typedef struct riscv64_hart_event{
+	long int cycle;                  // of the poster, on the clock of the harts
+	reg64 addr;
+	int size;                        // bytes at addr
+	int type;
+	int from;                        // id of the poster
+} Riscv64_hart_event;
+
+typedef struct riscv64_hart_sync{
+	long int offset;                 // the clock of the harts is the cycles of its model + offset
+	bool member;                     // of the barrier
+	// statistics
+	long int quanta;                 // barriers passed
+	long int waited;                 // ns at them
+	long int cycles;                 // on the clock of the harts, when it has ended
+	long int lost;                   // events posted to a full ring
+	bool code_lost;                  // an HART_EVENT_CODE among them: drop all the translations
+	bool ended;                      // nothing takes the events any more
+	// the events posted to it
+	Riscv64_hart_event event[HART_EVENTS];
+	long int sequence[HART_EVENTS];  // event + 1 once it is written, + HART_EVENTS once it is taken
+	long int head;                   // the next to take
+	long int tail;                   // the next to post
+} Riscv64_hart_sync;
+
+typedef struct riscv64_harts{
+	Riscv64_hart* hart[HART_MAX];    // hart[0] is the program, not in the table
+	int num;                         // ids handed out, hart[id] is set once its thread runs
+	// the barrier, with a quantum
+	pthread_mutex_t lock;
+	pthread_cond_t next;
+	int members;
+	int arrived;
+	long int quantum_end;            // on the clock of the harts
+	long int generation;             // quanta ended
+	// the code write handler of hart 0, from before the first clone
+	code_write_handler code_written;
+	void* code_write_arg;
+	Riscv64_hart_sync sync[HART_MAX];
+} Riscv64_harts;
+
+// the cycles of a quantum with a timing model, 0 (the default) for harts that do not wait for each other
+extern long int quantum_length;
+// what the harts do with the events of the models posted to them, NULL while no one posts
+typedef void (*hart_event_handler)(Riscv64_memory*, Riscv64_hart_event*);
+extern hart_event_handler hart_event_taker;
+
+// system calls, the registers and the memory of the calling hart, the result in a0
+void hart_clone(Riscv64_register*, Riscv64_memory*);
+void hart_exit_group(Riscv64_register*, Riscv64_memory*);
+// end the program with exit_code as exit_group does, from the hart of the memory
+void exit_program(Riscv64_memory*, int exit_code);
+void hart_futex(Riscv64_register*, Riscv64_memory*);
+// stop the harts of the program and wait for them, return the instructions they executed
+long int stop_harts(Riscv64_memory*);
+// the cycle of a hart on the clock of the harts
+long int hart_cycles(Riscv64_memory*);
+// post an event to hart to, FALSE if its ring is full; the owner drops the code of the
+// HART_EVENT_CODE it took, gives the others to hart_event_taker and returns how many there were
+bool post_hart_event(Riscv64_memory*, int to, int type, reg64 addr, int size);
+int take_hart_events(Riscv64_memory*);
+// for the engines of hart 0 once there are harts, at branches or between blocks: take the
+// events and tell if another hart ended the program
+bool poll_harts(Riscv64_memory*);
+
+#endif
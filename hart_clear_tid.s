@@ -0,0 +1,38 @@
+# A hart cloned with CLONE_CHILD_CLEARTID on a bad address faults when it
+# clears the word at its exit. That ends the program like any bad access,
+# and the hart is still joined and counted.
+# expect: Out of memory!
+# expect: harts: 1 started, 6 instructions executed by them
+# exit: 0
+  li a0, 0x200100       # CLONE_VM | CLONE_CHILD_CLEARTID
+  li a1, 0x80000        # the stack of the child
+  li a2, 0
+  li a3, 0
+  li a4, 1
+  slli a4, a4, 40       # the tid word, far beyond the guard pages
+  li a7, 220
+  ecall
+  beqz a0, child
+  blt a0, zero, missed
+  li s1, 0
+  li s2, 1000000
+wait:
+  li a7, 124            # sched_yield until the fault of the child ends the program
+  ecall
+  addi s1, s1, 1
+  blt s1, s2, wait
+missed:
+  li t0, 0x0a6f6e       # "no\n"
+  li a0, 1
+  li a1, 0x40100
+  sw t0, 0(a1)
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 1
+  li a7, 94
+  ecall
+child:
+  li a0, 0
+  li a7, 93
+  ecall
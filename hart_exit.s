@@ -0,0 +1,42 @@
+# exit_group on another hart ends the program while the first hart loops
+# with no system call: every engine looks at the exit after the branches.
+# The child waits for the loop to start.
+# expect: Program exits!
+# absent: no
+# exit: 0
+  li a0, 0x100          # CLONE_VM
+  li a1, 0x80000        # the child uses no stack
+  li a2, 0
+  li a3, 0
+  li a4, 0
+  li a7, 220
+  ecall
+  beqz a0, child
+  blt a0, zero, missed
+  li s1, 0
+  li s2, 50000000
+  li s3, 0x40000
+  li t0, 1
+loop:
+  sw t0, 0(s3)          # the loop runs
+  addi s1, s1, 1
+  blt s1, s2, loop
+missed:
+  li t0, 0x0a6f6e       # "no\n", the loop ran to its end
+  li a0, 1
+  li a1, 0x40100
+  sw t0, 0(a1)
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 1
+  li a7, 94
+  ecall
+child:
+  li s3, 0x40000
+wait:
+  lw t0, 0(s3)
+  beqz t0, wait
+  li a0, 7
+  li a7, 94
+  ecall
@@ -0,0 +1,67 @@
+# Up to HART_MAX - 1 clones start a hart, the next one gets EAGAIN and
+# takes no id: the ids of the harts that started are all joined at the exit.
+# The program waits on the tid words for all the children to end first.
+# expect: ok
+# expect: harts: 63 started, 378 instructions executed by them
+# exit: 0
+  li s1, 0
+  li s2, 63
+  li s4, 0x40000        # the tid words
+spawn:
+  li a0, 0x1200100      # CLONE_VM | CLONE_CHILD_SETTID | CLONE_CHILD_CLEARTID
+  li a1, 0x80000        # the children use no stack
+  li a2, 0
+  li a3, 0
+  mv a4, s4
+  li a7, 220
+  ecall
+  beqz a0, child
+  blt a0, zero, refused
+  addi s1, s1, 1
+  addi s4, s4, 4
+  j spawn
+refused:
+  li t0, -11            # -EAGAIN, once all the ids are taken
+  bne a0, t0, missed
+  bne s1, s2, missed
+  li s4, 0x40000
+  li s1, 0
+join:
+  lw t1, 0(s4)
+  beqz t1, joined
+  mv a0, s4
+  li a1, 128            # FUTEX_WAIT_PRIVATE
+  mv a2, t1
+  li a3, 0
+  li a7, 98
+  ecall
+  j join
+joined:
+  addi s1, s1, 1
+  addi s4, s4, 4
+  blt s1, s2, join
+  li t0, 0x0a6b6f       # "ok\n"
+  li a0, 1
+  li a1, 0x40100
+  sw t0, 0(a1)
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 0
+  li a7, 94
+  ecall
+missed:
+  li t0, 0x0a6f6e       # "no\n"
+  li a0, 1
+  li a1, 0x40100
+  sw t0, 0(a1)
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 1
+  li a7, 94
+  ecall
+child:
+  li a0, 0
+  li a7, 93
+  ecall
@@ -0,0 +1,96 @@
+# Each hart rewrites a function the other one runs in a loop: the first
+# hart the one of the child, then the child the one of the first hart. The
+# loop goes on till the function returns 2, so it ends only if the store
+# dropped the translations of the other hart too.
+# expect: ok
+# absent: no
+# exit: 0
+  li s2, 0x40000        # +0 the tid word, +4 the child runs fa, +8 the program runs fb
+  li s6, 0x00200513     # addi a0, zero, 2
+  li s7, 10000000       # iterations before giving up
+  li a0, 0x1200100      # CLONE_VM | CLONE_CHILD_SETTID | CLONE_CHILD_CLEARTID
+  li a1, 0x80000        # the child uses no stack
+  li a2, 0
+  li a3, 0
+  mv a4, s2
+  li a7, 220
+  ecall
+  beqz a0, child
+  blt a0, zero, missed
+started:
+  lw t0, 4(s2)          # wait for the child to run fa
+  beqz t0, started
+  li s1, fa
+  sw s6, 0(s1)
+  li s1, 0
+main_loop:
+  jal fb
+  li t0, 1
+  sw t0, 8(s2)          # the program runs fb
+  li t0, 2
+  beq a0, t0, join
+  addi s1, s1, 1
+  blt s1, s7, main_loop
+  j missed
+join:
+  lw t1, 0(s2)          # wait for the child to end
+  beqz t1, joined
+  mv a0, s2
+  li a1, 128            # FUTEX_WAIT_PRIVATE
+  mv a2, t1
+  li a3, 0
+  li a7, 98
+  ecall
+  j join
+joined:
+  lw t0, 12(s2)
+  bnez t0, missed
+  li t0, 0x0a6b6f       # "ok\n"
+  li a1, 0x40100
+  sw t0, 0(a1)
+  li a0, 1
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 0
+  li a7, 94
+  ecall
+missed:
+  li t0, 0x0a6f6e       # "no\n"
+  li a1, 0x40100
+  sw t0, 0(a1)
+  li a0, 1
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 1
+  li a7, 94
+  ecall
+child:
+  li s1, 0
+child_loop:
+  jal fa
+  li t0, 1
+  sw t0, 4(s2)          # the child runs fa
+  li t0, 2
+  beq a0, t0, patch
+  addi s1, s1, 1
+  blt s1, s7, child_loop
+  li t0, 1
+  sw t0, 12(s2)         # the child missed the store
+  j child_exit
+patch:
+  lw t0, 8(s2)          # wait for the program to run fb
+  beqz t0, patch
+  li s1, fb
+  sw s6, 0(s1)
+child_exit:
+  li a0, 0
+  li a7, 93
+  ecall
+fa:
+  addi a0, zero, 1
+  ret
+fb:
+  addi a0, zero, 1
+  ret
@@ -0,0 +1,109 @@
+# The benchmark of harts_scaling.sh: reads a number of harts N (a power of
+# 2 up to 32) from stdin and splits 1920000 rounds of a loop between N
+# harts it clones; the program waits for them on their tid words, checks
+# the rounds they counted and prints "ok".
+  li a0, 0
+  li a1, 0x40000
+  li a2, 8
+  li a7, 63             # read
+  ecall
+  li s0, 0              # N
+  li t2, 0x40000
+  add t3, t2, a0
+  li t1, 10
+digits:
+  bge t2, t3, parsed
+  lbu t0, 0(t2)
+  addi t0, t0, -48
+  bgeu t0, t1, parsed   # not a digit
+  slli t4, s0, 3
+  slli t5, s0, 1
+  add s0, t4, t5
+  add s0, s0, t0
+  addi t2, t2, 1
+  j digits
+parsed:
+  beqz s0, missed
+  li s8, 1920000        # rounds of a hart, 1920000 / N
+  mv t0, s0
+split:
+  li t1, 1
+  beq t0, t1, spawn_all
+  srli s8, s8, 1
+  srli t0, t0, 1
+  j split
+spawn_all:
+  li s9, 0x40010        # the rounds counted by all the harts
+  li s4, 0x40100        # the tid words
+  li s10, 0x50000       # a line of its own a hart
+  li s1, 0
+spawn:
+  li a0, 0x1200100      # CLONE_VM | CLONE_CHILD_SETTID | CLONE_CHILD_CLEARTID
+  li a1, 0x80000        # the harts use no stack
+  li a2, 0
+  li a3, 0
+  mv a4, s4
+  li a7, 220
+  ecall
+  beqz a0, worker
+  blt a0, zero, missed
+  addi s1, s1, 1
+  addi s4, s4, 4
+  addi s10, s10, 64
+  blt s1, s0, spawn
+  li s4, 0x40100
+  li s1, 0
+join:
+  lw t1, 0(s4)
+  beqz t1, joined
+  mv a0, s4
+  li a1, 128            # FUTEX_WAIT_PRIVATE
+  mv a2, t1
+  li a3, 0
+  li a7, 98
+  ecall
+  j join
+joined:
+  addi s1, s1, 1
+  addi s4, s4, 4
+  blt s1, s0, join
+  lw t0, 0(s9)
+  li t1, 1920000
+  bne t0, t1, missed
+  li t0, 0x0a6b6f       # "ok\n"
+  li a1, 0x40020
+  sw t0, 0(a1)
+  li a0, 1
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 0
+  li a7, 94
+  ecall
+missed:
+  li t0, 0x0a6f6e       # "no\n"
+  li a1, 0x40020
+  sw t0, 0(a1)
+  li a0, 1
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 1
+  li a7, 94
+  ecall
+worker:
+  li t1, 0
+  li t4, 0
+round:
+  addi t1, t1, 1
+  xor t4, t4, t1
+  slli t5, t4, 1
+  add t4, t4, t5
+  ld t6, 0(s10)
+  add t6, t6, t4
+  sd t6, 0(s10)
+  blt t1, s8, round
+  amoadd.w zero, t1, (s9)
+  li a0, 0
+  li a7, 93
+  ecall
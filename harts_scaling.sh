@@ -0,0 +1,29 @@
+#!/bin/sh
+# Run harts_scaling.elf, the same rounds split between 1 to 32 harts, in
+# quanta of the given cycles (1000 by default) and print for each number of
+# harts the simulated cycles of the program (its longest hart), the speedup
+# on them over one hart, the quanta, the mean ms a hart waited at the
+# barrier, and the host seconds and MIPS. It needs a simulator built with a
+# timing model (make TIMING=inorder or TIMING=ooo).
+#
+#   sh harts_scaling.sh [quantum]
+simulator=${SIMULATOR:-./simulator}
+quantum=${1:-1000}
+echo "quantum $quantum cycles"
+rows=
+for harts in 1 2 4 8 16 32; do
+	echo "$harts" | $simulator -quantum "$quantum" harts_scaling.elf > harts_scaling.log 2>&1
+	if ! grep -qx ok harts_scaling.log || ! grep -q "^quanta:" harts_scaling.log; then
+		echo "$harts harts: failed, see harts_scaling.log" >&2
+		exit 1
+	fi
+	rows="$rows$(awk -v harts="$harts" '
+		/^quanta:/ { quanta = $5 }
+		/^hart [0-9]+:/ { if($3 > cycles) cycles = $3; if($2 != "0:") { waited += $7; n++ } }
+		/ seconds, .* MIPS$/ { seconds = $1; mips = $3 }
+		END { printf "%6d %13d %8s %9d %11.1f %9.3f %7.2f\n", harts, cycles, "-", quanta, n ? waited / n : 0, seconds, mips }
+	' harts_scaling.log)
+"
+done
+echo " harts        cycles  speedup    quanta  barrier ms   seconds    MIPS"
+printf "%s" "$rows" | awk '{ if(NR == 1) one = $2; $3 = sprintf("%.2f", one / $2); printf "%6d %13d %8s %9d %11.1f %9.3f %7.2f\n", $1, $2, $3, $4, $5, $6, $7 }'
@@ -0,0 +1,173 @@
+/*******************************************************************/
+/* The list of every concrete instruction the simulator knows.     */
+/* Each entry is INST(ID, function, FORMAT):                       */
+/*                                                                 */
+/*   ID       - suffix of the enum value INST_<ID>                 */
+/*   function - the implementation in "riscv_instruction.c"        */
+/*   FORMAT   - how the operands are handed to the function        */
+/*                                                                 */
+/*   RR      f(reg, rd, rs1, rs2)                                  */
+/*   RI      f(reg, rd, rs1, imm)     shifts carry shamt in imm    */
+/*   R1      f(reg, rd, rs1)                                       */
+/*   R4      f(reg, rd, rs1, rs2, rs3)                             */
+/*   MEM_RD  f(reg, mem, rd, rs1, imm)   loads, jalr               */
+/*   MEM_RS  f(reg, mem, rs1, rs2, imm)  stores, branches          */
+/*   UPPER   f(reg, mem, rd, imm)        lui, auipc, jal           */
+/*   SYS     f(reg, mem)                 scall                     */
+/*   AMO     f(reg, mem, rd, rs1, rs2)   lr, sc, amo               */
+/*                                                                 */
+/* The encoding of each is in "gen_decode_table.c".                */
+/*                                                                 */
+/* Include this file after defining INST, and #undef it after.     */
+/*******************************************************************/
+
+/* RV32I / RV64I */
+INST(LB,     lb,     MEM_RD)
+INST(LH,     lh,     MEM_RD)
+INST(LW,     lw,     MEM_RD)
+INST(LD,     ld,     MEM_RD)
+INST(LBU,    lbu,    MEM_RD)
+INST(LHU,    lhu,    MEM_RD)
+INST(LWU,    lwu,    MEM_RD)
+INST(SB,     sb,     MEM_RS)
+INST(SH,     sh,     MEM_RS)
+INST(SW,     sw,     MEM_RS)
+INST(SD,     sd,     MEM_RS)
+INST(ADD,    add,    RR)
+INST(SUB,    sub,    RR)
+INST(SLL,    sll,    RR)
+INST(SLT,    slt,    RR)
+INST(SLTU,   sltu,   RR)
+INST(XOR,    xor,    RR)
+INST(SRL,    srl,    RR)
+INST(SRA,    sra,    RR)
+INST(OR,     or,     RR)
+INST(AND,    and,    RR)
+INST(ADDI,   addi,   RI)
+INST(SLTI,   slti,   RI)
+INST(SLTIU,  sltiu,  RI)
+INST(XORI,   xori,   RI)
+INST(ORI,    ori,    RI)
+INST(ANDI,   andi,   RI)
+INST(SLLI,   slli,   RI)
+INST(SRLI,   srli,   RI)
+INST(SRAI,   srai,   RI)
+INST(ADDW,   addw,   RR)
+INST(SUBW,   subw,   RR)
+INST(SLLW,   sllw,   RR)
+INST(SRLW,   srlw,   RR)
+INST(SRAW,   sraw,   RR)
+INST(ADDIW,  addiw,  RI)
+INST(SLLIW,  slliw,  RI)
+INST(SRLIW,  srliw,  RI)
+INST(SRAIW,  sraiw,  RI)
+INST(LUI,    lui,    UPPER)
+INST(AUIPC,  auipc,  UPPER)
+INST(BEQ,    beq,    MEM_RS)
+INST(BNE,    bne,    MEM_RS)
+INST(BLT,    blt,    MEM_RS)
+INST(BGE,    bge,    MEM_RS)
+INST(BLTU,   bltu,   MEM_RS)
+INST(BGEU,   bgeu,   MEM_RS)
+INST(JAL,    jal,    UPPER)
+INST(JALR,   jalr,   MEM_RD)
+INST(SCALL,  scall,  SYS)
+
+/* RV32M / RV64M */
+INST(MUL,    mul,    RR)
+INST(MULH,   mulh,   RR)
+INST(MULHSU, mulhsu, RR)
+INST(MULHU,  mulhu,  RR)
+INST(DIV,    divd,   RR)
+INST(DIVU,   divu,   RR)
+INST(REM,    rem,    RR)
+INST(REMU,   remu,   RR)
+INST(MULW,   mulw,   RR)
+INST(DIVW,   divw,   RR)
+INST(DIVUW,  divuw,  RR)
+INST(REMW,   remw,   RR)
+INST(REMUW,  remuw,  RR)
+
+/* RV32F / RV64F */
+INST(FLW,       flw,       MEM_RD)
+INST(FSW,       fsw,       MEM_RS)
+INST(FADD_S,    fadd_S,    RR)
+INST(FSUB_S,    fsub_S,    RR)
+INST(FMUL_S,    fmul_S,    RR)
+INST(FDIV_S,    fdiv_S,    RR)
+INST(FMIN_S,    fmin_S,    RR)
+INST(FMAX_S,    fmax_S,    RR)
+INST(FSQRT_S,   fsqrt_S,   RR)
+INST(FSGNJ_S,   fsgnj_S,   RR)
+INST(FSGNJN_S,  fsgnjn_S,  RR)
+INST(FSGNJX_S,  fsgnjx_S,  RR)
+INST(FEQ_S,     feq_S,     RR)
+INST(FLT_S,     flt_S,     RR)
+INST(FLE_S,     fle_S,     RR)
+INST(FMV_X_S,   fmv_X_S,   RR)
+INST(FMV_S_X,   fmv_S_X,   RR)
+INST(FCVT_W_S,  fcvt_W_S,  R1)
+INST(FCVT_WU_S, fcvt_WU_S, R1)
+INST(FCVT_L_S,  fcvt_L_S,  R1)
+INST(FCVT_LU_S, fcvt_LU_S, R1)
+INST(FCVT_S_W,  fcvt_S_W,  R1)
+INST(FCVT_S_WU, fcvt_S_WU, R1)
+INST(FCVT_S_L,  fcvt_S_L,  R1)
+INST(FCVT_S_LU, fcvt_S_LU, R1)
+INST(FMADD_S,   fmadd_S,   R4)
+INST(FMSUB_S,   fmsub_S,   R4)
+INST(FNMSUB_S,  fnmsub_S,  R4)
+INST(FNMADD_S,  fnmadd_S,  R4)
+
+/* RV32D */
+INST(FLD,       fld,       MEM_RD)
+INST(FSD,       fsd,       MEM_RS)
+INST(FADD_D,    fadd_D,    RR)
+INST(FSUB_D,    fsub_D,    RR)
+INST(FMUL_D,    fmul_D,    RR)
+INST(FDIV_D,    fdiv_D,    RR)
+INST(FMIN_D,    fmin_D,    RR)
+INST(FMAX_D,    fmax_D,    RR)
+INST(FSQRT_D,   fsqrt_D,   RR)
+INST(FSGNJ_D,   fsgnj_D,   RR)
+INST(FSGNJN_D,  fsgnjn_D,  RR)
+INST(FSGNJX_D,  fsgnjx_D,  RR)
+INST(FEQ_D,     feq_D,     RR)
+INST(FLT_D,     flt_D,     RR)
+INST(FLE_D,     fle_D,     RR)
+INST(FMV_X_D,   fmv_X_D,   RR)
+INST(FMV_D_X,   fmv_D_X,   RR)
+INST(FCVT_S_D,  fcvt_S_D,  R1)
+INST(FCVT_D_S,  fcvt_D_S,  R1)
+INST(FCVT_W_D,  fcvt_W_D,  R1)
+INST(FCVT_WU_D, fcvt_WU_D, R1)
+INST(FCVT_D_W,  fcvt_D_W,  R1)
+INST(FCVT_D_WU, fcvt_D_WU, R1)
+INST(FMADD_D,   fmadd_D,   R4)
+INST(FMSUB_D,   fmsub_D,   R4)
+INST(FNMSUB_D,  fnmsub_D,  R4)
+INST(FNMADD_D,  fnmadd_D,  R4)
+
+/* RV32A / RV64A, appended so that the ranges of the ids above stay as they are */
+INST(LR_W,      lr_W,      AMO)
+INST(SC_W,      sc_W,      AMO)
+INST(AMOSWAP_W, amoswap_W, AMO)
+INST(AMOADD_W,  amoadd_W,  AMO)
+INST(AMOXOR_W,  amoxor_W,  AMO)
+INST(AMOAND_W,  amoand_W,  AMO)
+INST(AMOOR_W,   amoor_W,   AMO)
+INST(AMOMIN_W,  amomin_W,  AMO)
+INST(AMOMAX_W,  amomax_W,  AMO)
+INST(AMOMINU_W, amominu_W, AMO)
+INST(AMOMAXU_W, amomaxu_W, AMO)
+INST(LR_D,      lr_D,      AMO)
+INST(SC_D,      sc_D,      AMO)
+INST(AMOSWAP_D, amoswap_D, AMO)
+INST(AMOADD_D,  amoadd_D,  AMO)
+INST(AMOXOR_D,  amoxor_D,  AMO)
+INST(AMOAND_D,  amoand_D,  AMO)
+INST(AMOOR_D,   amoor_D,   AMO)
+INST(AMOMIN_D,  amomin_D,  AMO)
+INST(AMOMAX_D,  amomax_D,  AMO)
+INST(AMOMINU_D, amominu_D, AMO)
+INST(AMOMAXU_D, amomaxu_D, AMO)
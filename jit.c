@@ -0,0 +1,759 @@
+#include "jit.h"
+#include "breakpoint.h"
+#include "cache_model.h"
+#include <stddef.h>
+#include <sys/mman.h>
+
+/*********************************************/
+/*                                           */
+/* initialization and gc                     */
+/*                                           */
+/*********************************************/
+
+// the jit whose code a fault on the guard pages is looked up in
+static Riscv64_jit* fault_jit = NULL;
+
+// the guest pc of the memory access at or before host_pc in the compiled code
+static bool jit_guest_pc(void* host_pc, reg64* guest_pc)
+{
+	Riscv64_jit* jit = fault_jit;
+	if(jit == NULL || jit->buffer == NULL || (byte*)host_pc < jit->buffer || (byte*)host_pc >= jit->buffer + jit->used
+	   || jit->fault_num == 0)
+		return FALSE;
+	long int offset = (byte*)host_pc - jit->buffer;
+	long int low = 0, high = jit->fault_num - 1;
+	while(low < high)
+	{
+		long int middle = (low + high + 1) / 2;
+		if(jit->fault_host[middle] <= offset)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	*guest_pc = jit->fault_pc[low];
+	return TRUE;
+}
+
+void init_jit(Riscv64_jit** jit)
+{
+	*jit = (Riscv64_jit*) malloc (sizeof(Riscv64_jit));
+	memset(*jit, 0, sizeof(Riscv64_jit));
+
+	#if defined(__x86_64__)
+	void* buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(buffer != MAP_FAILED)
+	{
+		(*jit)->buffer = (byte*)buffer;
+		(*jit)->size = JIT_BUFFER_SIZE;
+		fault_jit = *jit;
+		add_guest_pc_finder(jit_guest_pc);
+	}
+	else
+	{
+		printf("jit: can not map executable memory, running interpreted.\n");
+	}
+	#endif
+}
+
+void delete_jit(Riscv64_jit* jit)
+{
+	if(fault_jit == jit)
+		fault_jit = NULL;
+	if(jit->buffer != NULL)
+		munmap(jit->buffer, jit->size);
+	free(jit->fault_host);
+	free(jit->fault_pc);
+	free(jit);
+}
+
+void print_jit_stats(Riscv64_jit* jit)
+{
+	printf("jit: %ld blocks compiled, %ld bytes of host code, %ld native / %ld helper instructions, %ld blocks not compiled\n",
+	       jit->compiled, jit->used, jit->native, jit->helper, jit->failed);
+}
+
+
+#if defined(__x86_64__)
+
+/*********************************************/
+/*                                           */
+/* x86-64 encoder                            */
+/*                                           */
+/*********************************************/
+
+// host registers
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// condition codes
+enum { CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_S = 0x8, CC_NS = 0x9 };
+
+// r15 holds the Riscv64_register*, r14 the host address of guest memory,
+// [rsp] the Riscv64_memory*, these hold cached guest registers:
+#define CACHE_REG_NUM 4
+static const int cache_host_reg[CACHE_REG_NUM] = {RBX, RBP, R12, R13};
+
+#define REG_BASE   R15
+#define MEM_BASE   R14
+
+#define OFFSET_X(i) ((int)(offsetof(Riscv64_register, x) + sizeof(reg64) * (i)))
+#define OFFSET_PC   ((int)offsetof(Riscv64_register, pc))
+
+typedef struct jit_emitter{
+	byte* p;            // next byte
+	byte* end;          // end of the space for this block
+	bool overflow;
+	int host_of[32];    // host register caching x[i], or -1
+	Riscv64_jit* jit;   // for the guest pcs of the memory accesses
+	reg64 far_limit;    // mem_size + 2 * GUARD_SIZE, see FAR_FROM_MEMORY() in "memory_system.h"
+} Jit_emitter;
+
+static void emit8(Jit_emitter* e, int value)
+{
+	if(e->p < e->end)
+		*e->p++ = (byte)value;
+	else
+		e->overflow = TRUE;
+}
+
+static void emit32(Jit_emitter* e, unsigned int value)
+{
+	for(int i = 0; i < 4; i++)
+		emit8(e, (value >> (8 * i)) & 0xff);
+}
+
+static void emit64(Jit_emitter* e, reg64 value)
+{
+	emit32(e, (unsigned int)value);
+	emit32(e, (unsigned int)(value >> 32));
+}
+
+// REX prefix, only emitted when needed
+static void emit_rex(Jit_emitter* e, int w, int reg, int index, int base)
+{
+	int rex = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1) | ((base >> 3) & 1);
+	if(rex != 0x40)
+		emit8(e, rex);
+}
+
+// op dst, src  (register to register, "op r/m, r" form)
+static void emit_rr(Jit_emitter* e, int w, int opcode, int dst, int src)
+{
+	emit_rex(e, w, src, 0, dst);
+	emit8(e, opcode);
+	emit8(e, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+// op reg, [base + disp32]  or  op [base + disp32], reg
+static void emit_mem(Jit_emitter* e, int w, int opcode, int reg, int base, int disp)
+{
+	emit_rex(e, w, reg, 0, base);
+	emit8(e, opcode);
+	emit8(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+	if((base & 7) == RSP)
+		emit8(e, 0x24);
+	emit32(e, disp);
+}
+
+// op reg, [MEM_BASE + index], opcode may be a 0x0F two-byte opcode
+static void emit_guest_mem(Jit_emitter* e, int prefix, int w, int opcode, int reg, int index)
+{
+	if(prefix)
+		emit8(e, prefix);
+	emit_rex(e, w, reg, index, MEM_BASE);
+	if(opcode > 0xff)
+		emit8(e, opcode >> 8);
+	emit8(e, opcode & 0xff);
+	emit8(e, 0x04 | ((reg & 7) << 3));
+	emit8(e, ((index & 7) << 3) | (MEM_BASE & 7));
+}
+
+static void emit_mov_rr(Jit_emitter* e, int dst, int src)
+{
+	if(dst != src)
+		emit_rr(e, 1, 0x89, dst, src);
+}
+
+static void emit_mov_imm(Jit_emitter* e, int reg, reg64 value)
+{
+	if((long int)value == (long int)(int)value)
+	{
+		// mov r64, simm32
+		emit_rex(e, 1, 0, 0, reg);
+		emit8(e, 0xC7);
+		emit8(e, 0xC0 | (reg & 7));
+		emit32(e, (unsigned int)value);
+	}
+	else
+	{
+		// mov r64, imm64
+		emit_rex(e, 1, 0, 0, reg);
+		emit8(e, 0xB8 | (reg & 7));
+		emit64(e, value);
+	}
+}
+
+// op reg, simm32 with the /ext of opcode 0x81 (0 add, 1 or, 4 and, 5 sub, 6 xor, 7 cmp)
+static void emit_alu_imm(Jit_emitter* e, int w, int ext, int reg, int imm)
+{
+	emit_rex(e, w, 0, 0, reg);
+	emit8(e, 0x81);
+	emit8(e, 0xC0 | (ext << 3) | (reg & 7));
+	emit32(e, (unsigned int)imm);
+}
+
+// shift reg by imm8 (ext 4 shl, 5 shr, 7 sar)
+static void emit_shift_imm(Jit_emitter* e, int w, int ext, int reg, int imm)
+{
+	emit_rex(e, w, 0, 0, reg);
+	emit8(e, 0xC1);
+	emit8(e, 0xC0 | (ext << 3) | (reg & 7));
+	emit8(e, imm);
+}
+
+// shift reg by cl
+static void emit_shift_cl(Jit_emitter* e, int w, int ext, int reg)
+{
+	emit_rex(e, w, 0, 0, reg);
+	emit8(e, 0xD3);
+	emit8(e, 0xC0 | (ext << 3) | (reg & 7));
+}
+
+// movsxd dst, src32
+static void emit_movsxd(Jit_emitter* e, int dst, int src)
+{
+	emit_rex(e, 1, dst, 0, src);
+	emit8(e, 0x63);
+	emit8(e, 0xC0 | ((dst & 7) << 3) | (src & 7));
+}
+
+// rax = condition ? 1 : 0
+static void emit_setcc_rax(Jit_emitter* e, int cc)
+{
+	emit8(e, 0x0F);
+	emit8(e, 0x90 | cc);
+	emit8(e, 0xC0);
+	// movzx eax, al
+	emit8(e, 0x0F);
+	emit8(e, 0xB6);
+	emit8(e, 0xC0);
+}
+
+// jcc rel32, return the address of rel32 to patch
+static byte* emit_jcc(Jit_emitter* e, int cc)
+{
+	emit8(e, 0x0F);
+	emit8(e, 0x80 | cc);
+	byte* rel = e->p;
+	emit32(e, 0);
+	return rel;
+}
+
+static void patch_rel32(Jit_emitter* e, byte* rel)
+{
+	if(e->overflow)
+		return;
+	int value = (int)(e->p - (rel + 4));
+	memcpy(rel, &value, 4);
+}
+
+static void emit_call(Jit_emitter* e, void* function)
+{
+	emit8(e, 0x48);
+	emit8(e, 0xB8);
+	emit64(e, (reg64)function);
+	// call rax
+	emit8(e, 0xFF);
+	emit8(e, 0xD0);
+}
+
+static void emit_push(Jit_emitter* e, int reg)
+{
+	emit_rex(e, 0, 0, 0, reg);
+	emit8(e, 0x50 | (reg & 7));
+}
+
+static void emit_pop(Jit_emitter* e, int reg)
+{
+	emit_rex(e, 0, 0, 0, reg);
+	emit8(e, 0x58 | (reg & 7));
+}
+
+
+/*********************************************/
+/*                                           */
+/* guest registers                           */
+/*                                           */
+/*********************************************/
+
+static void load_guest(Jit_emitter* e, int host, int guest)
+{
+	if(e->host_of[guest] >= 0)
+		emit_mov_rr(e, host, e->host_of[guest]);
+	else
+		emit_mem(e, 1, 0x8B, host, REG_BASE, OFFSET_X(guest));
+}
+
+static void store_guest(Jit_emitter* e, int guest, int host)
+{
+	if(e->host_of[guest] >= 0)
+		emit_mov_rr(e, e->host_of[guest], host);
+	else
+		emit_mem(e, 1, 0x89, host, REG_BASE, OFFSET_X(guest));
+}
+
+// write the cached registers back to the register file
+static void flush_cache(Jit_emitter* e)
+{
+	for(int i = 0; i < 32; i++)
+		if(e->host_of[i] >= 0)
+			emit_mem(e, 1, 0x89, e->host_of[i], REG_BASE, OFFSET_X(i));
+}
+
+// read the cached registers from the register file
+static void reload_cache(Jit_emitter* e)
+{
+	for(int i = 0; i < 32; i++)
+		if(e->host_of[i] >= 0)
+			emit_mem(e, 1, 0x8B, e->host_of[i], REG_BASE, OFFSET_X(i));
+}
+
+static void store_pc(Jit_emitter* e, reg64 pc)
+{
+	emit_mov_imm(e, RAX, pc);
+	emit_mem(e, 1, 0x89, RAX, REG_BASE, OFFSET_PC);
+}
+
+// rax = x[rs1] + imm, the access after it faults on the guard pages if it leaves the memory:
+// remember its guest pc for that, an address too far for the guard pages is reported here
+static void emit_address(Jit_emitter* e, int rs1, int imm, reg64 pc)
+{
+	Riscv64_jit* jit = e->jit;
+	if(jit->fault_num == jit->fault_size)
+	{
+		jit->fault_size = jit->fault_size > 0 ? 2 * jit->fault_size : 1024;
+		jit->fault_host = (long int*) realloc (jit->fault_host, jit->fault_size * sizeof(long int));
+		jit->fault_pc = (reg64*) realloc (jit->fault_pc, jit->fault_size * sizeof(reg64));
+		if(jit->fault_host == NULL || jit->fault_pc == NULL)
+		{
+			printf("Memory error.\n");
+			exit(1);
+		}
+	}
+	jit->fault_host[jit->fault_num] = e->p - jit->buffer;
+	jit->fault_pc[jit->fault_num] = pc;
+	jit->fault_num++;
+
+	load_guest(e, RAX, rs1);
+	emit_alu_imm(e, 1, 0, RAX, imm);
+
+	// rax + GUARD_SIZE < far_limit or bad_guest_access(memory, rax)
+	emit_mov_imm(e, RDX, GUARD_SIZE);
+	emit_rr(e, 1, 0x01, RDX, RAX);
+	emit_mov_imm(e, RCX, e->far_limit);
+	emit_rr(e, 1, 0x39, RDX, RCX);
+	byte* near = emit_jcc(e, CC_B);
+	flush_cache(e);
+	emit_mov_rr(e, RSI, RAX);
+	store_pc(e, pc + sizeof(instruction));
+	emit_mem(e, 1, 0x8B, RDI, RSP, 0);
+	emit_call(e, (void*)bad_guest_access);
+	patch_rel32(e, near);
+}
+
+static void emit_epilogue(Jit_emitter* e)
+{
+	flush_cache(e);
+	emit_alu_imm(e, 1, 0, RSP, 8);
+	emit_pop(e, R13);
+	emit_pop(e, R12);
+	emit_pop(e, RBP);
+	emit_pop(e, RBX);
+	emit_pop(e, R14);
+	emit_pop(e, R15);
+	emit8(e, 0xC3);
+}
+
+
+/*********************************************/
+/*                                           */
+/* translation                               */
+/*                                           */
+/*********************************************/
+
+// guest registers read or written natively by an op, for choosing what to cache
+static void count_uses(Riscv64_decoded* op, int* uses)
+{
+	switch(op->id)
+	{
+		case INST_LUI: case INST_AUIPC: case INST_JAL:
+			uses[op->rd]++;
+			break;
+		case INST_SB: case INST_SH: case INST_SW: case INST_SD:
+		case INST_BEQ: case INST_BNE: case INST_BLT: case INST_BGE: case INST_BLTU: case INST_BGEU:
+			uses[op->rs1]++;
+			uses[op->rs2]++;
+			break;
+		default:
+			uses[op->rd]++;
+			uses[op->rs1]++;
+			uses[op->rs2]++;
+	}
+}
+
+// emit one op natively, return FALSE if it needs the handler
+static bool emit_native(Jit_emitter* e, Riscv64_decoded* op, reg64 pc)
+{
+	int rd = op->rd, rs1 = op->rs1, rs2 = op->rs2, imm = op->imm;
+	int alu = -1;     // opcode of a 64-bit register-register op
+	int alu_w = -1;   // opcode of a 32-bit register-register op
+	int shift = -1;   // /ext of a shift
+	int cc = -1;      // condition of a branch
+
+	#ifdef BRANCH_MODEL
+	// the branches and jumps go through the predictors in their handlers
+	if(op->id >= INST_BEQ && op->id <= INST_JALR)
+		return FALSE;
+	#endif
+	switch(op->id)
+	{
+		/* register-register */
+		case INST_ADD:  alu = 0x01; break;
+		case INST_SUB:  alu = 0x29; break;
+		case INST_AND:  alu = 0x21; break;
+		case INST_OR:   alu = 0x09; break;
+		case INST_XOR:  alu = 0x31; break;
+		case INST_ADDW: alu_w = 0x01; break;
+		case INST_SUBW: alu_w = 0x29; break;
+		case INST_SLL: case INST_SRL: case INST_SRA:
+		case INST_SLLW: case INST_SRLW: case INST_SRAW:
+		{
+			int w = op->id == INST_SLL || op->id == INST_SRL || op->id == INST_SRA;
+			int ext = (op->id == INST_SLL || op->id == INST_SLLW) ? 4 : (op->id == INST_SRL || op->id == INST_SRLW) ? 5 : 7;
+			load_guest(e, RAX, rs1);
+			load_guest(e, RCX, rs2);
+			emit_shift_cl(e, w, ext, RAX); // cl is masked to 6 (or 5) bits, as in sll (sllw)
+			if(op->id == INST_SLLW || op->id == INST_SRAW)
+				emit_movsxd(e, RAX, RAX);
+			store_guest(e, rd, RAX);
+			return TRUE;
+		}
+		case INST_SLT: // sign of x[rs1] - x[rs2], as slt()
+			load_guest(e, RAX, rs1);
+			load_guest(e, RCX, rs2);
+			emit_rr(e, 1, 0x29, RAX, RCX);
+			emit_shift_imm(e, 1, 5, RAX, 63);
+			store_guest(e, rd, RAX);
+			return TRUE;
+		case INST_SLTU:
+			load_guest(e, RAX, rs1);
+			load_guest(e, RCX, rs2);
+			emit_rr(e, 1, 0x39, RAX, RCX);
+			emit_setcc_rax(e, CC_B);
+			store_guest(e, rd, RAX);
+			return TRUE;
+
+		/* register-immediate */
+		case INST_ADDI: case INST_ORI: case INST_ANDI: case INST_XORI: case INST_ADDIW:
+		{
+			int ext = op->id == INST_ORI ? 1 : op->id == INST_ANDI ? 4 : op->id == INST_XORI ? 6 : 0;
+			load_guest(e, RAX, rs1);
+			emit_alu_imm(e, op->id != INST_ADDIW, ext, RAX, imm);
+			if(op->id == INST_ADDIW)
+				emit_movsxd(e, RAX, RAX);
+			store_guest(e, rd, RAX);
+			return TRUE;
+		}
+		case INST_SLTI:
+			load_guest(e, RAX, rs1);
+			emit_alu_imm(e, 1, 5, RAX, imm);
+			emit_shift_imm(e, 1, 5, RAX, 63);
+			store_guest(e, rd, RAX);
+			return TRUE;
+		case INST_SLTIU:
+			load_guest(e, RAX, rs1);
+			emit_alu_imm(e, 1, 7, RAX, imm);
+			emit_setcc_rax(e, CC_B);
+			store_guest(e, rd, RAX);
+			return TRUE;
+		case INST_SLLI:  shift = 4; break;
+		case INST_SRLI:  shift = 5; break;
+		case INST_SRAI:  shift = 7; break;
+		case INST_SLLIW: case INST_SRLIW: case INST_SRAIW:
+			load_guest(e, RAX, rs1);
+			emit_shift_imm(e, 0, op->id == INST_SLLIW ? 4 : op->id == INST_SRLIW ? 5 : 7, RAX, imm);
+			if(op->id != INST_SRLIW) // srliw zero-extends, see srliw()
+				emit_movsxd(e, RAX, RAX);
+			store_guest(e, rd, RAX);
+			return TRUE;
+
+		/* upper immediates */
+		case INST_LUI:
+			emit_mov_imm(e, RAX, (reg64)(long int)imm);
+			store_guest(e, rd, RAX);
+			return TRUE;
+		case INST_AUIPC:
+			emit_mov_imm(e, RAX, pc + (long int)imm);
+			store_guest(e, rd, RAX);
+			return TRUE;
+
+		#if !defined(SOFT_MMU) && !defined(CACHE_MODEL)
+		// with the software mmu loads and stores go through the tlb in their handlers,
+		// with the cache model through the caches
+		/* loads, all zero-extended like the load functions */
+		case INST_LB: case INST_LBU:
+			emit_address(e, rs1, imm, pc);
+			emit_guest_mem(e, 0, 0, 0x0FB6, RAX, RAX);
+			store_guest(e, rd, RAX);
+			return TRUE;
+		case INST_LH: case INST_LHU:
+			emit_address(e, rs1, imm, pc);
+			emit_guest_mem(e, 0, 0, 0x0FB7, RAX, RAX);
+			store_guest(e, rd, RAX);
+			return TRUE;
+		case INST_LW: case INST_LWU:
+			emit_address(e, rs1, imm, pc);
+			emit_guest_mem(e, 0, 0, 0x8B, RAX, RAX);
+			store_guest(e, rd, RAX);
+			return TRUE;
+		case INST_LD:
+			emit_address(e, rs1, imm, pc);
+			emit_guest_mem(e, 0, 1, 0x8B, RAX, RAX);
+			store_guest(e, rd, RAX);
+			return TRUE;
+
+		/* stores */
+		case INST_SB:
+			emit_address(e, rs1, imm, pc);
+			load_guest(e, RCX, rs2);
+			emit_guest_mem(e, 0, 0, 0x88, RCX, RAX);
+			return TRUE;
+		case INST_SH:
+			emit_address(e, rs1, imm, pc);
+			load_guest(e, RCX, rs2);
+			emit_guest_mem(e, 0x66, 0, 0x89, RCX, RAX);
+			return TRUE;
+		case INST_SW:
+			emit_address(e, rs1, imm, pc);
+			load_guest(e, RCX, rs2);
+			emit_guest_mem(e, 0, 0, 0x89, RCX, RAX);
+			return TRUE;
+		case INST_SD:
+			emit_address(e, rs1, imm, pc);
+			load_guest(e, RCX, rs2);
+			emit_guest_mem(e, 0, 1, 0x89, RCX, RAX);
+			return TRUE;
+		#endif
+
+		/* branches, same comparisons as the branch functions */
+		case INST_BEQ:  cc = CC_E;  break;
+		case INST_BNE:  cc = CC_NE; break;
+		case INST_BLT:  cc = CC_S;  break;
+		case INST_BGE:  cc = CC_NS; break;
+		case INST_BLTU: cc = CC_B;  break;
+		case INST_BGEU: cc = CC_A;  break;
+
+		/* jumps */
+		case INST_JAL:
+			if(rd != 0)
+			{
+				emit_mov_imm(e, RAX, pc + sizeof(instruction));
+				store_guest(e, rd, RAX);
+			}
+			store_pc(e, pc + (long int)imm);
+			return TRUE;
+		case INST_JALR:
+			if(rd != 0)
+			{
+				emit_mov_imm(e, RAX, pc + sizeof(instruction));
+				store_guest(e, rd, RAX);
+			}
+			load_guest(e, RAX, rs1); // after writing rd, as jalr() does
+			emit_alu_imm(e, 1, 0, RAX, imm);
+			emit_alu_imm(e, 1, 4, RAX, ~1);
+			emit_mem(e, 1, 0x89, RAX, REG_BASE, OFFSET_PC);
+			return TRUE;
+
+		default:
+			return FALSE;
+	}
+
+	if(alu >= 0 || alu_w >= 0)
+	{
+		load_guest(e, RAX, rs1);
+		load_guest(e, RCX, rs2);
+		emit_rr(e, alu >= 0, alu >= 0 ? alu : alu_w, RAX, RCX);
+		if(alu_w >= 0)
+			emit_movsxd(e, RAX, RAX);
+		store_guest(e, rd, RAX);
+		return TRUE;
+	}
+	if(shift >= 0)
+	{
+		load_guest(e, RAX, rs1);
+		emit_shift_imm(e, 1, shift, RAX, imm);
+		store_guest(e, rd, RAX);
+		return TRUE;
+	}
+
+	// branch: flags from the comparison, then pick the next pc
+	load_guest(e, RAX, rs1);
+	load_guest(e, RCX, rs2);
+	if(cc == CC_S || cc == CC_NS)
+		emit_rr(e, 1, 0x29, RAX, RCX); // sub
+	else
+		emit_rr(e, 1, 0x39, RAX, RCX); // cmp
+	emit_mov_imm(e, RDX, pc + sizeof(instruction));
+	emit_mov_imm(e, RAX, pc + (long int)imm);
+	// cmovcc rdx, rax
+	emit_rex(e, 1, RDX, 0, RAX);
+	emit8(e, 0x0F);
+	emit8(e, 0x40 | cc);
+	emit8(e, 0xC0 | ((RDX & 7) << 3) | (RAX & 7));
+	emit_mem(e, 1, 0x89, RDX, REG_BASE, OFFSET_PC);
+	return TRUE;
+}
+
+// after an op that may store: if the store dropped translations (see code_written() in
+// "memory_system.c") the rest of the block may be stale, return with the pc of the next instruction
+static void emit_code_check(Jit_emitter* e, reg64 next_pc, bool set_pc)
+{
+	emit_mem(e, 1, 0x8B, RAX, RSP, 0);
+	// cmp byte [rax + code_invalidated], 0
+	emit_mem(e, 0, 0x80, 7, RAX, (int)offsetof(Riscv64_memory, code_invalidated));
+	emit8(e, 0);
+	byte* skip = emit_jcc(e, CC_E);
+	if(set_pc)
+		store_pc(e, next_pc);
+	emit_epilogue(e);
+	patch_rel32(e, skip);
+}
+
+// call the interpreter's handler for an op
+static void emit_helper(Jit_emitter* e, Riscv64_decoded* op, inst_handler handler, reg64 pc)
+{
+	flush_cache(e);
+	store_pc(e, pc + sizeof(instruction));
+	emit_mov_imm(e, RDI, (reg64)op);
+	emit_mov_rr(e, RSI, REG_BASE);
+	emit_mem(e, 1, 0x8B, RDX, RSP, 0);
+	emit_call(e, (void*)handler);
+	reload_cache(e);
+}
+
+jit_code jit_compile(Riscv64_jit* jit, Riscv64_memory* riscv_memory, reg64 start, Riscv64_decoded* ops, int length)
+{
+	if(jit->buffer == NULL)
+		return NULL;
+	// traps stop in the guest code, and a watched store must be seen at its guest pc
+	if(watchpoints_set())
+		return NULL;
+	#ifdef PIPELINE_MODEL
+	// the timing model needs every record, the blocks stay interpreted
+	return NULL;
+	#endif
+	for(int i = 0; i < length; i++)
+		if(ops[i].id == INST_TRAP)
+			return NULL;
+
+	Jit_emitter emitter;
+	Jit_emitter* e = &emitter;
+	byte* code = jit->buffer + jit->used;
+	e->p = code;
+	e->end = jit->buffer + jit->size;
+	e->overflow = FALSE;
+	e->jit = jit;
+	e->far_limit = (reg64)riscv_memory->mem_size + 2 * GUARD_SIZE;
+	long int fault_num = jit->fault_num;
+
+	// cache the most used guest registers
+	int uses[32] = {0};
+	for(int i = 0; i < length; i++)
+	{
+		Riscv64_decoded plain = ops[i];
+		unfuse_record(&plain);
+		count_uses(&plain, uses);
+	}
+	for(int i = 0; i < 32; i++)
+		e->host_of[i] = -1;
+	for(int k = 0; k < CACHE_REG_NUM; k++)
+	{
+		int best = -1;
+		for(int i = 0; i < 32; i++)
+			if(e->host_of[i] < 0 && uses[i] >= 2 && (best < 0 || uses[i] > uses[best]))
+				best = i;
+		if(best < 0)
+			break;
+		e->host_of[best] = cache_host_reg[k];
+	}
+
+	// prologue
+	emit_push(e, R15);
+	emit_push(e, R14);
+	emit_push(e, RBX);
+	emit_push(e, RBP);
+	emit_push(e, R12);
+	emit_push(e, R13);
+	emit_alu_imm(e, 1, 5, RSP, 8); // keep rsp 16-byte aligned for calls
+	emit_mem(e, 1, 0x89, RSI, RSP, 0);
+	emit_mov_rr(e, REG_BASE, RDI);
+	emit_mem(e, 1, 0x8B, MEM_BASE, RSI, (int)offsetof(Riscv64_memory, memory));
+	#ifdef CACHE_MODEL
+	// the instructions of the block are fetched on entry
+	emit_mov_imm(e, RDI, (reg64)riscv_memory->cache_model);
+	emit_mov_imm(e, RSI, start);
+	emit_mov_imm(e, RDX, length * sizeof(instruction));
+	emit_call(e, (void*)cache_fetch_block);
+	#endif
+	reload_cache(e);
+
+	long int native = 0;
+	long int helper = 0;
+	for(int i = 0; i < length; i++)
+	{
+		reg64 pc = start + i * sizeof(instruction);
+		// a fused pair is compiled as its two instructions
+		Riscv64_decoded plain = ops[i];
+		unfuse_record(&plain);
+		if(emit_native(e, &plain, pc))
+		{
+			native++;
+			if(plain.id >= INST_SB && plain.id <= INST_SD && i < length - 1)
+				emit_code_check(e, pc + sizeof(instruction), TRUE);
+			// a block cut at BLOCK_MAX_LENGTH falls through
+			if(i == length - 1 && !(plain.id >= INST_BEQ && plain.id <= INST_JALR))
+				store_pc(e, pc + sizeof(instruction));
+		}
+		else
+		{
+			emit_helper(e, &ops[i], plain.handler, pc);
+			helper++;
+			// the handler left the pc of the next instruction
+			if(i < length - 1)
+				emit_code_check(e, 0, FALSE);
+		}
+	}
+	emit_epilogue(e);
+
+	if(e->overflow)
+	{
+		jit->fault_num = fault_num;
+		jit->failed++;
+		jit->used = jit->size; // full, stop compiling
+		return NULL;
+	}
+
+	jit->used = (e->p - jit->buffer + 15) & ~15L;
+	jit->compiled++;
+	jit->native += native;
+	jit->helper += helper;
+	return (jit_code)code;
+}
+
+#else
+
+jit_code jit_compile(Riscv64_jit* jit, Riscv64_memory* riscv_memory, reg64 start, Riscv64_decoded* ops, int length)
+{
+	return NULL;
+}
+
+#endif
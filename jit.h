@@ -0,0 +1,59 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+#include "memory_system.h"
+#include "riscv_instruction.h"
+#include "decode_cache.h"
+
+/*********************************************/
+/*                                           */
+/* x86-64 dynamic binary translation         */
+/*                                           */
+/*********************************************/
+/* Built with "make ENGINE=jit". A block of  */
+/* the block engine that has run JIT_        */
+/* THRESHOLD times is translated to x86-64.  */
+/* Within the compiled block the most used   */
+/* guest x[] registers live in host          */
+/* registers. Integer ALU, loads, stores,    */
+/* branches and jumps are emitted natively,  */
+/* loads and stores unchecked like           */
+/* get_memory_reg*; everything else (scall,  */
+/* M, F/D, unknown) calls the interpreter's  */
+/* handler. With "make CACHE=model" loads    */
+/* and stores call it too, and the block     */
+/* fetches its instructions on entry; with   */
+/* "make BPRED=model" branches and jumps do. */
+/*********************************************/
+
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD   50          // executions before a block is compiled
+#endif
+#define JIT_BUFFER_SIZE (16<<20)    // bytes of host code
+
+// compiled block: runs the whole block and leaves the next guest pc in riscv_register->pc
+typedef void (*jit_code)(Riscv64_register*, Riscv64_memory*);
+
+typedef struct riscv64_jit{
+	byte* buffer;     // executable memory
+	long int size;
+	long int used;
+	// guest pc of every native load and store, by the offset of its code in buffer, ascending
+	long int* fault_host;
+	reg64* fault_pc;
+	long int fault_num;
+	long int fault_size;
+	// statistics
+	long int compiled;    // blocks compiled
+	long int failed;      // blocks that did not fit
+	long int native;      // instructions emitted as host code
+	long int helper;      // instructions emitted as handler calls
+} Riscv64_jit;
+
+void init_jit(Riscv64_jit**);
+void delete_jit(Riscv64_jit*);
+void print_jit_stats(Riscv64_jit*);
+
+// translate the ops of a block starting at guest pc start, NULL if it can not be compiled
+jit_code jit_compile(Riscv64_jit*, Riscv64_memory*, reg64 start, Riscv64_decoded* ops, int length);
+
+#endif
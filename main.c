@@ -0,0 +1,527 @@
+#include "execute.h"
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*********************************************/
+/*                                           */
+/* the simulator binary, on the context of   */
+/* "riscvsim.h"                              */
+/*                                           */
+/*********************************************/
+
+// print the help information
+void help()
+{
+	printf("This is a simulator to execute riscv ELF!\n\n");
+	printf("     Usage: ./exeute filename\n\n");
+	printf("Multiple ELFs is supported, just separate the filename with space. The order of execution is the same as the input order.\n");
+	printf("\n     Usage: ./exeute -aot filename\n\n");
+	printf("Translate the ELFs ahead of time into filename.aot.so instead of executing them, the block and jit engines use it when it exists.\n");
+	printf("\n     Usage: ./exeute [-b pc]... [-w addr bytes]... filename\n\n");
+	printf("Stop in the debug mode before the instruction at pc, or after a store to the bytes at addr (both hexadecimal), the aot code is not used then.\n");
+	printf("\n     Usage: ./exeute [-m megabytes] [-thp] filename\n\n");
+	printf("Give the guest megabytes of memory instead of 128, the stack moves up to 32Mb below its end. -thp asks the host for transparent huge pages.\n");
+	printf("\n     Usage: ./exeute -repeat times filename\n\n");
+	printf("Run each ELF the given times, resetting its registers and the memory pages it wrote to the state right after loading in between.\n");
+	printf("\n     Usage: ./exeute -j jobs filename...\n\n");
+	printf("Run the ELFs in batch mode, jobs of them at the same time (0 for one a host core), each with its output captured and printed in order, then a table of their exit codes, instructions and times.\n");
+	printf("\n     Usage: ./exeute [-checkpoint instructions|@pc]... filename\n\n");
+	printf("Write the state of the program into filename.instructions.ckpt after that many instructions, or when it first gets to pc (hexadecimal). A checkpoint is run like an ELF and goes on from there.\n");
+	printf("\n     Usage: ./exeute -bbv instructions[:k] filename\n\n");
+	printf("Write the basic block vectors of every interval of instructions into filename.bbv, and the intervals that stand for up to k (10) clusters of them into filename.simpoints.\n");
+	#ifdef PIPELINE_MODEL
+	printf("\n     Usage: ./exeute -simpoint filename.simpoints filename\n\n");
+	printf("Run only the intervals of filename.simpoints in the timing model and estimate the CPI of the whole program from them.\n");
+	#endif
+	#ifdef CACHE_MODEL
+	printf("\n     Usage: ./exeute [-cache level:size:ways:line[:lru|plru|rrip[:wb|wt]]]... filename\n\n");
+	printf("Configure a level (l1i, l1d, l2 or llc) of the cache model, e.g. -cache l2:512k:8:64:rrip, a size of 0 leaves out l2 or llc.\n");
+	printf("\n     Usage: ./exeute -coherence mesi|moesi filename\n\n");
+	printf("Choose the protocol that keeps the L1D caches of the harts coherent, MESI by default.\n");
+	#endif
+	#ifdef BRANCH_MODEL
+	printf("\n     Usage: ./exeute [-bpred bimodal|gshare|tage:bits]... [-bpred btb:bits] [-bpred ras:entries] filename\n\n");
+	printf("Compare the given direction predictors of 2^bits entries in one run instead of bimodal:12, gshare:14 and tage:10.\n");
+	#endif
+	#ifdef OOO_MODEL
+	printf("\n     Usage: ./exeute [-ooo fetch|issue|commit|depth|rob|iq|lsq|prf|alu|mul|lsu|fpu:value]... filename\n\n");
+	printf("Set a width, the front end depth, a structure size or the number of units of the out-of-order core.\n");
+	#endif
+	#ifdef PIPELINE_MODEL
+	printf("\n     Usage: ./exeute [-pipe load|mul|div|fp|fdiv|branch:cycles]... filename\n\n");
+	printf("Set the latency of a class of instructions, or the cycles lost behind a taken branch, in the pipeline model.\n");
+	printf("\n     Usage: ./exeute -quantum cycles filename\n\n");
+	printf("Run the harts of the program in step, none of them more than a quantum of cycles ahead of the others.\n");
+	#endif
+
+}
+
+
+/*********************************************/
+/*                                           */
+/* running the files                         */
+/*                                           */
+/*********************************************/
+
+// what a run of a file ended with, for the batch summary
+typedef struct batch_result{
+	long int count;           // instructions of the last run
+	double seconds;           // of the runs
+	int exit_code;            // the guest passed to exit
+} Batch_result;
+
+// load (or restore) the file and run it the given times, or translate it with aot_mode
+static void execute_file(const char* file_name, bool aot_mode, int repeat, Batch_result* result)
+{
+	Riscv64_sim* sim;
+	memset(result, 0, sizeof(Batch_result));
+
+	// the name is opened with "./" in front if it is not absolute
+	if(file_name[0] != '/')
+		printf("./%s", file_name);
+	printf("executing file : %s%s ...\n", file_name[0] != '/' ? "./" : "", file_name);
+
+	struct timeval load_start, load_end;
+	gettimeofday(&load_start, NULL);
+
+	// initialize the machine, then load the program or restore a checkpoint
+	init_sim(&sim);
+	if(!load_sim(sim, file_name))
+		exit(1);
+	Riscv64_register* riscv_register = sim->riscv_register;
+	Riscv64_memory* riscv_memory = sim->riscv_memory;
+
+	gettimeofday(&load_end, NULL);
+	printf("the size of the file is : %d bytes, loaded in %.3f ms\n", sim->size,
+	       (load_end.tv_sec - load_start.tv_sec) * 1e3 + (load_end.tv_usec - load_start.tv_usec) / 1e3);
+
+	if(aot_mode)
+	{
+		if(sim->checkpoint)
+		{
+			printf("A checkpoint can not be translated ahead of time.\n");
+			exit(1);
+		}
+		translate_aot(sim->file_name, (Elf64_Ehdr*)sim->buffer, riscv_memory, get_register_pc(riscv_register));
+		delete_sim(sim);
+		return;
+	}
+
+	// the runs after the first start from the snapshot of the loaded program
+	Riscv64_snapshot* riscv_snapshot = NULL;
+	if(repeat > 1)
+		init_snapshot(&riscv_snapshot, riscv_register, riscv_memory);
+
+	for(int run = 0; run < repeat; run++)
+	{
+		struct timeval start_time, end_time;
+		if(run > 0)
+		{
+			gettimeofday(&start_time, NULL);
+			long int pages = restore_snapshot(riscv_snapshot, riscv_register, riscv_memory);
+			riscv_memory->exit_happened = FALSE;
+			sim->count = 0;
+			gettimeofday(&end_time, NULL);
+			printf("reset: %ld pages restored in %.3f ms\n", pages,
+			       (end_time.tv_sec - start_time.tv_sec) * 1e3 + (end_time.tv_usec - start_time.tv_usec) / 1e3);
+		}
+		#ifdef CACHE_MODEL
+		reset_cache_model(riscv_memory->cache_model); // every run starts cold
+		#endif
+		#ifdef BRANCH_MODEL
+		reset_branch_model(riscv_memory->branch_model);
+		#endif
+		#if defined(OOO_MODEL)
+		reset_ooo_model(riscv_memory->ooo_model);
+		#elif defined(PIPELINE_MODEL)
+		reset_pipeline_model(riscv_memory->pipeline_model);
+		#endif
+		gettimeofday(&start_time, NULL);
+
+		long int count = run_sim(sim, 0);
+		// the simulator ends with the program, as it always did
+		if(sim_fault(sim) != FAULT_NONE)
+			exit(sim_fault(sim) == FAULT_ACCESS ? 0 : 1);
+
+		gettimeofday(&end_time, NULL);
+		double seconds = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1e6;
+
+		printf("Program exits!\n");
+		printf("%ld instructions executed.\n", count);
+		printf("%.3f seconds, %.2f MIPS\n", seconds, seconds > 0 ? count / seconds / 1e6 : 0.0);
+		result->count = count;
+		result->seconds += seconds;
+		result->exit_code = sim_exit_code(sim);
+		#ifdef CACHE_MODEL
+		print_cache_stats(riscv_memory->cache_model, count);
+		#endif
+		#ifdef BRANCH_MODEL
+		print_branch_stats(riscv_memory->branch_model, count);
+		#endif
+		#if defined(OOO_MODEL)
+		print_ooo_stats(riscv_memory->ooo_model);
+		#elif defined(PIPELINE_MODEL)
+		print_pipeline_stats(riscv_memory->pipeline_model);
+		#endif
+		print_engine_stats(sim, count);
+		print_memory_stats(riscv_memory);
+	}
+	// gc
+	if(riscv_snapshot != NULL)
+		delete_snapshot(riscv_snapshot, riscv_memory);
+	delete_sim(sim);
+}
+
+/*********************************************/
+/* In batch mode every file is run by a      */
+/* process of its own, jobs of them at a     */
+/* time. A job writes into temporary files   */
+/* instead of stdout and stderr and reads an */
+/* empty stdin; its output is printed when   */
+/* it and the jobs before it are done, then  */
+/* a table of all of them.                   */
+/*                                           */
+/* Processes, not threads: a process runs    */
+/* one context at a time (see "riscvsim.h"), */
+/* as the options, the configuration of the  */
+/* models, the breakpoints and the SIGSEGV   */
+/* handler are global to it, and so are the  */
+/* descriptors 0, 1 and 2 a job's output is  */
+/* captured on. A job forks after the        */
+/* options are read and shares the simulator */
+/* with the batch copy-on-write, and a job   */
+/* that crashes the simulator is one failed  */
+/* row.                                      */
+/*********************************************/
+
+typedef struct batch_job{
+	const char* file_name;
+	pid_t pid;
+	int pipe;                 // the result comes through it
+	FILE* output;             // captured stdout
+	FILE* errors;             // captured stderr
+	struct timeval start;
+	double wall;
+	int status;               // from waitpid
+	bool reported;            // the result arrived, the job got to its end
+	Batch_result result;
+} Batch_job;
+
+static void start_job(Batch_job* job, bool aot_mode, int repeat)
+{
+	int fds[2];
+	job->output = tmpfile();
+	job->errors = tmpfile();
+	if(job->output == NULL || job->errors == NULL || pipe(fds) != 0)
+	{
+		printf("batch: can not capture the output of %s.\n", job->file_name);
+		exit(1);
+	}
+	fflush(stdout);
+	fflush(stderr);
+	gettimeofday(&job->start, NULL);
+	job->pid = fork();
+	if(job->pid < 0)
+	{
+		printf("batch: can not start %s.\n", job->file_name);
+		exit(1);
+	}
+	if(job->pid == 0)
+	{
+		close(fds[0]);
+		int null = open("/dev/null", O_RDONLY);
+		dup2(null, 0);
+		dup2(fileno(job->output), 1);
+		dup2(fileno(job->errors), 2);
+		Batch_result result;
+		execute_file(job->file_name, aot_mode, repeat, &result);
+		fflush(stdout);
+		fflush(stderr);
+		if(write(fds[1], &result, sizeof(result)) != sizeof(result))
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	job->pipe = fds[0];
+}
+
+static void finish_job(Batch_job* job, int status)
+{
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	job->wall = (end.tv_sec - job->start.tv_sec) + (end.tv_usec - job->start.tv_usec) / 1e6;
+	job->status = status;
+	job->reported = read(job->pipe, &job->result, sizeof(Batch_result)) == sizeof(Batch_result);
+	close(job->pipe);
+	job->pid = 0;
+}
+
+static void copy_output(FILE* from, FILE* to)
+{
+	char buffer[4096];
+	size_t length;
+	rewind(from);
+	while((length = fread(buffer, 1, sizeof(buffer), from)) > 0)
+		fwrite(buffer, 1, length, to);
+	fclose(from);
+}
+
+static void print_job_output(Batch_job* job)
+{
+	printf("==== %s ====\n", job->file_name);
+	copy_output(job->output, stdout);
+	fflush(stdout);
+	copy_output(job->errors, stderr);
+	fflush(stderr);
+}
+
+static void print_batch_summary(Batch_job* jobs, int num, int workers, double wall)
+{
+	long int total = 0;
+	int failed = 0;
+	printf("batch: %d files on %d workers\n", num, workers);
+	printf("      exit   instructions    seconds       wall       MIPS   file\n");
+	for(int i = 0; i < num; i++)
+	{
+		Batch_job* job = &jobs[i];
+		char exit_text[32];
+		if(job->reported)
+			snprintf(exit_text, sizeof(exit_text), "%d", job->result.exit_code);
+		else if(WIFSIGNALED(job->status))
+			snprintf(exit_text, sizeof(exit_text), "signal %d", WTERMSIG(job->status));
+		else
+			snprintf(exit_text, sizeof(exit_text), "error %d", WEXITSTATUS(job->status));
+		if(!job->reported || job->result.exit_code != 0)
+			failed++;
+		if(job->reported)
+		{
+			Batch_result* r = &job->result;
+			total += r->count;
+			printf("%10s %14ld %10.3f %10.3f %10.2f   %s\n", exit_text, r->count, r->seconds, job->wall,
+			       r->seconds > 0 ? r->count / r->seconds / 1e6 : 0.0, job->file_name);
+		}
+		else
+			printf("%10s %14s %10s %10.3f %10s   %s\n", exit_text, "-", "-", job->wall, "-", job->file_name);
+	}
+	printf("batch: %d passed, %d failed, %ld instructions in %.3f seconds, %.2f MIPS altogether\n",
+	       num - failed, failed, total, wall, wall > 0 ? total / wall / 1e6 : 0.0);
+}
+
+// run the files at most jobs at a time, 0 for one a host core
+static void run_batch(char const* files[], int num, int jobs, bool aot_mode, int repeat)
+{
+	int workers = jobs > 0 ? jobs : sysconf(_SC_NPROCESSORS_ONLN);
+	if(workers < 1)
+		workers = 1;
+	Batch_job* job = (Batch_job*) calloc (num, sizeof(Batch_job));
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	int started = 0, running = 0, printed = 0;
+	while(printed < num)
+	{
+		for(; running < workers && started < num; started++, running++)
+		{
+			job[started].file_name = files[started];
+			start_job(&job[started], aot_mode, repeat);
+		}
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if(pid < 0)
+			break;
+		for(int i = 0; i < started; i++)
+			if(job[i].pid == pid)
+			{
+				finish_job(&job[i], status);
+				running--;
+			}
+		// in the order of the files
+		while(printed < started && job[printed].pid == 0)
+			print_job_output(&job[printed++]);
+	}
+	gettimeofday(&end, NULL);
+	print_batch_summary(job, num, workers, (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+	free(job);
+}
+
+/*********************************************/
+/*                                           */
+/* main function                             */
+/*                                           */
+/*********************************************/
+
+int main(int argc, char const *argv[])
+{
+	// check
+	if(argc < 2 || strcmp(argv[1],"help") == 0)
+	{
+		help();
+		return 0;
+	}
+
+
+	#ifdef DEBUG
+	printf("Now in DEBUG mode.\n");
+	printf("Please type in the address(hexadecimal) where the program will be paused:\n");
+	unsigned long int pause_addr;
+	if(scanf("%lx", &pause_addr) == 1)
+		add_breakpoint(pause_addr);
+	#endif
+
+	// options before the files
+	bool aot_mode = FALSE; // translate ahead of time instead of executing
+	int repeat = 1;        // runs of each ELF, reset from a snapshot in between
+	int jobs = 1;          // ELFs run at the same time, each by a process of its own
+	int first_file = 1;
+	while(first_file < argc && argv[first_file][0] == '-')
+	{
+		if(strcmp(argv[first_file], "-aot") == 0)
+		{
+			aot_mode = TRUE;
+			first_file += 1;
+		}
+		else if(strcmp(argv[first_file], "-b") == 0 && first_file + 1 < argc)
+		{
+			if(!add_breakpoint(strtoul(argv[first_file + 1], NULL, 16)))
+				exit(1);
+			first_file += 2;
+		}
+		#ifdef OOO_MODEL
+		else if(strcmp(argv[first_file], "-ooo") == 0 && first_file + 1 < argc)
+		{
+			if(!set_ooo_config(argv[first_file + 1]))
+				exit(1);
+			first_file += 2;
+		}
+		#endif
+		#ifdef PIPELINE_MODEL
+		else if(strcmp(argv[first_file], "-pipe") == 0 && first_file + 1 < argc)
+		{
+			if(!set_pipeline_config(argv[first_file + 1]))
+				exit(1);
+			first_file += 2;
+		}
+		#endif
+		#ifdef BRANCH_MODEL
+		else if(strcmp(argv[first_file], "-bpred") == 0 && first_file + 1 < argc)
+		{
+			if(!set_branch_config(argv[first_file + 1]))
+				exit(1);
+			first_file += 2;
+		}
+		#endif
+		#ifdef CACHE_MODEL
+		else if(strcmp(argv[first_file], "-cache") == 0 && first_file + 1 < argc)
+		{
+			if(!set_cache_config(argv[first_file + 1]))
+				exit(1);
+			first_file += 2;
+		}
+		else if(strcmp(argv[first_file], "-coherence") == 0 && first_file + 1 < argc)
+		{
+			if(!set_coherence_config(argv[first_file + 1]))
+				exit(1);
+			first_file += 2;
+		}
+		#endif
+		else if(strcmp(argv[first_file], "-m") == 0 && first_file + 1 < argc)
+		{
+			guest_mem_size = strtol(argv[first_file + 1], NULL, 0) << 20;
+			if(guest_mem_size <= (MEM_SIZE) - STACK_BOTTOM)
+			{
+				printf("The memory must be bigger than %dMb.\n", ((MEM_SIZE) - STACK_BOTTOM) >> 20);
+				exit(1);
+			}
+			first_file += 2;
+		}
+		else if(strcmp(argv[first_file], "-repeat") == 0 && first_file + 1 < argc)
+		{
+			repeat = atoi(argv[first_file + 1]);
+			if(repeat < 1)
+			{
+				printf("-repeat needs a positive number of runs.\n");
+				exit(1);
+			}
+			first_file += 2;
+		}
+		else if(strcmp(argv[first_file], "-checkpoint") == 0 && first_file + 1 < argc)
+		{
+			if(!add_checkpoint_trigger(argv[first_file + 1]))
+				exit(1);
+			first_file += 2;
+		}
+		else if(strcmp(argv[first_file], "-bbv") == 0 && first_file + 1 < argc)
+		{
+			if(!set_bbv_config(argv[first_file + 1]))
+				exit(1);
+			first_file += 2;
+		}
+		#ifdef PIPELINE_MODEL
+		else if(strcmp(argv[first_file], "-simpoint") == 0 && first_file + 1 < argc)
+		{
+			simpoint_file = argv[first_file + 1];
+			first_file += 2;
+		}
+		else if(strcmp(argv[first_file], "-quantum") == 0 && first_file + 1 < argc)
+		{
+			quantum_length = strtol(argv[first_file + 1], NULL, 0);
+			if(quantum_length < 1)
+			{
+				printf("-quantum needs a positive number of cycles.\n");
+				exit(1);
+			}
+			first_file += 2;
+		}
+		#endif
+		else if(strcmp(argv[first_file], "-j") == 0 && first_file + 1 < argc)
+		{
+			jobs = atoi(argv[first_file + 1]);
+			if(jobs < 0)
+			{
+				printf("-j needs a number of jobs, 0 for one a host core.\n");
+				exit(1);
+			}
+			first_file += 2;
+		}
+		else if(strcmp(argv[first_file], "-thp") == 0)
+		{
+			guest_mem_hugepage = TRUE;
+			first_file += 1;
+		}
+		else if(strcmp(argv[first_file], "-w") == 0 && first_file + 2 < argc)
+		{
+			if(!add_watchpoint(strtoul(argv[first_file + 1], NULL, 16), strtoul(argv[first_file + 2], NULL, 0)))
+				exit(1);
+			first_file += 3;
+		}
+		else
+		{
+			help();
+			return 0;
+		}
+	}
+	// the stores to watched pages are let through behind the back of the dirty page tracking
+	if(repeat > 1 && watchpoints_set())
+	{
+		printf("-repeat can not be used with watchpoints.\n");
+		exit(1);
+	}
+	// the checkpoints are taken in a loop of their own, without the traps
+	if(checkpoint_trigger_num > 0 && breakpoints_set())
+	{
+		printf("-checkpoint can not be used with breakpoints or watchpoints.\n");
+		exit(1);
+	}
+
+	int file_num = argc - 1; // number of file
+	Batch_result result;
+
+	// execute elf one by one, or all at once in batch mode
+	if(jobs != 1)
+		run_batch(argv + first_file, file_num - first_file + 1, jobs, aot_mode, repeat);
+	else
+		for (int i = first_file; i <= file_num; i++ )
+			execute_file(argv[i], aot_mode, repeat, &result);
+
+	return 0;
+}
@@ -1,8 +1,457 @@
+#define _GNU_SOURCE // REG_RIP
 #include "memory_system.h"
+#include <signal.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 // somthing for debug
-extern bool debug_flag;
-extern unsigned long int pause_addr;
+
+long int guest_mem_size = MEM_SIZE;
+bool guest_mem_hugepage = FALSE;
+
+
+/*********************************************/
+/*                                           */
+/* faults                                    */
+/*                                           */
+/*********************************************/
+
+static long int host_page_size = 0;
+
+#define GUEST_PC_FINDER_MAX 4
+static guest_pc_finder finders[GUEST_PC_FINDER_MAX];
+static int finder_num = 0;
+
+void add_guest_pc_finder(guest_pc_finder finder)
+{
+	for(int i = 0; i < finder_num; i++)
+		if(finders[i] == finder)
+			return;
+	if(finder_num < GUEST_PC_FINDER_MAX)
+		finders[finder_num++] = finder;
+}
+
+// the run of the thread catches faults while it is set
+static __thread sigjmp_buf* fault_jump = NULL;
+
+void catch_faults(sigjmp_buf* jump)
+{
+	fault_jump = jump;
+}
+
+void raise_fault(Riscv64_memory* riscv_memory, int fault)
+{
+	if(fault_jump == NULL)
+		exit(fault == FAULT_ACCESS ? 0 : 1);
+	// the other harts stop as on exit_group
+	Riscv64_memory* process = riscv_memory->process;
+	__atomic_store_n(&process->fault, fault, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&process->exit_happened, TRUE, __ATOMIC_SEQ_CST);
+	riscv_memory->exit_happened = TRUE;
+	siglongjmp(*fault_jump, fault);
+}
+
+// report a bad guest access and raise the fault, host_pc is the faulting host instruction or NULL
+static void __attribute__((noreturn)) memory_fault(Riscv64_memory* riscv_memory, const char* message, reg64 addr, void* host_pc)
+{
+	// the host code of the jit or the aot knows the guest pc, the handlers ran after pc += 4
+	reg64 pc = 0;
+	int i;
+	for(i = 0; i < finder_num && host_pc != NULL; i++)
+		if(finders[i](host_pc, &pc))
+			break;
+	if(host_pc == NULL || i == finder_num)
+		pc = riscv_memory->fault_register != NULL ? get_register_pc(riscv_memory->fault_register) - sizeof(instruction) : 0;
+
+	printf("%s\n", message);
+	printf("address 0x%lx accessed by the instruction at pc 0x%lx\n", addr, pc);
+	raise_fault(riscv_memory, FAULT_ACCESS);
+}
+
+void bad_guest_access(Riscv64_memory* riscv_memory, reg64 virtual_addr)
+{
+	memory_fault(riscv_memory, "Out of memory!", virtual_addr, NULL);
+}
+
+// a page holding translated code is written, the caches drop what they translated from addr
+static void code_written(Riscv64_memory* riscv_memory, reg64 addr, reg64 length)
+{
+	if(riscv_memory->code_written != NULL && riscv_memory->code_written(riscv_memory->code_write_arg, addr, length))
+	{
+		// with harts the handler flags the memory of the hart that stored
+		if(riscv_memory->harts == NULL)
+			riscv_memory->code_invalidated = TRUE;
+	}
+}
+
+// remember the content of a guest page before its first write since the snapshot
+static void save_dirty_page(Riscv64_memory* riscv_memory, reg64 addr, byte* host)
+{
+	Riscv64_snapshot* snapshot = riscv_memory->snapshot;
+	if(snapshot->dirty_num == snapshot->dirty_size)
+	{
+		snapshot->dirty_size = snapshot->dirty_size ? 2 * snapshot->dirty_size : 64;
+		snapshot->dirty = (reg64*) realloc (snapshot->dirty, snapshot->dirty_size * sizeof(reg64));
+		snapshot->pages = (byte*) realloc (snapshot->pages, snapshot->dirty_size * snapshot->page_size);
+		if(snapshot->dirty == NULL || snapshot->pages == NULL)
+		{
+			printf("Memory error.\n");
+			raise_fault(riscv_memory, FAULT_HOST);
+		}
+	}
+	snapshot->dirty[snapshot->dirty_num] = addr;
+	memcpy(snapshot->pages + snapshot->dirty_num * snapshot->page_size, host, snapshot->page_size);
+	snapshot->dirty_num++;
+}
+
+#ifndef SOFT_MMU
+/*********************************************/
+/* The guest memory lies in the middle of a  */
+/* reservation with GUARD_SIZE inaccessible  */
+/* bytes on each side, so loads and stores   */
+/* do not check the address. One that leaves */
+/* the memory faults on a guard page, and    */
+/* the SIGSEGV handler reports it as the     */
+/* bounds check did.                         */
+/*********************************************/
+
+// every memory alive, the fault is in the one whose reservation holds the address
+static Riscv64_memory* memories = NULL;
+// a hart marks a code page while another lets a store into one through: the state and the
+// protection of a page change together
+static pthread_mutex_t code_pages = PTHREAD_MUTEX_INITIALIZER;
+
+static void on_guard_fault(int sig, siginfo_t* info, void* context)
+{
+	ucontext_t* uc = (ucontext_t*)context;
+	byte* host = (byte*)info->si_addr;
+	Riscv64_memory* riscv_memory = memories;
+	while(riscv_memory != NULL && (host < riscv_memory->memory - GUARD_SIZE
+	      || host >= riscv_memory->memory + riscv_memory->mem_size + GUARD_SIZE))
+		riscv_memory = riscv_memory->next;
+
+	if(riscv_memory != NULL && host >= riscv_memory->memory && host < riscv_memory->memory + riscv_memory->mem_size)
+	{
+		// a write to a page kept read-only to see it, let it through; with harts another
+		// one may have let it through already between the fault and the handler
+		byte* page = (byte*)((reg64)host & ~(host_page_size - 1));
+		pthread_mutex_lock(&code_pages);
+		bool tracked = track_host_write(riscv_memory, host);
+		int protection = guest_page_protection(riscv_memory, (reg64)(page - riscv_memory->memory));
+		if(tracked || (riscv_memory->harts != NULL && (protection & PROT_WRITE)))
+		{
+			mprotect(page, host_page_size, protection);
+			pthread_mutex_unlock(&code_pages);
+			return;
+		}
+		pthread_mutex_unlock(&code_pages);
+	}
+	if(riscv_memory == NULL || (host >= riscv_memory->memory && host < riscv_memory->memory + riscv_memory->mem_size))
+	{
+		// not a guard page, fault again and crash as without the handler
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+	memory_fault(riscv_memory, "Out of memory!", (reg64)(host - riscv_memory->memory), (void*)uc->uc_mcontext.gregs[REG_RIP]);
+}
+
+static void install_guard_handler()
+{
+	static bool installed = FALSE;
+	if(installed)
+		return;
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	action.sa_sigaction = on_guard_fault;
+	sigaction(SIGSEGV, &action, NULL);
+	installed = TRUE;
+}
+#endif
+
+
+#ifdef SOFT_MMU
+/*********************************************/
+/*                                           */
+/* software mmu                              */
+/*                                           */
+/*********************************************/
+
+#define PAGE_CHUNK (2L<<20)  // host memory is mapped this much at a time
+#define PAGE_ENTRIES (1 << PAGE_LEVEL_BITS)
+#define PAGE_INDEX(addr, level) (((addr) >> (PAGE_SHIFT + PAGE_LEVEL_BITS * (PAGE_LEVELS - 1 - (level)))) & (PAGE_ENTRIES - 1))
+#define ADDRESS_BITS (PAGE_SHIFT + PAGE_LEVEL_BITS * PAGE_LEVELS)
+#define HOST_ACCESS 32 // for translate(), ignore the permissions
+
+static void** new_table(Riscv64_memory* riscv_memory)
+{
+	void** table = (void**) calloc (PAGE_ENTRIES, sizeof(void*));
+	if(table == NULL)
+	{
+		printf("Memory error.\n");
+		raise_fault(riscv_memory, FAULT_HOST);
+	}
+	return table;
+}
+
+static void delete_table(void** table, int level)
+{
+	if(level < PAGE_LEVELS - 1)
+		for(int i = 0; i < PAGE_ENTRIES; i++)
+			if(table[i] != NULL)
+				delete_table((void**)table[i], level + 1);
+	free(table);
+}
+
+// remember a host mapping for delete_memory_system
+static void add_host_map(Riscv64_memory* riscv_memory, void* addr, long int length)
+{
+	riscv_memory->maps = (Riscv64_host_map*) realloc (riscv_memory->maps, (riscv_memory->map_num + 1) * sizeof(Riscv64_host_map));
+	if(riscv_memory->maps == NULL)
+	{
+		printf("Memory error.\n");
+		raise_fault(riscv_memory, FAULT_HOST);
+	}
+	riscv_memory->maps[riscv_memory->map_num].addr = addr;
+	riscv_memory->maps[riscv_memory->map_num].length = length;
+	riscv_memory->map_num++;
+}
+
+// a zero host page, page aligned so that it can be mprotect()ed on its own
+static byte* new_page(Riscv64_memory* riscv_memory)
+{
+	if(riscv_memory->chunk == NULL || riscv_memory->chunk_used == PAGE_CHUNK)
+	{
+		byte* chunk = (byte*) mmap (NULL, PAGE_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(chunk == MAP_FAILED)
+		{
+			printf("Memory error.\n");
+			raise_fault(riscv_memory, FAULT_HOST);
+		}
+		#ifdef MADV_HUGEPAGE
+		if(guest_mem_hugepage)
+			madvise(chunk, PAGE_CHUNK, MADV_HUGEPAGE);
+		#endif
+		add_host_map(riscv_memory, chunk, PAGE_CHUNK);
+		riscv_memory->chunk = chunk;
+		riscv_memory->chunk_used = 0;
+	}
+	byte* page = riscv_memory->chunk + riscv_memory->chunk_used;
+	riscv_memory->chunk_used += PAGE_SIZE;
+	riscv_memory->page_num++;
+	return page;
+}
+
+// leaf entry of the page of addr: host page | prot, NULL if the page has none yet
+static void** find_page(Riscv64_memory* riscv_memory, reg64 addr, bool create)
+{
+	void** table = riscv_memory->page_table;
+	for(int level = 0; level < PAGE_LEVELS - 1; level++)
+	{
+		void** next = (void**)table[PAGE_INDEX(addr, level)];
+		if(next == NULL)
+		{
+			if(!create)
+				return NULL;
+			next = new_table(riscv_memory);
+			table[PAGE_INDEX(addr, level)] = next;
+		}
+		table = next;
+	}
+	return &table[PAGE_INDEX(addr, PAGE_LEVELS - 1)];
+}
+
+static Riscv64_region* find_region(Riscv64_memory* riscv_memory, reg64 addr)
+{
+	for(int i = 0; i < riscv_memory->region_num; i++)
+		if(addr >= riscv_memory->region[i].start && addr < riscv_memory->region[i].end)
+			return &riscv_memory->region[i];
+	return NULL;
+}
+
+// host address of addr for a guest load or store (PAGE_READ or PAGE_WRITE) or for the
+// simulator itself (HOST_ACCESS, and PAGE_WRITE if it writes) of length bytes in the page,
+// refills the TLB
+static byte* translate(Riscv64_memory* riscv_memory, reg64 addr, reg64 length, int access)
+{
+	Riscv64_region* region;
+	if((addr >> ADDRESS_BITS) != 0 || (region = find_region(riscv_memory, addr)) == NULL)
+		memory_fault(riscv_memory, "Out of memory!", addr, NULL);
+
+	void** leaf = find_page(riscv_memory, addr, TRUE);
+	if(*leaf == NULL)
+		*leaf = (void*)((reg64)new_page(riscv_memory) | region->prot);
+	int prot = access & (PAGE_READ | PAGE_WRITE);
+	byte* page = (byte*)((reg64)*leaf & ~PAGE_MASK);
+	if(!(access & HOST_ACCESS) && ((reg64)*leaf & prot) != prot)
+		memory_fault(riscv_memory, prot == PAGE_WRITE ? "Write to a read-only page!" : "Read of an unreadable page!", addr, NULL);
+
+	reg64 guest_page = addr & ~PAGE_MASK;
+	Riscv64_snapshot* snapshot = riscv_memory->snapshot;
+	// the page keeps its other translations, and the next store misses the TLB again
+	if((access & PAGE_WRITE) && ((reg64)*leaf & PAGE_CODE))
+		code_written(riscv_memory, addr, length);
+	if((access & PAGE_WRITE) && snapshot != NULL && !((reg64)*leaf & PAGE_DIRTY))
+	{
+		save_dirty_page(riscv_memory, guest_page, page);
+		*leaf = (void*)((reg64)*leaf | PAGE_DIRTY);
+	}
+	// stores miss the TLB while the page has code or is not dirty yet, so that they are seen
+	int page_prot = (reg64)*leaf & PAGE_MASK;
+	Riscv64_tlb_entry* entry = &riscv_memory->tlb[(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+	entry->tag_read = (page_prot & PAGE_READ) ? guest_page : -1;
+	entry->tag_write = (page_prot & PAGE_WRITE) && !(page_prot & PAGE_CODE)
+	                   && (snapshot == NULL || (page_prot & PAGE_DIRTY)) ? guest_page : -1;
+	entry->addend = (long int)page - (long int)guest_page;
+	return page + (addr & PAGE_MASK);
+}
+
+static void flush_tlb(Riscv64_memory* riscv_memory)
+{
+	for(int i = 0; i < TLB_SIZE; i++)
+		riscv_memory->tlb[i].tag_read = riscv_memory->tlb[i].tag_write = -1;
+}
+
+reg64 load_slow(Riscv64_memory* riscv_memory, reg64 addr, int size)
+{
+	riscv_memory->tlb_miss++;
+	reg64 value = 0;
+	if((addr & PAGE_MASK) + size <= PAGE_SIZE)
+		memcpy(&value, translate(riscv_memory, addr, size, PAGE_READ), size);
+	else
+		for(int i = 0; i < size; i++) // across two pages
+			value |= (reg64)*translate(riscv_memory, addr + i, 1, PAGE_READ) << (8 * i);
+	return value;
+}
+
+void store_slow(Riscv64_memory* riscv_memory, reg64 addr, int size, reg64 value)
+{
+	riscv_memory->tlb_miss++;
+	if((addr & PAGE_MASK) + size <= PAGE_SIZE)
+		memcpy(translate(riscv_memory, addr, size, PAGE_WRITE), &value, size);
+	else
+		for(int i = 0; i < size; i++)
+			*translate(riscv_memory, addr + i, 1, PAGE_WRITE) = (byte)(value >> (8 * i));
+}
+
+void map_region(Riscv64_memory* riscv_memory, reg64 addr, reg64 length, int prot)
+{
+	reg64 start = addr & ~PAGE_MASK;
+	reg64 end = (addr + length + PAGE_MASK) & ~PAGE_MASK;
+	if(length == 0)
+		return;
+	// pages already given to an overlapping region get its permissions too
+	for(int i = 0; i < riscv_memory->region_num; i++)
+	{
+		Riscv64_region* region = &riscv_memory->region[i];
+		if(start < region->end && region->start < end)
+		{
+			region->prot |= prot;
+			prot = region->prot;
+			reg64 last = end < region->end ? end : region->end;
+			for(reg64 page = start > region->start ? start : region->start; page < last; page += PAGE_SIZE)
+			{
+				void** leaf = find_page(riscv_memory, page, FALSE);
+				if(leaf != NULL && *leaf != NULL)
+					*leaf = (void*)(((reg64)*leaf & ~PAGE_MASK) | ((reg64)*leaf & PAGE_DIRTY) | prot);
+			}
+		}
+	}
+	if(riscv_memory->region_num == REGION_MAX)
+	{
+		printf("Memory error: more than %d regions.\n", REGION_MAX);
+		raise_fault(riscv_memory, FAULT_HOST);
+	}
+	riscv_memory->region[riscv_memory->region_num].start = start;
+	riscv_memory->region[riscv_memory->region_num].end = end;
+	riscv_memory->region[riscv_memory->region_num].prot = prot;
+	riscv_memory->region_num++;
+	// the permissions may have changed
+	flush_tlb(riscv_memory);
+}
+
+void copy_to_guest(Riscv64_memory* riscv_memory, reg64 addr, const void* source, reg64 length)
+{
+	while(length > 0)
+	{
+		reg64 part = PAGE_SIZE - (addr & PAGE_MASK);
+		if(part > length)
+			part = length;
+		memcpy(translate(riscv_memory, addr, part, HOST_ACCESS | PAGE_WRITE), source, part);
+		addr += part;
+		source = (const byte*)source + part;
+		length -= part;
+	}
+}
+
+void copy_from_guest(Riscv64_memory* riscv_memory, void* destination, reg64 addr, reg64 length)
+{
+	while(length > 0)
+	{
+		reg64 part = PAGE_SIZE - (addr & PAGE_MASK);
+		if(part > length)
+			part = length;
+		memcpy(destination, translate(riscv_memory, addr, part, HOST_ACCESS), part);
+		addr += part;
+		destination = (byte*)destination + part;
+		length -= part;
+	}
+}
+
+bool map_file_to_guest(Riscv64_memory* riscv_memory, reg64 virtual_addr, reg64 length, int fd, long int offset)
+{
+	Riscv64_region* region = find_region(riscv_memory, virtual_addr);
+	if(((virtual_addr | length | offset) & PAGE_MASK) != 0 || length == 0 || sysconf(_SC_PAGESIZE) != PAGE_SIZE
+	   || region == NULL || virtual_addr + length > region->end)
+		return FALSE;
+	for(reg64 page = virtual_addr; page < virtual_addr + length; page += PAGE_SIZE)
+	{
+		void** leaf = find_page(riscv_memory, page, FALSE);
+		if(leaf != NULL && *leaf != NULL)
+			return FALSE;
+	}
+	byte* host = (byte*) mmap (NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+	if(host == MAP_FAILED)
+		return FALSE;
+	add_host_map(riscv_memory, host, length);
+	// the pages are shared with the page cache until the guest writes them
+	for(reg64 page = 0; page < length; page += PAGE_SIZE)
+		*find_page(riscv_memory, virtual_addr + page, TRUE) = (void*)((reg64)(host + page) | region->prot);
+	return TRUE;
+}
+
+static void visit_table(void** table, int level, reg64 base, page_visitor visit, void* arg)
+{
+	for(int i = 0; i < PAGE_ENTRIES; i++)
+	{
+		if(table[i] == NULL)
+			continue;
+		reg64 addr = base | ((reg64)i << (PAGE_SHIFT + PAGE_LEVEL_BITS * (PAGE_LEVELS - 1 - level)));
+		if(level < PAGE_LEVELS - 1)
+			visit_table((void**)table[i], level + 1, addr, visit, arg);
+		else
+			visit(arg, addr, (byte*)((reg64)table[i] & ~PAGE_MASK), PAGE_SIZE);
+	}
+}
+
+void visit_pages(Riscv64_memory* riscv_memory, page_visitor visit, void* arg)
+{
+	visit_table(riscv_memory->page_table, 0, 0, visit, arg);
+}
+
+void print_memory_stats(Riscv64_memory* riscv_memory)
+{
+	long int access = riscv_memory->tlb_hit + riscv_memory->tlb_miss;
+	printf("mmu: %d regions, %ld pages (%ld Kb) touched, tlb: %ld hits, %ld misses, hit rate %.4f%%\n",
+	       riscv_memory->region_num, riscv_memory->page_num, riscv_memory->page_num * PAGE_SIZE >> 10,
+	       riscv_memory->tlb_hit, riscv_memory->tlb_miss, access ? 100.0 * riscv_memory->tlb_hit / access : 0.0);
+}
+
+#endif
+
 
 /*********************************************/
 /*                                           */
@@ -25,23 +474,67 @@ void init_register(Riscv64_register** riscv_register, Riscv64_memory* riscv_memo
 	// set all registers 0 
 	*riscv_register = (Riscv64_register*) malloc (sizeof(Riscv64_register));
 	memset(*riscv_register, 0, sizeof(Riscv64_register));
-	(*riscv_register)->sp = get_virtual_addr(riscv_memory, (reg64)riscv_memory->stack_bottom); // set sp
+	(*riscv_register)->sp = STACK_ADDR; // set sp
+	// the run a bad access is reported for
+	riscv_memory->fault_register = *riscv_register;
 }
 
 // Riscv64_memory* init_memory(Riscv64_memory* riscv_memory)
 void init_memory(Riscv64_memory** riscv_memory)
 {
 	*riscv_memory = (Riscv64_memory*) malloc (sizeof(Riscv64_memory));
-	(*riscv_memory)->mem_size = MEM_SIZE;
-	(*riscv_memory)->memory = (byte*) malloc (sizeof(byte) * (*riscv_memory)->mem_size);
-	(*riscv_memory)->stack_bottom = get_actual_addr((*riscv_memory), (byte*)STACK_BOTTOM);
+	memset(*riscv_memory, 0, sizeof(Riscv64_memory));
+	(*riscv_memory)->mem_size = guest_mem_size;
+	(*riscv_memory)->process = *riscv_memory;
+	#ifdef SOFT_MMU
+	// nothing is mapped but the stack, load_program maps the segments and the heap
+	(*riscv_memory)->page_table = new_table(*riscv_memory);
+	map_region(*riscv_memory, STACK_ADDR - STACK_SIZE, STACK_SIZE + PAGE_SIZE, PAGE_READ | PAGE_WRITE);
+	#else
+	// anonymous pages are zero and only get host memory when first touched,
+	// nothing is reserved for the pages the guest never uses
+	byte* reserved = (byte*) mmap (NULL, guest_mem_size + 2 * GUARD_SIZE, PROT_NONE,
+	                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(reserved == MAP_FAILED
+	   || mprotect(reserved + GUARD_SIZE, guest_mem_size, PROT_READ | PROT_WRITE) != 0)
+	{
+		printf("Memory error: can not map %ld bytes of guest memory.\n", guest_mem_size);
+		exit(1);
+	}
+	(*riscv_memory)->memory = reserved + GUARD_SIZE;
+	host_page_size = sysconf(_SC_PAGESIZE);
+	(*riscv_memory)->page_state = (byte*) calloc (guest_mem_size / host_page_size, 1);
+	install_guard_handler();
+	(*riscv_memory)->next = memories;
+	memories = *riscv_memory;
+	#ifdef MADV_HUGEPAGE
+	if(guest_mem_hugepage)
+		madvise((*riscv_memory)->memory, guest_mem_size, MADV_HUGEPAGE);
+	#endif
+	// the stack stays as far below the end of the memory as in the default 128Mb
+	(*riscv_memory)->stack_bottom = get_actual_addr((*riscv_memory), (byte*)STACK_ADDR);
+	#endif
 }
 
 void delete_memory_system(Riscv64_decoder* riscv_decoder, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
 {
 	free(riscv_decoder);
 	free(riscv_register);
-	free(riscv_memory->memory);
+	#ifdef SOFT_MMU
+	delete_table(riscv_memory->page_table, 0);
+	for(long int i = 0; i < riscv_memory->map_num; i++)
+		munmap(riscv_memory->maps[i].addr, riscv_memory->maps[i].length);
+	free(riscv_memory->maps);
+	#else
+	Riscv64_memory** link = &memories;
+	while(*link != NULL && *link != riscv_memory)
+		link = &(*link)->next;
+	if(*link != NULL)
+		*link = riscv_memory->next;
+	munmap(riscv_memory->memory - GUARD_SIZE, riscv_memory->mem_size + 2 * GUARD_SIZE);
+	free(riscv_memory->page_state);
+	#endif
+	free(riscv_memory->symbols);
 	free(riscv_memory);
 }
 
@@ -52,6 +545,23 @@ void delete_memory_system(Riscv64_decoder* riscv_decoder, Riscv64_register* risc
 /*                                           */
 /*********************************************/
 
+#ifdef SOFT_MMU
+byte* get_actual_addr(Riscv64_memory* riscv_memory, byte* virtual_addr)
+{
+	return translate(riscv_memory, (reg64)virtual_addr, 1, HOST_ACCESS);
+}
+
+byte* get_virtual_addr(Riscv64_memory* riscv_memory, byte* actual_addr)
+{
+	printf("Error: get_virtual_addr() with the software mmu.\n");
+	exit(1);
+}
+
+bool out_of_memory_virtual(Riscv64_memory* riscv_memory, byte* virtual_addr)
+{
+	return find_region(riscv_memory, (reg64)virtual_addr) == NULL ? TRUE : FALSE;
+}
+#else
 byte* get_actual_addr(Riscv64_memory* riscv_memory, byte* virtual_addr)
 {
 	return riscv_memory->memory + (unsigned long int)virtual_addr;
@@ -67,6 +577,46 @@ bool out_of_memory_virtual(Riscv64_memory* riscv_memory, byte* virtual_addr)
 	return (unsigned long int)virtual_addr > riscv_memory->mem_size ? TRUE : FALSE;
 }
 
+void copy_to_guest(Riscv64_memory* riscv_memory, reg64 virtual_addr, const void* source, reg64 length)
+{
+	if(virtual_addr > riscv_memory->mem_size || length > riscv_memory->mem_size - virtual_addr)
+		bad_guest_access(riscv_memory, virtual_addr);
+	memcpy(riscv_memory->memory + virtual_addr, source, length);
+}
+
+void copy_from_guest(Riscv64_memory* riscv_memory, void* destination, reg64 virtual_addr, reg64 length)
+{
+	if(virtual_addr > riscv_memory->mem_size || length > riscv_memory->mem_size - virtual_addr)
+		bad_guest_access(riscv_memory, virtual_addr);
+	memcpy(destination, riscv_memory->memory + virtual_addr, length);
+}
+
+void map_region(Riscv64_memory* riscv_memory, reg64 virtual_addr, reg64 length, int prot)
+{
+	// all of the flat memory is accessible
+}
+
+bool map_file_to_guest(Riscv64_memory* riscv_memory, reg64 virtual_addr, reg64 length, int fd, long int offset)
+{
+	long int page_size = sysconf(_SC_PAGESIZE);
+	if(((virtual_addr | length | offset) & (page_size - 1)) != 0 || length == 0
+	   || virtual_addr + length > riscv_memory->mem_size || virtual_addr + length < virtual_addr)
+		return FALSE;
+	// replaces the anonymous pages, shared with the page cache until the guest writes them
+	return mmap(riscv_memory->memory + virtual_addr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) != MAP_FAILED;
+}
+
+void visit_pages(Riscv64_memory* riscv_memory, page_visitor visit, void* arg)
+{
+	// the pages never touched read as zero
+	visit(arg, 0, riscv_memory->memory, riscv_memory->mem_size);
+}
+
+void print_memory_stats(Riscv64_memory* riscv_memory)
+{
+}
+#endif
+
 bool out_of_memory_actual(Riscv64_memory* riscv_memory, byte* actual_addr)
 {
 	byte* memory_addr_0 = riscv_memory->memory;
@@ -82,60 +632,193 @@ void check_valid_memory_virtual(Riscv64_memory* riscv_memory, byte* virtual_addr
 	if(out_of_memory_virtual(riscv_memory, virtual_addr))
 	{
 		printf("Out of memory!\n");
-		exit(0);
+		raise_fault(riscv_memory, FAULT_ACCESS);
 	}
 	return;
 }
- 
 
 
-void  set_memory_reg8(Riscv64_memory* riscv_memory, byte* virtual_addr, reg8 value)
+byte* get_atomic_addr(Riscv64_memory* riscv_memory, reg64 virtual_addr, int size, bool write)
 {
-	check_valid_memory_virtual(riscv_memory, virtual_addr);
-	byte* actual_addr = get_actual_addr(riscv_memory, virtual_addr);
-	*(reg8*)actual_addr = value;
+	if(virtual_addr & (size - 1))
+		memory_fault(riscv_memory, "Misaligned atomic access!", virtual_addr, NULL);
+	#ifdef SOFT_MMU
+	return translate(riscv_memory, virtual_addr, size, write ? PAGE_WRITE : PAGE_READ);
+	#else
+	// out of the memory it faults on the guard pages as any other access, or is too far for them
+	if(FAR_FROM_MEMORY(riscv_memory, virtual_addr))
+		bad_guest_access(riscv_memory, virtual_addr);
+	return riscv_memory->memory + virtual_addr;
+	#endif
 }
-reg8 get_memory_reg8(Riscv64_memory* riscv_memory, byte* virtual_addr)
+
+
+/*********************************************/
+/*                                           */
+/* tracked pages                             */
+/*                                           */
+/*********************************************/
+
+void set_code_write_handler(Riscv64_memory* riscv_memory, code_write_handler handler, void* arg)
 {
-	check_valid_memory_virtual(riscv_memory, virtual_addr);
-	byte* actual_addr = get_actual_addr(riscv_memory, virtual_addr);
-	return *(reg8*)actual_addr;
+	riscv_memory->code_written = handler;
+	riscv_memory->code_write_arg = arg;
 }
-void  set_memory_reg16(Riscv64_memory* riscv_memory, byte* virtual_addr, reg16 value)
+
+#ifdef SOFT_MMU
+void mark_code_page(Riscv64_memory* riscv_memory, reg64 virtual_addr)
 {
-	check_valid_memory_virtual(riscv_memory, virtual_addr);
-	byte* actual_addr = get_actual_addr(riscv_memory, virtual_addr);
-	*(reg16*)actual_addr = value;
+	if(find_region(riscv_memory, virtual_addr) == NULL)
+		return;
+	translate(riscv_memory, virtual_addr, 1, HOST_ACCESS);
+	void** leaf = find_page(riscv_memory, virtual_addr, FALSE);
+	if((reg64)*leaf & PAGE_CODE)
+		return;
+	*leaf = (void*)((reg64)*leaf | PAGE_CODE);
+	// the next store to the page has to miss
+	Riscv64_tlb_entry* entry = &riscv_memory->tlb[(virtual_addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+	if(entry->tag_write == (virtual_addr & ~PAGE_MASK))
+		entry->tag_write = -1;
 }
-reg16 get_memory_reg16(Riscv64_memory* riscv_memory, byte* virtual_addr)
+
+bool track_host_write(Riscv64_memory* riscv_memory, byte* host)
 {
-	check_valid_memory_virtual(riscv_memory, virtual_addr);
-	byte* actual_addr = get_actual_addr(riscv_memory, virtual_addr);
-	return *(reg16*)actual_addr;
+	// the tlb miss of the store did it already
+	return FALSE;
 }
-void  set_memory_reg32(Riscv64_memory* riscv_memory, byte* virtual_addr, reg32 value)
+
+int guest_page_protection(Riscv64_memory* riscv_memory, reg64 virtual_addr)
 {
-	check_valid_memory_virtual(riscv_memory, virtual_addr);
-	byte* actual_addr = get_actual_addr(riscv_memory, virtual_addr);
-	*(reg32*)actual_addr = value;
+	return PROT_READ | PROT_WRITE;
 }
-reg32 get_memory_reg32(Riscv64_memory* riscv_memory, byte* virtual_addr)
+#else
+void mark_code_page(Riscv64_memory* riscv_memory, reg64 virtual_addr)
 {
-	check_valid_memory_virtual(riscv_memory, virtual_addr);
-	byte* actual_addr = get_actual_addr(riscv_memory, virtual_addr);
-	return *(reg32*)actual_addr;
+	if(virtual_addr >= riscv_memory->mem_size)
+		return;
+	byte* state = &riscv_memory->page_state[virtual_addr / host_page_size];
+	if(__atomic_load_n(state, __ATOMIC_RELAXED) & PAGE_CODE)
+		return;
+	pthread_mutex_lock(&code_pages);
+	__atomic_fetch_or(state, PAGE_CODE, __ATOMIC_SEQ_CST);
+	mprotect(riscv_memory->memory + (virtual_addr & ~(host_page_size - 1)), host_page_size, PROT_READ);
+	pthread_mutex_unlock(&code_pages);
 }
-void  set_memory_reg64(Riscv64_memory* riscv_memory, byte* virtual_addr, reg64 value)
-{		
-	check_valid_memory_virtual(riscv_memory, virtual_addr);
-	byte* actual_addr = get_actual_addr(riscv_memory, virtual_addr);
-	*(reg64*)actual_addr = value;
+
+bool track_host_write(Riscv64_memory* riscv_memory, byte* host)
+{
+	reg64 page = (reg64)(host - riscv_memory->memory) & ~(host_page_size - 1);
+	byte* state = &riscv_memory->page_state[page / host_page_size];
+	bool tracked = FALSE;
+	// harts may fault on the same page one after the other, only the first finds it a code page
+	if(__atomic_fetch_and(state, ~PAGE_CODE, __ATOMIC_SEQ_CST) & PAGE_CODE)
+	{
+		code_written(riscv_memory, page, host_page_size);
+		tracked = TRUE;
+	}
+	if(riscv_memory->snapshot != NULL && !(*state & PAGE_DIRTY))
+	{
+		save_dirty_page(riscv_memory, page, riscv_memory->memory + page);
+		*state |= PAGE_DIRTY;
+		tracked = TRUE;
+	}
+	return tracked;
 }
-reg64 get_memory_reg64(Riscv64_memory* riscv_memory, byte* virtual_addr)
+
+int guest_page_protection(Riscv64_memory* riscv_memory, reg64 virtual_addr)
 {
-	check_valid_memory_virtual(riscv_memory, virtual_addr);
-	byte* actual_addr = get_actual_addr(riscv_memory, virtual_addr);
-	return *(reg64*)actual_addr;
+	byte state = riscv_memory->page_state[virtual_addr / host_page_size];
+	if((state & PAGE_CODE) || (riscv_memory->snapshot != NULL && !(state & PAGE_DIRTY)))
+		return PROT_READ;
+	return PROT_READ | PROT_WRITE;
+}
+#endif
+
+
+/*********************************************/
+/*                                           */
+/* snapshots                                 */
+/*                                           */
+/*********************************************/
+
+void init_snapshot(Riscv64_snapshot** snapshot, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	*snapshot = (Riscv64_snapshot*) malloc (sizeof(Riscv64_snapshot));
+	memset(*snapshot, 0, sizeof(Riscv64_snapshot));
+	(*snapshot)->registers = *riscv_register;
+	(*snapshot)->edata = riscv_memory->edata;
+	riscv_memory->snapshot = *snapshot;
+	#ifdef SOFT_MMU
+	(*snapshot)->page_size = PAGE_SIZE;
+	flush_tlb(riscv_memory);
+	#else
+	(*snapshot)->page_size = host_page_size;
+	// the first write to each page faults
+	mprotect(riscv_memory->memory, riscv_memory->mem_size, PROT_READ);
+	#endif
+}
+
+long int restore_snapshot(Riscv64_snapshot* snapshot, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	for(long int i = 0; i < snapshot->dirty_num; i++)
+	{
+		reg64 page = snapshot->dirty[i];
+		byte* saved = snapshot->pages + i * snapshot->page_size;
+		// the translations of a code page may be from the content it had in the run
+		#ifdef SOFT_MMU
+		void** leaf = find_page(riscv_memory, page, FALSE);
+		if((reg64)*leaf & PAGE_CODE)
+			code_written(riscv_memory, page, PAGE_SIZE);
+		memcpy((byte*)((reg64)*leaf & ~PAGE_MASK), saved, PAGE_SIZE);
+		*leaf = (void*)((reg64)*leaf & ~(PAGE_DIRTY | PAGE_CODE));
+		#else
+		byte* state = &riscv_memory->page_state[page / host_page_size];
+		if(*state & PAGE_CODE)
+		{
+			code_written(riscv_memory, page, host_page_size);
+			mprotect(riscv_memory->memory + page, host_page_size, PROT_READ | PROT_WRITE);
+		}
+		memcpy(riscv_memory->memory + page, saved, host_page_size);
+		*state &= ~(PAGE_DIRTY | PAGE_CODE);
+		mprotect(riscv_memory->memory + page, host_page_size, PROT_READ);
+		#endif
+	}
+	#ifdef SOFT_MMU
+	flush_tlb(riscv_memory);
+	#endif
+	long int restored = snapshot->dirty_num;
+	snapshot->dirty_num = 0;
+	snapshot->restored += restored;
+	snapshot->restore_num++;
+
+	*riscv_register = snapshot->registers;
+	riscv_memory->edata = snapshot->edata;
+	return restored;
+}
+
+void delete_snapshot(Riscv64_snapshot* snapshot, Riscv64_memory* riscv_memory)
+{
+	#ifdef SOFT_MMU
+	for(long int i = 0; i < snapshot->dirty_num; i++)
+	{
+		void** leaf = find_page(riscv_memory, snapshot->dirty[i], FALSE);
+		*leaf = (void*)((reg64)*leaf & ~PAGE_DIRTY);
+	}
+	riscv_memory->snapshot = NULL;
+	flush_tlb(riscv_memory);
+	#else
+	for(long int i = 0; i < snapshot->dirty_num; i++)
+		riscv_memory->page_state[snapshot->dirty[i] / host_page_size] &= ~PAGE_DIRTY;
+	riscv_memory->snapshot = NULL;
+	// writable again but for the code pages
+	mprotect(riscv_memory->memory, riscv_memory->mem_size, PROT_READ | PROT_WRITE);
+	for(long int i = 0; i < riscv_memory->mem_size / host_page_size; i++)
+		if(riscv_memory->page_state[i] & PAGE_CODE)
+			mprotect(riscv_memory->memory + i * host_page_size, host_page_size, PROT_READ);
+	#endif
+	free(snapshot->dirty);
+	free(snapshot->pages);
+	free(snapshot);
 }
 
 
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <setjmp.h>
 
 typedef unsigned char      reg8;
 typedef unsigned short int reg16;
@@ -53,8 +54,10 @@ typedef unsigned int instruction;
 #define t6   x[31]   // ..
 
 // memory size 128Mb
-#define MEM_SIZE 1<<27           // 0x0800 0000
-#define STACK_BOTTOM 0x6000000   // virtual address of stack 
+#define MEM_SIZE 1<<27           // 0x0800 0000, default of guest_mem_size
+#define STACK_BOTTOM 0x6000000   // virtual address of stack, moved up with the end of a bigger memory
+#define STACK_ADDR (guest_mem_size - ((MEM_SIZE) - STACK_BOTTOM)) // initial sp
+#define STACK_SIZE (8L<<20)      // the stack is below STACK_ADDR, the heap below it
 #define TRUE 1
 #define FALSE 0
 
@@ -97,6 +100,83 @@ typedef struct riscv64_register{
 	reg64 f[32];
 } Riscv64_register;
 
+#ifdef SOFT_MMU
+/*********************************************/
+/* Built with "make MMU=soft" the guest has  */
+/* a sparse 48-bit address space of 4Kb      */
+/* pages instead of one flat buffer. Only    */
+/* the regions mapped by map_region() can be */
+/* accessed; their pages get host memory on  */
+/* first touch and keep the permissions of   */
+/* the region. A direct-mapped TLB in front  */
+/* of the page table turns the common load   */
+/* or store into a tag compare and an add.   */
+/*********************************************/
+#define PAGE_SHIFT   12
+#define PAGE_SIZE    (1L<<PAGE_SHIFT)
+#define PAGE_MASK    (PAGE_SIZE - 1)
+#define PAGE_LEVEL_BITS 9             // 4 levels of 512 entries above the page offset
+#define PAGE_LEVELS  4
+#define TLB_SIZE     256              // entries of the direct-mapped TLB
+#define REGION_MAX   16
+
+typedef struct riscv64_tlb_entry{
+	reg64 tag_read;   // guest page address if loads hit this entry, -1 if not
+	reg64 tag_write;  // guest page address if stores hit this entry, -1 if not
+	long int addend;  // host address - guest address within the page
+} Riscv64_tlb_entry;
+
+typedef struct riscv64_host_map{
+	void* addr;
+	long int length;
+} Riscv64_host_map;
+
+typedef struct riscv64_region{
+	reg64 start;      // page aligned
+	reg64 end;
+	int prot;         // PAGE_READ | PAGE_WRITE | PAGE_EXEC
+} Riscv64_region;
+#endif
+
+#define PAGE_READ  1
+#define PAGE_WRITE 2
+#define PAGE_EXEC  4
+// state of a page, in the page table with MMU=soft
+#define PAGE_DIRTY 8  // written since the snapshot was taken
+#define PAGE_CODE  16 // the caches hold translations of it, stores drop them (see mark_code_page())
+
+/*********************************************/
+/* A snapshot holds the registers right      */
+/* after load_program and tracks the pages   */
+/* written since then. The first write to a  */
+/* page saves its old content (a write fault */
+/* on the read-only flat memory, a TLB miss  */
+/* with MMU=soft), so restoring it copies    */
+/* back only the pages the run touched.      */
+/*********************************************/
+typedef struct riscv64_snapshot{
+	Riscv64_register registers;
+	byte* edata;
+	long int page_size;
+	reg64* dirty;               // guest pages written since the snapshot or the last restore
+	long int dirty_num;
+	long int dirty_size;
+	byte* pages;                // their old contents, in the same order
+	// statistics
+	long int restored;          // pages copied back by every restore
+	long int restore_num;
+} Riscv64_snapshot;
+
+// drop the translations of [virtual_addr, virtual_addr + length), TRUE if there were any
+typedef bool (*code_write_handler)(void* arg, reg64 virtual_addr, reg64 length);
+
+// a symbol of the ELF with a size, its name is in the mapped file
+typedef struct riscv64_symbol{
+	reg64 addr;
+	reg64 size;
+	const char* name;
+} Riscv64_symbol;
+
 // memory
 typedef struct riscv64_memory{
 	// main memory
@@ -105,7 +185,62 @@ typedef struct riscv64_memory{
 	byte *stack_bottom;
 	// top of the heap 
 	byte* edata;
-
+	// range of the executable sections, set by load_program
+	reg64 text_start;
+	reg64 text_end;
+	// the objects and functions of the symbol table by address, set by load_program
+	Riscv64_symbol* symbols;
+	long int symbol_num;
+	// dirty pages are tracked while a snapshot is set
+	Riscv64_snapshot* snapshot;
+	// called before a store into a code page, see mark_code_page()
+	code_write_handler code_written;
+	void* code_write_arg;
+	// set after the handler dropped translations, the block engine leaves the block at the store (see "block_cache.c")
+	bool code_invalidated;
+	// the registers a bad access is reported with, set by init_register
+	Riscv64_register* fault_register;
+	// the memory of the program, the one of hart 0; a hart started by clone runs on a copy of
+	// it with the models and the state of its own, see "hart.h"
+	struct riscv64_memory* process;
+	struct riscv64_harts* harts;    // of the process, NULL until the first clone
+	int hart_id;                    // of the hart that runs on it, 0 for the process
+	// the reservation of lr, sc succeeds while it holds the value lr read
+	reg64 reservation;
+	reg64 reservation_value;
+	bool reserved;
+	// set by the exit system call, the engines stop there
+	bool exit_happened;
+	int exit_code;                  // a0 of the exit system call
+	int fault;                      // FAULT_xxx that ended the program in the place of an exit
+	// fused pairs executed by their handler, see "decode_cache.h"
+	long int fused_executed;
+	// the caches every access goes through with CACHE_MODEL, see "cache_model.h"
+	struct riscv64_cache_model* cache_model;
+	// the predictors every branch goes through with BRANCH_MODEL, see "branch_predictor.h"
+	struct riscv64_branch_model* branch_model;
+	// the timing model every executed record goes to with PIPELINE_MODEL, see "pipeline_model.h"
+	struct riscv64_pipeline_model* pipeline_model;
+	// or the out-of-order one with OOO_MODEL, see "ooo_model.h"
+	struct riscv64_ooo_model* ooo_model;
+#ifndef SOFT_MMU
+	byte* page_state;           // PAGE_DIRTY and PAGE_CODE of every host page
+	struct riscv64_memory* next; // the memories the SIGSEGV handler looks through
+#endif
+#ifdef SOFT_MMU
+	void** page_table;          // root of the radix tree, leaves hold host page | prot
+	Riscv64_region region[REGION_MAX];
+	int region_num;
+	Riscv64_tlb_entry tlb[TLB_SIZE];
+	byte* chunk;                // host pages are carved from chunks of PAGE_CHUNK bytes
+	long int chunk_used;
+	Riscv64_host_map* maps;     // every chunk and mapped file range, for delete_memory_system
+	long int map_num;
+	// statistics
+	long int tlb_hit;
+	long int tlb_miss;
+	long int page_num;          // pages given host memory
+#endif
 } Riscv64_memory;
 
 
@@ -116,10 +251,24 @@ typedef struct riscv64_memory{
 /*********************************************/
 
 void init_decoder(Riscv64_decoder**);
-void init_memory(Riscv64_memory**);
+void init_memory(Riscv64_memory**); // guest_mem_size bytes, zero-filled and paged in on demand
 void init_register(Riscv64_register**, Riscv64_memory*);
 void delete_memory_system(Riscv64_decoder*, Riscv64_register*, Riscv64_memory*); // free the memory 
 
+// size of the guest memory and whether to ask for transparent huge pages, set before init_memory
+extern long int guest_mem_size;
+extern bool guest_mem_hugepage;
+
+// what ends a program that did not exit, after a message
+#define FAULT_NONE   0
+#define FAULT_ACCESS 1  // a guest access out of the memory, or one its page does not allow
+#define FAULT_HOST   2  // no host memory for the guest
+// a thread that catches faults goes back to jump (siglongjmp, the value is the fault) with the
+// fault and exit_happened set in the memory of the process; one that does not exits the process,
+// with 0 after a bad access and 1 without memory
+void catch_faults(sigjmp_buf* jump); // of the calling thread, NULL to stop
+void raise_fault(Riscv64_memory*, int fault) __attribute__((noreturn));
+
 /*********************************************/
 /*                                           */
 /* functions for decoder                     */
@@ -136,21 +285,110 @@ void decode_instruction(Riscv64_decoder*);
 
 /* note: actual_addr stands for the addr in your machine  */
 /*       while virtual_addr for the addr in the simulator */
-byte* get_actual_addr(Riscv64_memory*, byte* virtual_addr); // return the actual addr in this machine
-byte* get_virtual_addr(Riscv64_memory*, byte* actual_addr); // invese function of the function above
+byte* get_actual_addr(Riscv64_memory*, byte* virtual_addr); // return the actual addr in this machine (only within its page with MMU=soft)
+byte* get_virtual_addr(Riscv64_memory*, byte* actual_addr); // invese function of the function above (not with MMU=soft)
+// copy between the host and guest memory, for loading and system calls, ignoring the page permissions
+void copy_to_guest(Riscv64_memory*, reg64 virtual_addr, const void* source, reg64 length);
+void copy_from_guest(Riscv64_memory*, void* destination, reg64 virtual_addr, reg64 length);
+// make [virtual_addr, virtual_addr + length) accessible with prot (PAGE_READ etc.), nothing to do with a flat memory
+void map_region(Riscv64_memory*, reg64 virtual_addr, reg64 length, int prot);
+// map length bytes of the file at offset copy-on-write at virtual_addr, all three page aligned
+// and inside a mapped region, return FALSE if the memory can not (then copy the bytes instead)
+bool map_file_to_guest(Riscv64_memory*, reg64 virtual_addr, reg64 length, int fd, long int offset);
+void print_memory_stats(Riscv64_memory*);
+// call visit for the guest memory that may hold data, in address order: all of the flat memory
+// at once, or every page given host memory with MMU=soft
+typedef void (*page_visitor)(void* arg, reg64 virtual_addr, byte* host, long int length);
+void visit_pages(Riscv64_memory*, page_visitor visit, void* arg);
+// self-modifying code: the caches mark the pages they translate from, a store into such a
+// page calls the code write handler, which drops the translations (with harts, on the thread
+// of the hart that stores, see "hart.h"). With MMU=soft every store into the page misses the
+// TLB and drops only what it overwrites; the flat memory sees the first store as a fault on
+// the read-only page and drops the translations of the whole page, which is writable again
+// until the caches translate from it anew.
+void set_code_write_handler(Riscv64_memory*, code_write_handler, void* arg);
+void mark_code_page(Riscv64_memory*, reg64 virtual_addr);
+// for a SIGSEGV handler: the store to host did what the tracked pages need (TRUE), then let it through
+// with the protection guest_page_protection() gives for the page (flat memory only)
+bool track_host_write(Riscv64_memory*, byte* host);
+int guest_page_protection(Riscv64_memory*, reg64 virtual_addr);
+// snapshot the loaded program and start tracking dirty pages, restore it as often as wanted
+void init_snapshot(Riscv64_snapshot**, Riscv64_register*, Riscv64_memory*);
+long int restore_snapshot(Riscv64_snapshot*, Riscv64_register*, Riscv64_memory*); // return the pages copied back
+void delete_snapshot(Riscv64_snapshot*, Riscv64_memory*);
 bool out_of_memory_virtual(Riscv64_memory*, byte* virtual_addr);
 bool out_of_memory_actual(Riscv64_memory*, byte* actual_addr); // judge if the actual address is out of virtual memory  
-void check_valid_memory_virtual(Riscv64_memory*, byte* virtual_addr); // check if the virtual memory is valid, if not exit(1)
+void check_valid_memory_virtual(Riscv64_memory*, byte* virtual_addr); // check if the virtual memory is valid, if not raise_fault()
+// host address of an aligned atomic access of size bytes (lr, sc and amo), reported as a bad access if not
+byte* get_atomic_addr(Riscv64_memory*, reg64 virtual_addr, int size, bool write);
+
+// inaccessible bytes on each side of the guest memory
+#define GUARD_SIZE (1L<<36)
+// report an access out of the memory at the pc of the running instruction and raise the fault,
+// for the accesses that check the address themselves
+void bad_guest_access(Riscv64_memory*, reg64 virtual_addr) __attribute__((noreturn));
 
 /* note: the only way to access memory is through vitual_addr */
-void  set_memory_reg8(Riscv64_memory*, byte* virtual_addr, reg8 value);
-reg8  get_memory_reg8(Riscv64_memory*, byte* virtual_addr);
-void  set_memory_reg16(Riscv64_memory*, byte* virtual_addr, reg16 value);
-reg16 get_memory_reg16(Riscv64_memory*, byte* virtual_addr);
-void  set_memory_reg32(Riscv64_memory*, byte* virtual_addr, reg32 value);
-reg32 get_memory_reg32(Riscv64_memory*, byte* virtual_addr);
-void  set_memory_reg64(Riscv64_memory*, byte* virtual_addr, reg64 value);
-reg64 get_memory_reg64(Riscv64_memory*, byte* virtual_addr);
+#ifdef SOFT_MMU
+/*       a TLB hit costs a compare and an add, a miss,      */
+/*       misaligned or not, walks the page table            */
+reg64 load_slow(Riscv64_memory*, reg64 virtual_addr, int size);
+void  store_slow(Riscv64_memory*, reg64 virtual_addr, int size, reg64 value);
+#define MEMORY_ACCESS(type, name) \
+	static inline void set_memory_##name(Riscv64_memory* riscv_memory, byte* virtual_addr, type value) \
+	{ \
+		reg64 addr = (reg64)virtual_addr; \
+		Riscv64_tlb_entry* entry = &riscv_memory->tlb[(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)]; \
+		if(entry->tag_write == (addr & ~(PAGE_MASK ^ (sizeof(type) - 1)))) \
+		{ \
+			riscv_memory->tlb_hit++; \
+			*(type*)(entry->addend + addr) = value; \
+		} \
+		else \
+			store_slow(riscv_memory, addr, sizeof(type), value); \
+	} \
+	static inline type get_memory_##name(Riscv64_memory* riscv_memory, byte* virtual_addr) \
+	{ \
+		reg64 addr = (reg64)virtual_addr; \
+		Riscv64_tlb_entry* entry = &riscv_memory->tlb[(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)]; \
+		if(entry->tag_read == (addr & ~(PAGE_MASK ^ (sizeof(type) - 1)))) \
+		{ \
+			riscv_memory->tlb_hit++; \
+			return *(type*)(entry->addend + addr); \
+		} \
+		return (type)load_slow(riscv_memory, addr, sizeof(type)); \
+	}
+#else
+/*       an address out of the memory but within the guard  */
+/*       faults on the guard pages (see "memory_system.c"), */
+/*       one farther away, which would reach host memory,   */
+/*       takes the slow path                                */
+#define FAR_FROM_MEMORY(riscv_memory, addr) \
+	__builtin_expect((addr) + GUARD_SIZE >= (reg64)(riscv_memory)->mem_size + 2 * GUARD_SIZE, 0)
+#define MEMORY_ACCESS(type, name) \
+	static inline void set_memory_##name(Riscv64_memory* riscv_memory, byte* virtual_addr, type value) \
+	{ \
+		if(FAR_FROM_MEMORY(riscv_memory, (reg64)virtual_addr)) \
+			bad_guest_access(riscv_memory, (reg64)virtual_addr); \
+		*(type*)(riscv_memory->memory + (unsigned long int)virtual_addr) = value; \
+	} \
+	static inline type get_memory_##name(Riscv64_memory* riscv_memory, byte* virtual_addr) \
+	{ \
+		if(FAR_FROM_MEMORY(riscv_memory, (reg64)virtual_addr)) \
+			bad_guest_access(riscv_memory, (reg64)virtual_addr); \
+		return *(type*)(riscv_memory->memory + (unsigned long int)virtual_addr); \
+	}
+#endif
+MEMORY_ACCESS(reg8,  reg8)
+MEMORY_ACCESS(reg16, reg16)
+MEMORY_ACCESS(reg32, reg32)
+MEMORY_ACCESS(reg64, reg64)
+#undef MEMORY_ACCESS
+
+// an engine running host code of its own finds the guest pc of a faulting host instruction,
+// FALSE if host_pc is not its code
+typedef bool (*guest_pc_finder)(void* host_pc, reg64* guest_pc);
+void add_guest_pc_finder(guest_pc_finder);
 
 
 /*********************************************/
@@ -0,0 +1,351 @@
+#include <limits.h>
+#include "ooo_model.h"
+
+Riscv64_ooo_config ooo_config = {
+	4,   // fetch_width, also the dispatch width
+	4,   // issue_width
+	4,   // commit_width
+	5,   // depth
+	128, // rob
+	48,  // iq
+	48,  // lsq
+	128, // prf
+	{3, 1, 2, 2}, // alu, mul, lsu, fpu
+};
+
+static const char* cpi_name[CPI_NUM] = {"base", "frontend", "branch", "memory", "muldiv", "fp", "dependence", "execute"};
+static const byte class_unit[CLASS_NUM] = {UNIT_ALU, UNIT_LSU, UNIT_LSU, UNIT_MUL, UNIT_MUL, UNIT_FP, UNIT_FP, UNIT_ALU, UNIT_ALU, UNIT_ALU};
+
+bool set_ooo_config(const char* spec)
+{
+	char name[16];
+	int value;
+	if(sscanf(spec, "%15[a-z]:%d", name, &value) != 2 || value < 1)
+	{
+		printf("-ooo needs name:value, the name one of fetch, issue, commit, depth, rob, iq, lsq, prf, alu, mul, lsu, fpu.\n");
+		return FALSE;
+	}
+	Riscv64_ooo_config* c = &ooo_config;
+	int* field = NULL;
+	int max = 16;
+	if(strcmp(name, "fetch") == 0)       field = &c->fetch_width;
+	else if(strcmp(name, "issue") == 0)  field = &c->issue_width;
+	else if(strcmp(name, "commit") == 0) field = &c->commit_width;
+	else if(strcmp(name, "depth") == 0)  field = &c->depth, max = 64;
+	else if(strcmp(name, "rob") == 0)    field = &c->rob, max = OOO_RING;
+	else if(strcmp(name, "iq") == 0)     field = &c->iq, max = OOO_RING;
+	else if(strcmp(name, "lsq") == 0)    field = &c->lsq, max = OOO_RING;
+	else if(strcmp(name, "prf") == 0)    field = &c->prf, max = 32 + OOO_RING;
+	else if(strcmp(name, "alu") == 0)    field = &c->units[UNIT_ALU];
+	else if(strcmp(name, "mul") == 0)    field = &c->units[UNIT_MUL];
+	else if(strcmp(name, "lsu") == 0)    field = &c->units[UNIT_LSU];
+	else if(strcmp(name, "fpu") == 0)    field = &c->units[UNIT_FP];
+	if(field == NULL)
+	{
+		printf("-ooo: unknown name %s.\n", name);
+		return FALSE;
+	}
+	if(value > max || (field == &c->prf && value <= 32))
+	{
+		printf("-ooo: %s must be %s%d.\n", name, field == &c->prf ? "more than 32 and at most " : "at most ", max);
+		return FALSE;
+	}
+	*field = value;
+	return TRUE;
+}
+
+
+/*********************************************/
+/*                                           */
+/* initialization and gc                     */
+/*                                           */
+/*********************************************/
+
+void init_ooo_model(Riscv64_ooo_model** model)
+{
+	init_inst_timing();
+	*model = (Riscv64_ooo_model*) malloc (sizeof(Riscv64_ooo_model));
+	(*model)->config = ooo_config;
+	reset_ooo_model(*model);
+}
+
+void reset_ooo_model(Riscv64_ooo_model* model)
+{
+	Riscv64_ooo_config config = model->config;
+	memset(model, 0, sizeof(Riscv64_ooo_model));
+	model->config = config;
+	model->fetch_cycle = 1;
+	model->quantum.end = LONG_MAX;
+	memset(model->gshare, 1, sizeof(model->gshare)); // weakly not taken
+}
+
+void delete_ooo_model(Riscv64_ooo_model* model)
+{
+	free(model);
+}
+
+
+/*********************************************/
+/*                                           */
+/* timing                                    */
+/*                                           */
+/*********************************************/
+
+// forget the issue slots of the cycles before cycle, no instruction issues there any more
+static void advance_slots(Riscv64_ooo_model* model, long int cycle)
+{
+	if(cycle - model->slot_base >= OOO_ISSUE_RING)
+	{
+		memset(model->slots, 0, sizeof(model->slots));
+		memset(model->unit_slots, 0, sizeof(model->unit_slots));
+		model->slot_base = cycle;
+		return;
+	}
+	for(; model->slot_base < cycle; model->slot_base++)
+	{
+		int s = model->slot_base % OOO_ISSUE_RING;
+		model->slots[s] = 0;
+		memset(model->unit_slots[s], 0, UNIT_NUM);
+	}
+}
+
+// the first cycle from cycle with a free issue slot and unit, taken
+static long int take_slot(Riscv64_ooo_model* model, long int cycle, int unit)
+{
+	Riscv64_ooo_config* c = &model->config;
+	for(; cycle < model->slot_base + OOO_ISSUE_RING; cycle++)
+	{
+		int s = cycle % OOO_ISSUE_RING;
+		if(model->slots[s] < c->issue_width && model->unit_slots[s][unit] < c->units[unit])
+		{
+			model->slots[s]++;
+			model->unit_slots[s][unit]++;
+			return cycle;
+		}
+	}
+	return cycle; // too far ahead to be counted, only after very long chains
+}
+
+// TRUE if the front end guessed wrong where the branch or jump goes
+static bool mispredicted(Riscv64_ooo_model* model, Riscv64_decoded* record, reg64 pc, reg64 next_pc)
+{
+	bool taken = next_pc != pc + sizeof(instruction);
+	if(record->id == INST_JAL)
+		return FALSE;
+	if(record->id == INST_JALR)
+	{
+		if(record->rd == 0 && (record->rs1 == 1 || record->rs1 == 5))
+			return FALSE; // returns, a deep enough return address stack
+		reg64* target = &model->targets[(pc >> 2) % OOO_TARGETS];
+		bool wrong = *target != next_pc;
+		*target = next_pc;
+		return wrong;
+	}
+	byte* counter = &model->gshare[((pc >> 2) ^ model->history) & (sizeof(model->gshare) - 1)];
+	bool wrong = (*counter >= 2) != taken;
+	if(taken && *counter < 3)
+		(*counter)++;
+	else if(!taken && *counter > 0)
+		(*counter)--;
+	model->history = (model->history << 1) | taken;
+	return wrong;
+}
+
+static void retire_one(Riscv64_ooo_model* model, Riscv64_decoded* record, reg64 pc, reg64 next_pc)
+{
+	Riscv64_ooo_config* c = &model->config;
+	Riscv64_inst_timing timing;
+	inst_timing(record, &timing);
+	int klass = timing.klass;
+	long int n = model->n++;
+	bool memory = klass == CLASS_LOAD || klass == CLASS_STORE;
+	int file = timing.rd >= 32;
+
+	// fetch, held back when dispatch is depth cycles behind
+	if(model->fetch_count >= c->fetch_width)
+	{
+		model->fetch_cycle++;
+		model->fetch_count = 0;
+	}
+	if(model->dispatch_cycle - c->depth > model->fetch_cycle)
+	{
+		model->fetch_cycle = model->dispatch_cycle - c->depth;
+		model->fetch_count = 0;
+	}
+	long int fetch = model->fetch_cycle;
+	model->fetch_count++;
+	bool redirected = model->after_mispredict;
+	model->after_mispredict = FALSE;
+
+	// dispatch
+	long int dispatch = fetch + c->depth;
+	if(dispatch > model->dispatch_cycle)
+	{
+		model->dispatch_cycle = dispatch;
+		model->dispatch_count = 0;
+	}
+	else if(model->dispatch_count >= c->fetch_width)
+	{
+		model->dispatch_cycle++;
+		model->dispatch_count = 0;
+	}
+	dispatch = model->dispatch_cycle;
+	long int freed[4] = {0, 0, 0, 0}; // cycles an entry of the ROB, IQ, LSQ and registers is free
+	if(n >= c->rob)
+		freed[0] = model->commit_ring[(n - c->rob) % OOO_RING] + 1;
+	if(n >= c->iq)
+		freed[1] = model->issue_ring[(n - c->iq) % OOO_RING] + 1;
+	if(memory && model->memory_n >= c->lsq)
+		freed[2] = model->memory_ring[(model->memory_n - c->lsq) % OOO_RING] + 1;
+	if(timing.rd != NO_REGISTER && model->rename_n[file] >= c->prf - 32)
+		freed[3] = model->rename_ring[file][(model->rename_n[file] - (c->prf - 32)) % OOO_RING] + 1;
+	int full = -1;
+	for(int i = 0; i < 4; i++)
+		if(freed[i] > dispatch && (full < 0 || freed[i] > freed[full]))
+			full = i;
+	if(full >= 0)
+	{
+		model->dispatch_stalls[full] += freed[full] - dispatch;
+		dispatch = model->dispatch_cycle = freed[full];
+		model->dispatch_count = 0;
+	}
+	model->dispatch_count++;
+
+	// issue, when the sources are written
+	long int ready = dispatch + 1;
+	bool waited = FALSE;
+	for(int i = 0; i < 3; i++)
+	{
+		byte r = timing.rs[i];
+		if(model->ready[r] > ready)
+		{
+			ready = model->ready[r];
+			waited = TRUE;
+		}
+	}
+	if(model->unit_free[klass] > ready)
+		ready = model->unit_free[klass];
+	if(klass == CLASS_SYS && model->finish > ready)
+		ready = model->finish; // after all older ones
+	advance_slots(model, dispatch + 1);
+	long int issue = take_slot(model, ready, class_unit[klass]);
+	int latency = pipeline_latency[klass];
+	long int complete = issue + latency;
+	if(klass == CLASS_DIV || klass == CLASS_FDIV)
+		model->unit_free[klass] = complete;
+	if(timing.rd != NO_REGISTER)
+	{
+		model->ready[timing.rd] = complete;
+		model->producer[timing.rd] = klass;
+	}
+	if(complete > model->finish)
+		model->finish = complete;
+
+	// commit, in order
+	long int commit = complete + 1;
+	if(commit > model->commit_cycle)
+	{
+		// the cycles nothing committed, waiting for this one
+		long int gap = commit - model->commit_cycle - 1;
+		int reason;
+		if(dispatch > model->commit_cycle)
+			reason = redirected ? CPI_BRANCH : CPI_FRONTEND;
+		else if(klass == CLASS_LOAD)
+			reason = CPI_MEMORY;
+		else if(klass == CLASS_MUL || klass == CLASS_DIV)
+			reason = CPI_MULDIV;
+		else if(klass == CLASS_FP || klass == CLASS_FDIV)
+			reason = CPI_FP;
+		else
+			reason = waited ? CPI_DEPENDENCE : CPI_EXECUTE;
+		model->cpi[reason] += gap;
+		model->cpi[CPI_BASE]++;
+		model->commit_cycle = commit;
+		model->commit_count = 1;
+	}
+	else if(model->commit_count >= c->commit_width)
+	{
+		model->cpi[CPI_BASE]++;
+		model->commit_cycle++;
+		model->commit_count = 1;
+	}
+	else
+		model->commit_count++;
+	commit = model->commit_cycle;
+
+	model->commit_ring[n % OOO_RING] = commit;
+	model->issue_ring[n % OOO_RING] = issue;
+	if(memory)
+		model->memory_ring[model->memory_n++ % OOO_RING] = commit;
+	if(timing.rd != NO_REGISTER)
+		model->rename_ring[file][model->rename_n[file]++ % OOO_RING] = commit;
+
+	// where fetch goes on
+	if(klass == CLASS_BRANCH || klass == CLASS_JUMP)
+	{
+		if(mispredicted(model, record, pc, next_pc))
+		{
+			model->mispredicted++;
+			model->after_mispredict = TRUE;
+			if(complete + 1 > model->fetch_cycle)
+				model->fetch_cycle = complete + 1;
+			model->fetch_count = 0;
+		}
+		else if(next_pc != pc + sizeof(instruction))
+			model->fetch_count = c->fetch_width; // a taken one ends the fetch group
+	}
+	else if(klass == CLASS_SYS)
+	{
+		if(complete + 1 > model->fetch_cycle)
+			model->fetch_cycle = complete + 1;
+		model->fetch_count = 0;
+	}
+}
+
+void ooo_retire(Riscv64_ooo_model* model, Riscv64_decoded* record, reg64 pc, reg64 next_pc)
+{
+	if(record->id >= INST_FUSED_FIRST)
+	{
+		Riscv64_decoded first = *record;
+		unfuse_record(&first);
+		retire_one(model, &first, pc, pc + sizeof(instruction));
+		retire_one(model, record + 1, pc + sizeof(instruction), next_pc);
+	}
+	else
+		retire_one(model, record, pc, next_pc);
+	if(model->commit_cycle >= model->quantum.end)
+		model->quantum.handler(model->quantum.arg);
+}
+
+long int ooo_cycles(Riscv64_ooo_model* model)
+{
+	return model->commit_cycle;
+}
+
+Riscv64_quantum* ooo_quantum(Riscv64_ooo_model* model)
+{
+	return &model->quantum;
+}
+
+
+/*********************************************/
+/*                                           */
+/* statistics                                */
+/*                                           */
+/*********************************************/
+
+void print_ooo_stats(Riscv64_ooo_model* model)
+{
+	Riscv64_ooo_config* c = &model->config;
+	long int cycles = model->commit_cycle;
+	long int n = model->n;
+	printf("ooo: %d-wide, rob %d, iq %d, lsq %d, prf %d; %ld cycles, %ld instructions, IPC %.3f, CPI %.3f\n",
+	       c->fetch_width, c->rob, c->iq, c->lsq, c->prf, cycles, n,
+	       cycles ? (double)n / cycles : 0.0, n ? (double)cycles / n : 0.0);
+	printf("ooo CPI stack:");
+	for(int i = 0; i < CPI_NUM; i++)
+		printf(" %s %.3f%s", cpi_name[i], n ? (double)model->cpi[i] / n : 0.0, i < CPI_NUM - 1 ? "," : "\n");
+	printf("ooo: %ld mispredicted (%.2f MPKI), dispatch stalled rob %ld, iq %ld, lsq %ld, registers %ld cycles\n",
+	       model->mispredicted, n ? 1000.0 * model->mispredicted / n : 0.0,
+	       model->dispatch_stalls[0], model->dispatch_stalls[1], model->dispatch_stalls[2], model->dispatch_stalls[3]);
+}
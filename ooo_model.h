@@ -0,0 +1,138 @@
+#ifndef __OOO_MODEL_H__
+#define __OOO_MODEL_H__
+#include "memory_system.h"
+#include "decode_cache.h"
+#include "pipeline_model.h"
+
+/*********************************************/
+/*                                           */
+/* out-of-order core timing model            */
+/*                                           */
+/*********************************************/
+/* Built with "make TIMING=ooo". Like the    */
+/* in-order model it gets the decoded record */
+/* of every executed instruction, with the   */
+/* same classes and latencies (-pipe), and   */
+/* computes in one pass in program order the */
+/* cycle each instruction is fetched,        */
+/* dispatched (renamed into the ROB and an   */
+/* issue queue), issued, completed and       */
+/* committed:                                */
+/*  - fetch takes fetch_width a cycle and     */
+/*    stops a group at a taken branch; after */
+/*    a mispredicted one (gshare, last       */
+/*    target for jalr) it waits for the      */
+/*    branch to complete;                    */
+/*  - dispatch takes fetch_width a cycle,    */
+/*    depth cycles after fetch, and waits    */
+/*    for a free ROB entry, issue queue      */
+/*    entry, LSQ entry for loads and stores  */
+/*    and a free physical register of the x  */
+/*    or f file for the renamed rd;          */
+/*  - issue waits for the sources (the       */
+/*    renaming removes WAR and WAW), a free  */
+/*    slot of issue_width and of the         */
+/*    functional units in that cycle;        */
+/*  - commit is in order, commit_width a     */
+/*    cycle.                                 */
+/* Instead of a cycle by cycle simulation    */
+/* each structure is a ring of the cycles    */
+/* its entries are freed, so an instruction  */
+/* costs a few dozen operations. Loads are   */
+/* not ordered against older stores (ideal   */
+/* disambiguation), and an issue queue entry */
+/* counts as freed in program order.         */
+/* A cycle without commits is blamed on the  */
+/* instruction at the head of the ROB, which */
+/* builds the CPI stack.                     */
+/*********************************************/
+
+#define OOO_RING      2048    // more than any of the structures below
+#define OOO_ISSUE_RING 4096   // cycles of issue slots kept ahead
+#define OOO_TARGETS   1024    // last targets of jalr
+
+// functional units
+#define UNIT_ALU  0           // alu, branches, jumps, system calls
+#define UNIT_MUL  1
+#define UNIT_LSU  2
+#define UNIT_FP   3
+#define UNIT_NUM  4
+
+// the components of the CPI stack
+#define CPI_BASE       0      // cycles with a commit
+#define CPI_FRONTEND   1      // the head was not dispatched yet
+#define CPI_BRANCH     2      // the same behind a mispredicted branch
+#define CPI_MEMORY     3      // the head is a load
+#define CPI_MULDIV     4
+#define CPI_FP         5
+#define CPI_DEPENDENCE 6      // the head waited for its operands
+#define CPI_EXECUTE    7      // anything else in flight
+#define CPI_NUM        8
+
+typedef struct riscv64_ooo_config{
+	int fetch_width;
+	int issue_width;
+	int commit_width;
+	int depth;                // cycles from fetch to dispatch
+	int rob;
+	int iq;
+	int lsq;
+	int prf;                  // physical registers of each of the x and f files
+	int units[UNIT_NUM];
+} Riscv64_ooo_config;
+
+// the core of the next init_ooo_model(), see ooo_model.c for the defaults
+extern Riscv64_ooo_config ooo_config;
+// parse "name:value", name one of fetch, issue, commit, depth, rob, iq, lsq, prf, alu, mul, lsu, fpu,
+// FALSE (with a message) if it is wrong
+bool set_ooo_config(const char* spec);
+
+typedef struct riscv64_ooo_model{
+	Riscv64_ooo_config config;
+	long int n;               // instructions so far
+	// fetch and dispatch
+	long int fetch_cycle;
+	int fetch_count;          // in fetch_cycle
+	bool after_mispredict;    // the next fetch is the redirected one
+	long int dispatch_cycle;
+	int dispatch_count;
+	// rings by instruction, memory operation and renamed rd of each file
+	long int commit_ring[OOO_RING];
+	long int issue_ring[OOO_RING];
+	long int memory_ring[OOO_RING];
+	long int memory_n;
+	long int rename_ring[2][OOO_RING];
+	long int rename_n[2];
+	// issue
+	long int ready[NO_REGISTER + 1];     // cycle a physical register mapped to it is written
+	byte producer[NO_REGISTER + 1];
+	byte slots[OOO_ISSUE_RING];          // instructions issued in a cycle
+	byte unit_slots[OOO_ISSUE_RING][UNIT_NUM];
+	long int slot_base;                  // cycle of the oldest slot kept
+	long int unit_free[CLASS_NUM];       // div and fdiv
+	long int finish;                     // the last cycle an instruction completes
+	// commit
+	long int commit_cycle;
+	int commit_count;
+	Riscv64_quantum quantum;             // on the commit cycles
+	// prediction
+	byte gshare[1 << 14];
+	reg64 history;
+	reg64 targets[OOO_TARGETS];
+	// statistics
+	long int mispredicted;
+	long int cpi[CPI_NUM];
+	long int dispatch_stalls[4];         // cycles dispatch waited for the ROB, IQ, LSQ and registers
+} Riscv64_ooo_model;
+
+void init_ooo_model(Riscv64_ooo_model**);
+void reset_ooo_model(Riscv64_ooo_model*);
+void delete_ooo_model(Riscv64_ooo_model*);
+void print_ooo_stats(Riscv64_ooo_model*);
+
+// the record executed at pc, and where it went; a fused record stands for itself and the next one
+void ooo_retire(Riscv64_ooo_model*, Riscv64_decoded*, reg64 pc, reg64 next_pc);
+long int ooo_cycles(Riscv64_ooo_model*); // the last commit so far
+Riscv64_quantum* ooo_quantum(Riscv64_ooo_model*);
+
+#endif
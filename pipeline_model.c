@@ -0,0 +1,316 @@
+#include <limits.h>
+#include "pipeline_model.h"
+
+const char* class_name[CLASS_NUM] = {"alu", "load", "store", "mul", "div", "fp", "fdiv", "branch", "jump", "sys"};
+static const char* stall_name[STALL_NUM] = {"load-use", "raw", "structural", "control", "serial"};
+
+int pipeline_latency[CLASS_NUM] = {
+	1,  // alu, forwarded to the next instruction
+	2,  // load, after MEM: a use right behind it stalls a cycle
+	1,  // store
+	3,  // mul
+	20, // div
+	4,  // fp
+	20, // fdiv
+	1,  // branch
+	1,  // jump, the link register
+	1,  // sys
+};
+int pipeline_branch_penalty = 2; // IF and ID behind a branch resolved in EX
+
+bool set_pipeline_config(const char* spec)
+{
+	char name[16];
+	int cycles;
+	if(sscanf(spec, "%15[a-z]:%d", name, &cycles) != 2 || cycles < 0 || cycles > 1000)
+	{
+		printf("-pipe needs class:cycles, the class one of load, mul, div, fp, fdiv, branch.\n");
+		return FALSE;
+	}
+	if(strcmp(name, "branch") == 0)
+	{
+		pipeline_branch_penalty = cycles;
+		return TRUE;
+	}
+	for(int i = 0; i < CLASS_NUM; i++)
+	{
+		if(strcmp(name, class_name[i]) != 0)
+			continue;
+		if(i != CLASS_LOAD && i != CLASS_MUL && i != CLASS_DIV && i != CLASS_FP && i != CLASS_FDIV)
+			break;
+		if(cycles < 1)
+		{
+			printf("-pipe: a latency is at least 1 cycle.\n");
+			return FALSE;
+		}
+		pipeline_latency[i] = cycles;
+		return TRUE;
+	}
+	printf("-pipe: unknown class %s.\n", name);
+	return FALSE;
+}
+
+
+/*********************************************/
+/*                                           */
+/* instruction classes and operands          */
+/*                                           */
+/*********************************************/
+
+// register file of rd, rs1, rs2 and rs3 by the format of the list, x, f or none
+#define OPERANDS_RR     "xxx-"
+#define OPERANDS_RI     "xx--"
+#define OPERANDS_R1     "xx--"
+#define OPERANDS_R4     "ffff"
+#define OPERANDS_MEM_RD "xx--"
+#define OPERANDS_MEM_RS "-xx-"
+#define OPERANDS_UPPER  "x---"
+#define OPERANDS_SYS    "----"
+#define OPERANDS_AMO    "xxx-"
+
+static const char* inst_operands[INST_COUNT] = {
+	#define INST(id, func, format) OPERANDS_##format,
+	#include "instruction_list.h"
+	#undef INST
+};
+static byte inst_class[INST_COUNT];
+static bool inst_tables_ready = FALSE;
+
+void init_inst_timing()
+{
+	if(inst_tables_ready)
+		return;
+	for(int id = 0; id < INST_COUNT; id++)
+	{
+		int klass = CLASS_ALU;
+		const char* operands = inst_operands[id];
+		switch(id)
+		{
+			case INST_LB: case INST_LH: case INST_LW: case INST_LD: case INST_LBU: case INST_LHU: case INST_LWU:
+				klass = CLASS_LOAD;
+				break;
+			case INST_FLW: case INST_FLD:
+				klass = CLASS_LOAD;
+				operands = "fx--";
+				break;
+			case INST_SB: case INST_SH: case INST_SW: case INST_SD:
+				klass = CLASS_STORE;
+				break;
+			case INST_FSW: case INST_FSD:
+				klass = CLASS_STORE;
+				operands = "-xf-";
+				break;
+			case INST_MUL: case INST_MULH: case INST_MULHSU: case INST_MULHU: case INST_MULW:
+				klass = CLASS_MUL;
+				break;
+			case INST_DIV: case INST_DIVU: case INST_REM: case INST_REMU:
+			case INST_DIVW: case INST_DIVUW: case INST_REMW: case INST_REMUW:
+				klass = CLASS_DIV;
+				break;
+			case INST_BEQ: case INST_BNE: case INST_BLT: case INST_BGE: case INST_BLTU: case INST_BGEU:
+				klass = CLASS_BRANCH;
+				break;
+			case INST_JAL: case INST_JALR:
+				klass = CLASS_JUMP;
+				break;
+			case INST_SCALL: case INST_FALLBACK: // the fallback may be anything
+				klass = CLASS_SYS;
+				break;
+			case INST_TRAP:
+				operands = "----";
+				break;
+			case INST_LR_W: case INST_LR_D:
+			case INST_AMOSWAP_W: case INST_AMOADD_W: case INST_AMOXOR_W: case INST_AMOAND_W: case INST_AMOOR_W:
+			case INST_AMOMIN_W: case INST_AMOMAX_W: case INST_AMOMINU_W: case INST_AMOMAXU_W:
+			case INST_AMOSWAP_D: case INST_AMOADD_D: case INST_AMOXOR_D: case INST_AMOAND_D: case INST_AMOOR_D:
+			case INST_AMOMIN_D: case INST_AMOMAX_D: case INST_AMOMINU_D: case INST_AMOMAXU_D:
+				klass = CLASS_LOAD; // the value read comes back to rd
+				break;
+			case INST_SC_W: case INST_SC_D:
+				klass = CLASS_STORE;
+				break;
+
+			case INST_FDIV_S: case INST_FDIV_D:
+				klass = CLASS_FDIV;
+				operands = "fff-";
+				break;
+			case INST_FSQRT_S: case INST_FSQRT_D:
+				klass = CLASS_FDIV;
+				operands = "ff--";
+				break;
+			case INST_FEQ_S: case INST_FLT_S: case INST_FLE_S: case INST_FEQ_D: case INST_FLT_D: case INST_FLE_D:
+				klass = CLASS_FP;
+				operands = "xff-";
+				break;
+			case INST_FMV_X_S: case INST_FMV_X_D:
+			case INST_FCVT_W_S: case INST_FCVT_WU_S: case INST_FCVT_L_S: case INST_FCVT_LU_S:
+			case INST_FCVT_W_D: case INST_FCVT_WU_D:
+				klass = CLASS_FP;
+				operands = "xf--";
+				break;
+			case INST_FMV_S_X: case INST_FMV_D_X:
+			case INST_FCVT_S_W: case INST_FCVT_S_WU: case INST_FCVT_S_L: case INST_FCVT_S_LU:
+			case INST_FCVT_D_W: case INST_FCVT_D_WU:
+				klass = CLASS_FP;
+				operands = "fx--";
+				break;
+			case INST_FCVT_S_D: case INST_FCVT_D_S:
+				klass = CLASS_FP;
+				operands = "ff--";
+				break;
+			case INST_FADD_S: case INST_FSUB_S: case INST_FMUL_S: case INST_FMIN_S: case INST_FMAX_S:
+			case INST_FSGNJ_S: case INST_FSGNJN_S: case INST_FSGNJX_S:
+			case INST_FADD_D: case INST_FSUB_D: case INST_FMUL_D: case INST_FMIN_D: case INST_FMAX_D:
+			case INST_FSGNJ_D: case INST_FSGNJN_D: case INST_FSGNJX_D:
+				klass = CLASS_FP;
+				operands = "fff-";
+				break;
+			case INST_FMADD_S: case INST_FMSUB_S: case INST_FNMSUB_S: case INST_FNMADD_S:
+			case INST_FMADD_D: case INST_FMSUB_D: case INST_FNMSUB_D: case INST_FNMADD_D:
+				klass = CLASS_FP;
+				break;
+		}
+		inst_class[id] = klass;
+		inst_operands[id] = operands != NULL ? operands : "----"; // fused ids are split before
+	}
+	inst_tables_ready = TRUE;
+}
+
+static inline byte operand_register(char file, int index)
+{
+	if(file == 'x')
+		return index != 0 ? index : NO_REGISTER;
+	if(file == 'f')
+		return 32 + index;
+	return NO_REGISTER;
+}
+
+void inst_timing(Riscv64_decoded* record, Riscv64_inst_timing* timing)
+{
+	const char* operands = inst_operands[record->id];
+	timing->klass = inst_class[record->id];
+	timing->rd = operand_register(operands[0], record->rd);
+	timing->rs[0] = operand_register(operands[1], record->rs1);
+	timing->rs[1] = operand_register(operands[2], record->rs2);
+	timing->rs[2] = operand_register(operands[3], record->imm & 31);
+}
+
+
+/*********************************************/
+/*                                           */
+/* initialization and gc                     */
+/*                                           */
+/*********************************************/
+
+void init_pipeline_model(Riscv64_pipeline_model** model)
+{
+	init_inst_timing();
+	*model = (Riscv64_pipeline_model*) malloc (sizeof(Riscv64_pipeline_model));
+	reset_pipeline_model(*model);
+}
+
+void reset_pipeline_model(Riscv64_pipeline_model* model)
+{
+	memset(model, 0, sizeof(Riscv64_pipeline_model));
+	model->ex = 2; // the first instruction is in IF at cycle 1
+	model->quantum.end = LONG_MAX;
+}
+
+void delete_pipeline_model(Riscv64_pipeline_model* model)
+{
+	free(model);
+}
+
+
+/*********************************************/
+/*                                           */
+/* timing                                    */
+/*                                           */
+/*********************************************/
+
+static void retire_one(Riscv64_pipeline_model* model, Riscv64_decoded* record, reg64 pc, reg64 next_pc)
+{
+	Riscv64_inst_timing timing;
+	inst_timing(record, &timing);
+	int klass = timing.klass;
+
+	long int cycle = model->ex + 1;
+	if(model->redirect)
+	{
+		cycle += pipeline_branch_penalty;
+		model->stalls[STALL_CONTROL] += pipeline_branch_penalty;
+		model->redirect = FALSE;
+	}
+	for(int i = 0; i < 3; i++)
+	{
+		byte r = timing.rs[i];
+		if(model->ready[r] > cycle)
+		{
+			model->stalls[model->producer[r] == CLASS_LOAD ? STALL_LOAD_USE : STALL_RAW] += model->ready[r] - cycle;
+			cycle = model->ready[r];
+		}
+	}
+	if(model->unit_free[klass] > cycle)
+	{
+		model->stalls[STALL_STRUCTURAL] += model->unit_free[klass] - cycle;
+		cycle = model->unit_free[klass];
+	}
+	if(klass == CLASS_SYS && model->finish > cycle)
+	{
+		model->stalls[STALL_SERIAL] += model->finish - cycle;
+		cycle = model->finish;
+	}
+
+	int latency = pipeline_latency[klass];
+	if(klass == CLASS_DIV || klass == CLASS_FDIV)
+		model->unit_free[klass] = cycle + latency;
+	if(timing.rd != NO_REGISTER)
+	{
+		model->ready[timing.rd] = cycle + latency;
+		model->producer[timing.rd] = klass;
+	}
+	long int written = cycle + (latency > 2 ? latency : 2); // MEM and WB
+	if(written > model->finish)
+		model->finish = written;
+	model->ex = cycle;
+	model->redirect = (klass == CLASS_BRANCH || klass == CLASS_JUMP) && next_pc != pc + sizeof(instruction);
+	model->instructions++;
+	model->class_count[klass]++;
+}
+
+void pipeline_retire(Riscv64_pipeline_model* model, Riscv64_decoded* record, reg64 pc, reg64 next_pc)
+{
+	if(record->id >= INST_FUSED_FIRST)
+	{
+		Riscv64_decoded first = *record;
+		unfuse_record(&first);
+		retire_one(model, &first, pc, pc + sizeof(instruction));
+		retire_one(model, record + 1, pc + sizeof(instruction), next_pc);
+	}
+	else
+		retire_one(model, record, pc, next_pc);
+	if(model->finish >= model->quantum.end)
+		model->quantum.handler(model->quantum.arg);
+}
+
+
+/*********************************************/
+/*                                           */
+/* statistics                                */
+/*                                           */
+/*********************************************/
+
+void print_pipeline_stats(Riscv64_pipeline_model* model)
+{
+	long int cycles = model->finish;
+	printf("pipeline: %ld cycles, %ld instructions, CPI %.3f\n", cycles, model->instructions,
+	       model->instructions ? (double)cycles / model->instructions : 0.0);
+	printf("pipeline stalls:");
+	for(int i = 0; i < STALL_NUM; i++)
+		printf(" %s %ld (%.2f%%)%s", stall_name[i], model->stalls[i], cycles ? 100.0 * model->stalls[i] / cycles : 0.0,
+		       i < STALL_NUM - 1 ? "," : "\n");
+	printf("pipeline mix:");
+	for(int i = 0; i < CLASS_NUM; i++)
+		printf(" %s %.2f%%%s", class_name[i], model->instructions ? 100.0 * model->class_count[i] / model->instructions : 0.0,
+		       i < CLASS_NUM - 1 ? "," : "\n");
+}
@@ -0,0 +1,127 @@
+#ifndef __PIPELINE_MODEL_H__
+#define __PIPELINE_MODEL_H__
+#include "memory_system.h"
+#include "decode_cache.h"
+
+/*********************************************/
+/*                                           */
+/* in-order pipeline timing model            */
+/*                                           */
+/*********************************************/
+/* Built with "make TIMING=inorder". The     */
+/* functional engines still execute every    */
+/* instruction; after each one its decoded   */
+/* record goes to a model of a 5-stage       */
+/* in-order pipeline (IF ID EX MEM WB) with  */
+/* full forwarding, which only computes when */
+/* it would enter EX:                        */
+/*  - after the previous one, one a cycle;   */
+/*  - after its sources are ready (RAW on    */
+/*    rd/rs1/rs2/rs3, x and f registers):    */
+/*    an ALU result forwards to the next     */
+/*    instruction, a load result one cycle   */
+/*    later (the load-use stall), and mul,   */
+/*    div and FP results after their         */
+/*    latency;                               */
+/*  - after div and fdiv/fsqrt, which are    */
+/*    not pipelined, leave their unit;       */
+/*  - a taken branch or jump is resolved in  */
+/*    EX, the instructions fetched behind it */
+/*    (predicted not taken) are flushed;     */
+/*  - a system call waits for the pipeline   */
+/*    to drain.                              */
+/* The cycles lost to each reason are added  */
+/* up into the stall breakdown.              */
+/*********************************************/
+
+// instruction classes, each with a latency from entering EX until its result can be forwarded
+#define CLASS_ALU    0
+#define CLASS_LOAD   1
+#define CLASS_STORE  2
+#define CLASS_MUL    3
+#define CLASS_DIV    4        // not pipelined
+#define CLASS_FP     5
+#define CLASS_FDIV   6        // fdiv and fsqrt, not pipelined
+#define CLASS_BRANCH 7
+#define CLASS_JUMP   8
+#define CLASS_SYS    9        // drains the pipeline
+#define CLASS_NUM    10
+
+// reasons of stall cycles
+#define STALL_LOAD_USE   0    // waiting for a load
+#define STALL_RAW        1    // waiting for a mul, div or FP result
+#define STALL_STRUCTURAL 2    // div or fdiv unit busy
+#define STALL_CONTROL    3    // flushed behind taken branches and jumps
+#define STALL_SERIAL     4    // draining for system calls
+#define STALL_NUM        5
+
+#define NO_REGISTER  64       // x0-x31 are 0-31, f0-f31 32-63
+
+// latencies and the branch penalty of the next init_pipeline_model(), see pipeline_model.c for the defaults
+extern int pipeline_latency[CLASS_NUM];
+extern int pipeline_branch_penalty;
+// parse "class:cycles", the class one of load, mul, div, fp, fdiv, branch, FALSE (with a message) if it is wrong
+bool set_pipeline_config(const char* spec);
+
+// the registers and class of an instruction, from its record
+typedef struct riscv64_inst_timing{
+	byte klass;
+	byte rd;                  // NO_REGISTER if none (or x0)
+	byte rs[3];
+} Riscv64_inst_timing;
+
+extern const char* class_name[CLASS_NUM];
+void init_inst_timing(); // once before inst_timing()
+void inst_timing(Riscv64_decoded*, Riscv64_inst_timing*); // of a record that is not fused
+
+// the end of the quantum of a hart that runs in step with other harts (see "hart.h"), in
+// cycles of its model: the first instruction that reaches it calls the handler, which waits
+// for the others and moves the end on
+typedef struct riscv64_quantum{
+	long int end;             // LONG_MAX while the hart runs alone
+	void (*handler)(void* arg);
+	void* arg;
+} Riscv64_quantum;
+
+typedef struct riscv64_pipeline_model{
+	long int ex;              // cycle the last instruction entered EX
+	long int finish;          // cycle the last result is written back
+	long int ready[NO_REGISTER + 1];   // cycle a register can be forwarded from
+	byte producer[NO_REGISTER + 1];    // class of the instruction that writes it
+	long int unit_free[CLASS_NUM];     // cycle the div and fdiv units take the next one
+	bool redirect;            // the last instruction was a taken branch or jump
+	Riscv64_quantum quantum;
+	// statistics
+	long int instructions;
+	long int stalls[STALL_NUM];
+	long int class_count[CLASS_NUM];
+} Riscv64_pipeline_model;
+
+void init_pipeline_model(Riscv64_pipeline_model**);
+void reset_pipeline_model(Riscv64_pipeline_model*);
+void delete_pipeline_model(Riscv64_pipeline_model*);
+void print_pipeline_stats(Riscv64_pipeline_model*);
+
+// the record executed at pc, and where it went; a fused record stands for itself and the next one
+void pipeline_retire(Riscv64_pipeline_model*, Riscv64_decoded*, reg64 pc, reg64 next_pc);
+
+// the hook of the engines, nothing without PIPELINE_MODEL, the out-of-order model with OOO_MODEL,
+// the cycles the model counted so far and its quantum
+#if defined(OOO_MODEL)
+struct riscv64_ooo_model;
+void ooo_retire(struct riscv64_ooo_model*, Riscv64_decoded*, reg64 pc, reg64 next_pc); // see "ooo_model.h"
+long int ooo_cycles(struct riscv64_ooo_model*);
+Riscv64_quantum* ooo_quantum(struct riscv64_ooo_model*);
+#define PIPELINE_RETIRE(riscv_memory, record, pc, next_pc) ooo_retire((riscv_memory)->ooo_model, record, pc, next_pc)
+#define PIPELINE_CYCLES(riscv_memory) ooo_cycles((riscv_memory)->ooo_model)
+#define PIPELINE_QUANTUM(riscv_memory) ooo_quantum((riscv_memory)->ooo_model)
+#elif defined(PIPELINE_MODEL)
+#define PIPELINE_RETIRE(riscv_memory, record, pc, next_pc) pipeline_retire((riscv_memory)->pipeline_model, record, pc, next_pc)
+#define PIPELINE_CYCLES(riscv_memory) ((riscv_memory)->pipeline_model->finish)
+#define PIPELINE_QUANTUM(riscv_memory) (&(riscv_memory)->pipeline_model->quantum)
+#else
+#define PIPELINE_RETIRE(riscv_memory, record, pc, next_pc)
+#define PIPELINE_CYCLES(riscv_memory) 0L
+#endif
+
+#endif
@@ -5,11 +5,11 @@
 /* implementation. If you want to add a new instruction to our     */
 /* simulator, you could just simply follow the steps below:        */
 /*                                                                 */
-/*  1. Add the opcode of your new instruction(maybe your funct3    */
-/*     and funct7 as well, if there are any conflict with current  */
-/*     opcodes) to the appropriate place(according to your         */
-/*     instruction type) in the function GetINSTYPE in             */
-/*     "riscv_instruction.c";                                      */
+/*  1. Add the encoding of your new instruction(its opcode, and    */
+/*     maybe funct3 and funct7 as well) to the patterns in         */
+/*     "gen_decode_table.c", which generates the decode table      */
+/*     behind GetINSTYPE and GetINSTID, and an entry to            */
+/*     "instruction_list.h";                                       */
 /*  2. Add your instruction entrance to function XX_Execute        */
 /*     according to your instruction type. For example, if your    */
 /*     instruction is R_TYPE, then your are welcome to the         */
@@ -22,13 +22,11 @@
 /* will work!                                                      */
 /*******************************************************************/
 #include "riscv_instruction.h"
-
-// something for debug 
-extern bool debug_flag;
-extern unsigned long int pause_addr;
-
-// a flag which shows whether syscall exit happened
-int EXIT_HAPPENED = FALSE;
+#include "breakpoint.h"
+#include "cache_model.h"
+#include "branch_predictor.h"
+#include "hart.h"
+#include <sched.h>
 
 void Error_NoDef(Riscv64_decoder* riscv_decoder)
 {
@@ -36,74 +34,26 @@ void Error_NoDef(Riscv64_decoder* riscv_decoder)
 	        riscv_decoder->inst, riscv_decoder->opcode, riscv_decoder->funct3, riscv_decoder->funct7, riscv_decoder->rs2);
 	// exit(1);
 }
+// the decode table, see "gen_decode_table.c"
+#include "decode_table.h"
+
 // return the instuction type according to the opcode
 INSTYPE GetINSTYPE(Riscv64_decoder* riscv_decoder)
 {
-	switch(riscv_decoder->opcode)
-	{
-		case 0x33: // b0110011
-		case 0x53: // b1010011 fp
-		case 0x3b: // b0111011
-			// printf("R_TYPE RETURNED;");
-			return R_TYPE;
-
-		case 0x43: // b1000011 fp
-		case 0x47: // b1000111 fp
-		case 0x4b: // b1001011 fp
-		case 0x4f: // b1001111 fp
-			return R4_TYPE;
-
-		case 0x67: // b1100111
-		case 0x03: // b0000011
-		case 0x73: // b1110011
-		case 0x07: // b0000111 fp
-			return I_TYPE;
-
-		case 0x23: // b0100011
-		case 0x27: // b0100111 fp
-			return S_TYPE;
-
-		case 0x63: // b1100011
-			return SB_TYPE;
-
-		case 0x37: // b0110111
-		case 0x17: // b0010111
-			return U_TYPE;
-
-		case 0x6F: // b1101111
-			return UJ_TYPE;
-
-		case 0x13: // b0010011
-			switch(riscv_decoder->funct3)
-			{
-				case 1: // b001
-				case 5: // b101
-					return R_TYPE;
-				case 0: // b000
-				case 2: // b010
-				case 3: // b011
-				case 4: // b100
-				case 6: // b110
-				case 7: // b111
-					return I_TYPE;
-				default:
-					return NOT_DEFINED;
-			}
+	return decode_major[riscv_decoder->opcode][riscv_decoder->funct3].type;
+}
 
-		case 0x1b: // b0011011
-			switch(riscv_decoder->funct3)
-			{
-				case 1: // b001
-				case 5: // b101
-					return R_TYPE;
-				case 0: // b000
-					return I_TYPE;
-				default:
-					return NOT_DEFINED;
-			}
-		default:
-			return NOT_DEFINED;
-	}
+// return the concrete instruction and the immediate its function takes
+INSTID GetINSTID(instruction inst, int* imm)
+{
+	const Riscv64_decode_entry* entry = &decode_major[OPCODE(inst)][FUNCT3(inst)];
+	INSTID id = decode_minor[entry->base + ((inst >> entry->shift) & entry->mask)];
+	int immediate[IMM_COUNT] = {
+		I_IMM(inst), S_IMM(inst), SB_IMM(inst), U_IMM(inst), UJ_IMM(inst),
+		SHAMT64(inst), SHAMT32(inst), RS3(inst), (int)inst
+	};
+	*imm = immediate[decode_immediate[id]];
+	return id;
 }
 
 // execute R_TYPE instructions
@@ -604,6 +554,93 @@ void R_execute(Riscv64_decoder* riscv_decoder, Riscv64_register* riscv_register,
 					Error_NoDef(riscv_decoder);
 			}
 			break;
+		case 0x2f: // b0101111 atomics
+			switch(riscv_decoder->funct3)
+			{
+				case 2: // b010
+					switch(riscv_decoder->funct5)
+					{
+						case 0x02: // b00010
+							lr_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x03: // b00011
+							sc_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x01: // b00001
+							amoswap_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x00: // b00000
+							amoadd_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x04: // b00100
+							amoxor_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x0c: // b01100
+							amoand_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x08: // b01000
+							amoor_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x10: // b10000
+							amomin_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x14: // b10100
+							amomax_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x18: // b11000
+							amominu_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x1c: // b11100
+							amomaxu_W(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						default:
+							Error_NoDef(riscv_decoder);
+					}
+					break;
+				case 3: // b011
+					switch(riscv_decoder->funct5)
+					{
+						case 0x02: // b00010
+							lr_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x03: // b00011
+							sc_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x01: // b00001
+							amoswap_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x00: // b00000
+							amoadd_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x04: // b00100
+							amoxor_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x0c: // b01100
+							amoand_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x08: // b01000
+							amoor_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x10: // b10000
+							amomin_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x14: // b10100
+							amomax_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x18: // b11000
+							amominu_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						case 0x1c: // b11100
+							amomaxu_D(riscv_register, riscv_memory, riscv_decoder->rd, riscv_decoder->rs1, riscv_decoder->rs2);
+							break;
+						default:
+							Error_NoDef(riscv_decoder);
+					}
+					break;
+				default:
+					Error_NoDef(riscv_decoder);
+			}
+			break;
 		default:
 			Error_NoDef(riscv_decoder);
 	}
@@ -964,30 +1001,35 @@ void UJ_execute(Riscv64_decoder* riscv_decoder, Riscv64_register* riscv_register
 void lb(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm)  // byte
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
+	CACHE_LOAD(riscv_memory, reg_value + imm, sizeof(reg8));
 	reg8 load_value = get_memory_reg8(riscv_memory, (byte*)(reg_value + imm));
 	set_register_general(riscv_register, rd, (long int)load_value);
 }
 void lh(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm)  // halfword
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
+	CACHE_LOAD(riscv_memory, reg_value + imm, sizeof(reg16));
 	reg16 load_value = get_memory_reg16(riscv_memory, (byte*)(reg_value + imm));
 	set_register_general(riscv_register, rd, (long int)load_value);
 }
 void lw(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm)  // word
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
+	CACHE_LOAD(riscv_memory, reg_value + imm, sizeof(reg32));
 	reg32 load_value = get_memory_reg32(riscv_memory, (byte*)(reg_value + imm));
 	set_register_general(riscv_register, rd, (long int)load_value);
 }
 void lbu(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm) // byte unsigned
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
+	CACHE_LOAD(riscv_memory, reg_value + imm, sizeof(reg8));
 	reg8 load_value = get_memory_reg8(riscv_memory, (byte*)(reg_value + imm));
 	set_register_general(riscv_register, rd, (unsigned long int)load_value);
 }
 void lhu(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm) // half unsigned
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
+	CACHE_LOAD(riscv_memory, reg_value + imm, sizeof(reg16));
 	reg16 load_value = get_memory_reg16(riscv_memory, (byte*)(reg_value + imm));
 	set_register_general(riscv_register, rd, (unsigned long int)load_value);
 }
@@ -997,18 +1039,21 @@ void sb(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1,
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
 	reg8 store_value = (reg8)get_register_general(riscv_register, rs2);
+	CACHE_STORE(riscv_memory, reg_value + imm, sizeof(reg8));
 	set_memory_reg8(riscv_memory, (byte*)(reg_value + imm), store_value);
 }
 void sh(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1, int rs2, int imm)  // halfword
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
 	reg16 store_value = (reg16)get_register_general(riscv_register, rs2);
+	CACHE_STORE(riscv_memory, reg_value + imm, sizeof(reg16));
 	set_memory_reg16(riscv_memory, (byte*)(reg_value + imm), store_value);
 }
 void sw(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1, int rs2, int imm)  // word
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
 	reg32 store_value = (reg32)get_register_general(riscv_register, rs2);
+	CACHE_STORE(riscv_memory, reg_value + imm, sizeof(reg32));
 	set_memory_reg32(riscv_memory, (byte*)(reg_value + imm), store_value);
 }
 
@@ -1133,42 +1178,54 @@ void beq(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1
 {
 	reg64 reg_value = get_register_pc(riscv_register) - sizeof(instruction) + (long int)imm;  // a bit tricky here, as the pc has self-increased in the fetch stage,
 	                                                                                          // we have to subtract it to get the current pc
-	if(riscv_register->x[rs1] - riscv_register->x[rs2] == 0)
+	bool taken = riscv_register->x[rs1] - riscv_register->x[rs2] == 0;
+	BRANCH_CONDITIONAL(riscv_memory, get_register_pc(riscv_register) - sizeof(instruction), reg_value, taken);
+	if(taken)
 		set_register_pc(riscv_register, reg_value);
 }
 void bne(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1, int rs2, int imm)
 {
 	reg64 reg_value = get_register_pc(riscv_register) - sizeof(instruction) + (long int)imm;  // a bit tricky here, as the pc has self-increased in the fetch stage,
 	                                                                                          // we have to subtract it to get the current pc
-	if(riscv_register->x[rs1] - riscv_register->x[rs2] != 0)
+	bool taken = riscv_register->x[rs1] - riscv_register->x[rs2] != 0;
+	BRANCH_CONDITIONAL(riscv_memory, get_register_pc(riscv_register) - sizeof(instruction), reg_value, taken);
+	if(taken)
 		set_register_pc(riscv_register, reg_value);
 }
 void blt(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1, int rs2, int imm)
 {
 	reg64 reg_value = get_register_pc(riscv_register) - sizeof(instruction) + (long int)imm;  // a bit tricky here, as the pc has self-increased in the fetch stage,
 	                                                                                          // we have to subtract it to get the current pc
-	if((long int)(riscv_register->x[rs1] - riscv_register->x[rs2]) < 0)
+	bool taken = (long int)(riscv_register->x[rs1] - riscv_register->x[rs2]) < 0;
+	BRANCH_CONDITIONAL(riscv_memory, get_register_pc(riscv_register) - sizeof(instruction), reg_value, taken);
+	if(taken)
 		set_register_pc(riscv_register, reg_value);
 }
 void bge(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1, int rs2, int imm)
 {
 	reg64 reg_value = get_register_pc(riscv_register) - sizeof(instruction) + (long int)imm;  // a bit tricky here, as the pc has self-increased in the fetch stage,
 	                                                                                          // we have to subtract it to get the current pc
-	if((long int)(riscv_register->x[rs1] - riscv_register->x[rs2]) >= 0)
+	bool taken = (long int)(riscv_register->x[rs1] - riscv_register->x[rs2]) >= 0;
+	BRANCH_CONDITIONAL(riscv_memory, get_register_pc(riscv_register) - sizeof(instruction), reg_value, taken);
+	if(taken)
 		set_register_pc(riscv_register, reg_value);
 }
 void bltu(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1, int rs2, int imm)
 {
 	reg64 reg_value = get_register_pc(riscv_register) - sizeof(instruction) + (long int)imm;  // a bit tricky here, as the pc has self-increased in the fetch stage,
 	                                                                              // we have to subtract it to get the current pc
-	if(riscv_register->x[rs1] < riscv_register->x[rs2])
+	bool taken = riscv_register->x[rs1] < riscv_register->x[rs2];
+	BRANCH_CONDITIONAL(riscv_memory, get_register_pc(riscv_register) - sizeof(instruction), reg_value, taken);
+	if(taken)
 		set_register_pc(riscv_register, reg_value);
 }
 void bgeu(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1, int rs2, int imm)
 {
 	reg64 reg_value = get_register_pc(riscv_register) - sizeof(instruction) + (long int)imm;  // a bit tricky here, as the pc has self-increased in the fetch stage,
 	                                                                                          // we have to subtract it to get the current pc
-	if(riscv_register->x[rs1] > riscv_register->x[rs2])
+	bool taken = riscv_register->x[rs1] > riscv_register->x[rs2];
+	BRANCH_CONDITIONAL(riscv_memory, get_register_pc(riscv_register) - sizeof(instruction), reg_value, taken);
+	if(taken)
 		set_register_pc(riscv_register, reg_value);
 }
 
@@ -1180,6 +1237,7 @@ void jal(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd,
 		set_register_general(riscv_register, rd, reg_value);
 	reg_value = reg_value - sizeof(instruction) + (long int)imm; // a bit tricky here, as the pc has self-increased in the fetch stage,
 	                                                             // we have to subtract it to get the current pc
+	BRANCH_JUMP(riscv_memory, reg_value - (long int)imm, reg_value, rd, -1);
 	set_register_pc(riscv_register, reg_value);
 }
 void jalr(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm)
@@ -1190,6 +1248,7 @@ void jalr(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd
 	reg_value = get_register_general(riscv_register, rs1) + (long int)imm;
 	if(reg_value & 1) // check the least significant bit of reg_value, if it is 1, than set it to 0
 		reg_value ^= 1;
+	BRANCH_JUMP(riscv_memory, get_register_pc(riscv_register) - sizeof(instruction), reg_value, rd, rs1);
 	set_register_pc(riscv_register, reg_value);
 }
 
@@ -1206,25 +1265,56 @@ void scall(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
 			#ifdef DEBUG
 			printf("exit parameters: a1=%d, a2=%d, a3=%d\n", riscv_register->x[11], riscv_register->x[12], riscv_register->x[13]);
 			#endif
-			EXIT_HAPPENED = TRUE;
+			riscv_memory->exit_happened = TRUE;
+			riscv_memory->exit_code = (int)riscv_register->x[10];
+			break;
+		case 94: // exit_group
+			hart_exit_group(riscv_register, riscv_memory);
+			break;
+		case 220: // clone
+			hart_clone(riscv_register, riscv_memory);
+			break;
+		case 98: // futex
+			hart_futex(riscv_register, riscv_memory);
+			break;
+		case 124: // sched_yield
+			riscv_register->x[10] = sched_yield();
 			break;
 		case 63: // read
-			riscv_register->x[10] = read(riscv_register->x[10], (void*)get_actual_addr(riscv_memory, riscv_register->x[11]), riscv_register->x[12]);
+		{
+			// through a host buffer, the guest range need not be contiguous on the host
+			reg64 buffer = riscv_register->x[11];
+			byte* host_buffer = (byte*) malloc (riscv_register->x[12] + 1);
+			long int length = read(riscv_register->x[10], host_buffer, riscv_register->x[12]);
+			begin_host_write();
+			if(length > 0)
+				copy_to_guest(riscv_memory, buffer, host_buffer, length);
+			end_host_write(buffer, length > 0 ? length : 0);
+			riscv_register->x[10] = length;
+			free(host_buffer);
 			break;
+		}
 		case 64: // write
-			riscv_register->x[10] = write(riscv_register->x[10], (void*)get_actual_addr(riscv_memory ,riscv_register->x[11]), riscv_register->x[12]);
+		{
+			byte* host_buffer = (byte*) malloc (riscv_register->x[12] + 1);
+			copy_from_guest(riscv_memory, host_buffer, riscv_register->x[11], riscv_register->x[12]);
+			riscv_register->x[10] = write(riscv_register->x[10], host_buffer, riscv_register->x[12]);
+			free(host_buffer);
 			break;
+		}
 		case 169: // time
 		{
-
-			struct timeval *tv_p;
-			tv_p = (struct timeval*)get_actual_addr(riscv_memory, riscv_register->x[10]);
-            riscv_register->x[10] = gettimeofday(tv_p, NULL);
-            break;
+			struct timeval tv_host;
+			reg64 tv = riscv_register->x[10];
+			riscv_register->x[10] = gettimeofday(&tv_host, NULL);
+			begin_host_write();
+			copy_to_guest(riscv_memory, tv, &tv_host, sizeof(struct timeval));
+			end_host_write(tv, sizeof(struct timeval));
+			break;
 		}
         case 214: // brk
         {
-        	riscv_memory->edata = riscv_register->x[10];
+        	riscv_memory->process->edata = (byte*)riscv_register->x[10];
         	break;
         }
         case 57: // close file
@@ -1315,12 +1405,14 @@ void remu(Riscv64_register* riscv_register, int rd, int rs1, int rs2)   // unsig
 void lwu(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm)
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
+	CACHE_LOAD(riscv_memory, reg_value + imm, sizeof(reg32));
 	reg32 load_value = get_memory_reg32(riscv_memory, (byte*)(reg_value + imm));
 	set_register_general(riscv_register, rd, (unsigned long int)load_value);
 }
 void ld(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm)
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
+	CACHE_LOAD(riscv_memory, reg_value + imm, sizeof(reg64));
 	reg64 load_value = get_memory_reg64(riscv_memory, (byte*)(reg_value + imm));
 	set_register_general(riscv_register, rd, load_value);
 }
@@ -1329,6 +1421,7 @@ void sd(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1,
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
 	reg64 store_value = get_register_general(riscv_register, rs2);
+	CACHE_STORE(riscv_memory, reg_value + imm, sizeof(reg64));
 	set_memory_reg64(riscv_memory, (byte*)(reg_value + imm), store_value);
 }
 
@@ -1434,6 +1527,7 @@ void remuw(Riscv64_register* riscv_register, int rd, int rs1, int rs2)
 void flw(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm)
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
+	CACHE_LOAD(riscv_memory, reg_value + imm, sizeof(reg32));
 	reg32 load_value = get_memory_reg32(riscv_memory, (byte*)(reg_value + imm));
 	set_register_fp(riscv_register, rd, (unsigned long int)load_value);
 }
@@ -1443,6 +1537,7 @@ void fsw(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
 	reg32 store_value = (reg32)get_register_fp(riscv_register, rs2);
+	CACHE_STORE(riscv_memory, reg_value + imm, sizeof(reg32));
 	set_memory_reg32(riscv_memory, (byte*)(reg_value + imm), store_value);
 }
 
@@ -1538,21 +1633,21 @@ void fsgnj_S(Riscv64_register* riscv_register, int rd, int rs1, int rs2)
 {
 	reg64 src_rs1 = get_register_fp(riscv_register, rs1);
 	reg64 src_rs2 = get_register_fp(riscv_register, rs2);
-	reg64 dest_rd = (src_rs1 & 0x00007fff) | (src_rs2 & 0x00008000);
+	reg64 dest_rd = (src_rs1 & 0x7fffffff) | (src_rs2 & 0x80000000);
 	set_register_fp(riscv_register, rd, dest_rd);
 }
 void fsgnjn_S(Riscv64_register* riscv_register, int rd, int rs1, int rs2)
 {
 	reg64 src_rs1 = get_register_fp(riscv_register, rs1);
 	reg64 src_rs2 = get_register_fp(riscv_register, rs2);
-	reg64 dest_rd = (src_rs1 & 0x00007fff) | (!src_rs2 & 0x00008000);
+	reg64 dest_rd = (src_rs1 & 0x7fffffff) | (~src_rs2 & 0x80000000);
 	set_register_fp(riscv_register, rd, dest_rd);
 }
 void fsgnjx_S(Riscv64_register* riscv_register, int rd, int rs1, int rs2)
 {
 	reg64 src_rs1 = get_register_fp(riscv_register, rs1);
 	reg64 src_rs2 = get_register_fp(riscv_register, rs2);
-	reg64 dest_rd = (src_rs1 & 0x00007fff) | ((src_rs1^src_rs2) & 0x00008000);
+	reg64 dest_rd = (src_rs1 & 0x7fffffff) | ((src_rs1^src_rs2) & 0x80000000);
 	set_register_fp(riscv_register, rd, dest_rd);
 }
 
@@ -1647,6 +1742,7 @@ void fcvt_S_LU(Riscv64_register* riscv_register, int rd, int rs1)
 void fld(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int imm)
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
+	CACHE_LOAD(riscv_memory, reg_value + imm, sizeof(reg64));
 	reg64 load_value = get_memory_reg64(riscv_memory, (byte*)(reg_value + imm));
 	set_register_fp(riscv_register, rd, (unsigned long int)load_value);
 }
@@ -1656,6 +1752,7 @@ void fsd(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rs1
 {
 	reg64 reg_value = get_register_general(riscv_register, rs1);
 	reg64 store_value = (reg64)get_register_fp(riscv_register, rs2);
+	CACHE_STORE(riscv_memory, reg_value + imm, sizeof(reg64));
 	set_memory_reg64(riscv_memory, (byte*)(reg_value + imm), store_value);
 }
 
@@ -1723,14 +1820,14 @@ void fcvt_S_D(Riscv64_register* riscv_register, int rd, int rs1) // double-preci
 	reg64 src_reg64 = get_register_fp(riscv_register, rs1);
 	double src_double = *((double*)&src_reg64);
 	float dest_float = (float)src_double;
-	set_register_general(riscv_register, rd, (unsigned long int)dest_float);
+	set_register_fp(riscv_register, rd, (unsigned long int)(*((unsigned int*)&dest_float)));
 }
 void fcvt_D_S(Riscv64_register* riscv_register, int rd, int rs1) // single-precision fp -> double-precision fp
 {
 	reg64 src_reg64 = get_register_fp(riscv_register, rs1);
 	float src_float = *((float*)&src_reg64);
 	double dest_double = (double)src_float;
-	set_register_general(riscv_register, rd, (unsigned long int)dest_double);
+	set_register_fp(riscv_register, rd, *((unsigned long int*)&dest_double));
 }
 void fcvt_W_D(Riscv64_register* riscv_register, int rd, int rs1)  // double-precision fp   -> single word(32-bit)
 {
@@ -1751,35 +1848,35 @@ void fcvt_D_W(Riscv64_register* riscv_register, int rd, int rs1)  // signed word
 	reg64 src_reg64 = get_register_general(riscv_register, rs1);
 	int src_int = (int)src_reg64;
 	double dest_double = (double)src_int;
-	set_register_fp(riscv_register, rd, (unsigned long int)(*((unsigned int*)&dest_double)));
+	set_register_fp(riscv_register, rd, *((unsigned long int*)&dest_double));
 }
 void fcvt_D_WU(Riscv64_register* riscv_register, int rd, int rs1) // unsigned word(32-bit) -> double-precision fp
 {
 	reg64 src_reg64 = get_register_general(riscv_register, rs1);
 	unsigned int src_uint = (unsigned int)src_reg64;
 	double dest_double = (double)src_uint;
-	set_register_fp(riscv_register, rd, (unsigned long int)(*((unsigned int*)&dest_double)));
+	set_register_fp(riscv_register, rd, *((unsigned long int*)&dest_double));
 }
 
 void fsgnj_D(Riscv64_register* riscv_register, int rd, int rs1, int rs2)
 {
 	reg64 src_rs1 = get_register_fp(riscv_register, rs1);
 	reg64 src_rs2 = get_register_fp(riscv_register, rs2);
-	reg64 dest_rd = (src_rs1 & 0x7fffffff) | (src_rs2 & 0x80000000);
+	reg64 dest_rd = (src_rs1 & 0x7fffffffffffffff) | (src_rs2 & 0x8000000000000000);
 	set_register_fp(riscv_register, rd, dest_rd);
 }
 void fsgnjn_D(Riscv64_register* riscv_register, int rd, int rs1, int rs2)
 {
 	reg64 src_rs1 = get_register_fp(riscv_register, rs1);
 	reg64 src_rs2 = get_register_fp(riscv_register, rs2);
-	reg64 dest_rd = (src_rs1 & 0x7fffffff) | (!src_rs2 & 0x80000000);
+	reg64 dest_rd = (src_rs1 & 0x7fffffffffffffff) | (~src_rs2 & 0x8000000000000000);
 	set_register_fp(riscv_register, rd, dest_rd);
 }
 void fsgnjx_D(Riscv64_register* riscv_register, int rd, int rs1, int rs2)
 {
 	reg64 src_rs1 = get_register_fp(riscv_register, rs1);
 	reg64 src_rs2 = get_register_fp(riscv_register, rs2);
-	reg64 dest_rd = (src_rs1 & 0x7fffffff) | ((src_rs1^src_rs2) & 0x80000000);
+	reg64 dest_rd = (src_rs1 & 0x7fffffffffffffff) | ((src_rs1^src_rs2) & 0x8000000000000000);
 	set_register_fp(riscv_register, rd, dest_rd);
 }
 
@@ -1829,3 +1926,95 @@ void fle_D(Riscv64_register* riscv_register, int rd, int rs1, int rs2) // <=
 	else
 		set_register_general(riscv_register, rd, 0);
 }
+
+/*********************************************/
+/*                                           */
+/* functions for instructions RV32A / RV64A  */
+/*                                           */
+/*********************************************/
+/* type is the signed type of the width, the */
+/* value read is sign-extended into rd       */
+
+#define LOAD_RESERVED(name, type) \
+void name(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int rs2) \
+{ \
+	reg64 addr = get_register_general(riscv_register, rs1); \
+	CACHE_LOAD(riscv_memory, addr, sizeof(type)); \
+	type* host = (type*)get_atomic_addr(riscv_memory, addr, sizeof(type), FALSE); \
+	type value = __atomic_load_n(host, __ATOMIC_SEQ_CST); \
+	riscv_memory->reservation = addr; \
+	riscv_memory->reservation_value = (reg64)(long int)value; \
+	riscv_memory->reserved = TRUE; \
+	if(rd != 0) \
+		set_register_general(riscv_register, rd, (reg64)(long int)value); \
+}
+
+// a store of another hart in between that left the value as it was does not fail it
+#define STORE_CONDITIONAL(name, type) \
+void name(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int rs2) \
+{ \
+	reg64 addr = get_register_general(riscv_register, rs1); \
+	CACHE_STORE(riscv_memory, addr, sizeof(type)); \
+	type* host = (type*)get_atomic_addr(riscv_memory, addr, sizeof(type), TRUE); \
+	bool stored = FALSE; \
+	if(riscv_memory->reserved && riscv_memory->reservation == addr) \
+	{ \
+		type expected = (type)riscv_memory->reservation_value; \
+		stored = __atomic_compare_exchange_n(host, &expected, (type)get_register_general(riscv_register, rs2), \
+		                                     FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+	} \
+	riscv_memory->reserved = FALSE; \
+	if(rd != 0) \
+		set_register_general(riscv_register, rd, stored ? 0 : 1); \
+}
+
+#define AMO_FETCH(name, type, builtin) \
+void name(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int rs2) \
+{ \
+	reg64 addr = get_register_general(riscv_register, rs1); \
+	CACHE_STORE(riscv_memory, addr, sizeof(type)); \
+	type* host = (type*)get_atomic_addr(riscv_memory, addr, sizeof(type), TRUE); \
+	type value = builtin(host, (type)get_register_general(riscv_register, rs2), __ATOMIC_SEQ_CST); \
+	if(rd != 0) \
+		set_register_general(riscv_register, rd, (reg64)(long int)value); \
+}
+
+// min and max have no builtin, compare type is the signed or unsigned type of the width
+#define AMO_COMPARE(name, type, compare_type, keep_old) \
+void name(Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, int rd, int rs1, int rs2) \
+{ \
+	reg64 addr = get_register_general(riscv_register, rs1); \
+	CACHE_STORE(riscv_memory, addr, sizeof(type)); \
+	type* host = (type*)get_atomic_addr(riscv_memory, addr, sizeof(type), TRUE); \
+	compare_type operand = (compare_type)get_register_general(riscv_register, rs2); \
+	type value = __atomic_load_n(host, __ATOMIC_SEQ_CST); \
+	while(!((compare_type)value keep_old operand) \
+	      && !__atomic_compare_exchange_n(host, &value, (type)operand, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) \
+		; \
+	if(rd != 0) \
+		set_register_general(riscv_register, rd, (reg64)(long int)value); \
+}
+
+LOAD_RESERVED(lr_W, int)
+STORE_CONDITIONAL(sc_W, int)
+AMO_FETCH(amoswap_W, int, __atomic_exchange_n)
+AMO_FETCH(amoadd_W, int, __atomic_fetch_add)
+AMO_FETCH(amoxor_W, int, __atomic_fetch_xor)
+AMO_FETCH(amoand_W, int, __atomic_fetch_and)
+AMO_FETCH(amoor_W, int, __atomic_fetch_or)
+AMO_COMPARE(amomin_W, int, int, <=)
+AMO_COMPARE(amomax_W, int, int, >=)
+AMO_COMPARE(amominu_W, int, unsigned int, <=)
+AMO_COMPARE(amomaxu_W, int, unsigned int, >=)
+
+LOAD_RESERVED(lr_D, long int)
+STORE_CONDITIONAL(sc_D, long int)
+AMO_FETCH(amoswap_D, long int, __atomic_exchange_n)
+AMO_FETCH(amoadd_D, long int, __atomic_fetch_add)
+AMO_FETCH(amoxor_D, long int, __atomic_fetch_xor)
+AMO_FETCH(amoand_D, long int, __atomic_fetch_and)
+AMO_FETCH(amoor_D, long int, __atomic_fetch_or)
+AMO_COMPARE(amomin_D, long int, long int, <=)
+AMO_COMPARE(amomax_D, long int, long int, >=)
+AMO_COMPARE(amominu_D, long int, unsigned long int, <=)
+AMO_COMPARE(amomaxu_D, long int, unsigned long int, >=)
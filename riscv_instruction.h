@@ -5,11 +5,11 @@
 /* implementation. If you want to add a new instruction to our     */
 /* simulator, you could just simply follow the steps below:        */
 /*                                                                 */
-/*  1. Add the opcode of your new instruction(maybe your funct3    */
-/*     and funct7 as well, if there are any conflict with current  */
-/*     opcodes) to the appropriate place(according to your         */
-/*     instruction type) in the function GetINSTYPE in             */
-/*     "riscv_instruction.c";                                      */
+/*  1. Add the encoding of your new instruction(its opcode, and    */
+/*     maybe funct3 and funct7 as well) to the patterns in         */
+/*     "gen_decode_table.c", which generates the decode table      */
+/*     behind GetINSTYPE and GetINSTID, and an entry to            */
+/*     "instruction_list.h";                                       */
 /*  2. Add your instruction entrance to function XX_Execute        */
 /*     according to your instruction type. For example, if your    */
 /*     instruction is R_TYPE, then your are welcome to the         */
@@ -38,6 +38,39 @@ typedef enum
 	R_TYPE, R4_TYPE, I_TYPE, S_TYPE, SB_TYPE, U_TYPE, UJ_TYPE, NOT_DEFINED
 }INSTYPE;
 
+// concrete instruction, one value per entry of "instruction_list.h"
+typedef enum
+{
+	#define INST(id, func, format) INST_##id,
+	#include "instruction_list.h"
+	#undef INST
+	INST_TRAP,     // breakpoint placed over an instruction, never decoded, see "breakpoint.h"
+	INST_FALLBACK, // not in the list, run by the old decode() & execute()
+	#define FUSE(id, FIRST, first, SECOND, second) INST_##id,
+	#include "fusion_list.h"
+	#undef FUSE
+	INST_COUNT
+}INSTID;
+
+#define INST_FUSED_FIRST (INST_FALLBACK + 1) // ids from here on are fused pairs, see "fusion_list.h"
+
+// which immediate a concrete instruction takes, the operand format of the decoder
+typedef enum
+{
+	IMM_I, IMM_S, IMM_SB, IMM_U, IMM_UJ, IMM_SHAMT64, IMM_SHAMT32, IMM_RS3,
+	IMM_RAW, // the instruction itself, for INST_FALLBACK
+	IMM_COUNT
+}IMMTYPE;
+
+// an entry of the decode table generated by gen_decode_table, one per opcode and funct3:
+// the id is decode_minor[base + ((inst >> shift) & mask)]
+typedef struct riscv64_decode_entry{
+	unsigned short base;
+	unsigned short mask;
+	unsigned char shift;
+	unsigned char type;   // INSTYPE
+} Riscv64_decode_entry;
+
 /* a tool, create a binary number like this :   */
 /*                                              */
 /*     value:  000... 00000111...1111000...000  */
@@ -45,7 +78,10 @@ typedef enum
 /*                                              */
 /*  for all k if (31>=x>=k>=y>=0), bit(k) = 1,  */
 /*                      otherwise, bit(k) = 0   */
-#define ONES(x,y)        (((1<<(x+1))-1)-((1<<y)-1))
+/*  unsigned long, so that ONES(31,y) does not  */
+/*  overflow an int                             */
+#define LOW_ONES(n)      ((n) >= 64 ? ~0UL : (1UL << ((n) & 63)) - 1)  // bits n-1...0
+#define ONES(x,y)        (LOW_ONES((x)+1) & ~LOW_ONES(y))
 
 /* same in all instructions */
 #define OPCODE(inst)     inst&ONES(6,0)              // 7
@@ -108,6 +144,8 @@ typedef enum
 void Error_NoDef(Riscv64_decoder*);
 // return the instruction tyoe according to the decoder
 INSTYPE GetINSTYPE(Riscv64_decoder*);
+// return the concrete instruction and the immediate its function takes, by table lookup
+INSTID GetINSTID(instruction inst, int* imm);
 
 // execute different instructions according to their types
 void R_execute(Riscv64_decoder*, Riscv64_register*, Riscv64_memory*);
@@ -344,5 +382,41 @@ void feq_D(Riscv64_register*, int rd, int rs1, int rs2); // ==
 void flt_D(Riscv64_register*, int rd, int rs1, int rs2); // <
 void fle_D(Riscv64_register*, int rd, int rs1, int rs2); // <=
 
-#endif
+/*********************************************/
+/*                                           */
+/* functions for instructions RV32A / RV64A  */
+/*                                           */
+/*********************************************/
+/* Each is one host atomic on the shared     */
+/* memory, sequentially consistent whatever  */
+/* aq and rl say, and rd gets the old value  */
+/* (sign-extended for the word ones). sc     */
+/* stores if the reservation of the hart is  */
+/* on the address and the word still holds   */
+/* what lr read, see "hart.h".               */
+/*********************************************/
+void lr_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // load reserved
+void sc_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // store conditional, rd 0 if it stored
+void amoswap_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amoadd_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amoxor_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amoand_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amoor_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amomin_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // signed
+void amomax_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // signed
+void amominu_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // unsigned
+void amomaxu_W(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // unsigned
+
+void lr_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // load reserved
+void sc_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // store conditional, rd 0 if it stored
+void amoswap_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amoadd_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amoxor_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amoand_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amoor_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2);
+void amomin_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // signed
+void amomax_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // signed
+void amominu_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // unsigned
+void amomaxu_D(Riscv64_register*, Riscv64_memory*, int rd, int rs1, int rs2); // unsigned
 
+#endif
@@ -0,0 +1,380 @@
+#include "execute.h"
+
+
+/*********************************************/
+/*                                           */
+/* engines                                   */
+/*                                           */
+/*********************************************/
+/* the engine is chosen at build time, see   */
+/* ENGINE in the Makefile                    */
+/*********************************************/
+
+// a store into a page the caches translated code from, drop the translations it overwrites
+// (the aot code sees its own stores into the text, see "aot.c")
+static bool on_code_write(void* arg, reg64 addr, reg64 length)
+{
+	Riscv64_sim* sim = (Riscv64_sim*)arg;
+	bool dropped = FALSE;
+	if(sim->decode_cache != NULL)
+	{
+		long int before = sim->decode_cache->invalidated;
+		invalidate_decode_cache(sim->decode_cache, addr, length);
+		dropped |= sim->decode_cache->invalidated != before;
+	}
+	if(sim->block_cache != NULL)
+	{
+		long int before = sim->block_cache->invalidated;
+		invalidate_blocks(sim->block_cache, addr, length);
+		dropped |= sim->block_cache->invalidated != before;
+	}
+	if(sim->aot != NULL)
+		invalidate_aot(sim->aot, sim->riscv_memory, addr, length);
+	return dropped;
+}
+
+// run the loop of the call engine until the last checkpoint is written, return the instructions executed
+static long int run_to_checkpoints(Riscv64_sim* sim)
+{
+	Riscv64_register* riscv_register = sim->riscv_register;
+	Riscv64_memory* riscv_memory = sim->riscv_memory;
+	bool taken[CHECKPOINT_MAX] = {FALSE};
+	int pending = checkpoint_trigger_num;
+	long int records = 0;
+	long int fused_before = riscv_memory->fused_executed;
+	while(!riscv_memory->exit_happened && pending > 0)
+	{
+		reg64 pc = get_register_pc(riscv_register);
+		long int count = records + riscv_memory->fused_executed - fused_before;
+		for(int i = 0; i < checkpoint_trigger_num; i++)
+		{
+			Riscv64_checkpoint_trigger* trigger = &checkpoint_trigger[i];
+			if(!taken[i] && (trigger->pc != 0 ? trigger->pc == pc : count >= trigger->count))
+			{
+				write_checkpoint(sim->file_name, count, riscv_register, riscv_memory);
+				taken[i] = TRUE;
+				pending--;
+			}
+		}
+		Riscv64_decoded* decoded = lookup_decode_cache(sim->decode_cache, riscv_memory, pc);
+		CACHE_FETCH(riscv_memory, pc, sizeof(instruction));
+		register_pc_self_increase(riscv_register);
+		decoded->handler(decoded, riscv_register, riscv_memory);
+		PIPELINE_RETIRE(riscv_memory, decoded, pc, riscv_register->pc);
+		records++;
+	}
+	return records + riscv_memory->fused_executed - fused_before;
+}
+
+// run the loaded program until it exits, return the number of instructions executed
+long int run_program(Riscv64_sim* sim)
+{
+	Riscv64_register* riscv_register = sim->riscv_register;
+	Riscv64_memory* riscv_memory = sim->riscv_memory;
+	long int count = 0;
+	riscv_memory->fused_executed = 0;
+
+	// profiling and sampling step through the decode cache whatever the engine
+	if(bbv_interval > 0 || simpoint_file != NULL)
+	{
+		if(sim->decode_cache == NULL)
+			init_decode_cache(&sim->decode_cache, riscv_memory);
+		attach_breakpoints(sim->decode_cache, NULL, riscv_register, riscv_memory);
+		if(bbv_interval > 0)
+			count = run_bbv(sim->decode_cache, riscv_register, riscv_memory, sim->file_name);
+		else
+			count = run_sampled(sim->decode_cache, riscv_register, riscv_memory);
+		detach_breakpoints();
+		return count;
+	}
+
+	// the checkpoints are taken on the way, then the engine goes on from there
+	if(checkpoint_trigger_num > 0)
+	{
+		if(sim->decode_cache == NULL)
+			init_decode_cache(&sim->decode_cache, riscv_memory);
+		count = run_to_checkpoints(sim);
+	}
+
+	#if defined(DEBUG)
+	// the decode cache only holds the traps here, see "breakpoint.h"
+	if(sim->decode_cache == NULL)
+		init_decode_cache(&sim->decode_cache, riscv_memory);
+	attach_breakpoints(sim->decode_cache, NULL, riscv_register, riscv_memory);
+	while(!riscv_memory->exit_happened)
+	{
+		Riscv64_decoded* decoded = lookup_decode_cache(sim->decode_cache, riscv_memory, get_register_pc(riscv_register));
+		if(decoded->id == INST_TRAP)
+		{
+			register_pc_self_increase(riscv_register);
+			exec_trap(decoded, riscv_register, riscv_memory);
+		}
+		else
+		{
+			instruction inst = fetch(riscv_memory, riscv_register);
+			decode(sim->riscv_decoder, inst);
+			execute(sim->riscv_decoder, riscv_register, riscv_memory);
+		}
+
+		count += 1;
+	}
+
+	#elif defined(BLOCK_ENGINE)
+	if(sim->block_cache == NULL)
+	{
+		init_block_cache(&sim->block_cache);
+		#if defined(JIT_ENGINE)
+		init_jit(&sim->block_cache->jit);
+		#endif
+	}
+	attach_breakpoints(NULL, sim->block_cache, riscv_register, riscv_memory);
+	// the aot code has no traps
+	if(!breakpoints_set() && sim->aot == NULL)
+		sim->aot = load_aot(sim->file_name, riscv_memory);
+	if(sim->aot != NULL)
+		count += run_aot(sim->aot, sim->block_cache, riscv_register, riscv_memory);
+	else
+		count += run_blocks(sim->block_cache, riscv_register, riscv_memory);
+
+	#elif defined(THREADED_ENGINE)
+	if(sim->decode_cache == NULL)
+		init_decode_cache(&sim->decode_cache, riscv_memory);
+	attach_breakpoints(sim->decode_cache, NULL, riscv_register, riscv_memory);
+	count += run_threaded(sim->decode_cache, riscv_register, riscv_memory);
+
+	#else
+	if(sim->decode_cache == NULL)
+		init_decode_cache(&sim->decode_cache, riscv_memory);
+	attach_breakpoints(sim->decode_cache, NULL, riscv_register, riscv_memory);
+	long int fused_before = riscv_memory->fused_executed; // counted with the checkpoints
+	while(!riscv_memory->exit_happened)
+	{
+		if(riscv_memory->harts != NULL && poll_harts(riscv_memory))
+			break;
+		reg64 pc = get_register_pc(riscv_register);
+		Riscv64_decoded* decoded = lookup_decode_cache(sim->decode_cache, riscv_memory, pc);
+		CACHE_FETCH(riscv_memory, pc, sizeof(instruction));
+		register_pc_self_increase(riscv_register);
+		decoded->handler(decoded, riscv_register, riscv_memory);
+		PIPELINE_RETIRE(riscv_memory, decoded, pc, riscv_register->pc);
+		count += 1;
+	}
+	count += riscv_memory->fused_executed - fused_before; // the second instructions of fused pairs
+	#endif
+
+	detach_breakpoints();
+	count += stop_harts(riscv_memory);
+	return count;
+}
+
+// at most max instructions through the decode cache whatever the engine, a fused pair
+// that would go past max runs its first instruction alone
+static long int run_steps(Riscv64_sim* sim, long int max)
+{
+	Riscv64_register* riscv_register = sim->riscv_register;
+	Riscv64_memory* riscv_memory = sim->riscv_memory;
+	if(sim->decode_cache == NULL)
+		init_decode_cache(&sim->decode_cache, riscv_memory);
+	attach_breakpoints(sim->decode_cache, NULL, riscv_register, riscv_memory);
+	long int count = 0;
+	while(!riscv_memory->exit_happened && count < max)
+	{
+		reg64 pc = get_register_pc(riscv_register);
+		Riscv64_decoded* decoded = lookup_decode_cache(sim->decode_cache, riscv_memory, pc);
+		Riscv64_decoded single;
+		if(decoded->id >= INST_FUSED_FIRST && count + 2 > max)
+		{
+			decode_to_record(&single, (instruction) get_memory_reg32(riscv_memory, (byte*)pc));
+			decoded = &single;
+		}
+		CACHE_FETCH(riscv_memory, pc, sizeof(instruction));
+		register_pc_self_increase(riscv_register);
+		decoded->handler(decoded, riscv_register, riscv_memory);
+		PIPELINE_RETIRE(riscv_memory, decoded, pc, riscv_register->pc);
+		count += decoded->id >= INST_FUSED_FIRST ? 2 : 1;
+	}
+	detach_breakpoints();
+	if(riscv_memory->exit_happened)
+		count += stop_harts(riscv_memory);
+	return count;
+}
+
+void print_engine_stats(Riscv64_sim* sim, long int count)
+{
+	long int pairs = (sim->decode_cache != NULL ? sim->decode_cache->fused : 0)
+	                 + (sim->block_cache != NULL ? sim->block_cache->fused : 0);
+	print_fusion_stats(pairs, sim->riscv_memory->fused_executed, count);
+	if(sim->aot != NULL)
+		print_aot_stats(sim->aot, count);
+	if(sim->block_cache != NULL)
+		print_block_cache_stats(sim->block_cache, count);
+	if(sim->decode_cache != NULL)
+		print_decode_cache_stats(sim->decode_cache);
+}
+
+void delete_engine(Riscv64_sim* sim)
+{
+	if(sim->block_cache != NULL)
+		delete_block_cache(sim->block_cache);
+	sim->block_cache = NULL;
+	if(sim->aot != NULL)
+		delete_aot(sim->aot);
+	sim->aot = NULL;
+	if(sim->decode_cache != NULL)
+		delete_decode_cache(sim->decode_cache);
+	sim->decode_cache = NULL;
+}
+
+
+/*********************************************/
+/*                                           */
+/* the context                               */
+/*                                           */
+/*********************************************/
+
+static void init_machine(Riscv64_sim* sim)
+{
+	init_decoder(&sim->riscv_decoder);
+	init_memory(&sim->riscv_memory);
+	init_register(&sim->riscv_register, sim->riscv_memory);
+	#ifdef CACHE_MODEL
+	init_cache_model(&sim->riscv_memory->cache_model);
+	#endif
+	#ifdef BRANCH_MODEL
+	init_branch_model(&sim->riscv_memory->branch_model);
+	#endif
+	#if defined(OOO_MODEL)
+	init_ooo_model(&sim->riscv_memory->ooo_model);
+	#elif defined(PIPELINE_MODEL)
+	init_pipeline_model(&sim->riscv_memory->pipeline_model);
+	#endif
+	set_code_write_handler(sim->riscv_memory, on_code_write, sim);
+}
+
+static void delete_machine(Riscv64_sim* sim)
+{
+	stop_harts(sim->riscv_memory); // of a program that did not get to its exit
+	delete_engine(sim);
+	#ifdef CACHE_MODEL
+	delete_cache_model(sim->riscv_memory->cache_model);
+	#endif
+	#ifdef BRANCH_MODEL
+	delete_branch_model(sim->riscv_memory->branch_model);
+	#endif
+	#if defined(OOO_MODEL)
+	delete_ooo_model(sim->riscv_memory->ooo_model);
+	#elif defined(PIPELINE_MODEL)
+	delete_pipeline_model(sim->riscv_memory->pipeline_model);
+	#endif
+	delete_memory_system(sim->riscv_decoder, sim->riscv_register, sim->riscv_memory);
+	if(sim->buffer != NULL)
+		unmap_file(sim->buffer, sim->size);
+	sim->buffer = NULL;
+	sim->loaded = FALSE;
+}
+
+void init_sim(Riscv64_sim** sim)
+{
+	*sim = (Riscv64_sim*) malloc (sizeof(Riscv64_sim));
+	if(*sim == NULL)
+	{
+		printf("Memory error.\n");
+		exit(1);
+	}
+	memset(*sim, 0, sizeof(Riscv64_sim));
+	init_machine(*sim);
+}
+
+bool load_sim(Riscv64_sim* sim, const char* file_name)
+{
+	// a second program starts over on a fresh machine
+	if(sim->loaded)
+	{
+		delete_machine(sim);
+		init_machine(sim);
+	}
+
+	// not absolute addr, add "./" to the head of the str
+	if(file_name[0] != '/')
+		snprintf(sim->file_name, sizeof(sim->file_name), "./%s", file_name);
+	else
+		snprintf(sim->file_name, sizeof(sim->file_name), "%s", file_name);
+
+	FILE* file_p = fopen(sim->file_name, "rb");  // binary mode
+	if(file_p == NULL)
+	{
+		printf("Can not open file : %s successfully.\n", sim->file_name);
+		return FALSE;
+	}
+
+	// map the whole file, an elf or a checkpoint
+	sim->buffer = map_file(file_p, &sim->size);
+	sim->checkpoint = is_checkpoint(sim->buffer, sim->size);
+	if(sim->checkpoint)
+		sim->count = load_checkpoint(sim->buffer, fileno(file_p), sim->riscv_register, sim->riscv_memory);
+	else
+	{
+		load_program((Elf64_Ehdr*)sim->buffer, fileno(file_p), sim->riscv_register, sim->riscv_memory);
+		sim->count = 0;
+	}
+	fclose(file_p);
+	sim->riscv_memory->exit_happened = FALSE;
+	sim->loaded = TRUE;
+	return TRUE;
+}
+
+// held by the thread running a context, the breakpoints and the options are of the process
+static pthread_mutex_t running = PTHREAD_MUTEX_INITIALIZER;
+
+long int run_sim(Riscv64_sim* sim, long int max)
+{
+	if(!sim->loaded || sim->riscv_memory->exit_happened)
+		return 0;
+	if(pthread_mutex_trylock(&running) != 0)
+	{
+		printf("riscvsim: another context is running, a process runs one at a time.\n");
+		return -1;
+	}
+	// a bad access or no host memory ends the program, not the process that runs it
+	sigjmp_buf jump;
+	if(sigsetjmp(jump, 1) != 0)
+	{
+		catch_faults(NULL);
+		detach_breakpoints();
+		stop_harts(sim->riscv_memory);
+		pthread_mutex_unlock(&running);
+		return 0;
+	}
+	catch_faults(&jump);
+	long int count = max > 0 ? run_steps(sim, max) : run_program(sim);
+	catch_faults(NULL);
+	pthread_mutex_unlock(&running);
+	sim->count += count;
+	return count;
+}
+
+bool step_sim(Riscv64_sim* sim)
+{
+	return run_sim(sim, 1) > 0;
+}
+
+bool sim_exited(Riscv64_sim* sim)
+{
+	return sim->riscv_memory->exit_happened;
+}
+
+int sim_exit_code(Riscv64_sim* sim)
+{
+	return sim->riscv_memory->exit_code;
+}
+
+int sim_fault(Riscv64_sim* sim)
+{
+	return sim->riscv_memory->fault;
+}
+
+void delete_sim(Riscv64_sim* sim)
+{
+	delete_machine(sim);
+	free(sim);
+}
@@ -0,0 +1,77 @@
+#ifndef __RISCVSIM_H__
+#define __RISCVSIM_H__
+#include "memory_system.h"
+#include "decode_cache.h"
+#include "block_cache.h"
+#include "aot.h"
+
+/*********************************************/
+/*                                           */
+/* simulator context                         */
+/*                                           */
+/*********************************************/
+/* Everything one guest program runs with:   */
+/* the decoder, the registers, the memory    */
+/* (which holds the exit status and the      */
+/* models), the caches of the engine and the */
+/* file it was loaded from. Contexts share   */
+/* nothing, so a process can load and run    */
+/* several of them one after the other or in */
+/* turns. This and the objects below it are  */
+/* libriscvsim.a and libriscvsim.so, the     */
+/* simulator binary is main.c on top of it.  */
+/*                                           */
+/* Still of the process: the options (-m,    */
+/* the model configurations, -checkpoint,    */
+/* -bbv), the breakpoints and the debug      */
+/* mode, and the SIGSEGV handlers, which     */
+/* find the memory or the compiled code a    */
+/* fault is in. So a process runs one        */
+/* context at a time: run_sim() in a thread  */
+/* while another thread is in it fails. A    */
+/* bad guest access, no host memory for the  */
+/* guest or "exit" in the debug mode ends    */
+/* the program (see sim_fault()) but not the */
+/* process; a missing file makes load_sim()  */
+/* fail.                                     */
+/*********************************************/
+
+typedef struct riscv64_sim{
+	Riscv64_decoder* riscv_decoder;
+	Riscv64_register* riscv_register;
+	Riscv64_memory* riscv_memory;
+	// the engine, kept for the runs of the same program after a restore_snapshot()
+	Riscv64_decode_cache* decode_cache;
+	Riscv64_block_cache* block_cache;
+	Riscv64_aot* aot;
+	// the loaded file, mapped
+	char file_name[4096];       // with "./" in front of a relative name
+	byte* buffer;
+	int size;
+	bool loaded;
+	bool checkpoint;            // the file is a checkpoint, not an ELF
+	long int count;             // instructions executed since the start of the program
+} Riscv64_sim;
+
+// an empty machine with the models of the build, nothing loaded yet
+void init_sim(Riscv64_sim**);
+// load an ELF or restore a checkpoint into a fresh machine, FALSE (with a message) if the file can not be opened
+bool load_sim(Riscv64_sim*, const char* file_name);
+// run until the program exits, or at most max instructions if max > 0; return the instructions executed.
+// Without a limit the engine of the build runs it, with one the decode cache steps through it.
+// A run that ends on a fault returns 0, its instructions are not counted; one started while
+// another thread runs a context returns -1 (with a message) and runs nothing.
+long int run_sim(Riscv64_sim*, long int max);
+// run one instruction, FALSE if the program had exited already or it faulted
+bool step_sim(Riscv64_sim*);
+bool sim_exited(Riscv64_sim*);
+int sim_exit_code(Riscv64_sim*); // a0 of the exit system call
+int sim_fault(Riscv64_sim*);     // FAULT_xxx of "memory_system.h" if a fault ended the program in the place of an exit
+void delete_sim(Riscv64_sim*);
+
+// the engines, on a loaded context
+long int run_program(Riscv64_sim*); // run till exit, return instruction count
+void print_engine_stats(Riscv64_sim*, long int count); // statistics of the engine, after "instructions executed"
+void delete_engine(Riscv64_sim*); // free the caches of the engine
+
+#endif
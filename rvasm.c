@@ -0,0 +1,514 @@
+/*******************************************************************/
+/* Assembler of the regression programs of "make check", run by   */
+/* the Makefile like gen_decode_table, so that they build without  */
+/* a RISC-V toolchain.                                             */
+/*                                                                 */
+/*   rvasm program.s program                                       */
+/*                                                                 */
+/* It knows the RV64IA instructions the programs use, the pseudo   */
+/* instructions li (always lui + addiw, so a label can be loaded), */
+/* mv, j, ret, nop, beqz and bnez, and the directives .word,       */
+/* .dword and .ascii (padded to 4 bytes). Operands are registers,  */
+/* numbers, labels and imm(reg). The code is linked at 0x10000 in  */
+/* one segment readable, writable and executable, followed by      */
+/* zeroed memory up to 0x110000 for data.                          */
+/*******************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "parse_elf.h"
+
+#define BASE      0x10000UL
+#define SEGMENT   0x100000UL   // bytes of the segment in memory
+#define CODE_OFF  0x1000       // of the code in the file
+#define LINE_SIZE 256
+#define LABEL_MAX 1024
+#define CODE_MAX  (1 << 16)    // bytes
+
+typedef struct{
+	char name[64];
+	unsigned long int addr;
+} label;
+
+static label labels[LABEL_MAX];
+static int label_num = 0;
+static unsigned char code[CODE_MAX];
+static unsigned long int pc;
+static const char* file_name;
+static int line_num;
+static int pass;
+
+static void fail(const char* message, const char* what)
+{
+	fprintf(stderr, "%s:%d: %s%s%s\n", file_name, line_num, message, what ? ": " : "", what ? what : "");
+	exit(1);
+}
+
+/*********************************************/
+/*                                           */
+/* operands                                  */
+/*                                           */
+/*********************************************/
+
+static const char* abi_names[32] = {
+	"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+	"a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+static int reg(const char* name)
+{
+	for(int i = 0; i < 32; i++)
+		if(strcmp(name, abi_names[i]) == 0)
+			return i;
+	if(strcmp(name, "fp") == 0)
+		return 8;
+	if(name[0] == 'x' && isdigit((unsigned char)name[1]))
+	{
+		char* end;
+		long int i = strtol(name + 1, &end, 10);
+		if(*end == '\0' && i < 32)
+			return i;
+	}
+	fail("not a register", name);
+	return 0;
+}
+
+// a number or a label, labels are 0 in the first pass
+static long int value(const char* text)
+{
+	char* end;
+	long int number = strtol(text, &end, 0);
+	if(end != text && *end == '\0')
+		return number;
+	for(int i = 0; i < label_num; i++)
+		if(strcmp(labels[i].name, text) == 0)
+			return labels[i].addr;
+	if(pass == 2)
+		fail("unknown label", text);
+	return 0;
+}
+
+// imm(reg) or (reg)
+static void memory_operand(const char* text, long int* imm, int* base)
+{
+	char number[LINE_SIZE];
+	const char* open = strchr(text, '(');
+	const char* close = strchr(text, ')');
+	if(open == NULL || close == NULL || close < open)
+		fail("not a memory operand", text);
+	memcpy(number, text, open - text);
+	number[open - text] = '\0';
+	*imm = open == text ? 0 : value(number);
+	char name[LINE_SIZE];
+	memcpy(name, open + 1, close - open - 1);
+	name[close - open - 1] = '\0';
+	*base = reg(name);
+}
+
+/*********************************************/
+/*                                           */
+/* encoding                                  */
+/*                                           */
+/*********************************************/
+
+static void emit(unsigned int inst)
+{
+	if(pc - BASE + 4 > CODE_MAX)
+		fail("program too large", NULL);
+	memcpy(code + (pc - BASE), &inst, 4);
+	pc += 4;
+}
+
+static void check_imm(long int imm, int bits, const char* text)
+{
+	if(pass == 2 && (imm < -(1L << (bits - 1)) || imm >= (1L << (bits - 1))))
+		fail("immediate out of range", text);
+}
+
+#define R_TYPE(op, f3, f7, rd, rs1, rs2) ((op) | (rd) << 7 | (f3) << 12 | (rs1) << 15 | (rs2) << 20 | (unsigned int)(f7) << 25)
+#define I_TYPE(op, f3, rd, rs1, imm)     ((op) | (rd) << 7 | (f3) << 12 | (rs1) << 15 | ((unsigned int)(imm) & 0xfff) << 20)
+#define S_TYPE(op, f3, rs1, rs2, imm)    ((op) | ((imm) & 0x1f) << 7 | (f3) << 12 | (rs1) << 15 | (rs2) << 20 \
+                                          | ((unsigned int)(imm) >> 5 & 0x7f) << 25)
+#define B_TYPE(f3, rs1, rs2, imm)        (0x63 | ((imm) >> 11 & 1) << 7 | ((imm) >> 1 & 0xf) << 8 | (f3) << 12 | (rs1) << 15 \
+                                          | (rs2) << 20 | ((imm) >> 5 & 0x3f) << 25 | ((unsigned int)(imm) >> 12 & 1) << 31)
+#define J_TYPE(rd, imm)                  (0x6f | (rd) << 7 | ((imm) >> 12 & 0xff) << 12 | ((imm) >> 11 & 1) << 20 \
+                                          | ((imm) >> 1 & 0x3ff) << 21 | ((unsigned int)(imm) >> 20 & 1) << 31)
+
+typedef struct{
+	const char* name;
+	char format;        // R, I (alu), H (shift), L (load), S (store), B (branch), A (atomic)
+	int opcode;
+	int funct3;
+	int funct7;         // or funct5 of the atomics, or the bits above a shift amount
+} mnemonic;
+
+static const mnemonic mnemonics[] = {
+	{"add",  'R', 0x33, 0, 0x00}, {"sub",  'R', 0x33, 0, 0x20}, {"sll",  'R', 0x33, 1, 0x00},
+	{"slt",  'R', 0x33, 2, 0x00}, {"sltu", 'R', 0x33, 3, 0x00}, {"xor",  'R', 0x33, 4, 0x00},
+	{"srl",  'R', 0x33, 5, 0x00}, {"sra",  'R', 0x33, 5, 0x20}, {"or",   'R', 0x33, 6, 0x00},
+	{"and",  'R', 0x33, 7, 0x00}, {"mul",  'R', 0x33, 0, 0x01},
+	{"addw", 'R', 0x3b, 0, 0x00}, {"subw", 'R', 0x3b, 0, 0x20}, {"sllw", 'R', 0x3b, 1, 0x00},
+	{"srlw", 'R', 0x3b, 5, 0x00}, {"sraw", 'R', 0x3b, 5, 0x20},
+	{"addi", 'I', 0x13, 0, 0}, {"slti", 'I', 0x13, 2, 0}, {"sltiu", 'I', 0x13, 3, 0},
+	{"xori", 'I', 0x13, 4, 0}, {"ori",  'I', 0x13, 6, 0}, {"andi",  'I', 0x13, 7, 0},
+	{"addiw", 'I', 0x1b, 0, 0},
+	{"slli", 'H', 0x13, 1, 0x000}, {"srli", 'H', 0x13, 5, 0x000}, {"srai", 'H', 0x13, 5, 0x400},
+	{"lb", 'L', 0x03, 0, 0}, {"lh", 'L', 0x03, 1, 0}, {"lw", 'L', 0x03, 2, 0}, {"ld", 'L', 0x03, 3, 0},
+	{"lbu", 'L', 0x03, 4, 0}, {"lhu", 'L', 0x03, 5, 0}, {"lwu", 'L', 0x03, 6, 0},
+	{"sb", 'S', 0x23, 0, 0}, {"sh", 'S', 0x23, 1, 0}, {"sw", 'S', 0x23, 2, 0}, {"sd", 'S', 0x23, 3, 0},
+	{"beq", 'B', 0x63, 0, 0}, {"bne", 'B', 0x63, 1, 0}, {"blt", 'B', 0x63, 4, 0},
+	{"bge", 'B', 0x63, 5, 0}, {"bltu", 'B', 0x63, 6, 0}, {"bgeu", 'B', 0x63, 7, 0},
+	{"lr", 'A', 0x2f, 0, 0x02}, {"sc", 'A', 0x2f, 0, 0x03}, {"amoswap", 'A', 0x2f, 0, 0x01},
+	{"amoadd", 'A', 0x2f, 0, 0x00}, {"amoxor", 'A', 0x2f, 0, 0x04}, {"amoand", 'A', 0x2f, 0, 0x0c},
+	{"amoor", 'A', 0x2f, 0, 0x08}, {"amomin", 'A', 0x2f, 0, 0x10}, {"amomax", 'A', 0x2f, 0, 0x14},
+	{"amominu", 'A', 0x2f, 0, 0x18}, {"amomaxu", 'A', 0x2f, 0, 0x1c},
+	{NULL, 0, 0, 0, 0}
+};
+
+static void expect(int argc, int n, const char* name)
+{
+	if(argc != n)
+		fail("wrong number of operands", name);
+}
+
+// one instruction or directive, arg[] are its operands
+static void assemble(char* name, char** arg, int argc)
+{
+	long int imm;
+	int base;
+
+	if(strcmp(name, ".word") == 0 || strcmp(name, ".dword") == 0)
+	{
+		expect(argc, 1, name);
+		unsigned long int data = value(arg[0]);
+		emit((unsigned int)data);
+		if(name[1] == 'd')
+			emit((unsigned int)(data >> 32));
+		return;
+	}
+	if(strcmp(name, ".ascii") == 0)
+	{
+		// arg[0] is the quoted string, \n and \\ are escaped
+		unsigned char text[LINE_SIZE];
+		int length = 0;
+		for(const char* c = arg[0] + 1; *c != '\0' && *c != '"'; c++)
+			text[length++] = (c[0] == '\\' && c[1] == 'n') ? (c++, '\n') : (c[0] == '\\' ? *++c : *c);
+		while(length % 4 != 0)
+			text[length++] = 0;
+		for(int i = 0; i < length; i += 4)
+			emit(text[i] | text[i + 1] << 8 | text[i + 2] << 16 | (unsigned int)text[i + 3] << 24);
+		return;
+	}
+
+	// pseudo instructions
+	if(strcmp(name, "li") == 0)
+	{
+		expect(argc, 2, name);
+		int rd = reg(arg[0]);
+		long int number = value(arg[1]);
+		check_imm(number, 32, arg[1]);
+		long int low = ((number & 0xfff) ^ 0x800) - 0x800;
+		emit(0x37 | rd << 7 | ((unsigned int)(number - low) & 0xfffff000));
+		emit(I_TYPE(0x1b, 0, rd, rd, low));
+		return;
+	}
+	if(strcmp(name, "mv") == 0)
+	{
+		expect(argc, 2, name);
+		emit(I_TYPE(0x13, 0, reg(arg[0]), reg(arg[1]), 0));
+		return;
+	}
+	if(strcmp(name, "nop") == 0)
+	{
+		emit(I_TYPE(0x13, 0, 0, 0, 0));
+		return;
+	}
+	if(strcmp(name, "ret") == 0)
+	{
+		emit(I_TYPE(0x67, 0, 0, 1, 0));
+		return;
+	}
+	if(strcmp(name, "j") == 0 || strcmp(name, "jal") == 0)
+	{
+		int rd = name[1] == '\0' ? 0 : 1;
+		if(argc == 2)
+			rd = reg(arg[0]);
+		else
+			expect(argc, 1, name);
+		imm = value(arg[argc - 1]) - (long int)pc;
+		check_imm(imm, 21, arg[argc - 1]);
+		emit(J_TYPE(rd, imm));
+		return;
+	}
+	if(strcmp(name, "jalr") == 0)
+	{
+		if(argc == 1)
+			emit(I_TYPE(0x67, 0, 1, reg(arg[0]), 0));
+		else
+		{
+			expect(argc, 2, name);
+			memory_operand(arg[1], &imm, &base);
+			emit(I_TYPE(0x67, 0, reg(arg[0]), base, imm));
+		}
+		return;
+	}
+	if(strcmp(name, "beqz") == 0 || strcmp(name, "bnez") == 0)
+	{
+		expect(argc, 2, name);
+		imm = value(arg[1]) - (long int)pc;
+		check_imm(imm, 13, arg[1]);
+		emit(B_TYPE(name[1] == 'e' ? 0 : 1, reg(arg[0]), 0, imm));
+		return;
+	}
+	if(strcmp(name, "lui") == 0 || strcmp(name, "auipc") == 0)
+	{
+		expect(argc, 2, name);
+		emit((name[0] == 'l' ? 0x37 : 0x17) | reg(arg[0]) << 7 | ((unsigned int)value(arg[1]) << 12));
+		return;
+	}
+	if(strcmp(name, "ecall") == 0)
+	{
+		emit(0x73);
+		return;
+	}
+	if(strcmp(name, "fence") == 0)
+	{
+		emit(0x0ff0000f);
+		return;
+	}
+
+	// the atomics are name.w or name.d, with .aq, .rl or .aqrl
+	char* suffix = strchr(name, '.');
+	if(suffix != NULL)
+		*suffix++ = '\0';
+	for(const mnemonic* m = mnemonics; m->name != NULL; m++)
+	{
+		if(strcmp(m->name, name) != 0)
+			continue;
+		if((m->format == 'A') != (suffix != NULL))
+			fail("unknown instruction", name);
+		switch(m->format)
+		{
+			case 'R':
+				expect(argc, 3, name);
+				emit(R_TYPE(m->opcode, m->funct3, m->funct7, reg(arg[0]), reg(arg[1]), reg(arg[2])));
+				return;
+			case 'I':
+				expect(argc, 3, name);
+				imm = value(arg[2]);
+				check_imm(imm, 12, arg[2]);
+				emit(I_TYPE(m->opcode, m->funct3, reg(arg[0]), reg(arg[1]), imm));
+				return;
+			case 'H':
+				expect(argc, 3, name);
+				imm = value(arg[2]);
+				if(imm < 0 || imm > 63)
+					fail("shift amount out of range", arg[2]);
+				emit(I_TYPE(m->opcode, m->funct3, reg(arg[0]), reg(arg[1]), imm | m->funct7));
+				return;
+			case 'L':
+				expect(argc, 2, name);
+				memory_operand(arg[1], &imm, &base);
+				check_imm(imm, 12, arg[1]);
+				emit(I_TYPE(m->opcode, m->funct3, reg(arg[0]), base, imm));
+				return;
+			case 'S':
+				expect(argc, 2, name);
+				memory_operand(arg[1], &imm, &base);
+				check_imm(imm, 12, arg[1]);
+				emit(S_TYPE(m->opcode, m->funct3, base, reg(arg[0]), imm));
+				return;
+			case 'B':
+				expect(argc, 3, name);
+				imm = value(arg[2]) - (long int)pc;
+				check_imm(imm, 13, arg[2]);
+				emit(B_TYPE(m->funct3, reg(arg[0]), reg(arg[1]), imm));
+				return;
+			case 'A':
+			{
+				int width = suffix[0] == 'w' ? 2 : suffix[0] == 'd' ? 3 : -1;
+				if(width < 0 || (suffix[1] != '\0' && strcmp(suffix + 1, ".aq") != 0
+				   && strcmp(suffix + 1, ".rl") != 0 && strcmp(suffix + 1, ".aqrl") != 0))
+					fail("unknown instruction", name);
+				int ordering = strstr(suffix, "aq") ? 2 : 0;
+				ordering |= strstr(suffix, "rl") ? 1 : 0;
+				// lr rd, (rs1) and the others rd, rs2, (rs1)
+				int rs2 = 0;
+				if(m->funct7 == 0x02)
+					expect(argc, 2, name);
+				else
+				{
+					expect(argc, 3, name);
+					rs2 = reg(arg[1]);
+				}
+				memory_operand(arg[argc - 1], &imm, &base);
+				emit(R_TYPE(m->opcode, width, m->funct7 << 2 | ordering, reg(arg[0]), base, rs2));
+				return;
+			}
+		}
+	}
+	fail("unknown instruction", name);
+}
+
+// split a line into a label, a name and the operands, then assemble it
+static void assemble_line(char* line)
+{
+	char* comment = strchr(line, '#');
+	if(comment != NULL && (strchr(line, '"') == NULL || comment < strchr(line, '"')))
+		*comment = '\0';
+
+	char* text = line;
+	while(isspace((unsigned char)*text))
+		text++;
+	char* colon = strchr(text, ':');
+	if(colon != NULL && strchr(text, '"') == NULL)
+	{
+		*colon = '\0';
+		if(pass == 1)
+		{
+			if(label_num == LABEL_MAX)
+				fail("too many labels", NULL);
+			strncpy(labels[label_num].name, text, sizeof(labels[0].name) - 1);
+			labels[label_num].addr = pc;
+			label_num++;
+		}
+		text = colon + 1;
+		while(isspace((unsigned char)*text))
+			text++;
+	}
+	if(*text == '\0')
+		return;
+
+	char* name = text;
+	while(*text != '\0' && !isspace((unsigned char)*text))
+		text++;
+	if(*text != '\0')
+		*text++ = '\0';
+
+	char* arg[4];
+	int argc = 0;
+	while(*text != '\0')
+	{
+		while(isspace((unsigned char)*text))
+			text++;
+		if(*text == '\0')
+			break;
+		if(argc == 4)
+			fail("too many operands", name);
+		arg[argc++] = text;
+		// a string is one operand
+		char* end = *text == '"' ? strchr(text + 1, '"') : strchr(text, ',');
+		if(end != NULL && *text == '"')
+			end = strchr(end, ',');
+		if(end == NULL)
+			end = text + strlen(text);
+		text = *end == ',' ? end + 1 : end;
+		*end = '\0';
+		for(char* last = end - 1; last >= arg[argc - 1] && isspace((unsigned char)*last); last--)
+			*last = '\0';
+	}
+	assemble(name, arg, argc);
+}
+
+/*********************************************/
+/*                                           */
+/* ELF                                       */
+/*                                           */
+/*********************************************/
+
+static const char section_names[] = "\0.text\0.shstrtab";
+
+static void write_elf(FILE* out, unsigned long int size)
+{
+	Elf64_Ehdr header;
+	Elf64_Phdr segment;
+	Elf64_Shdr sections[3];
+	unsigned long int names_off = CODE_OFF + size;
+	unsigned long int sections_off = (names_off + sizeof(section_names) + 7) & ~7UL;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.e_ident, "\177ELF\2\1\1", 7);
+	header.e_type = 2;        // executable
+	header.e_machine = 0xf3;  // RISC-V
+	header.e_version = 1;
+	header.e_entry = BASE;
+	header.e_phoff = sizeof(header);
+	header.e_shoff = sections_off;
+	header.e_ehsize = sizeof(header);
+	header.e_phentsize = sizeof(segment);
+	header.e_phnum = 1;
+	header.e_shentsize = sizeof(Elf64_Shdr);
+	header.e_shnum = 3;
+	header.e_shstrndx = 2;
+
+	memset(&segment, 0, sizeof(segment));
+	segment.p_type = PT_LOAD;
+	segment.p_flags = PF_R | PF_W | PF_X;
+	segment.p_offset = CODE_OFF;
+	segment.p_vaddr = BASE;
+	segment.p_paddr = BASE;
+	segment.p_filesz = size;
+	segment.p_memsz = SEGMENT;
+	segment.p_align = 0x1000;
+
+	memset(sections, 0, sizeof(sections));
+	sections[1].sh_name = 1;
+	sections[1].sh_type = SHT_PROGBITS;
+	sections[1].sh_flags = 0x6;  // alloc, execinstr
+	sections[1].sh_addr = BASE;
+	sections[1].sh_offset = CODE_OFF;
+	sections[1].sh_size = size;
+	sections[1].sh_addralign = 4;
+	sections[2].sh_name = 7;
+	sections[2].sh_type = SHT_STRTAB;
+	sections[2].sh_offset = names_off;
+	sections[2].sh_size = sizeof(section_names);
+	sections[2].sh_addralign = 1;
+
+	static const unsigned char zero[CODE_OFF];
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(&segment, sizeof(segment), 1, out);
+	fwrite(zero, CODE_OFF - sizeof(header) - sizeof(segment), 1, out);
+	fwrite(code, size, 1, out);
+	fwrite(section_names, sizeof(section_names), 1, out);
+	fwrite(zero, sections_off - names_off - sizeof(section_names), 1, out);
+	fwrite(sections, sizeof(sections), 1, out);
+}
+
+int main(int argc, char** argv)
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "usage: %s program.s program\n", argv[0]);
+		return 1;
+	}
+	file_name = argv[1];
+	for(pass = 1; pass <= 2; pass++)
+	{
+		FILE* in = fopen(argv[1], "r");
+		if(in == NULL)
+		{
+			perror(argv[1]);
+			return 1;
+		}
+		char line[LINE_SIZE];
+		pc = BASE;
+		line_num = 0;
+		while(fgets(line, LINE_SIZE, in) != NULL)
+		{
+			line_num++;
+			assemble_line(line);
+		}
+		fclose(in);
+	}
+
+	FILE* out = fopen(argv[2], "wb");
+	if(out == NULL)
+	{
+		perror(argv[2]);
+		return 1;
+	}
+	write_elf(out, pc - BASE);
+	fclose(out);
+	return 0;
+}
@@ -0,0 +1,543 @@
+#include <math.h>
+#include <limits.h>
+#include "simpoint.h"
+
+
+long int bbv_interval = 0;
+int bbv_max_k = BBV_MAX_K;
+const char* simpoint_file = NULL;
+
+bool set_bbv_config(const char* spec)
+{
+	long int interval;
+	int max_k = BBV_MAX_K;
+	int fields = sscanf(spec, "%ld:%d", &interval, &max_k);
+	if(fields < 1 || interval < 1000 || max_k < 1 || max_k > 100)
+	{
+		printf("-bbv needs instructions[:max k], at least 1000 instructions an interval and 1 to 100 clusters.\n");
+		return FALSE;
+	}
+	bbv_interval = interval;
+	bbv_max_k = max_k;
+	return TRUE;
+}
+
+
+/*********************************************/
+/*                                           */
+/* executing                                 */
+/*                                           */
+/*********************************************/
+
+// execute the record at pc, return the number of instructions it stands for
+static inline int step(Riscv64_decode_cache* cache, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, bool detailed)
+{
+	reg64 pc = get_register_pc(riscv_register);
+	Riscv64_decoded* decoded = lookup_decode_cache(cache, riscv_memory, pc);
+	CACHE_FETCH(riscv_memory, pc, sizeof(instruction));
+	register_pc_self_increase(riscv_register);
+	decoded->handler(decoded, riscv_register, riscv_memory);
+	if(detailed)
+		PIPELINE_RETIRE(riscv_memory, decoded, pc, riscv_register->pc);
+	return decoded->id >= INST_FUSED_FIRST ? 2 : 1;
+}
+
+// run until the program exits or count reaches limit, return count
+static long int run_until(Riscv64_decode_cache* cache, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory,
+                          long int count, long int limit, bool detailed)
+{
+	if(detailed)
+		while(!riscv_memory->exit_happened && count < limit)
+			count += step(cache, riscv_register, riscv_memory, TRUE);
+	else
+		while(!riscv_memory->exit_happened && count < limit)
+			count += step(cache, riscv_register, riscv_memory, FALSE);
+	return count;
+}
+
+
+/*********************************************/
+/*                                           */
+/* basic block vectors                       */
+/*                                           */
+/*********************************************/
+
+static void init_bbv(Riscv64_bbv** bbv, long int interval, const char* file_name)
+{
+	char name[4096];
+	snprintf(name, sizeof(name), "%s.bbv", file_name);
+	Riscv64_bbv* b = (Riscv64_bbv*) calloc (1, sizeof(Riscv64_bbv));
+	b->file = fopen(name, "w");
+	if(b->file == NULL)
+	{
+		printf("can not write %s.\n", name);
+		exit(1);
+	}
+	b->interval = interval;
+	b->table_size = 1024;
+	b->block_pc = (reg64*) calloc (b->table_size, sizeof(reg64));
+	b->block_id = (int*) malloc (b->table_size * sizeof(int));
+	b->counts = (long int*) calloc (b->table_size / 2, sizeof(long int));
+	b->touched = (int*) malloc (b->table_size / 2 * sizeof(int));
+	*bbv = b;
+}
+
+static void delete_bbv(Riscv64_bbv* bbv)
+{
+	fclose(bbv->file);
+	free(bbv->block_pc);
+	free(bbv->block_id);
+	free(bbv->counts);
+	free(bbv->touched);
+	free(bbv->vectors);
+	free(bbv->lengths);
+	free(bbv);
+}
+
+static inline unsigned int hash_pc(reg64 pc)
+{
+	return (unsigned int)((pc >> 2) * 0x9E3779B97F4A7C15UL >> 32);
+}
+
+// double the table, there are never more blocks than half of it
+static void grow_blocks(Riscv64_bbv* bbv)
+{
+	int old_size = bbv->table_size;
+	reg64* old_pc = bbv->block_pc;
+	int* old_id = bbv->block_id;
+	bbv->table_size *= 2;
+	bbv->block_pc = (reg64*) calloc (bbv->table_size, sizeof(reg64));
+	bbv->block_id = (int*) malloc (bbv->table_size * sizeof(int));
+	unsigned int mask = bbv->table_size - 1;
+	for(int i = 0; i < old_size; i++)
+	{
+		if(old_pc[i] == 0)
+			continue;
+		unsigned int h = hash_pc(old_pc[i]) & mask;
+		while(bbv->block_pc[h] != 0)
+			h = (h + 1) & mask;
+		bbv->block_pc[h] = old_pc[i];
+		bbv->block_id[h] = old_id[i];
+	}
+	free(old_pc);
+	free(old_id);
+	bbv->counts = (long int*) realloc (bbv->counts, bbv->table_size / 2 * sizeof(long int));
+	memset(bbv->counts + old_size / 2, 0, (bbv->table_size - old_size) / 2 * sizeof(long int));
+	bbv->touched = (int*) realloc (bbv->touched, bbv->table_size / 2 * sizeof(int));
+}
+
+// count the instructions executed in the block that starts at pc
+static void add_block(Riscv64_bbv* bbv, reg64 pc, long int instructions)
+{
+	if(instructions == 0)
+		return;
+	unsigned int mask = bbv->table_size - 1;
+	unsigned int h = hash_pc(pc) & mask;
+	while(bbv->block_pc[h] != pc && bbv->block_pc[h] != 0)
+		h = (h + 1) & mask;
+	if(bbv->block_pc[h] == 0)
+	{
+		bbv->block_pc[h] = pc;
+		bbv->block_id[h] = bbv->blocks++;
+		if(bbv->blocks * 2 > bbv->table_size)
+		{
+			grow_blocks(bbv);
+			add_block(bbv, pc, instructions);
+			return;
+		}
+	}
+	int id = bbv->block_id[h];
+	if(bbv->counts[id] == 0)
+		bbv->touched[bbv->touched_num++] = id;
+	bbv->counts[id] += instructions;
+}
+
+// a random coordinate in [-1, 1] of the projection of block id
+static double projection(int id, int dimension)
+{
+	reg64 x = (reg64)id * BBV_DIMENSIONS + dimension + 0x9E3779B97F4A7C15UL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9UL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBUL;
+	x ^= x >> 31;
+	return (double)(x >> 11) / (double)(1UL << 52) - 1.0;
+}
+
+// write out the counts of the interval and keep its projection
+static void end_interval(Riscv64_bbv* bbv, long int length)
+{
+	if(length == 0)
+		return;
+	if(bbv->intervals == bbv->capacity)
+	{
+		bbv->capacity = bbv->capacity ? bbv->capacity * 2 : 256;
+		bbv->vectors = realloc (bbv->vectors, bbv->capacity * sizeof(*bbv->vectors));
+		bbv->lengths = (long int*) realloc (bbv->lengths, bbv->capacity * sizeof(long int));
+	}
+	double* vector = bbv->vectors[bbv->intervals];
+	memset(vector, 0, sizeof(*bbv->vectors));
+	bbv->lengths[bbv->intervals++] = length;
+
+	fprintf(bbv->file, "T");
+	for(int i = 0; i < bbv->touched_num; i++)
+	{
+		int id = bbv->touched[i];
+		fprintf(bbv->file, ":%d:%ld ", id + 1, bbv->counts[id]);
+		double share = (double)bbv->counts[id] / length;
+		for(int d = 0; d < BBV_DIMENSIONS; d++)
+			vector[d] += share * projection(id, d);
+		bbv->counts[id] = 0;
+	}
+	fprintf(bbv->file, "\n");
+	bbv->touched_num = 0;
+}
+
+
+/*********************************************/
+/*                                           */
+/* clustering                                */
+/*                                           */
+/*********************************************/
+
+static reg64 random_state;
+static double random_unit() // in [0, 1)
+{
+	random_state = random_state * 6364136223846793005UL + 1442695040888963407UL;
+	return (double)(random_state >> 11) / (double)(1UL << 53);
+}
+
+static double distance2(const double* a, const double* b)
+{
+	double sum = 0;
+	for(int d = 0; d < BBV_DIMENSIONS; d++)
+		sum += (a[d] - b[d]) * (a[d] - b[d]);
+	return sum;
+}
+
+// k-means with k-means++ seeds, return the sum of the squared distances to the centres
+static double kmeans(double (*x)[BBV_DIMENSIONS], int n, int k, int* assign, double (*centre)[BBV_DIMENSIONS])
+{
+	double* nearest = (double*) malloc (n * sizeof(double));
+	memcpy(centre[0], x[(int)(random_unit() * n)], sizeof(*centre));
+	for(int c = 1; c < k; c++)
+	{
+		double sum = 0;
+		for(int i = 0; i < n; i++)
+		{
+			nearest[i] = INFINITY;
+			for(int j = 0; j < c; j++)
+				nearest[i] = fmin(nearest[i], distance2(x[i], centre[j]));
+			sum += nearest[i];
+		}
+		int pick = (int)(random_unit() * n);
+		if(sum > 0)
+		{
+			double r = random_unit() * sum;
+			for(pick = 0; pick < n - 1 && (r -= nearest[pick]) > 0; pick++)
+				;
+		}
+		memcpy(centre[c], x[pick], sizeof(*centre));
+	}
+	free(nearest);
+
+	int* size = (int*) malloc (k * sizeof(int));
+	for(int i = 0; i < n; i++)
+		assign[i] = -1;
+	double sse = 0;
+	for(int iteration = 0; iteration < 100; iteration++)
+	{
+		bool changed = FALSE;
+		sse = 0;
+		for(int i = 0; i < n; i++)
+		{
+			int best = 0;
+			double best_d = distance2(x[i], centre[0]);
+			for(int c = 1; c < k; c++)
+			{
+				double d = distance2(x[i], centre[c]);
+				if(d < best_d)
+				{
+					best = c;
+					best_d = d;
+				}
+			}
+			changed |= assign[i] != best;
+			assign[i] = best;
+			sse += best_d;
+		}
+		if(!changed)
+			break;
+		// an empty cluster keeps its centre
+		memset(size, 0, k * sizeof(int));
+		for(int i = 0; i < n; i++)
+			size[assign[i]]++;
+		for(int c = 0; c < k; c++)
+			if(size[c] > 0)
+				memset(centre[c], 0, sizeof(*centre));
+		for(int i = 0; i < n; i++)
+			for(int d = 0; d < BBV_DIMENSIONS; d++)
+				centre[assign[i]][d] += x[i][d] / size[assign[i]];
+	}
+	free(size);
+	return sse;
+}
+
+// the Bayesian information criterion of a clustering, as SimPoint scores them
+static double bic(int* assign, int n, int k, double sse)
+{
+	double variance = n > k ? sse / (n - k) : 0;
+	if(variance < 1e-12)
+		variance = 1e-12;
+	int* size = (int*) calloc (k, sizeof(int));
+	for(int i = 0; i < n; i++)
+		size[assign[i]]++;
+	double likelihood = 0;
+	for(int c = 0; c < k; c++)
+	{
+		double r = size[c];
+		if(r == 0)
+			continue;
+		likelihood += r * log(r) - r * log(n) - r / 2 * log(2 * M_PI) - r * BBV_DIMENSIONS / 2 * log(variance) - (r - k) / 2;
+	}
+	free(size);
+	return likelihood - k * (BBV_DIMENSIONS + 1) / 2.0 * log(n);
+}
+
+// cluster the intervals and write filename.simpoints
+static void pick_simpoints(Riscv64_bbv* bbv, const char* file_name)
+{
+	int n = bbv->intervals;
+	int max_k = bbv_max_k < n ? bbv_max_k : n;
+	if(n == 0)
+		return;
+	int* assign = (int*) malloc (max_k * n * sizeof(int));
+	double (*centre)[BBV_DIMENSIONS] = malloc (max_k * max_k * sizeof(*centre));
+	double* score = (double*) malloc (max_k * sizeof(double));
+	random_state = 1;
+	for(int k = 1; k <= max_k; k++)
+		score[k - 1] = bic(assign + (k - 1) * n, n, k, kmeans(bbv->vectors, n, k, assign + (k - 1) * n, centre + (k - 1) * max_k));
+	// the smallest k that scores 90% of the way from the worst to the best
+	double worst = score[0], best = score[0];
+	for(int k = 1; k < max_k; k++)
+	{
+		worst = fmin(worst, score[k]);
+		best = fmax(best, score[k]);
+	}
+	int k = 1;
+	while(k < max_k && score[k - 1] < worst + 0.9 * (best - worst))
+		k++;
+	int* chosen = assign + (k - 1) * n;
+	double (*chosen_centre)[BBV_DIMENSIONS] = centre + (k - 1) * max_k;
+
+	char name[4096];
+	snprintf(name, sizeof(name), "%s.simpoints", file_name);
+	FILE* file = fopen(name, "w");
+	if(file == NULL)
+	{
+		printf("can not write %s.\n", name);
+		exit(1);
+	}
+	fprintf(file, "interval %ld\n# %d intervals, %d blocks, %d clusters\n# interval cluster weight\n", bbv->interval, n, bbv->blocks, k);
+	long int total = 0;
+	for(int i = 0; i < n; i++)
+		total += bbv->lengths[i];
+	// the interval closest to the centre and a random other one of each cluster, in program order
+	int* first = (int*) malloc (k * sizeof(int));
+	int* second = (int*) malloc (k * sizeof(int));
+	long int* instructions = (long int*) calloc (k, sizeof(long int));
+	int* size = (int*) calloc (k, sizeof(int));
+	for(int i = 0; i < n; i++)
+	{
+		int c = chosen[i];
+		instructions[c] += bbv->lengths[i];
+		if(size[c]++ == 0 || distance2(bbv->vectors[i], chosen_centre[c]) < distance2(bbv->vectors[first[c]], chosen_centre[c]))
+			first[c] = i;
+	}
+	for(int c = 0; c < k; c++)
+	{
+		second[c] = -1;
+		int skip = size[c] > 1 ? (int)(random_unit() * (size[c] - 1)) : -1;
+		for(int i = 0; i < n && skip >= 0; i++)
+			if(chosen[i] == c && i != first[c] && skip-- == 0)
+				second[c] = i;
+	}
+	for(int i = 0; i < n; i++)
+	{
+		int c = chosen[i];
+		if(i == first[c] || i == second[c])
+			fprintf(file, "%d %d %.6f\n", i, c, (double)instructions[c] / total);
+	}
+	fclose(file);
+	printf("bbv: %d intervals of %ld instructions, %d basic blocks, %d clusters, written to %s\n", n, bbv->interval, bbv->blocks, k, name);
+	free(first);
+	free(second);
+	free(instructions);
+	free(size);
+	free(score);
+	free(centre);
+	free(assign);
+}
+
+long int run_bbv(Riscv64_decode_cache* cache, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory, const char* file_name)
+{
+	Riscv64_bbv* bbv;
+	init_bbv(&bbv, bbv_interval, file_name);
+	long int count = 0;
+	long int interval_start = 0;
+	reg64 block = get_register_pc(riscv_register);
+	long int block_count = 0;
+	while(!riscv_memory->exit_happened)
+	{
+		reg64 pc = get_register_pc(riscv_register);
+		int n = step(cache, riscv_register, riscv_memory, FALSE);
+		count += n;
+		block_count += n;
+		if(riscv_register->pc != pc + n * sizeof(instruction))
+		{
+			add_block(bbv, block, block_count);
+			block = riscv_register->pc;
+			block_count = 0;
+		}
+		if(count - interval_start >= bbv->interval)
+		{
+			add_block(bbv, block, block_count); // the rest of the block goes to the next interval
+			block_count = 0;
+			end_interval(bbv, count - interval_start);
+			interval_start = count;
+		}
+	}
+	add_block(bbv, block, block_count);
+	end_interval(bbv, count - interval_start);
+	pick_simpoints(bbv, file_name);
+	delete_bbv(bbv);
+	return count;
+}
+
+
+/*********************************************/
+/*                                           */
+/* sampled simulation                        */
+/*                                           */
+/*********************************************/
+
+static int compare_samples(const void* a, const void* b)
+{
+	long int x = ((Riscv64_sample*)a)->interval, y = ((Riscv64_sample*)b)->interval;
+	return x < y ? -1 : x > y;
+}
+
+static Riscv64_sample* load_samples(const char* path, long int* interval, int* num)
+{
+	FILE* file = fopen(path, "r");
+	if(file == NULL)
+	{
+		printf("can not open %s.\n", path);
+		exit(1);
+	}
+	char line[256];
+	*interval = 0;
+	*num = 0;
+	int capacity = 16;
+	Riscv64_sample* samples = (Riscv64_sample*) malloc (capacity * sizeof(Riscv64_sample));
+	while(fgets(line, sizeof(line), file) != NULL)
+	{
+		if(line[0] == '#' || line[0] == '\n')
+			continue;
+		if(*interval == 0)
+		{
+			if(sscanf(line, "interval %ld", interval) != 1 || *interval < 1)
+			{
+				printf("%s does not start with the interval.\n", path);
+				exit(1);
+			}
+			continue;
+		}
+		if(*num == capacity)
+			samples = (Riscv64_sample*) realloc (samples, (capacity *= 2) * sizeof(Riscv64_sample));
+		Riscv64_sample* s = &samples[*num];
+		if(sscanf(line, "%ld %d %lf", &s->interval, &s->cluster, &s->weight) != 3 || s->interval < 0 || s->cluster < 0)
+		{
+			printf("%s: wrong line %s", path, line);
+			exit(1);
+		}
+		s->instructions = 0;
+		s->cpi = 0;
+		(*num)++;
+	}
+	fclose(file);
+	if(*num == 0)
+	{
+		printf("%s has no samples.\n", path);
+		exit(1);
+	}
+	qsort(samples, *num, sizeof(Riscv64_sample), compare_samples);
+	return samples;
+}
+
+// the weighted CPI of the clusters and its 95% confidence interval, from the samples of each cluster
+static void print_estimate(Riscv64_sample* samples, int num, long int interval, long int count, long int detailed)
+{
+	int clusters = 0;
+	for(int i = 0; i < num; i++)
+		if(samples[i].cluster >= clusters)
+			clusters = samples[i].cluster + 1;
+	double estimate = 0, variance = 0, weight = 0;
+	for(int c = 0; c < clusters; c++)
+	{
+		int n = 0;
+		double w = 0, sum = 0, sum2 = 0;
+		for(int i = 0; i < num; i++)
+			if(samples[i].cluster == c && samples[i].instructions > 0)
+			{
+				n++;
+				w = samples[i].weight;
+				sum += samples[i].cpi;
+				sum2 += samples[i].cpi * samples[i].cpi;
+			}
+		if(n == 0)
+			continue;
+		double mean = sum / n;
+		estimate += w * mean;
+		weight += w;
+		if(n > 1)
+			variance += w * w * (sum2 - n * mean * mean) / (n - 1) / n;
+	}
+	if(weight == 0)
+	{
+		printf("simpoint: the program ended before the first sample\n");
+		return;
+	}
+	estimate /= weight;
+	double bound = 1.96 * sqrt(fmax(variance, 0)) / weight;
+	printf("simpoint: %d samples of %ld instructions in %d clusters, %ld instructions (%.2f%%) in detail\n",
+	       num, interval, clusters, detailed, count ? 100.0 * detailed / count : 0.0);
+	printf("simpoint: estimated CPI %.3f +- %.3f (95%%), %.0f cycles for %ld instructions\n", estimate, bound, estimate * count, count);
+}
+
+long int run_sampled(Riscv64_decode_cache* cache, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	long int interval;
+	int num;
+	Riscv64_sample* samples = load_samples(simpoint_file, &interval, &num);
+	long int count = 0;
+	long int detailed = 0;
+	for(int i = 0; i < num && !riscv_memory->exit_happened; i++)
+	{
+		Riscv64_sample* s = &samples[i];
+		long int start = s->interval * interval;
+		count = run_until(cache, riscv_register, riscv_memory, count, start - SIMPOINT_WARMUP, FALSE);
+		long int warm = count;
+		count = run_until(cache, riscv_register, riscv_memory, count, start, TRUE);
+		long int first = count;
+		long int cycles = PIPELINE_CYCLES(riscv_memory);
+		count = run_until(cache, riscv_register, riscv_memory, count, start + interval, TRUE);
+		detailed += count - warm;
+		s->instructions = count - first;
+		s->cpi = s->instructions ? (double)(PIPELINE_CYCLES(riscv_memory) - cycles) / s->instructions : 0;
+		printf("simpoint: interval %ld (cluster %d, weight %.4f), %ld instructions, CPI %.3f\n",
+		       s->interval, s->cluster, s->weight, s->instructions, s->cpi);
+	}
+	count = run_until(cache, riscv_register, riscv_memory, count, LONG_MAX, FALSE);
+	print_estimate(samples, num, interval, count, detailed);
+	free(samples);
+	return count;
+}
@@ -0,0 +1,84 @@
+#ifndef __SIMPOINT_H__
+#define __SIMPOINT_H__
+#include <stdio.h>
+#include "memory_system.h"
+#include "decode_cache.h"
+#include "cache_model.h"
+#include "pipeline_model.h"
+
+/*********************************************/
+/*                                           */
+/* basic block vectors and sampling          */
+/*                                           */
+/*********************************************/
+/* Two runs replace the detailed simulation  */
+/* of a long program:                        */
+/*  - "-bbv interval" runs it through the    */
+/*    decode cache without any timing and    */
+/*    counts the instructions executed in    */
+/*    every basic block (from a jump target  */
+/*    to the next taken jump) for each       */
+/*    interval of that many instructions,    */
+/*    written to filename.bbv as SimPoint    */
+/*    does. Afterwards the vectors, randomly */
+/*    projected to BBV_DIMENSIONS, are       */
+/*    clustered with k-means, k chosen by    */
+/*    BIC, and filename.simpoints gets for   */
+/*    each cluster the interval closest to   */
+/*    its centre and one more of its         */
+/*    intervals, with the share of the       */
+/*    program the cluster stands for;        */
+/*  - "-simpoint filename.simpoints" (with a */
+/*    timing model) fast forwards to each of */
+/*    those intervals, warms the model up on */
+/*    the SIMPOINT_WARMUP instructions before*/
+/*    it and then runs it in detailed mode.  */
+/*    The weighted CPI of the clusters is    */
+/*    the estimate for the whole program,    */
+/*    the spread of the two samples of each  */
+/*    cluster gives its confidence interval. */
+/*********************************************/
+
+#define BBV_DIMENSIONS  15
+#define BBV_MAX_K       10          // clusters tried by default
+#define SIMPOINT_WARMUP 100000      // detailed instructions before a sample, not measured
+
+// the options, 0 and NULL when not used
+extern long int bbv_interval;       // -bbv instructions[:max k]
+extern int bbv_max_k;
+extern const char* simpoint_file;   // -simpoint file
+bool set_bbv_config(const char* spec); // FALSE (with a message) if it is wrong
+
+typedef struct riscv64_bbv{
+	long int interval;
+	FILE* file;                     // filename.bbv
+	// basic blocks by start pc, open addressing
+	reg64* block_pc;                // 0 if empty
+	int* block_id;
+	int table_size;                 // a power of 2
+	int blocks;
+	// counts of the interval being profiled, by block id
+	long int* counts;
+	int* touched;                   // ids counted in this interval
+	int touched_num;
+	// every interval, projected
+	double (*vectors)[BBV_DIMENSIONS];
+	long int* lengths;              // instructions of each, the last one may be short
+	int intervals;
+	int capacity;
+} Riscv64_bbv;
+
+// a sample of -simpoint
+typedef struct riscv64_sample{
+	long int interval;
+	int cluster;
+	double weight;                  // of its cluster
+	long int instructions;          // measured, 0 if the program ended before
+	double cpi;
+} Riscv64_sample;
+
+// run the loaded program until it exits, return the number of instructions executed
+long int run_bbv(Riscv64_decode_cache*, Riscv64_register*, Riscv64_memory*, const char* file_name);
+long int run_sampled(Riscv64_decode_cache*, Riscv64_register*, Riscv64_memory*);
+
+#endif
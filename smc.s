@@ -0,0 +1,43 @@
+# A store rewrites an instruction of the loop after it has run 59 times,
+# so every engine has translated it (the block and jit engines have compiled
+# the loop), and the same round must run the new instruction: 59 rounds add
+# 3, the last 11 add 7. Before that the store goes to data.
+# expect: ok
+# absent: ba
+# exit: 0
+  li s1, 0
+  li s3, 60
+  li s5, 70
+  li s2, 0x40000
+  li s4, target
+  li t0, 0x00700513     # addi a0, zero, 7
+  li t2, 0
+  li s0, 0x40100
+  sd s2, 0(s0)
+loop:
+  addi s1, s1, 1
+  blt s1, s3, keep
+  sd s4, 0(s0)
+  j keep
+keep:
+  ld s2, 0(s0)
+  sw t0, 0(s2)
+target:
+  addi a0, zero, 3
+  add t2, t2, a0
+  blt s1, s5, loop
+  li t1, 254
+  li t3, 0x0a6b6f       # "ok\n"
+  beq t2, t1, print
+  li t3, 0x0a6162       # "ba\n", a stale instruction ran
+print:
+  li s2, 0x40000
+  sw t3, 16(s2)
+  li a0, 1
+  addi a1, s2, 16
+  li a2, 3
+  li a7, 64
+  ecall
+  li a0, 0
+  li a7, 93
+  ecall
@@ -0,0 +1,103 @@
+#include "threaded_engine.h"
+#include "cache_model.h"
+#include "pipeline_model.h"
+#include "hart.h"
+
+
+long int run_threaded(Riscv64_decode_cache* cache, Riscv64_register* riscv_register, Riscv64_memory* riscv_memory)
+{
+	// label of every instruction, indexed by INSTID
+	static void* labels[INST_COUNT] = {
+		#define INST(id, func, format) &&L_##id,
+		#include "instruction_list.h"
+		#undef INST
+		&&L_TRAP,
+		&&L_FALLBACK,
+		#define FUSE(id, FIRST, first, SECOND, second) &&L_##id,
+		#include "fusion_list.h"
+		#undef FUSE
+	};
+
+	long int count = 0;
+	Riscv64_decoded* d;
+	reg64 pc;
+
+	// fetch the record at pc and jump to its label
+	#define NEXT() \
+		do { \
+			pc = riscv_register->pc; \
+			d = lookup_decode_cache(cache, riscv_memory, pc); \
+			CACHE_FETCH(riscv_memory, pc, sizeof(instruction)); \
+			riscv_register->pc = pc + sizeof(instruction); \
+			count++; \
+			goto *labels[d->id]; \
+		} while(0)
+
+	// end of an instruction
+	#define DISPATCH() \
+		do { \
+			PIPELINE_RETIRE(riscv_memory, d, pc, riscv_register->pc); \
+			NEXT(); \
+		} while(0)
+
+	// only a system call can end the program
+	#define CHECK_EXIT_RR()
+	#define CHECK_EXIT_RI()
+	#define CHECK_EXIT_R1()
+	#define CHECK_EXIT_R4()
+	#define CHECK_EXIT_MEM_RD()
+	#define CHECK_EXIT_MEM_RS()
+	#define CHECK_EXIT_UPPER()
+	#define CHECK_EXIT_AMO()
+	#define CHECK_EXIT_SYS() \
+		if(riscv_memory->exit_happened) \
+		{ \
+			PIPELINE_RETIRE(riscv_memory, d, pc, riscv_register->pc); \
+			return count; \
+		}
+
+	// or another hart, with exit_group: looked at after the branches and jumps, so that
+	// no loop runs past it, with the events of the harts (hart 0 runs on the process memory)
+	#define CHECK_HARTS(id) \
+		if((id) >= INST_BEQ && (id) <= INST_JALR && riscv_memory->harts != NULL && poll_harts(riscv_memory)) \
+		{ \
+			PIPELINE_RETIRE(riscv_memory, d, pc, riscv_register->pc); \
+			return count; \
+		}
+
+	NEXT();
+
+	#define INST(id, func, format) \
+	L_##id: \
+		FORMAT_##format(func); \
+		CHECK_EXIT_##format(); \
+		CHECK_HARTS(INST_##id); \
+		DISPATCH();
+	#include "instruction_list.h"
+	#undef INST
+
+	// a breakpoint, or an instruction the list does not have
+L_TRAP:
+L_FALLBACK:
+	d->handler(d, riscv_register, riscv_memory);
+	if(riscv_memory->exit_happened)
+	{
+		PIPELINE_RETIRE(riscv_memory, d, pc, riscv_register->pc);
+		return count;
+	}
+	DISPATCH();
+
+	// a fused pair is two instructions in one dispatch
+	#define FUSE(id, FIRST, first, SECOND, second) \
+	L_##id: \
+		d->handler(d, riscv_register, riscv_memory); \
+		count++; \
+		CHECK_HARTS(INST_##SECOND); \
+		DISPATCH();
+	#include "fusion_list.h"
+	#undef FUSE
+
+	#undef NEXT
+	#undef DISPATCH
+	#undef CHECK_HARTS
+}
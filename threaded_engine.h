@@ -0,0 +1,22 @@
+#ifndef __THREADED_ENGINE_H__
+#define __THREADED_ENGINE_H__
+#include "memory_system.h"
+#include "riscv_instruction.h"
+#include "decode_cache.h"
+
+/*********************************************/
+/*                                           */
+/* threaded interpreter core                 */
+/*                                           */
+/*********************************************/
+/* Built with "make ENGINE=threaded". Every  */
+/* concrete instruction gets its own label,  */
+/* and each label ends with its own computed */
+/* goto to the next instruction, so the host */
+/* predicts every dispatch separately.       */
+/*********************************************/
+
+// run until the guest exits, return the number of instructions executed
+long int run_threaded(Riscv64_decode_cache*, Riscv64_register*, Riscv64_memory*);
+
+#endif